@@ -65,6 +65,11 @@
 #include "libs/pilight/core/proc.h"
 #include "libs/pilight/core/ntp.h"
 #include "libs/pilight/core/config.h"
+#include "libs/pilight/core/journal.h"
+#include "libs/pilight/core/history.h"
+#include "libs/pilight/core/capture.h"
+#include "libs/pilight/core/frame.h"
+#include "libs/pilight/core/http.h"
 
 #ifdef EVENTS
 	#include "libs/pilight/events/events.h"
@@ -96,6 +101,7 @@ typedef struct clients_t {
 	int core;
 	int stats;
 	int forward;
+	int frames;
 	char media[8];
 	double cpu;
 	double ram;
@@ -114,6 +120,8 @@ typedef struct sendqueue_t {
 	int code[MAXPULSESTREAMLENGTH];
 	int length;
 	char uuid[UUID_LENGTH];
+	char *device;
+	int priority;
 	struct sendqueue_t *next;
 } sendqueue_t;
 
@@ -139,11 +147,58 @@ static unsigned short sendqueue_init = 0;
 static int sendqueue_number = 0;
 static int recvqueue_number = 0;
 
+/*
+ * Commands are sent by priority class, user commands first.
+ * Everything but user commands is held back once the airtime
+ * of a window is used up, and the receiver gets a short window
+ * to listen between two transmissions.
+ */
+#define SEND_PRIO_USER				0
+#define SEND_PRIO_RULE				1
+#define SEND_PRIO_PERIODIC		2
+
+#define SEND_AIRTIME_WINDOW		10000000
+#define SEND_AIRTIME_MAX			5000000
+#define SEND_RECEIVE_WINDOW		100000
+
+static unsigned long long send_window = 0;
+static unsigned long long send_airtime = 0;
+static unsigned long long send_next = 0;
+
 static pthread_mutex_t recvqueue_lock;
 static pthread_cond_t recvqueue_signal;
 static pthread_mutexattr_t recvqueue_attr;
 static unsigned short recvqueue_init = 0;
 
+/*
+ * Recently received pulse trains keyed by a hash of their
+ * symbols, so repeats of the same code are only decoded once.
+ * The symbol widths of a repeat have to match within a quarter,
+ * so codes with the same rhythm at another speed differ.
+ */
+#define DEDUPE_SIZE			64
+#define DEDUPE_PROBES		4
+#define DEDUPE_TTL			500000
+
+typedef struct dedupe_t {
+	unsigned int hash;
+	int length;
+	int nrsymbols;
+	int widths[PULSE_SYMBOLS];
+	int count;
+	int done;
+	unsigned long long last;
+} dedupe_t;
+
+static struct dedupe_t dedupe[DEDUPE_SIZE];
+static unsigned long dedupe_hits = 0;
+static unsigned long dedupe_total = 0;
+
+/* Pulse trains received by the hardware can be recorded */
+static struct capture_t *recorder = NULL;
+static pthread_mutex_t recorder_lock;
+static pthread_mutexattr_t recorder_attr;
+
 typedef struct bcqueue_t {
 	JsonNode *jmessage;
 	char *protoname;
@@ -183,12 +238,42 @@ static int sending = 0;
 static int receive_repeat = RECEIVE_REPEATS;
 /* Socket identifier to the server if we are running as client */
 static int sockfd = 0;
+
+/*
+ * Nodes batch the codes they forward to the master into binary
+ * frames, when the master supports them. Masters that don't know
+ * frames answer identify without confirming them, after which we
+ * reconnect and fall back to text.
+ */
+#define NODE_FRAME_FLUSH	16384
+
+static struct frame_t node_frame;
+static int node_frames = 1;
+
+/*
+ * Every configuration sent to a node is identified by a hash of its
+ * devices. A reconnecting node presents the version it has, and the
+ * master answers that nothing changed or sends the changed devices,
+ * as long as it still remembers the devices of that version.
+ */
+#define CONFIG_VERSIONS		8
+#define CONFIG_VERSION_SIZE	17
+
+typedef struct config_versions_t {
+	char version[CONFIG_VERSION_SIZE];
+	struct JsonNode *jdevices;
+} config_versions_t;
+
+static struct config_versions_t config_versions[CONFIG_VERSIONS];
+static int config_versions_pos = 0;
+
+static char node_version[CONFIG_VERSION_SIZE];
+static struct JsonNode *node_config = NULL;
 /* Thread pointers */
 static pthread_t logpth;
 /* While loop conditions */
 static unsigned short main_loop = 1;
 /* Reset repeats after a certain amount of time */
-static struct timeval tv;
 /* Are we running standalone */
 static int standalone = 0;
 /* What is the minimum rawlenth to consider a pulse stream valid */
@@ -293,6 +378,25 @@ static void broadcast_queue(char *protoname, JsonNode *json, enum origin_t origi
 	}
 }
 
+static void node_flush(void) {
+	if(node_frame.count > 0 && sockfd > 0 && socket_is_framed(sockfd) == 1) {
+		logprintf(LOG_DEBUG, "forwarded %u messages in a frame of %u bytes", node_frame.count, (unsigned int)node_frame.len);
+		socket_write_frame(sockfd, SOCKET_FRAME_JSON, node_frame.buffer, node_frame.len);
+	}
+	frame_clear(&node_frame);
+}
+
+/* Forward a message to the master */
+static void node_forward(struct JsonNode *json) {
+	if(socket_is_framed(sockfd) == 1) {
+		frame_add(&node_frame, json);
+	} else {
+		char *ret = json_stringify(json, NULL);
+		socket_write(sockfd, ret);
+		json_free(ret);
+	}
+}
+
 void *broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -327,11 +431,9 @@ void *broadcast(void *param) {
 					if(pilight.runmode == ADHOC && sockfd > 0) {
 						struct JsonNode *jupdate = json_decode(conf);
 						json_append_member(jupdate, "action", json_mkstring("update"));
-						char *ret = json_stringify(jupdate, NULL);
-						socket_write(sockfd, ret);
+						node_forward(jupdate);
 						broadcasted = 1;
 						json_delete(jupdate);
-						json_free(ret);
 					}
 					if(broadcasted == 1) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", conf);
@@ -465,11 +567,9 @@ void *broadcast(void *param) {
 					if(pilight.runmode == ADHOC && sockfd > 0) {
 						struct JsonNode *jupdate = json_decode(internal);
 						json_append_member(jupdate, "action", json_mkstring("update"));
-						char *ret = json_stringify(jupdate, NULL);
-						socket_write(sockfd, ret);
+						node_forward(jupdate);
 						broadcasted = 1;
 						json_delete(jupdate);
-						json_free(ret);
 					}
 					if((broadcasted == 1 || nodaemon == 1) && (strcmp(out, "{}") != 0 && nrchilds > 1)) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", out);
@@ -478,6 +578,11 @@ void *broadcast(void *param) {
 					json_free(out);
 				}
 			}
+			/* Send the batch once the queue has been drained */
+			if(node_frame.count > 0 && (bcqueue_number <= 1 || node_frame.len >= NODE_FRAME_FLUSH)) {
+				node_flush();
+			}
+
 			struct bcqueue_t *tmp = bcqueue;
 			FREE(tmp->protoname);
 			json_delete(tmp->jmessage);
@@ -529,40 +634,138 @@ static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
 	}
 }
 
+static void receive_record(int *raw, int rawlen, int hwtype) {
+	if(recorder != NULL) {
+		pthread_mutex_lock(&recorder_lock);
+		if(recorder != NULL && capture_write(recorder, capture_time(), hwtype, raw, rawlen) != 0) {
+			logprintf(LOG_ERR, "failed to record pulse train, recording stopped");
+			capture_close(recorder);
+			recorder = NULL;
+		}
+		pthread_mutex_unlock(&recorder_lock);
+	}
+}
+
+/* Feed a pulse capture into the receiver as fast as it is parsed */
+static void *receive_replay(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct capture_t *capture = NULL;
+	unsigned long long timestamp = 0, start = 0;
+	unsigned long nr = 0;
+	double duration = 0;
+	int raw[MAXPULSESTREAMLENGTH], rawlen = 0, hwtype = 0, ret = 0;
+	char *file = (char *)param;
+
+	if((capture = capture_open(file, CAPTURE_READ)) == NULL) {
+		return (void *)NULL;
+	}
+
+	start = capture_time();
+	while(main_loop == 1 && (ret = capture_read(capture, &timestamp, &hwtype, raw, &rawlen)) == 1) {
+		while(main_loop == 1 && recvqueue_number >= 1024) {
+			usleep(1000);
+		}
+		receive_queue(raw, rawlen, raw[rawlen-1]/PULSE_DIV, hwtype);
+		nr++;
+	}
+	if(ret == -1) {
+		logprintf(LOG_ERR, "pulse capture %s is corrupt after %lu pulse trains", file, nr);
+	}
+	capture_close(capture);
+
+	/* Include the time needed to parse the last trains */
+	while(main_loop == 1 && recvqueue_number > 0) {
+		usleep(1000);
+	}
+	duration = (double)(capture_time()-start)/1000000;
+	logprintf(LOG_INFO, "replayed %lu pulse trains from %s in %.3f seconds, %.1f trains/s",
+		nr, file, duration, (duration > 0) ? (double)nr/duration : 0);
+
+	return (void *)NULL;
+}
+
 static void receiver_create_message(protocol_t *protocol) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	if(protocol->message != NULL) {
-		char *valid = json_stringify(protocol->message, NULL);
-		json_delete(protocol->message);
-		if(valid != NULL && json_validate(valid) == true) {
-			JsonNode *jmessage = json_mkobject();
-
-			json_append_member(jmessage, "message", json_decode(valid));
-			json_append_member(jmessage, "origin", json_mkstring("receiver"));
-			json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
-			if(strlen(pilight_uuid) > 0) {
-				json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
-			}
-			if(protocol->repeats > -1) {
-				json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
-			}
-			char *output = json_stringify(jmessage, NULL);
-			JsonNode *json = json_decode(output);
-			broadcast_queue(protocol->id, json, RECEIVER);
-			json_free(output);
-			json_delete(json);
-			json = NULL;
-			json_delete(jmessage);
+		JsonNode *jmessage = json_mkobject();
+
+		json_append_member(jmessage, "message", protocol->message);
+		json_append_member(jmessage, "origin", json_mkstring("receiver"));
+		json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
+		if(strlen(pilight_uuid) > 0) {
+			json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
+		}
+		if(protocol->repeats > -1) {
+			json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
 		}
-		json_free(valid);
+		broadcast_queue(protocol->id, jmessage, RECEIVER);
+		json_delete(jmessage);
 	}
 	protocol->message = NULL;
 }
 
+static unsigned long long receive_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000+(unsigned long long)(ts.tv_nsec/1000);
+}
+
+static int receive_dedupe_widths(struct dedupe_t *node, struct pulsetrain_t *train) {
+	int i = 0, a = 0, b = 0;
+
+	if(node->nrsymbols != train->nrsymbols) {
+		return -1;
+	}
+	for(i=0;i<train->nrsymbols;i++) {
+		a = node->widths[i];
+		b = train->widths[i];
+		if(abs(a-b)*4 > ((a > b) ? a : b)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Find the entry of a pulse train, or claim the oldest slot */
+static struct dedupe_t *receive_dedupe(struct pulsetrain_t *train) {
+	struct dedupe_t *node = NULL, *oldest = NULL;
+	unsigned long long now = receive_time();
+	unsigned int hash = fnv1a(train->symbols, (size_t)train->length);
+	int i = 0;
+
+	hash ^= (unsigned int)train->nrsymbols << 24;
+	for(i=0;i<DEDUPE_PROBES;i++) {
+		node = &dedupe[(hash+(unsigned int)i) % DEDUPE_SIZE];
+		if(node->count > 0 && node->hash == hash && node->length == train->length &&
+		   now-node->last <= DEDUPE_TTL && receive_dedupe_widths(node, train) == 0) {
+			node->count++;
+			node->last = now;
+			return node;
+		}
+		if(oldest == NULL || node->last < oldest->last) {
+			oldest = node;
+		}
+	}
+
+	oldest->hash = hash;
+	oldest->length = train->length;
+	oldest->nrsymbols = train->nrsymbols;
+	memcpy(oldest->widths, train->widths, sizeof(oldest->widths));
+	oldest->count = 1;
+	oldest->done = 0;
+	oldest->last = now;
+	return oldest;
+}
+
 void *receive_parse_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct pulsetrain_t pulsetrain;
+	struct dedupe_t *entry = NULL;
+	int pending = 0, needed = 0;
+
 	pthread_mutex_lock(&recvqueue_lock);
 	while(main_loop) {
 		if(recvqueue_number > 0) {
@@ -573,6 +776,18 @@ void *receive_parse_code(void *param) {
 			struct protocol_t *protocol = NULL;
 			struct protocols_t *pnode = protocols;
 
+			/* Analyse the pulse train once for all protocols */
+			protocol_pulsetrain(&pulsetrain, recvqueue->raw, recvqueue->rawlen);
+
+			/* Repeats of a code that was already decoded are dropped */
+			entry = receive_dedupe(&pulsetrain);
+			dedupe_total++;
+			if(entry->done == 1) {
+				dedupe_hits++;
+				pnode = NULL;
+			}
+			pending = 0;
+
 			while(pnode != NULL && main_loop) {
 				protocol = pnode->listener;
 
@@ -583,28 +798,21 @@ void *receive_parse_code(void *param) {
 						protocol->raw = recvqueue->raw;
 					}
 					protocol->rawlen = recvqueue->rawlen;
+					protocol->pulses = &pulsetrain;
 
 					if(protocol->validate() == 0) {
 						logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
-						gettimeofday(&tv, NULL);
-						if(protocol->first > 0) {
-							protocol->first = protocol->second;
-						}
-						protocol->second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
-						if(protocol->first == 0) {
-							protocol->first = protocol->second;
-						}
 
-						/* Reset # of repeats after a certain delay */
-						if(((int)protocol->second-(int)protocol->first) > 500000) {
-							protocol->repeats = 0;
+						protocol->repeats = entry->count;
+						needed = receive_repeat*protocol->rxrpt;
+						if(needed < 1 || strcmp(protocol->id, "pilight_firmware") == 0) {
+							needed = 1;
 						}
-
-						protocol->repeats++;
-						/* Continue if we have recognized enough repeated codes */
-						if((protocol->repeats >= (receive_repeat*protocol->rxrpt) ||
-						   strcmp(protocol->id, "pilight_firmware") == 0) &&
-							 protocol->parseCode != NULL) {
+						if(entry->count < needed) {
+							pending = 1;
+						}
+						/* Decode once when enough repeats were recognized */
+						if(entry->count == needed && protocol->parseCode != NULL) {
 							logprintf(LOG_DEBUG, "recevied pulse length of %d", recvqueue->plslen);
 							logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", protocol->repeats, protocol->id);
 							logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
@@ -615,6 +823,9 @@ void *receive_parse_code(void *param) {
 				}
 				pnode = pnode->next;
 			}
+			if(pending == 0) {
+				entry->done = 1;
+			}
 
 			struct recvqueue_t *tmp = recvqueue;
 			recvqueue = recvqueue->next;
@@ -628,10 +839,110 @@ void *receive_parse_code(void *param) {
 	return (void *)NULL;
 }
 
+/* Transmit priority of a command by its origin */
+static int send_priority(enum origin_t origin) {
+	switch(origin) {
+		case SENDER:
+		case MASTER:
+		case NODE:
+			return SEND_PRIO_USER;
+		case ACTION:
+		case RULE:
+			return SEND_PRIO_RULE;
+		default:
+			return SEND_PRIO_PERIODIC;
+	}
+}
+
+static void send_free(struct sendqueue_t *node) {
+	if(node->message != NULL) {
+		FREE(node->message);
+	}
+	if(node->settings != NULL) {
+		FREE(node->settings);
+	}
+	if(node->device != NULL) {
+		FREE(node->device);
+	}
+	FREE(node->protoname);
+	FREE(node);
+}
+
+/* Unlink a queued command, prev being the one before it */
+static void send_unlink(struct sendqueue_t *prev, struct sendqueue_t *node) {
+	if(prev == NULL) {
+		sendqueue = node->next;
+	} else {
+		prev->next = node->next;
+	}
+	if(sendqueue_head == node) {
+		sendqueue_head = prev;
+	}
+	node->next = NULL;
+	sendqueue_number--;
+}
+
+/* Drop queued commands for a device that a newer one supersedes.
+   Commands of a higher priority class are kept, so a rule can't
+   push back a pending user command. */
+static void send_coalesce(char *device, int priority) {
+	struct sendqueue_t *node = sendqueue, *prev = NULL, *next = NULL;
+
+	while(node != NULL && sendqueue_number > 0) {
+		next = node->next;
+		if(node->device != NULL && node->priority >= priority && strcmp(node->device, device) == 0) {
+			logprintf(LOG_DEBUG, "dropped superseded %s code for %s", node->protoname, device);
+			send_unlink(prev, node);
+			send_free(node);
+		} else {
+			prev = node;
+		}
+		node = next;
+	}
+}
+
+/*
+ * Take the oldest command of the highest priority class. When the
+ * airtime budget of the current window is spent only user commands
+ * are taken, the others wait for the next window.
+ */
+static struct sendqueue_t *send_pick(unsigned long long now, unsigned long long *wait) {
+	struct sendqueue_t *node = sendqueue, *prev = NULL;
+	struct sendqueue_t *best = NULL, *bestprev = NULL;
+	int i = 0;
+
+	if(now-send_window >= SEND_AIRTIME_WINDOW) {
+		send_window = now;
+		send_airtime = 0;
+	}
+
+	for(i=0;i<sendqueue_number && node != NULL;i++) {
+		if(best == NULL || node->priority < best->priority) {
+			best = node;
+			bestprev = prev;
+		}
+		prev = node;
+		node = node->next;
+	}
+
+	if(best != NULL && best->priority != SEND_PRIO_USER && send_airtime >= SEND_AIRTIME_MAX) {
+		*wait = send_window+SEND_AIRTIME_WINDOW-now;
+		return NULL;
+	}
+	if(best != NULL) {
+		send_unlink(bestprev, best);
+	}
+	return best;
+}
+
 void *send_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	int i = 0;
+	struct sendqueue_t *node = NULL;
+	unsigned long long now = 0, wait = 0, airtime = 0;
+	struct timeval tv;
+	struct timespec ts;
+	int i = 0, window = 0;
 
 	/* Make sure the pilight sender gets
 	   the highest priority available */
@@ -648,37 +959,55 @@ void *send_code(void *param) {
 
 	while(main_loop) {
 		if(sendqueue_number > 0) {
-			pthread_mutex_lock(&sendqueue_lock);
-
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
+			now = receive_time();
+			wait = 0;
+			/* Give the receiver a moment between two transmissions */
+			if(window == 1 && now < send_next) {
+				wait = send_next-now;
+			} else if((node = send_pick(now, &wait)) == NULL && wait == 0) {
+				/* Nothing could be taken, sleep until a new command arrives */
+				pthread_cond_wait(&sendqueue_signal, &sendqueue_lock);
+				continue;
+			}
+			if(wait > 0) {
+				gettimeofday(&tv, NULL);
+				wait += (unsigned long long)tv.tv_usec;
+				ts.tv_sec = tv.tv_sec+(time_t)(wait/1000000);
+				ts.tv_nsec = (long)((wait%1000000)*1000);
+				pthread_cond_timedwait(&sendqueue_signal, &sendqueue_lock, &ts);
+				continue;
+			}
+
 			sending = 1;
+			pthread_mutex_unlock(&sendqueue_lock);
 
-			struct protocol_t *protocol = sendqueue->protopt;
+			struct protocol_t *protocol = node->protopt;
 			struct hardware_t *hw = NULL;
 
 			JsonNode *message = NULL;
 
-			if(sendqueue->message != NULL && strcmp(sendqueue->message, "{}") != 0) {
-				if(json_validate(sendqueue->message) == true) {
+			if(node->message != NULL && strcmp(node->message, "{}") != 0) {
+				if(json_validate(node->message) == true) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
 					json_append_member(message, "origin", json_mkstring("sender"));
 					json_append_member(message, "protocol", json_mkstring(protocol->id));
-					json_append_member(message, "message", json_decode(sendqueue->message));
-					if(strlen(sendqueue->uuid) > 0) {
-						json_append_member(message, "uuid", json_mkstring(sendqueue->uuid));
+					json_append_member(message, "message", json_decode(node->message));
+					if(strlen(node->uuid) > 0) {
+						json_append_member(message, "uuid", json_mkstring(node->uuid));
 					}
 					json_append_member(message, "repeat", json_mknumber(1, 0));
 				}
 			}
-			if(sendqueue->settings != NULL && strcmp(sendqueue->settings, "{}") != 0) {
-				if(json_validate(sendqueue->settings) == true) {
+			if(node->settings != NULL && strcmp(node->settings, "{}") != 0) {
+				if(json_validate(node->settings) == true) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
-					json_append_member(message, "settings", json_decode(sendqueue->settings));
+					json_append_member(message, "settings", json_decode(node->settings));
 				}
 			}
 
@@ -690,29 +1019,37 @@ void *send_code(void *param) {
 				}
 				tmp_confhw = tmp_confhw->next;
 			}
+			airtime = 0;
+			window = 0;
 			if(hw != NULL && hw->send != NULL) {
 				if(hw->receiveOOK != NULL || hw->receivePulseTrain != NULL) {
 					hw->wait = 1;
 					pthread_mutex_unlock(&hw->lock);
 					pthread_cond_signal(&hw->signal);
+					window = 1;
 				}
 				logprintf(LOG_DEBUG, "**** RAW CODE ****");
 				if(log_level_get() >= LOG_DEBUG) {
-					for(i=0;i<sendqueue->length;i++) {
-						printf("%d ", sendqueue->code[i]);
+					for(i=0;i<node->length;i++) {
+						printf("%d ", node->code[i]);
 					}
 					printf("\n");
 				}
 				logprintf(LOG_DEBUG, "**** RAW CODE ****");
 
-				if(hw->send(sendqueue->code, sendqueue->length, protocol->txrpt) == 0) {
+				for(i=0;i<node->length;i++) {
+					airtime += (unsigned long long)node->code[i];
+				}
+				airtime *= (unsigned long long)protocol->txrpt;
+
+				if(hw->send(node->code, node->length, protocol->txrpt) == 0) {
 					logprintf(LOG_DEBUG, "successfully send %s code", protocol->id);
 				} else {
 					logprintf(LOG_ERR, "failed to send code");
 				}
 				if(strcmp(protocol->id, "raw") == 0) {
-					int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-					receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
+					int plslen = node->code[node->length-1]/PULSE_DIV;
+					receive_queue(node->code, node->length, plslen, -1);
 				}
 				if(hw->receiveOOK != NULL || hw->receivePulseTrain != NULL) {
 					hw->wait = 0;
@@ -721,33 +1058,26 @@ void *send_code(void *param) {
 				}
 			} else {
 				if(strcmp(protocol->id, "raw") == 0) {
-					int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-					receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
+					int plslen = node->code[node->length-1]/PULSE_DIV;
+					receive_queue(node->code, node->length, plslen, -1);
 				}
 			}
 			if(message != NULL) {
-				broadcast_queue(sendqueue->protoname, message, sendqueue->origin);
+				broadcast_queue(node->protoname, message, node->origin);
 				json_delete(message);
 				message = NULL;
 			}
+			send_free(node);
 
-			struct sendqueue_t *tmp = sendqueue;
-			if(tmp->message != NULL) {
-				FREE(tmp->message);
-			}
-			if(tmp->settings != NULL) {
-				FREE(tmp->settings);
-			}
-			FREE(tmp->protoname);
-			sendqueue = sendqueue->next;
-			FREE(tmp);
-			sendqueue_number--;
+			pthread_mutex_lock(&sendqueue_lock);
+			send_airtime += airtime;
+			send_next = receive_time()+SEND_RECEIVE_WINDOW;
 			sending = 0;
-			pthread_mutex_unlock(&sendqueue_lock);
 		} else {
 			pthread_cond_wait(&sendqueue_signal, &sendqueue_lock);
 		}
 	}
+	pthread_mutex_unlock(&sendqueue_lock);
 	return (void *)NULL;
 }
 
@@ -758,7 +1088,7 @@ static int send_queue(JsonNode *json, enum origin_t origin) {
 
 	int match = 0, raw[MAXPULSESTREAMLENGTH-1];
 	struct timeval tcurrent;
-	char *uuid = NULL;
+	char *uuid = NULL, *device = NULL;
 	/* Hold the final protocol struct */
 	struct protocol_t *protocol = NULL;
 
@@ -822,6 +1152,9 @@ static int send_queue(JsonNode *json, enum origin_t origin) {
 						}
 						gettimeofday(&tcurrent, NULL);
 						mnode->origin = origin;
+						mnode->priority = send_priority(origin);
+						mnode->device = NULL;
+						mnode->next = NULL;
 						mnode->id = 1000000 * (unsigned int)tcurrent.tv_sec + (unsigned int)tcurrent.tv_usec;
 						mnode->message = NULL;
 						if(protocol->message != NULL) {
@@ -875,6 +1208,14 @@ static int send_queue(JsonNode *json, enum origin_t origin) {
 						} else {
 							memset(mnode->uuid, '\0', UUID_LENGTH);
 						}
+						if(json_find_string(json, "device", &device) == 0) {
+							if((mnode->device = MALLOC(strlen(device)+1)) == NULL) {
+								logprintf(LOG_ERR, "out of memory");
+								exit(EXIT_FAILURE);
+							}
+							strcpy(mnode->device, device);
+							send_coalesce(mnode->device, mnode->priority);
+						}
 						if(sendqueue_number == 0) {
 							sendqueue = mnode;
 							sendqueue_head = mnode;
@@ -1084,6 +1425,7 @@ static int control_device(struct devices_t *dev, char *state, JsonNode *values,
 	}
 	json_append_member(json, "code", code);
 	json_append_member(json, "message", json_mkstring("send"));
+	json_append_member(json, "device", json_mkstring(dev->id));
 
 	if(send_queue(json, origin) == 0) {
 		json_delete(json);
@@ -1094,7 +1436,161 @@ static int control_device(struct devices_t *dev, char *state, JsonNode *values,
 	return -1;
 }
 
+static void registry_list(const char *key, int type, char *string, double number, int decimals, void *userdata) {
+	struct JsonNode *jvalues = userdata;
+
+	if(type == JSON_NUMBER) {
+		json_append_member(jvalues, key, json_mknumber(number, decimals));
+	} else {
+		json_append_member(jvalues, key, json_mkstring(string));
+	}
+}
+
 /* Parse the incoming buffer from the client */
+static void config_version(struct JsonNode *jdevices, char *version) {
+	unsigned long long hash = 14695981039346656037ULL;
+	char *content = NULL, *p = NULL;
+
+	if(jdevices != NULL) {
+		content = json_stringify(jdevices, NULL);
+		for(p=content;*p!='\0';p++) {
+			hash ^= (unsigned char)*p;
+			hash *= 1099511628211ULL;
+		}
+		json_free(content);
+	}
+	snprintf(version, CONFIG_VERSION_SIZE, "%016llx", hash);
+}
+
+static struct JsonNode *config_version_find(char *version) {
+	int i = 0;
+
+	for(i=0;i<CONFIG_VERSIONS;i++) {
+		if(config_versions[i].jdevices != NULL && strcmp(config_versions[i].version, version) == 0) {
+			return config_versions[i].jdevices;
+		}
+	}
+	return NULL;
+}
+
+static void config_version_store(char *version, struct JsonNode *jdevices) {
+	struct config_versions_t *node = NULL;
+	char *content = NULL;
+
+	if(jdevices == NULL || config_version_find(version) != NULL) {
+		return;
+	}
+	node = &config_versions[config_versions_pos];
+	config_versions_pos = (config_versions_pos+1) % CONFIG_VERSIONS;
+	if(node->jdevices != NULL) {
+		json_delete(node->jdevices);
+	}
+	content = json_stringify(jdevices, NULL);
+	node->jdevices = json_decode(content);
+	json_free(content);
+	strcpy(node->version, version);
+}
+
+static void config_versions_gc(void) {
+	int i = 0;
+
+	for(i=0;i<CONFIG_VERSIONS;i++) {
+		if(config_versions[i].jdevices != NULL) {
+			json_delete(config_versions[i].jdevices);
+			config_versions[i].jdevices = NULL;
+		}
+	}
+	if(node_config != NULL) {
+		json_delete(node_config);
+		node_config = NULL;
+	}
+}
+
+/* The devices that were added or changed, and the names of the removed ones */
+static struct JsonNode *config_delta(struct JsonNode *jold, struct JsonNode *jnew) {
+	struct JsonNode *jdelta = json_mkobject();
+	struct JsonNode *jdevices = json_mkobject();
+	struct JsonNode *jremoved = json_mkarray();
+	struct JsonNode *jchild = NULL, *jprev = NULL;
+	char *a = NULL, *b = NULL;
+
+	json_foreach(jchild, jnew) {
+		b = json_stringify(jchild, NULL);
+		if((jprev = json_find_member(jold, jchild->key)) != NULL) {
+			a = json_stringify(jprev, NULL);
+		}
+		if(a == NULL || strcmp(a, b) != 0) {
+			json_append_member(jdevices, jchild->key, json_decode(b));
+		}
+		if(a != NULL) {
+			json_free(a);
+			a = NULL;
+		}
+		json_free(b);
+	}
+	json_foreach(jchild, jold) {
+		if(json_find_member(jnew, jchild->key) == NULL) {
+			json_append_element(jremoved, json_mkstring(jchild->key));
+		}
+	}
+	json_append_member(jdelta, "devices", jdevices);
+	json_append_member(jdelta, "removed", jremoved);
+	return jdelta;
+}
+
+/* Apply the changes the master sent to our copy of its devices */
+static void config_apply_delta(struct JsonNode *jdevices, struct JsonNode *jdelta) {
+	struct JsonNode *jchanged = NULL, *jremoved = NULL;
+	struct JsonNode *jchild = NULL, *jnext = NULL, *jprev = NULL;
+
+	if((jremoved = json_find_member(jdelta, "removed")) != NULL) {
+		json_foreach(jchild, jremoved) {
+			if(jchild->tag == JSON_STRING && (jprev = json_find_member(jdevices, jchild->string_)) != NULL) {
+				json_remove_from_parent(jprev);
+				json_delete(jprev);
+			}
+		}
+	}
+	if((jchanged = json_find_member(jdelta, "devices")) != NULL) {
+		jchild = json_first_child(jchanged);
+		while(jchild) {
+			jnext = jchild->next;
+			if((jprev = json_find_member(jdevices, jchild->key)) != NULL) {
+				json_remove_from_parent(jprev);
+				json_delete(jprev);
+			}
+			/* Removing the device from the delta frees its key */
+			char key[strlen(jchild->key)+1];
+			strcpy(key, jchild->key);
+			json_remove_from_parent(jchild);
+			json_append_member(jdevices, key, jchild);
+			jchild = jnext;
+		}
+	}
+}
+
+/* Parse received codes and values from nodes */
+static void socket_parse_update(int sd, struct JsonNode *json) {
+	struct clients_t *tmp_clients = NULL;
+	struct JsonNode *jvalues = NULL;
+	char *pname = NULL;
+
+	if((jvalues = json_find_member(json, "values")) != NULL) {
+		tmp_clients = clients;
+		while(tmp_clients) {
+			if(tmp_clients->id == sd) {
+				json_find_number(jvalues, "ram", &tmp_clients->ram);
+				json_find_number(jvalues, "cpu", &tmp_clients->cpu);
+				break;
+			}
+			tmp_clients = tmp_clients->next;
+		}
+	}
+	if(json_find_string(json, "protocol", &pname) == 0) {
+		broadcast_queue(pname, json, MASTER);
+	}
+}
+
 static void socket_parse_data(int i, char *buffer) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -1160,6 +1656,7 @@ static void socket_parse_data(int i, char *buffer) {
 						client->config = 0;
 						client->receiver = 0;
 						client->forward = 0;
+						client->frames = 0;
 						client->stats = 0;
 						client->cpu = 0;
 						client->ram = 0;
@@ -1218,6 +1715,13 @@ static void socket_parse_data(int i, char *buffer) {
 								} else {
 									client->forward = 0;
 								}
+							} else if(strcmp(childs->key, "frames") == 0 &&
+							   childs->tag == JSON_NUMBER) {
+								if((int)childs->number_ == 1) {
+									client->frames = 1;
+								} else {
+									client->frames = 0;
+								}
 							} else {
 							   error = 1;
 							   break;
@@ -1241,7 +1745,12 @@ static void socket_parse_data(int i, char *buffer) {
 							}
 						}
 					}
-					socket_write(sd, "{\"status\":\"success\"}");
+					if(error == 0 && client->frames == 1 && pilight.runmode != ADHOC) {
+						socket_write(sd, "{\"status\":\"success\",\"frames\":1}");
+						socket_set_framed(sd);
+					} else {
+						socket_write(sd, "{\"status\":\"success\"}");
+					}
 				} else if(strcmp(action, "send") == 0) {
 					if(send_queue(json, SENDER) == 0) {
 						socket_write(sd, "{\"status\":\"success\"}");
@@ -1346,23 +1855,87 @@ static void socket_parse_data(int i, char *buffer) {
 									socket_write(sd, output);
 									json_free(output);
 									json_delete(jsend);
+									FREE(sval);
 								} else {
 									logprintf(LOG_ERR, "registry key '%s' doesn't exists", key);
 									socket_write(sd, "{\"status\":\"failed\"}");
 								}
 							}
+						} else if(strcmp(type, "list") == 0) {
+							struct JsonNode *jsend = json_mkobject();
+							struct JsonNode *jvalues = json_mkobject();
+							if(json_find_string(json, "key", &key) != 0) {
+								key = "";
+							}
+							registry_iterate(key, &registry_list, jvalues);
+							json_append_member(jsend, "message", json_mkstring("registry"));
+							json_append_member(jsend, "key", json_mkstring(key));
+							json_append_member(jsend, "values", jvalues);
+							char *output = json_stringify(jsend, NULL);
+							socket_write(sd, output);
+							json_free(output);
+							json_delete(jsend);
+						}
+					}
+				} else if(strcmp(action, "history") == 0) {
+					struct JsonNode *jsend = NULL;
+					char *device = NULL, *name = NULL, *tier = NULL;
+					double from = 0.0, to = 0.0;
+					int type = HISTORY_AUTO;
+					if(json_find_string(json, "device", &device) != 0) {
+						logprintf(LOG_ERR, "client did not send a device");
+						socket_write(sd, "{\"status\":\"failed\"}");
+					} else if(json_find_string(json, "value", &name) != 0) {
+						logprintf(LOG_ERR, "client did not send a device value");
+						socket_write(sd, "{\"status\":\"failed\"}");
+					} else {
+						if(json_find_number(json, "to", &to) != 0) {
+							to = (double)time(NULL);
+						}
+						if(json_find_number(json, "from", &from) != 0) {
+							from = to - 3600;
+						}
+						if(json_find_string(json, "tier", &tier) == 0) {
+							type = history_tier(tier);
+						}
+						if((jsend = history_print(device, name, (time_t)from, (time_t)to, type)) != NULL) {
+							char *output = json_stringify(jsend, NULL);
+							socket_write(sd, output);
+							json_free(output);
+							json_delete(jsend);
+						} else {
+							logprintf(LOG_ERR, "no history for \"%s\" of device \"%s\"", name, device);
+							socket_write(sd, "{\"status\":\"failed\"}");
 						}
 					}
 				} else if(strcmp(action, "request config") == 0) {
 					struct JsonNode *jsend = json_mkobject();
-					struct JsonNode *jconfig = NULL;
+					struct JsonNode *jconfig = NULL, *jdevices = NULL, *jold = NULL;
+					char version[CONFIG_VERSION_SIZE], *current = NULL;
 					if(client->forward == 1) {
 						jconfig = config_print(CONFIG_FORWARD, client->media);
 					} else {
 						jconfig = config_print(CONFIG_INTERNAL, client->media);
 					}
+					jdevices = json_find_member(jconfig, "devices");
+					config_version(jdevices, version);
+					json_find_string(json, "version", &current);
+
 					json_append_member(jsend, "message", json_mkstring("config"));
-					json_append_member(jsend, "config", jconfig);
+					json_append_member(jsend, "version", json_mkstring(version));
+					if(current != NULL && strcmp(current, version) == 0) {
+						json_append_member(jsend, "unchanged", json_mknumber(1, 0));
+						json_delete(jconfig);
+					} else if(current != NULL && jdevices != NULL && (jold = config_version_find(current)) != NULL) {
+						json_append_member(jsend, "delta", config_delta(jold, jdevices));
+						config_version_store(version, jdevices);
+						json_delete(jconfig);
+					} else {
+						if(client->forward == 1 || current != NULL) {
+							config_version_store(version, jdevices);
+						}
+						json_append_member(jsend, "config", jconfig);
+					}
 					char *output = json_stringify(jsend, NULL);
 					str_replace("%", "%%", &output);
 					socket_write(sd, output);
@@ -1381,27 +1954,7 @@ static void socket_parse_data(int i, char *buffer) {
 				 * Parse received codes from nodes
 				 */
 				} else if(strcmp(action, "update") == 0) {
-					struct JsonNode *jvalues = NULL;
-					char *pname = NULL;
-					if((jvalues = json_find_member(json, "values")) != NULL) {
-						exists = 0;
-						tmp_clients = clients;
-						while(tmp_clients) {
-							if(tmp_clients->id == sd) {
-								exists = 1;
-								client = tmp_clients;
-								break;
-							}
-							tmp_clients = tmp_clients->next;
-						}
-						if(exists) {
-							json_find_number(jvalues, "ram", &client->ram);
-							json_find_number(jvalues, "cpu", &client->cpu);
-						}
-					}
-					if(json_find_string(json, "protocol", &pname) == 0) {
-						broadcast_queue(pname, json, MASTER);
-					}
+					socket_parse_update(sd, json);
 				} else {
 					error = 1;
 				}
@@ -1432,12 +1985,56 @@ static void socket_parse_data(int i, char *buffer) {
 	}
 }
 
+/* Binary frames with a batch of messages from a node */
+static void socket_parse_frame(int i, int type, unsigned char *data, size_t len) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct JsonNode *json = NULL;
+	char *action = NULL, *out = NULL;
+	int sd = socket_get_clients(i);
+	size_t pos = 0;
+
+	if(type != SOCKET_FRAME_JSON) {
+		return;
+	}
+	while(pos < len) {
+		if((json = frame_next(data, len, &pos)) == NULL) {
+			logprintf(LOG_NOTICE, "received a corrupt frame from client %d", i);
+			break;
+		}
+		if(json_find_string(json, "action", &action) == 0 && strcmp(action, "update") == 0) {
+			socket_parse_update(sd, json);
+		} else {
+			out = json_stringify(json, NULL);
+			socket_parse_data(i, out);
+			json_free(out);
+		}
+		json_delete(json);
+	}
+}
+
 static void socket_client_disconnected(int i) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	client_remove(socket_get_clients(i));
 }
 
+/*
+ * Wait while the sender is busy. The sender does not hold the
+ * hardware lock when it wakes us, so don't wait forever on a
+ * signal we might have missed.
+ */
+static void receive_pause(struct hardware_t *hw) {
+	struct timeval tp;
+	struct timespec ts;
+
+	gettimeofday(&tp, NULL);
+	tp.tv_usec += 100000;
+	ts.tv_sec = tp.tv_sec+tp.tv_usec/1000000;
+	ts.tv_nsec = (tp.tv_usec%1000000)*1000;
+	pthread_cond_timedwait(&hw->signal, &hw->lock, &ts);
+}
+
 void *receivePulseTrain(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -1465,8 +2062,9 @@ void *receivePulseTrain(void *param) {
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
 			hw->receivePulseTrain(&r);
-			plslen = r.pulses[r.length-1]/PULSE_DIV;
 			if(r.length > 0) {
+				plslen = r.pulses[r.length-1]/PULSE_DIV;
+				receive_record(r.pulses, r.length, hw->hwtype);
 				receive_queue(r.pulses, r.length, plslen, hw->hwtype);
 			} else if(r.length == -1) {
 				hw->init();
@@ -1475,7 +2073,7 @@ void *receivePulseTrain(void *param) {
 
 			pthread_mutex_unlock(&hw->lock);
 		} else {
-			pthread_cond_wait(&hw->signal, &hw->lock);
+			receive_pause(hw);
 		}
 	}
 	hw->running = 0;
@@ -1522,6 +2120,7 @@ void *receiveOOK(void *param) {
 					}
 					/* Let's do a little filtering here as well */
 					if(r.length >= minrawlen && r.length <= maxrawlen) {
+						receive_record(r.pulses, r.length, hw->hwtype);
 						receive_queue(r.pulses, r.length, plslen, hw->hwtype);
 					}
 					r.length = 0;
@@ -1538,7 +2137,7 @@ void *receiveOOK(void *param) {
 			}
 			pthread_mutex_unlock(&hw->lock);
 		} else {
-			pthread_cond_wait(&hw->signal, &hw->lock);
+			receive_pause(hw);
 		}
 	}
 	hw->running = 0;
@@ -1594,6 +2193,9 @@ void *clientize(void *param) {
 		json_append_member(joptions, "receiver", json_mknumber(1, 0));
 		json_append_member(joptions, "forward", json_mknumber(1, 0));
 		json_append_member(joptions, "config", json_mknumber(1, 0));
+		if(node_frames == 1) {
+			json_append_member(joptions, "frames", json_mknumber(1, 0));
+		}
 		json_append_member(json, "uuid", json_mkstring(pilight_uuid));
 		json_append_member(json, "options", joptions);
 		output = json_stringify(json, NULL);
@@ -1605,14 +2207,47 @@ void *clientize(void *param) {
 		json_free(output);
 		json_delete(json);
 
-		if(socket_read(sockfd, &recvBuff, 1) != 0
-		   || strcmp(recvBuff, "{\"status\":\"success\"}") != 0) {
+		if(socket_read(sockfd, &recvBuff, 1) != 0 || json_validate(recvBuff) == false) {
+			socket_close(sockfd);
+			sockfd = 0;
 			continue;
 		}
 		logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
 
+		double frames = 0;
+		json = json_decode(recvBuff);
+		if(json_find_string(json, "status", &message) != 0 || strcmp(message, "success") != 0) {
+			json_delete(json);
+			socket_close(sockfd);
+			sockfd = 0;
+			continue;
+		}
+		if(node_frames == 1) {
+			if(json_find_number(json, "frames", &frames) == 0 && (int)frames == 1) {
+				socket_set_framed(sockfd);
+				logprintf(LOG_DEBUG, "forwarding codes to the main pilight daemon in frames");
+			} else {
+				/*
+				 * Older masters answer success, but don't register
+				 * a client with an unknown option, so identify again
+				 * on a new connection without frames.
+				 */
+				logprintf(LOG_NOTICE, "main pilight daemon did not accept frames, falling back to text");
+				node_frames = 0;
+				json_delete(json);
+				socket_close(sockfd);
+				sockfd = 0;
+				client_loop = 0;
+				continue;
+			}
+		}
+		json_delete(json);
+
 		json = json_mkobject();
 		json_append_member(json, "action", json_mkstring("request config"));
+		if(node_config != NULL) {
+			json_append_member(json, "version", json_mkstring(node_version));
+		}
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
 			json_free(output);
@@ -1628,8 +2263,31 @@ void *clientize(void *param) {
 				json = json_decode(recvBuff);
 				if(json_find_string(json, "message", &message) == 0) {
 					if(strcmp(message, "config") == 0) {
-						struct JsonNode *jconfig = NULL;
-						if((jconfig = json_find_member(json, "config")) != NULL) {
+						struct JsonNode *jconfig = NULL, *jdelta = NULL, *jdevices = NULL;
+						char *version = NULL;
+						double unchanged = 0;
+						json_find_string(json, "version", &version);
+						if(node_config != NULL && json_find_number(json, "unchanged", &unchanged) == 0 && (int)unchanged == 1) {
+							logprintf(LOG_DEBUG, "master configuration unchanged");
+							config_synced = 1;
+						} else if(node_config != NULL && version != NULL && (jdelta = json_find_member(json, "delta")) != NULL &&
+						          (jdevices = json_find_member(node_config, "devices")) != NULL) {
+							config_apply_delta(jdevices, jdelta);
+							gui_gc();
+							devices_gc();
+#ifdef EVENTS
+							rules_gc();
+#endif
+							if(config_parse(node_config) == EXIT_SUCCESS) {
+								logprintf(LOG_DEBUG, "loaded master configuration changes");
+								strcpy(node_version, version);
+								config_synced = 1;
+							} else {
+								logprintf(LOG_NOTICE, "failed to load master configuration changes");
+								json_delete(node_config);
+								node_config = NULL;
+							}
+						} else if((jconfig = json_find_member(json, "config")) != NULL) {
 							gui_gc();
 							devices_gc();
 #ifdef EVENTS
@@ -1654,6 +2312,16 @@ void *clientize(void *param) {
 							if(config_parse(jconfig) == EXIT_SUCCESS) {
 								logprintf(LOG_DEBUG, "loaded master configuration");
 								config_synced = 1;
+								/* Keep it to apply the changes to on a reconnect */
+								if(node_config != NULL) {
+									json_delete(node_config);
+									node_config = NULL;
+								}
+								if(version != NULL && strlen(version) == CONFIG_VERSION_SIZE-1) {
+									json_remove_from_parent(jconfig);
+									node_config = jconfig;
+									strcpy(node_version, version);
+								}
 							} else {
 								logprintf(LOG_NOTICE, "failed to load master configuration");
 							}
@@ -1845,11 +2513,22 @@ int main_gc(void) {
 	options_gc();
 	socket_gc();
 
+	journal_gc();
+	history_gc();
+	if(recorder != NULL) {
+		pthread_mutex_lock(&recorder_lock);
+		capture_close(recorder);
+		recorder = NULL;
+		pthread_mutex_unlock(&recorder_lock);
+	}
 	config_gc();
 	protocol_gc();
 	ntp_gc();
 	whitelist_free();
 	threads_gc();
+	http_gc();
+	frame_free(&node_frame);
+	config_versions_gc();
 #ifndef _WIN32
 	wiringXGC();
 #endif
@@ -2023,7 +2702,17 @@ void *pilight_stats(void *param) {
 					if(ram > 0) {
 						json_append_member(code, "ram", json_mknumber(ram, 16));
 					}
-					logprintf(LOG_DEBUG, "cpu: %f%%, ram: %f%%", cpu, ram);
+					/* Share of received pulse trains dropped as repeats */
+					double hitrate = (dedupe_total > 0) ? ((double)dedupe_hits*100)/(double)dedupe_total : 0;
+					json_append_member(code, "dedupe", json_mknumber(hitrate, 2));
+					struct conf_hardware_t *tmp_confhw = conf_hardware;
+					while(tmp_confhw) {
+						if(tmp_confhw->hardware->stats != NULL) {
+							tmp_confhw->hardware->stats(code);
+						}
+						tmp_confhw = tmp_confhw->next;
+					}
+					logprintf(LOG_DEBUG, "cpu: %f%%, ram: %f%%, dedupe: %f%%", cpu, ram, hitrate);
 					json_append_member(procProtocol->message, "values", code);
 					json_append_member(procProtocol->message, "origin", json_mkstring("core"));
 					json_append_member(procProtocol->message, "type", json_mknumber(PROCESS, 0));
@@ -2400,6 +3089,9 @@ int start_pilight(int argc, char **argv) {
 	}
 
 	if(pilight.runmode == STANDALONE) {
+		/* Bring device states up to date with the state journal */
+		devices_restore();
+		history_init();
 		socket_start((unsigned short)port);
 		if(standalone == 0) {
 			ssdp_start();
@@ -2434,6 +3126,10 @@ int start_pilight(int argc, char **argv) {
 	pthread_cond_init(&recvqueue_signal, NULL);
 	recvqueue_init = 1;
 
+	pthread_mutexattr_init(&recorder_attr);
+	pthread_mutexattr_settype(&recorder_attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&recorder_lock, &recorder_attr);
+
 	pthread_mutexattr_init(&bcqueue_attr);
 	pthread_mutexattr_settype(&bcqueue_attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&bcqueue_lock, &bcqueue_attr);
@@ -2444,6 +3140,7 @@ int start_pilight(int argc, char **argv) {
 	socket_callback.client_disconnected_callback = &socket_client_disconnected;
 	socket_callback.client_connected_callback = NULL;
 	socket_callback.client_data_callback = &socket_parse_data;
+	socket_callback.client_frame_callback = &socket_parse_frame;
 
 	/* Start threads library that keeps track of all threads used */
 	threads_start();
@@ -2460,6 +3157,10 @@ int start_pilight(int argc, char **argv) {
 		}
 	}
 	threads_register("sender", &send_code, (void *)NULL, 0);
+	if(pilight.runmode == STANDALONE) {
+		threads_register("config writer", &config_writer, (void *)NULL, 0);
+		threads_register("history writer", &history_writer, (void *)NULL, 0);
+	}
 	threads_register("broadcaster", &broadcast, (void *)NULL, 0);
 
 	struct conf_hardware_t *tmp_confhw = conf_hardware;
@@ -2482,6 +3183,15 @@ int start_pilight(int argc, char **argv) {
 
 	threads_register("receive parser", &receive_parse_code, (void *)NULL, 0);
 
+	if(settings_find_string("pulse-record", &stmp) == 0 && strlen(stmp) > 0) {
+		if((recorder = capture_open(stmp, CAPTURE_WRITE)) != NULL) {
+			logprintf(LOG_INFO, "recording pulse trains to %s", stmp);
+		}
+	}
+	if(settings_find_string("pulse-replay", &stmp) == 0 && strlen(stmp) > 0) {
+		threads_register("pulse replay", &receive_replay, (void *)stmp, 0);
+	}
+
 #ifdef EVENTS
 	/* Register a seperate thread for the events parser */
 	if(pilight.runmode == STANDALONE) {
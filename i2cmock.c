@@ -0,0 +1,236 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libs/pilight/core/pilight.h"
+#include "libs/pilight/core/common.h"
+#include "libs/pilight/core/log.h"
+#include "libs/pilight/core/options.h"
+#include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/i2c.h"
+
+/*
+ * Runs the i2c bus scheduler against the mock bus. Every sensor
+ * writes its config register and then reads its temperature
+ * register, like the lm75 does. One address is polled that does
+ * not exist on the bus, so the batched reads fail and have to be
+ * sorted out. Each poll must write the config register exactly
+ * once and read back the value stored in the mock.
+ */
+
+#define SENSOR_BASE		0x48
+#define SENSOR_MAX		32
+#define SENSOR_MISSING	0x20
+#define SENSOR_CONFIG	0x60
+#define SENSOR_REG		0x02
+
+struct sensor_t {
+	int address;
+	int polls;
+	int writes;
+	int reads;
+	int errors;
+	int wrong;
+};
+
+static struct sensor_t sensors[SENSOR_MAX+1];
+static int nrsensors = 4;
+static struct i2c_backend_t *mock = NULL;
+static struct i2c_backend_t counter;
+
+static struct sensor_t *sensor_get(int address) {
+	int i = 0;
+
+	for(i=0;i<=nrsensors;i++) {
+		if(sensors[i].address == address) {
+			return &sensors[i];
+		}
+	}
+	return NULL;
+}
+
+/* Counts the config writes that reach the mock */
+static int counter_transfer(int fd, struct i2c_msg *msgs, int nr) {
+	struct sensor_t *sensor = NULL;
+	int i = 0;
+
+	for(i=0;i<nr;i++) {
+		if((msgs[i].flags & I2C_M_RD) == 0 && msgs[i].len == 2 &&
+		   (sensor = sensor_get(msgs[i].addr)) != NULL && sensor->address != SENSOR_MISSING) {
+			sensor->writes++;
+		}
+	}
+	return mock->transfer(fd, msgs, nr);
+}
+
+static int step(struct i2c_job_t *job) {
+	struct sensor_t *sensor = (struct sensor_t *)job->userdata;
+
+	switch(job->step) {
+		case 0:
+			sensor->polls++;
+			/* The missing sensor only reads, so it fails a batch */
+			if(sensor->address != SENSOR_MISSING) {
+				i2c_write(job, SENSOR_REG, SENSOR_CONFIG);
+			}
+			return 0;
+		case 1:
+			if(job->error == 1) {
+				sensor->errors++;
+				return -1;
+			}
+			i2c_read(job, 0x00, 2);
+			return 1000;
+		case 2:
+			if(job->error == 1) {
+				sensor->errors++;
+				return -1;
+			}
+			sensor->reads++;
+			if(job->result[0] != (unsigned char)sensor->address || job->result[1] != 0x80) {
+				sensor->wrong++;
+			}
+		break;
+	}
+	return -1;
+}
+
+int main_gc(void) {
+	log_shell_disable();
+
+	i2c_gc();
+	options_gc();
+	log_gc();
+	gc_clear();
+
+	FREE(progname);
+	xfree();
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+	// memtrack();
+	atomicinit();
+	gc_attach(main_gc);
+
+	/* Catch all exit signals for gc */
+	gc_catch();
+
+	log_shell_enable();
+	log_file_disable();
+	log_level_set(LOG_NOTICE);
+
+	struct options_t *options = NULL;
+	char *args = NULL;
+	int seconds = 3, i = 0, failed = 0;
+
+	if((progname = MALLOC(15)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(progname, "pilight-i2cmock");
+
+	options_add(&options, 'H', "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'V', "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'n', "sensors", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^[0-9]+$");
+	options_add(&options, 't', "time", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^[0-9]+$");
+
+	while (1) {
+		int c;
+		c = options_parse(&options, argc, argv, 1, &args);
+		if(c == -1)
+			break;
+		if(c == -2)
+			c = 'H';
+		switch (c) {
+			case 'H':
+				printf("Usage: %s [options]\n", progname);
+				printf("\t -H --help\t\tdisplay usage summary\n");
+				printf("\t -V --version\t\tdisplay version\n");
+				printf("\t -n --sensors=sensors\tnumber of sensors on the bus\n");
+				printf("\t -t --time=seconds\tseconds to run the bus\n");
+				goto close;
+			break;
+			case 'V':
+				printf("%s v%s\n", progname, PILIGHT_VERSION);
+				goto close;
+			break;
+			case 'n':
+				nrsensors = atoi(args);
+			break;
+			case 't':
+				seconds = atoi(args);
+			break;
+			default:
+				printf("Usage: %s [options]\n", progname);
+				goto close;
+			break;
+		}
+	}
+	options_delete(options);
+
+	if(nrsensors < 1) {
+		nrsensors = 1;
+	}
+	if(nrsensors > SENSOR_MAX) {
+		nrsensors = SENSOR_MAX;
+	}
+
+	mock = i2c_mock();
+	memcpy(&counter, mock, sizeof(struct i2c_backend_t));
+	counter.transfer = counter_transfer;
+	i2c_set_backend(&counter);
+
+	memset(sensors, 0, sizeof(sensors));
+	for(i=0;i<nrsensors;i++) {
+		unsigned char temp[2] = { (unsigned char)(SENSOR_BASE+i), 0x80 };
+		sensors[i].address = SENSOR_BASE+i;
+		i2c_mock_set(sensors[i].address, 0x00, temp, 2);
+		i2c_add(sensors[i].address, 1, step, &sensors[i]);
+	}
+	sensors[nrsensors].address = SENSOR_MISSING;
+	i2c_add(SENSOR_MISSING, 1, step, &sensors[nrsensors]);
+
+	sleep((unsigned int)seconds);
+	i2c_gc();
+
+	printf("%-8s %6s %6s %6s %6s %6s\n", "address", "polls", "writes", "reads", "errors", "wrong");
+	for(i=0;i<=nrsensors;i++) {
+		struct sensor_t *sensor = &sensors[i];
+		printf("0x%02x     %6d %6d %6d %6d %6d\n", sensor->address,
+			sensor->polls, sensor->writes, sensor->reads, sensor->errors, sensor->wrong);
+		if(sensor->address == SENSOR_MISSING) {
+			if(sensor->reads > 0 || sensor->errors != sensor->polls) {
+				failed = 1;
+			}
+		} else if(sensor->writes != sensor->polls || sensor->errors > 0 ||
+		          sensor->wrong > 0 || sensor->reads < sensor->polls-1) {
+			failed = 1;
+		}
+	}
+	printf("%s\n", (failed == 0) ? "ok" : "failed");
+
+close:
+	main_gc();
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -37,11 +37,15 @@
 #include "../core/ssdp.h"
 #include "../core/firmware.h"
 #include "../core/datetime.h"
+#include "../core/journal.h"
+#include "../core/history.h"
 
 #include "../protocols/protocol.h"
+#include "../events/window.h"
 
 #include "defines.h"
 #include "devices.h"
+#include "settings.h"
 #include "gui.h"
 
 struct config_t *config_devices;
@@ -49,6 +53,19 @@ struct config_t *config_devices;
 /* Struct to store the locations */
 static struct devices_t *devices = NULL;
 
+/* Record the current value of a device setting in the state journal */
+static void devices_journal_value(struct devices_t *dev, struct devices_settings_t *sett) {
+	struct devices_values_t *val = sett->values;
+
+	if(val != NULL && val->next == NULL) {
+		if(val->type == JSON_STRING) {
+			journal_append(dev->id, sett->name, JSON_STRING, 0, 0, val->string_, dev->timestamp);
+		} else if(val->type == JSON_NUMBER) {
+			journal_append(dev->id, sett->name, JSON_NUMBER, val->number_, val->decimals, NULL, dev->timestamp);
+		}
+	}
+}
+
 int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNode **out) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -333,12 +350,23 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 											}
 											strcpy(sptr->values->string_, vstring_);
 											sptr->values->type = JSON_STRING;
+											dptr->timestamp = utct;
+											devices_journal_value(dptr, sptr);
 										} else if(valueType == JSON_NUMBER &&
 												  sptr->values->type == JSON_NUMBER &&
 												  fabs(sptr->values->number_-vnumber_) >= EPSILON) {
 											sptr->values->number_ = vnumber_;
 											sptr->values->decimals = vdecimals_;
 											sptr->values->type = JSON_NUMBER;
+											dptr->timestamp = utct;
+											devices_journal_value(dptr, sptr);
+										}
+										/* Every numeric reading goes into the history, changed or not */
+										if(valueType == JSON_NUMBER && sptr->values->type == JSON_NUMBER) {
+											history_add(dptr->id, sptr->name, vnumber_, vdecimals_, utct);
+#ifdef EVENTS
+											event_window_update(dptr->id, sptr->name, vnumber_, vdecimals_, utct);
+#endif
 										}
 										if(sptr->values->type == JSON_STRING && json_find_string(rval, sptr->name, &stmp) != 0) {
 											json_append_member(rval, sptr->name, json_mkstring(sptr->values->string_));
@@ -368,6 +396,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 									sptr->values->type = JSON_STRING;
 									dptr->timestamp = utct;
 									update = 1;
+									devices_journal_value(dptr, sptr);
 								} else if((stateType == JSON_NUMBER &&
 										   sptr->values->type == JSON_NUMBER &&
 										   fabs(sptr->values->number_-snumber_) < EPSILON)) {
@@ -376,6 +405,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 									sptr->values->type = JSON_NUMBER;
 									dptr->timestamp = utct;
 									update = 1;
+									devices_journal_value(dptr, sptr);
 								}
 								if(sptr->values->type == JSON_STRING && json_find_string(rval, sptr->name, &stmp) != 0) {
 									json_append_member(rval, sptr->name, json_mkstring(sptr->values->string_));
@@ -1741,6 +1771,96 @@ int devices_gc(void) {
 	return EXIT_SUCCESS;
 }
 
+/* Write the current state of all devices to the journal */
+static void devices_journal_snapshot(void) {
+	struct devices_t *tmp_devices = devices;
+	struct devices_settings_t *tmp_settings = NULL;
+	struct protocols_t *tmp_protocols = NULL;
+	struct options_t *opt = NULL;
+	int match = 0;
+
+	while(tmp_devices) {
+		tmp_settings = tmp_devices->settings;
+		while(tmp_settings) {
+			match = 0;
+			if(strcmp(tmp_settings->name, "state") == 0) {
+				match = 1;
+			} else {
+				tmp_protocols = tmp_devices->protocols;
+				while(tmp_protocols && match == 0) {
+					opt = tmp_protocols->listener->options;
+					while(opt) {
+						if(opt->conftype == DEVICES_VALUE && strcmp(opt->name, tmp_settings->name) == 0) {
+							match = 1;
+							break;
+						}
+						opt = opt->next;
+					}
+					tmp_protocols = tmp_protocols->next;
+				}
+			}
+			if(match == 1) {
+				devices_journal_value(tmp_devices, tmp_settings);
+			}
+			tmp_settings = tmp_settings->next;
+		}
+		tmp_devices = tmp_devices->next;
+	}
+}
+
+static void devices_journal_restore(char *device, char *name, int type, double number, int decimals, char *string, time_t timestamp) {
+	struct devices_t *dev = NULL;
+	struct devices_settings_t *tmp_settings = NULL;
+	struct devices_values_t *val = NULL;
+
+	if(devices_get(device, &dev) != 0) {
+		return;
+	}
+	tmp_settings = dev->settings;
+	while(tmp_settings) {
+		if(strcmp(tmp_settings->name, name) == 0) {
+			val = tmp_settings->values;
+			/* Only restore single values of the same type as configured */
+			if(val != NULL && val->next == NULL && val->type == type) {
+				if(type == JSON_STRING) {
+					if((val->string_ = REALLOC(val->string_, strlen(string)+1)) == NULL) {
+						logprintf(LOG_ERR, "out of memory");
+						exit(EXIT_FAILURE);
+					}
+					strcpy(val->string_, string);
+				} else if(type == JSON_NUMBER) {
+					val->number_ = number;
+					val->decimals = decimals;
+				}
+				if(timestamp > dev->timestamp) {
+					dev->timestamp = timestamp;
+				}
+			}
+			break;
+		}
+		tmp_settings = tmp_settings->next;
+	}
+}
+
+/* Restore the latest device states from the state journal */
+int devices_restore(void) {
+	char *file = NULL;
+
+	if(settings_find_string("state-journal", &file) != 0) {
+		file = JOURNAL_FILE;
+	}
+	if(strlen(file) == 0 || journal_open(file) != 0) {
+		return -1;
+	}
+	if(journal_replay(&devices_journal_restore) > 0) {
+		logprintf(LOG_INFO, "restored device states from %s", file);
+	}
+	journal_compact(&devices_journal_snapshot);
+	journal_set_snapshot(&devices_journal_snapshot);
+
+	return 0;
+}
+
 static int devices_read(JsonNode *root) {
 	if(devices_parse(root) == 0 && devices_validate_settings() == 0) {
 		return 0;
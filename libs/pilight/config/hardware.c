@@ -101,6 +101,7 @@ void hardware_register(struct hardware_t **hw) {
 	(*hw)->send = NULL;
 	(*hw)->gc = NULL;
 	(*hw)->settings = NULL;
+	(*hw)->stats = NULL;
 
 	pthread_mutexattr_init(&(*hw)->attr);
 	pthread_mutexattr_settype(&(*hw)->attr, PTHREAD_MUTEX_RECURSIVE);
@@ -162,6 +163,20 @@ static int hardware_gc(void) {
 	return EXIT_SUCCESS;
 }
 
+/* Fewest decimals that write a setting back as it was configured */
+static int hardware_decimals(double number) {
+	char buffer[64];
+	int decimals = 0;
+
+	for(decimals=0;decimals<6;decimals++) {
+		snprintf(buffer, sizeof(buffer), "%.*f", decimals, number);
+		if(atof(buffer) == number) {
+			break;
+		}
+	}
+	return decimals;
+}
+
 static JsonNode *hardware_sync(int level, const char *display) {
 	struct conf_hardware_t *tmp = conf_hardware;
 	struct JsonNode *root = json_mkobject();
@@ -170,8 +185,8 @@ static JsonNode *hardware_sync(int level, const char *display) {
 		struct options_t *options = tmp->hardware->options;
 		while(options) {
 			if(options->vartype == JSON_NUMBER) {
-				json_append_member(module, options->name, json_mknumber(options->number_, 0));
-			} else if(options->vartype == JSON_STRING) {
+				json_append_member(module, options->name, json_mknumber(options->number_, hardware_decimals(options->number_)));
+			} else if(options->vartype == JSON_STRING && options->string_ != NULL) {
 				json_append_member(module, options->name, json_mkstring(options->string_));
 			}
 			options = options->next;
@@ -245,7 +260,7 @@ static int hardware_parse(JsonNode *root) {
 				jvalues = json_first_child(jchilds);
 				while(jvalues) {
 					if(jvalues->tag == JSON_NUMBER || jvalues->tag == JSON_STRING) {
-						if(strcmp(jvalues->key, hw_options->name) == 0 && hw_options->argtype == OPTION_HAS_VALUE) {
+						if(strcmp(jvalues->key, hw_options->name) == 0) {
 							match = 1;
 							break;
 						}
@@ -253,9 +268,12 @@ static int hardware_parse(JsonNode *root) {
 					jvalues = jvalues->next;
 				}
 				if(match == 0) {
-					logprintf(LOG_ERR, "config hardware module #%d \"%s\", setting \"%s\" missing", i, jchilds->key, hw_options->name);
-					have_error = 1;
-					goto clear;
+					/* Optional settings may be left out */
+					if(hw_options->argtype == OPTION_HAS_VALUE) {
+						logprintf(LOG_ERR, "config hardware module #%d \"%s\", setting \"%s\" missing", i, jchilds->key, hw_options->name);
+						have_error = 1;
+						goto clear;
+					}
 				} else {
 					/* Check if setting contains a valid value */
 #if !defined(__FreeBSD__) && !defined(_WIN32)
@@ -264,12 +282,13 @@ static int hardware_parse(JsonNode *root) {
 					char *stmp = NULL;
 
 					if(jvalues->tag == JSON_NUMBER) {
-						stmp = REALLOC(stmp, sizeof(jvalues->number_));
+						stmp = REALLOC(stmp, 64);
 						if(!stmp) {
 							logprintf(LOG_ERR, "out of memory");
 							exit(EXIT_FAILURE);
 						}
-						sprintf(stmp, "%d", (int)jvalues->number_);
+						/* Check the number as written, so a mask can reject decimals */
+						snprintf(stmp, 64, "%.*f", jvalues->decimals_, jvalues->number_);
 					} else if(jvalues->tag == JSON_STRING) {
 						stmp = REALLOC(stmp, strlen(jvalues->string_)+1);
 						if(!stmp) {
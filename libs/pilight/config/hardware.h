@@ -69,6 +69,8 @@ typedef struct hardware_t {
 	int (*send)(int *code, int rawlen, int repeats);
 	int (*gc)(void);
 	unsigned short (*settings)(JsonNode *json);
+	/* Add module statistics to the periodic stats message */
+	void (*stats)(JsonNode *json);
 	struct hardware_t *next;
 } hardware_t;
 
@@ -25,6 +25,12 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <libgen.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
 
 #include "../core/pilight.h"
 #include "../core/common.h"
@@ -32,226 +38,502 @@
 #include "../core/log.h"
 #include "registry.h"
 
-struct JsonNode *registry = NULL;
+/*
+ * The registry is kept as a flat hash table indexed by the full
+ * dotted key. Every intermediate level of a key is stored as a
+ * JSON_OBJECT node that counts its direct children, so conflicts
+ * between leaves and subtrees can be checked without walking the
+ * whole table. The JSON tree is only rebuilt when syncing.
+ */
 
-static int registry_get_value_recursive(struct JsonNode *root, const char *key, void **value, void **decimals, int type) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+#define REGISTRY_BUCKETS	64
 
-	char *sub = strstr(key, ".");
-	char *buff = MALLOC(strlen(key)+1);
-	strcpy(buff, key);
-	if(sub != NULL) {
-		int pos = sub-key;
-		buff[pos] = '\0';
-	}
-	struct JsonNode *member = json_find_member(root, buff);
-	if(member != NULL) {
-		if(member->tag == type) {
-			if(type == JSON_NUMBER) {
-				*value = (void *)&member->number_;
-				*decimals = (void *)&member->decimals_;
-			} else if(type == JSON_STRING) {
-				*value = (void *)member->string_;
-			}
-			FREE(buff);
-			return 0;
-		} else if(member->tag == JSON_OBJECT) {
-			if(sub != NULL) {
-				int pos = sub-key;
-				strcpy(buff, &key[pos+1]);
-			}
-			int ret = registry_get_value_recursive(member, buff, value, decimals, type);
-			FREE(buff);
-			return ret;
+struct registry_t {
+	char *key;
+	size_t len;
+	unsigned int hash;
+	int type;
+	char *string_;
+	double number_;
+	int decimals_;
+	int children;
+	struct registry_t *next;
+};
+
+static struct registry_t **registry = NULL;
+static unsigned int registry_buckets = 0;
+static unsigned int registry_count = 0;
+
+static pthread_mutex_t registry_lock;
+static pthread_mutexattr_t registry_attr;
+static unsigned short registry_lock_init = 0;
+
+static void registry_lock_create(void) {
+	if(registry_lock_init == 0) {
+		pthread_mutexattr_init(&registry_attr);
+		pthread_mutexattr_settype(&registry_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&registry_lock, &registry_attr);
+		registry_lock_init = 1;
+	}
+}
+
+static void registry_rehash(unsigned int buckets) {
+	struct registry_t **table = NULL, *node = NULL, *next = NULL;
+	unsigned int i = 0;
+
+	if((table = MALLOC(sizeof(struct registry_t *)*buckets)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(table, 0, sizeof(struct registry_t *)*buckets);
+	for(i=0;i<registry_buckets;i++) {
+		node = registry[i];
+		while(node) {
+			next = node->next;
+			node->next = table[node->hash & (buckets-1)];
+			table[node->hash & (buckets-1)] = node;
+			node = next;
 		}
 	}
-	FREE(buff);
-	return -1;
+	if(registry != NULL) {
+		FREE(registry);
+	}
+	registry = table;
+	registry_buckets = buckets;
 }
 
-static int registry_set_value_recursive(struct JsonNode *root, const char *key, void *value, int decimals, int type) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+static struct registry_t *registry_find(const char *key, size_t len) {
+	struct registry_t *node = NULL;
+	unsigned int hash = 0;
 
-	char *sub = strstr(key, ".");
-	char *buff = MALLOC(strlen(key)+1);
-	strcpy(buff, key);
-	if(sub != NULL) {
-		int pos = sub-key;
-		buff[pos] = '\0';
-	}
-	struct JsonNode *member = json_find_member(root, buff);
-	if(member != NULL) {
-		if(member->tag == type) {
-			if(type == JSON_NUMBER) {
-				member->number_ = *(double *)value;
-				member->decimals_ = decimals;
-			} else if(type == JSON_STRING) {
-				member->string_ = REALLOC(member->string_, strlen(value)+1);
-				strcpy(member->string_, (char *)value);
-			}
-			FREE(buff);
-			return 0;
-		} else if(member->tag == JSON_OBJECT) {
-			if(sub != NULL) {
-				int pos = sub-key;
-				strcpy(buff, &key[pos+1]);
-			}
-			int ret = registry_set_value_recursive(member, buff, value, decimals, type);
-			FREE(buff);
-			return ret;
+	if(registry == NULL) {
+		return NULL;
+	}
+	hash = fnv1a(key, len);
+	node = registry[hash & (registry_buckets-1)];
+	while(node) {
+		if(node->hash == hash && node->len == len && strncmp(node->key, key, len) == 0) {
+			return node;
 		}
-	} else if(sub != NULL) {
-		member = json_mkobject();
-		json_append_member(root, buff, member);
-		int pos = sub-key;
-		strcpy(buff, &key[pos+1]);
-		int ret = registry_set_value_recursive(member, buff, value, decimals, type);
-		FREE(buff);
-		return ret;
-	} else {
-		if(type == JSON_NUMBER) {
-			json_append_member(root, buff, json_mknumber(*(double *)value, decimals));
-		} else if(type == JSON_STRING) {
-			json_append_member(root, buff, json_mkstring(value));
+		node = node->next;
+	}
+	return NULL;
+}
+
+static struct registry_t *registry_add(const char *key, size_t len, int type) {
+	struct registry_t *node = NULL;
+
+	if(registry == NULL) {
+		registry_rehash(REGISTRY_BUCKETS);
+	} else if(registry_count >= registry_buckets*2) {
+		registry_rehash(registry_buckets*2);
+	}
+	if((node = MALLOC(sizeof(struct registry_t))) == NULL ||
+	   (node->key = MALLOC(len+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(node->key, key, len);
+	node->key[len] = '\0';
+	node->len = len;
+	node->hash = fnv1a(key, len);
+	node->type = type;
+	node->string_ = NULL;
+	node->number_ = 0.0;
+	node->decimals_ = 0;
+	node->children = 0;
+	node->next = registry[node->hash & (registry_buckets-1)];
+	registry[node->hash & (registry_buckets-1)] = node;
+	registry_count++;
+	return node;
+}
+
+static void registry_unlink(struct registry_t *node) {
+	struct registry_t **p = &registry[node->hash & (registry_buckets-1)];
+
+	while(*p) {
+		if(*p == node) {
+			*p = node->next;
+			break;
 		}
-		FREE(buff);
-		return 0;
+		p = &(*p)->next;
 	}
-	FREE(buff);
-	return -1;
+	if(node->string_ != NULL) {
+		FREE(node->string_);
+	}
+	FREE(node->key);
+	FREE(node);
+	registry_count--;
 }
 
-static void registry_remove_empty_parent(struct JsonNode *root) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/* Decrease the child count of the parent of key and drop empty parents */
+static void registry_release_parent(const char *key, size_t len) {
+	struct registry_t *parent = NULL;
 
-	struct JsonNode *parent = root->parent;
-	if(json_first_child(root) == NULL) {
-		if(parent != NULL) {
-			json_remove_from_parent(root);
-			registry_remove_empty_parent(parent);
-			json_delete(root);
+	while(len > 0 && key[len-1] != '.') {
+		len--;
+	}
+	if(len == 0) {
+		return;
+	}
+	len--;
+	if((parent = registry_find(key, len)) != NULL) {
+		if(--parent->children <= 0) {
+			registry_unlink(parent);
+			registry_release_parent(key, len);
 		}
 	}
 }
 
-static int registry_remove_value_recursive(struct JsonNode *root, const char *key) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/* Return the leaf node of key, creating it and its parents when needed */
+static struct registry_t *registry_leaf(const char *key, int type) {
+	struct registry_t *node = NULL, *parent = NULL;
+	size_t len = strlen(key), i = 0;
 
-	char *sub = strstr(key, ".");
-	char *buff = MALLOC(strlen(key)+1);
-	strcpy(buff, key);
-	if(sub != NULL) {
-		int pos = sub-key;
-		buff[pos] = '\0';
-	}
-	struct JsonNode *member = json_find_member(root, buff);
-	if(member != NULL) {
-		if(sub == NULL) {
-			json_remove_from_parent(member);
-			json_delete(member);
-			registry_remove_empty_parent(root);
-			FREE(buff);
-			return 0;
+	if(len == 0 || key[0] == '.' || key[len-1] == '.' || strstr(key, "..") != NULL) {
+		return NULL;
+	}
+	if((node = registry_find(key, len)) != NULL) {
+		return (node->type == type) ? node : NULL;
+	}
+	/* None of the parents may be a leaf */
+	for(i=0;i<len;i++) {
+		if(key[i] == '.' && (parent = registry_find(key, i)) != NULL && parent->type != JSON_OBJECT) {
+			return NULL;
+		}
+	}
+	node = registry_add(key, len, type);
+	i = len;
+	while(i > 0) {
+		while(i > 0 && key[i-1] != '.') {
+			i--;
 		}
-		if(member->tag == JSON_OBJECT) {
-			if(sub != NULL) {
-				int pos = sub-key;
-				strcpy(buff, &key[pos+1]);
+		if(i == 0) {
+			break;
+		}
+		i--;
+		if((parent = registry_find(key, i)) != NULL) {
+			parent->children++;
+			break;
+		}
+		parent = registry_add(key, i, JSON_OBJECT);
+		parent->children++;
+	}
+	return node;
+}
+
+static int registry_cmp(const void *a, const void *b) {
+	return strcmp((*(struct registry_t **)a)->key, (*(struct registry_t **)b)->key);
+}
+
+/* Collect all leaves at or below prefix, sorted by key */
+static struct registry_t **registry_collect(const char *prefix, unsigned int *nr) {
+	struct registry_t **list = NULL, *node = NULL;
+	size_t len = (prefix == NULL) ? 0 : strlen(prefix);
+	unsigned int i = 0;
+
+	*nr = 0;
+	if(registry == NULL || registry_count == 0) {
+		return NULL;
+	}
+	if((list = MALLOC(sizeof(struct registry_t *)*registry_count)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	for(i=0;i<registry_buckets;i++) {
+		for(node=registry[i];node;node=node->next) {
+			if(node->type == JSON_OBJECT) {
+				continue;
+			}
+			if(len == 0 || (node->len >= len && strncmp(node->key, prefix, len) == 0 &&
+			   (node->len == len || node->key[len] == '.'))) {
+				list[(*nr)++] = node;
 			}
-			int ret = registry_remove_value_recursive(member, buff);
-			FREE(buff);
-			return ret;
 		}
 	}
-	FREE(buff);
-	return -1;
+	qsort(list, *nr, sizeof(struct registry_t *), registry_cmp);
+	return list;
 }
 
+/* The value is a copy the caller has to free, because the
+   node can be changed or removed once the lock is released */
 int registry_get_string(const char *key, char **value) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(registry == NULL) {
-		return -1;
+	struct registry_t *node = NULL;
+	int ret = -1;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	if((node = registry_find(key, strlen(key))) != NULL && node->type == JSON_STRING) {
+		if((*value = MALLOC(strlen(node->string_)+1)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(*value, node->string_);
+		ret = 0;
 	}
-	return registry_get_value_recursive(registry, key, (void *)value, NULL, JSON_STRING);
+	pthread_mutex_unlock(&registry_lock);
+	return ret;
 }
 
 int registry_get_number(const char *key, double *value, int *decimals) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(registry == NULL) {
-		return -1;
-	}
-	void *p = NULL;
-	void *q = NULL;
-	int ret = registry_get_value_recursive(registry, key, &p, &q, JSON_NUMBER);
-	if(ret == 0) {
-		*value = *(double *)p;
-		*decimals = *(int *)q;
+	struct registry_t *node = NULL;
+	int ret = -1;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	if((node = registry_find(key, strlen(key))) != NULL && node->type == JSON_NUMBER) {
+		*value = node->number_;
+		*decimals = node->decimals_;
+		ret = 0;
 	}
+	pthread_mutex_unlock(&registry_lock);
 	return ret;
 }
 
 int registry_set_string(const char *key, char *value) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(registry == NULL) {
-		registry = json_mkobject();
+	struct registry_t *node = NULL;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	if((node = registry_leaf(key, JSON_STRING)) == NULL) {
+		pthread_mutex_unlock(&registry_lock);
+		return -1;
+	}
+	/* Don't mark the config as changed when nothing did */
+	if(node->string_ != NULL && strcmp(node->string_, value) == 0) {
+		pthread_mutex_unlock(&registry_lock);
+		return 0;
 	}
-	return registry_set_value_recursive(registry, key, (void *)value, 0, JSON_STRING);
+	if((node->string_ = REALLOC(node->string_, strlen(value)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(node->string_, value);
+	pthread_mutex_unlock(&registry_lock);
+
+	config_schedule_write();
+	return 0;
 }
 
 int registry_set_number(const char *key, double value, int decimals) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(registry == NULL) {
-		registry = json_mkobject();
+	struct registry_t *node = NULL;
+	unsigned int count = 0;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	count = registry_count;
+	if((node = registry_leaf(key, JSON_NUMBER)) == NULL) {
+		pthread_mutex_unlock(&registry_lock);
+		return -1;
+	}
+	/* Don't mark the config as changed when nothing did */
+	if(count == registry_count && node->number_ == value && node->decimals_ == decimals) {
+		pthread_mutex_unlock(&registry_lock);
+		return 0;
 	}
-	void *p = (void *)&value;
-	return registry_set_value_recursive(registry, key, p, decimals, JSON_NUMBER);
+	node->number_ = value;
+	node->decimals_ = decimals;
+	pthread_mutex_unlock(&registry_lock);
+
+	config_schedule_write();
+	return 0;
 }
 
 int registry_remove_value(const char *key) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(registry == NULL) {
+	struct registry_t *node = NULL, *tmp = NULL, *next = NULL;
+	size_t len = strlen(key);
+	unsigned int i = 0;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	if((node = registry_find(key, len)) == NULL) {
+		pthread_mutex_unlock(&registry_lock);
 		return -1;
 	}
-	return registry_remove_value_recursive(registry, key);
+	if(node->type == JSON_OBJECT) {
+		/* Drop the whole subtree */
+		for(i=0;i<registry_buckets;i++) {
+			tmp = registry[i];
+			while(tmp) {
+				next = tmp->next;
+				if(tmp->len > len && strncmp(tmp->key, key, len) == 0 && tmp->key[len] == '.') {
+					registry_unlink(tmp);
+				}
+				tmp = next;
+			}
+		}
+	}
+	registry_unlink(node);
+	registry_release_parent(key, len);
+	pthread_mutex_unlock(&registry_lock);
+
+	config_schedule_write();
+	return 0;
+}
+
+int registry_iterate(const char *prefix, registry_callback_t callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct registry_t **list = NULL;
+	unsigned int nr = 0, i = 0;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	list = registry_collect(prefix, &nr);
+	for(i=0;i<nr;i++) {
+		callback(list[i]->key, list[i]->type, list[i]->string_, list[i]->number_, list[i]->decimals_, userdata);
+	}
+	if(list != NULL) {
+		FREE(list);
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return (int)nr;
+}
+
+static int registry_parse_object(JsonNode *root, char *prefix) {
+	struct JsonNode *jchilds = json_first_child(root);
+	struct registry_t *node = NULL;
+	char *key = NULL;
+	int ret = 0;
+
+	while(jchilds && ret == 0) {
+		if((key = MALLOC(strlen(prefix)+strlen(jchilds->key)+2)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		if(strlen(prefix) > 0) {
+			sprintf(key, "%s.%s", prefix, jchilds->key);
+		} else {
+			strcpy(key, jchilds->key);
+		}
+		if(jchilds->tag == JSON_OBJECT) {
+			ret = registry_parse_object(jchilds, key);
+		} else if(jchilds->tag == JSON_NUMBER || jchilds->tag == JSON_STRING) {
+			if((node = registry_leaf(key, jchilds->tag)) == NULL) {
+				logprintf(LOG_ERR, "config registry key \"%s\" is invalid", key);
+				ret = -1;
+			} else if(jchilds->tag == JSON_NUMBER) {
+				node->number_ = jchilds->number_;
+				node->decimals_ = jchilds->decimals_;
+			} else {
+				if((node->string_ = REALLOC(node->string_, strlen(jchilds->string_)+1)) == NULL) {
+					logprintf(LOG_ERR, "out of memory");
+					exit(EXIT_FAILURE);
+				}
+				strcpy(node->string_, jchilds->string_);
+			}
+		} else {
+			logprintf(LOG_ERR, "config registry values can only be a string or number");
+			ret = -1;
+		}
+		FREE(key);
+		jchilds = jchilds->next;
+	}
+	return ret;
 }
 
 static int registry_parse(JsonNode *root) {
+	int ret = 0;
+
 	if(root->tag == JSON_OBJECT) {
-		char *content = json_stringify(root, NULL);
-		registry = json_decode(content);
-		json_free(content);
+		registry_lock_create();
+		pthread_mutex_lock(&registry_lock);
+		ret = registry_parse_object(root, "");
+		pthread_mutex_unlock(&registry_lock);
 	} else {
 		logprintf(LOG_ERR, "config registry should be of an object type");
 		return -1;
 	}
-	return 0;
+	return ret;
 }
 
 static JsonNode *registry_sync(int level, const char *display) {
-	if(registry != NULL) {
-		char *content = json_stringify(registry, NULL);
-		struct JsonNode *jret = json_decode(content);
-		json_free(content);
-		return jret;
-	} else {
+	struct registry_t **list = NULL;
+	struct JsonNode *jret = NULL, *jparent = NULL, *jchild = NULL;
+	unsigned int nr = 0, i = 0;
+	char *key = NULL, *sub = NULL, *ptr = NULL;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	if(registry == NULL) {
+		pthread_mutex_unlock(&registry_lock);
 		return NULL;
 	}
+	jret = json_mkobject();
+	list = registry_collect(NULL, &nr);
+	for(i=0;i<nr;i++) {
+		if((key = MALLOC(list[i]->len+1)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(key, list[i]->key);
+		jparent = jret;
+		ptr = key;
+		while((sub = strstr(ptr, ".")) != NULL) {
+			*sub = '\0';
+			if((jchild = json_find_member(jparent, ptr)) == NULL) {
+				jchild = json_mkobject();
+				json_append_member(jparent, ptr, jchild);
+			}
+			jparent = jchild;
+			ptr = sub+1;
+		}
+		if(list[i]->type == JSON_NUMBER) {
+			json_append_member(jparent, ptr, json_mknumber(list[i]->number_, list[i]->decimals_));
+		} else {
+			json_append_member(jparent, ptr, json_mkstring(list[i]->string_));
+		}
+		FREE(key);
+	}
+	if(list != NULL) {
+		FREE(list);
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return jret;
 }
 
 static int registry_gc(void) {
+	struct registry_t *node = NULL, *next = NULL;
+	unsigned int i = 0;
+
+	registry_lock_create();
+	pthread_mutex_lock(&registry_lock);
+	for(i=0;i<registry_buckets;i++) {
+		node = registry[i];
+		while(node) {
+			next = node->next;
+			if(node->string_ != NULL) {
+				FREE(node->string_);
+			}
+			FREE(node->key);
+			FREE(node);
+			node = next;
+		}
+	}
 	if(registry != NULL) {
-		json_delete(registry);
+		FREE(registry);
 	}
+	registry_buckets = 0;
+	registry_count = 0;
+	pthread_mutex_unlock(&registry_lock);
+
 	logprintf(LOG_DEBUG, "garbage collected config registry library");
 	return 1;
 }
 
 void registry_init(void) {
+	registry_lock_create();
+
 	/* Request settings json object in main configuration */
 	config_register(&config_registry, "registry");
 	config_registry->readorder = 5;
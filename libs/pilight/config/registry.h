@@ -24,11 +24,14 @@
 
 struct config_t *config_registry;
 
+typedef void (*registry_callback_t)(const char *key, int type, char *string, double number, int decimals, void *userdata);
+
 void registry_init(void);
 int registry_get_string(const char *key, char **value);
 int registry_get_number(const char *key, double *value, int *decimals);
 int registry_set_string(const char *key, char *value);
 int registry_set_number(const char *key, double value, int decimals);
 int registry_remove_value(const char *key);
+int registry_iterate(const char *prefix, registry_callback_t callback, void *userdata);
 
 #endif
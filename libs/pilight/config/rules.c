@@ -83,6 +83,11 @@ static int rules_parse(JsonNode *root) {
 					node->nrdevices = 0;
 					node->status = 0;
 					node->devices = NULL;
+					node->whole = NULL;
+					node->minutes = NULL;
+					node->windows = NULL;
+					node->nrwindows = 0;
+					node->validate = 0;
 					node->actions = NULL;
 					node->nr = i;
 					if((node->name = MALLOC(strlen(jrules->key)+1)) == NULL) {
@@ -221,6 +226,15 @@ int rules_gc(void) {
 		if(tmp_rules->devices != NULL) {
 			FREE(tmp_rules->devices);
 		}
+		if(tmp_rules->whole != NULL) {
+			FREE(tmp_rules->whole);
+		}
+		if(tmp_rules->minutes != NULL) {
+			FREE(tmp_rules->minutes);
+		}
+		if(tmp_rules->windows != NULL) {
+			FREE(tmp_rules->windows);
+		}
 		rules = rules->next;
 		FREE(tmp_rules);
 	}
@@ -23,6 +23,8 @@
 #include "../core/config.h"
 #include "../events/action.h"
 
+struct event_window_t;
+
 typedef struct rules_values_t {
 	char *device;
 	char *name;
@@ -43,7 +45,16 @@ typedef struct rules_t {
 	char *rule;
 	char *name;
 	char **devices;
+	/* Devices used as a whole, e.g. by functions */
+	unsigned short *whole;
+	/* Last minute each datetime device ran this rule */
+	long *minutes;
 	int nrdevices;
+	/* Windows of the window functions in this rule */
+	struct event_window_t **windows;
+	int nrwindows;
+	/* Set while the rule is validated instead of evaluated */
+	unsigned short validate;
 	int nr;
 	int status;
 	struct {
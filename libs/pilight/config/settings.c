@@ -253,6 +253,21 @@ static int settings_parse(JsonNode *root) {
 				settings_add_number(jsettings->key, (int)jsettings->number_);
 			}
 		}
+		else if(strcmp(jsettings->key, "config-write-delay") == 0) {
+			if(jsettings->tag != JSON_NUMBER) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number of 0 or larger", jsettings->key);
+				have_error = 1;
+				goto clear;
+			}
+			else if((int)jsettings->number_ < 0) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number of 0 or larger", jsettings->key);
+				have_error = 1;
+				goto clear;
+			}
+			else {
+				settings_add_number(jsettings->key, (int)jsettings->number_);
+			}
+		}
 		else if(strcmp(jsettings->key, "log-level") == 0) {
 			if(jsettings->tag != JSON_NUMBER) {
 				logprintf(LOG_ERR, "config setting \"%s\" must contain a number from 0 till 5", jsettings->key);
@@ -269,10 +284,14 @@ static int settings_parse(JsonNode *root) {
 			}
 #ifndef _WIN32
 		}
-		else if(strcmp(jsettings->key, "pid-file") == 0 || strcmp(jsettings->key, "log-file") == 0) {
+		else if(strcmp(jsettings->key, "pid-file") == 0 || strcmp(jsettings->key, "log-file") == 0 ||
+			strcmp(jsettings->key, "state-journal") == 0 || strcmp(jsettings->key, "history-file") == 0 ||
+			strcmp(jsettings->key, "pulse-record") == 0 || strcmp(jsettings->key, "pulse-replay") == 0) {
 #else
 		}
-		else if(strcmp(jsettings->key, "log-file") == 0) {
+		else if(strcmp(jsettings->key, "log-file") == 0 || strcmp(jsettings->key, "state-journal") == 0 ||
+			strcmp(jsettings->key, "history-file") == 0 || strcmp(jsettings->key, "pulse-record") == 0 ||
+			strcmp(jsettings->key, "pulse-replay") == 0) {
 #endif
 			if(jsettings->tag != JSON_STRING) {
 				logprintf(LOG_ERR, "config setting \"%s\" must contain an existing path", jsettings->key);
@@ -285,11 +304,22 @@ static int settings_parse(JsonNode *root) {
 				goto clear;
 			}
 			else {
-				if(path_exists(jsettings->string_) != EXIT_SUCCESS) {
+				/* An empty state journal, history or pulse capture path disables them */
+				if((strcmp(jsettings->key, "state-journal") == 0 || strcmp(jsettings->key, "history-file") == 0 ||
+				    strcmp(jsettings->key, "pulse-record") == 0 || strcmp(jsettings->key, "pulse-replay") == 0) &&
+				   strlen(jsettings->string_) == 0) {
+					settings_add_string(jsettings->key, jsettings->string_);
+				}
+				else if(path_exists(jsettings->string_) != EXIT_SUCCESS) {
 					logprintf(LOG_ERR, "config setting \"%s\" must point to an existing folder", jsettings->key);
 					have_error = 1;
 					goto clear;
 				}
+				else if(strcmp(jsettings->key, "pulse-replay") == 0 && file_exists(jsettings->string_) != EXIT_SUCCESS) {
+					logprintf(LOG_ERR, "config setting \"%s\" must point to an existing file", jsettings->key);
+					have_error = 1;
+					goto clear;
+				}
 				else {
 					settings_add_string(jsettings->key, jsettings->string_);
 				}
@@ -69,6 +69,11 @@
 	#endif
 	#include <regex.h>
 	#include <netdb.h>
+	#ifdef __linux__
+		#include <linux/netlink.h>
+		#include <linux/rtnetlink.h>
+		#include <linux/neighbour.h>
+	#endif
 #endif
 #include <pcap.h>
 
@@ -78,7 +83,11 @@
 #include <stdarg.h>
 #include <unistd.h>
 
+#include <pthread.h>
+
 #include "network.h"
+#include "common.h"
+#include "threads.h"
 #include "mem.h"
 #include "log.h"
 #include "arp.h"
@@ -92,17 +101,6 @@
 #define FRAMING_ETHERNET_II	0
 #define FRAMING_LLC_SNAP		1
 
-typedef struct host_entry {
-   double timeout;
-   struct in_addr addr;
-   struct timeval last_send_time;
-   unsigned short num_sent;
-   unsigned short num_recv;
-   unsigned short found;
-   unsigned char live;
-	 uint8_t mac[ETH_ALEN];
-} host_entry;
-
 typedef struct ether_hdr {
 	uint8_t dest_addr[ETH_ALEN];
 	uint8_t src_addr[ETH_ALEN];
@@ -121,55 +119,6 @@ typedef struct arp_ether_ipv4 {
 	uint32_t ar_tip;
 } arp_ether_ipv4;
 
-static struct host_entry **helist;
-static struct host_entry **cursor;
-static unsigned num_hosts = 0;
-static unsigned live_count = 0;
-
-static void advance_cursor(void) {
-	if(live_count > 0) {
-		do {
-			if(cursor == (helist+(num_hosts-1))) {
-				cursor = helist;
-			} else {
-				cursor++;
-			}
-		} while(!(*cursor)->live);
-	}
-}
-
-static void remove_host(host_entry **he) {
-  if((*he)->live == 1) {
-		(*he)->live = 0;
-		live_count--;
-		if(*he == *cursor) {
-			advance_cursor();
-		}
-	}
-}
-
-static void timeval_diff(const struct timeval *a, const struct timeval *b, struct timeval *diff) {
-	struct timeval temp;
-
-	temp.tv_sec = b->tv_sec;
-	temp.tv_usec = b->tv_usec;
-
-	if(a->tv_usec < temp.tv_usec) {
-		int nsec = (temp.tv_usec - a->tv_usec) / 1000000 + 1;
-		temp.tv_usec -= 1000000 * nsec;
-		temp.tv_sec += nsec;
-	}
-	if(a->tv_usec - temp.tv_usec > 1000000) {
-		int nsec = (a->tv_usec - temp.tv_usec) / 1000000;
-		temp.tv_usec += 1000000 * nsec;
-		temp.tv_sec -= nsec;
-	}
-
-	diff->tv_sec = a->tv_sec - temp.tv_sec;
-	diff->tv_usec = a->tv_usec - temp.tv_usec;
-}
-
-
 static void marshal_arp_pkt(unsigned char *buffer, ether_hdr *frame_hdr, arp_ether_ipv4 *arp_pkt, int *buf_siz) {
 	unsigned char *cp;
 	int packet_size;
@@ -254,39 +203,120 @@ static int unmarshal_arp_pkt(const unsigned char *buffer, size_t buf_len, ether_
 	return framing;
 }
 
-void arp_add_host(const char *host_name) {
+/* Microseconds between two requests of a subnet sweep */
+#define ARP_PACE		5000
+/* Seconds to wait for a reply to our requests */
+#define ARP_TIMEOUT	2
+/* Forget neighbours we have not seen for this many seconds */
+#define ARP_EXPIRE	3600
+
+typedef struct arp_entry_t {
+	uint8_t mac[ETH_ALEN];
+	struct in_addr addr;
+	time_t seen;
+	struct arp_entry_t *next;
+} arp_entry_t;
+
+typedef struct arp_watch_t {
+	uint8_t mac[ETH_ALEN];
+	char ip[INET_ADDRSTRLEN+1];
+	int interval;
+	int state;
+	int probing;
+	int swept;
+	time_t due;
+	time_t probed;
+	time_t deadline;
+	arp_callback_t *callback;
+	struct arp_watch_t *next;
+} arp_watch_t;
+
+static pthread_mutex_t arp_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct arp_entry_t *arp_table = NULL;
+static struct arp_watch_t *arp_watches = NULL;
+
+static pthread_t arp_pth;
+static int arp_started = 0;
+static int arp_loop = 1;
+
+static pcap_t *arp_pcap = NULL;
+static int arp_netlink = -1;
+static uint8_t arp_srcmac[ETH_ALEN];
+static struct in_addr arp_srcip;
+
+/* Next host of a running subnet sweep, 0 when idle */
+static int arp_sweep = 0;
+static unsigned long long arp_sweep_time = 0;
+
+static unsigned long long arp_time(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
 
-	if((helist = REALLOC(helist, ((num_hosts+1) * sizeof(struct host_entry *)))) == NULL) {
-		logprintf(LOG_ERR, "out of memory\n");
-		exit(EXIT_FAILURE);
+static void arp_seen(uint8_t *mac, uint32_t addr) {
+	struct arp_entry_t *tmp = NULL;
+
+	pthread_mutex_lock(&arp_lock);
+	for(tmp=arp_table;tmp!=NULL;tmp=tmp->next) {
+		if(memcmp(tmp->mac, mac, ETH_ALEN) == 0) {
+			break;
+		}
 	}
+	if(tmp == NULL) {
+		if((tmp = MALLOC(sizeof(struct arp_entry_t))) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(tmp->mac, mac, ETH_ALEN);
+		tmp->next = arp_table;
+		arp_table = tmp;
+	}
+	tmp->addr.s_addr = addr;
+	tmp->seen = time(NULL);
+	pthread_mutex_unlock(&arp_lock);
+}
 
-	if((helist[num_hosts] = MALLOC(sizeof(struct host_entry))) == NULL) {
-		logprintf(LOG_ERR, "out of memory\n");
-		exit(EXIT_FAILURE);
+static struct arp_entry_t *arp_find(uint8_t *mac) {
+	struct arp_entry_t *tmp = NULL;
+
+	for(tmp=arp_table;tmp!=NULL;tmp=tmp->next) {
+		if(memcmp(tmp->mac, mac, ETH_ALEN) == 0) {
+			return tmp;
+		}
 	}
-	helist[num_hosts]->addr.s_addr = inet_addr(host_name);
-	helist[num_hosts]->live = 1;
-	helist[num_hosts]->timeout = 500 * 1000;	/* Convert from ms to us */
-	helist[num_hosts]->num_sent = 0;
-	helist[num_hosts]->num_recv = 0;
-	helist[num_hosts]->found = 0;
-	helist[num_hosts]->last_send_time.tv_sec = 0;
-	helist[num_hosts]->last_send_time.tv_usec = 0;
-	num_hosts++;
+	return NULL;
 }
 
-static int send_packet(pcap_t *pcap_handle, host_entry *he, struct timeval *last_packet_time, char source_mac[ETH_ALEN]) {
+static void arp_expire(time_t now) {
+	struct arp_entry_t *tmp = NULL, *prev = NULL, *next = NULL;
+
+	tmp = arp_table;
+	while(tmp) {
+		next = tmp->next;
+		if(now-tmp->seen > ARP_EXPIRE) {
+			if(prev == NULL) {
+				arp_table = next;
+			} else {
+				prev->next = next;
+			}
+			FREE(tmp);
+		} else {
+			prev = tmp;
+		}
+		tmp = next;
+	}
+}
+
+static int arp_send(struct in_addr addr) {
 	struct ether_hdr frame_hdr;
 	struct arp_ether_ipv4 arpei;
 	unsigned char buf[MAX_FRAME];
 	unsigned char target_mac[ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-	unsigned char arp_tha[ETH_ALEN] = {0, 0, 0, 0, 0, 0};
 	int buflen = 0;
-	int nsent = 0;
 
 	memcpy(frame_hdr.dest_addr, target_mac, ETH_ALEN);
-	memcpy(frame_hdr.src_addr, source_mac, ETH_ALEN);
+	memcpy(frame_hdr.src_addr, arp_srcmac, ETH_ALEN);
 	frame_hdr.frame_type = htons(0x0806);
 
 	memset(&arpei, '\0', sizeof(arp_ether_ipv4));
@@ -295,143 +325,295 @@ static int send_packet(pcap_t *pcap_handle, host_entry *he, struct timeval *last
 	arpei.ar_hln = 6;
 	arpei.ar_pln = 4;
 	arpei.ar_op = htons(1);
-	memcpy(arpei.ar_sha, source_mac, ETH_ALEN);
-	memcpy(arpei.ar_tha, arp_tha, ETH_ALEN);
+	memcpy(arpei.ar_sha, arp_srcmac, ETH_ALEN);
 	arpei.ar_sip = 0;
-	if(he != NULL) {
-		arpei.ar_tip = he->addr.s_addr;
-	}
+	arpei.ar_tip = addr.s_addr;
 
 	marshal_arp_pkt(buf, &frame_hdr, &arpei, &buflen);
 
-	if(he == NULL) {
-		return buflen;
-	}
-
-	if(he->live == 0) {
-		logprintf(LOG_ERR, "send_packet called on non-live host");
+	if(pcap_sendpacket(arp_pcap, buf, buflen) < 0) {
+		logprintf(LOG_ERR, "failed to send arp request");
 		return -1;
 	}
+	return 0;
+}
 
-	gettimeofday(last_packet_time, NULL);
-	he->last_send_time.tv_sec  = last_packet_time->tv_sec;
-	he->last_send_time.tv_usec = last_packet_time->tv_usec;
-	he->num_sent++;
+/* Every arp packet on the wire tells us where its sender lives */
+static void arp_capture(u_char *args, const struct pcap_pkthdr *header, const u_char *packet_in) {
+	struct arp_ether_ipv4 arpei;
+	struct ether_hdr frame_hdr;
+	size_t n = header->caplen;
 
-	nsent = pcap_sendpacket(pcap_handle, buf, buflen);
-	if(nsent < 0) {
-		logprintf(LOG_ERR, "ERROR: failed to send packet");
-		return -1;
+	if(n < ETHER_HDR_SIZE+ARP_PKT_SIZE) {
+		return;
+	}
+	if(packet_in[ETHER_HDR_SIZE] == 0xAA && n < ETHER_HDR_SIZE+ARP_PKT_SIZE+8) {
+		return;
 	}
 
-	return buflen;
-}
-
-static struct host_entry *find_host(host_entry **he, struct in_addr *addr) {
-	host_entry **p;
-	int found = 0;
-
-	if(*he == NULL) {
-		return NULL;
+	unmarshal_arp_pkt(packet_in, n, &frame_hdr, &arpei, NULL, NULL);
+	if(ntohs(arpei.ar_hrd) != 1 || ntohs(arpei.ar_pro) != 0x0800 || arpei.ar_sip == 0) {
+		return;
+	}
+	if(memcmp(arpei.ar_sha, arp_srcmac, ETH_ALEN) == 0) {
+		return;
 	}
+	arp_seen(arpei.ar_sha, arpei.ar_sip);
+}
 
-	p = he;
+#ifdef __linux__
+#ifndef NDA_RTA
+	#define NDA_RTA(r) ((struct rtattr *)(((char *)(r))+NLMSG_ALIGN(sizeof(struct ndmsg))))
+#endif
+#ifndef NDA_PAYLOAD
+	#define NDA_PAYLOAD(n) NLMSG_PAYLOAD(n, sizeof(struct ndmsg))
+#endif
 
-  do {
-		if((*p)->addr.s_addr == addr->s_addr) {
-			found = 1;
-		} else {
-			if(p == helist) {
-				p = helist + (num_hosts-1);	/* Wrap round to end */
-			} else {
-				p--;
-			}
-		}
-	} while(!found && p != he);
+/* The kernel tells us about neighbours it talked to itself */
+static int arp_netlink_open(void) {
+	struct sockaddr_nl sa;
+	int fd = 0;
 
-	if(found == 1) {
-		return *p;
-	} else {
-		return NULL;
+	if((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+		return -1;
 	}
+	memset(&sa, '\0', sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_NEIGH;
+	if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
 }
 
-static void callback(u_char *args, const struct pcap_pkthdr *header, const u_char *packet_in) {
-	struct arp_ether_ipv4 arpei;
-	struct ether_hdr frame_hdr;
-	size_t n = header->caplen;
-	struct in_addr source_ip;
-	struct host_entry *temp_cursor = NULL;
+static void arp_netlink_read(int fd) {
+	char buf[8192];
+	struct nlmsghdr *nh = NULL;
+	struct ndmsg *nd = NULL;
+	struct rtattr *rta = NULL;
+	uint8_t *mac = NULL;
+	uint32_t addr = 0;
+	int len = 0, attrlen = 0;
 
-	if(n < ETHER_HDR_SIZE + ARP_PKT_SIZE) {
-		logprintf(LOG_ERR, "%d byte packet too short to decode\n", (int)n);
+	if((len = (int)recv(fd, buf, sizeof(buf), 0)) <= 0) {
 		return;
-   }
-
-	unmarshal_arp_pkt(packet_in, n, &frame_hdr, &arpei, NULL, NULL);
-	source_ip.s_addr = arpei.ar_sip;
-	temp_cursor = find_host(cursor, &source_ip);
-
-	if(temp_cursor != NULL) {
-		temp_cursor->num_recv++;
-		if(temp_cursor->live == 1) {
-			temp_cursor->found = 1;
-			memcpy(temp_cursor->mac, arpei.ar_sha, ETH_ALEN);
+	}
+	for(nh=(struct nlmsghdr *)buf;NLMSG_OK(nh, (unsigned int)len);nh=NLMSG_NEXT(nh, len)) {
+		if(nh->nlmsg_type != RTM_NEWNEIGH) {
+			continue;
+		}
+		nd = (struct ndmsg *)NLMSG_DATA(nh);
+		if(nd->ndm_family != AF_INET || (nd->ndm_state & NUD_REACHABLE) == 0) {
+			continue;
+		}
+		mac = NULL;
+		addr = 0;
+		attrlen = (int)NDA_PAYLOAD(nh);
+		for(rta=NDA_RTA(nd);RTA_OK(rta, attrlen);rta=RTA_NEXT(rta, attrlen)) {
+			if(rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == 4) {
+				memcpy(&addr, RTA_DATA(rta), 4);
+			} else if(rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == ETH_ALEN) {
+				mac = (uint8_t *)RTA_DATA(rta);
+			}
+		}
+		if(mac != NULL && addr != 0) {
+			arp_seen(mac, addr);
 		}
-		remove_host(&temp_cursor);
 	}
 }
+#endif
 
-static int recvfrom_wto(long unsigned int tmo, pcap_t *pcap_handle) {
+static int arp_wait(unsigned long long usec) {
 #ifdef _WIN32
-	WaitForSingleObject(pcap_getevent(pcap_handle), (DWORD)tmo);
+	WaitForSingleObject(pcap_getevent(arp_pcap), (DWORD)(usec/1000));
 #else
 	fd_set readset;
 	struct timeval to;
-	int n = 0, pcap_fd = 0;
-	if((pcap_fd = pcap_get_selectable_fd(pcap_handle)) < 0) {
-		logprintf(LOG_ERR, "pcap_fileno: %s", pcap_geterr(pcap_handle));
+	int n = 0, pcap_fd = 0, max = 0;
+
+	if((pcap_fd = pcap_get_selectable_fd(arp_pcap)) < 0) {
+		logprintf(LOG_ERR, "pcap_fileno: %s", pcap_geterr(arp_pcap));
 		return -1;
-	}	
+	}
 	FD_ZERO(&readset);
-	if(pcap_fd >= 0)
-		FD_SET(pcap_fd, &readset);
-		to.tv_sec  = (__time_t)(tmo/(long unsigned int)1000000);
-		to.tv_usec = (__suseconds_t)(tmo - (long unsigned int)((time_t)1000000 * to.tv_sec));
-		n = select(pcap_fd+1, &readset, NULL, NULL, &to);
-	if(n < 0) {
-		logprintf(LOG_ERR, "select");
-		return -1;
-	} else if (n == 0 && pcap_fd >= 0) {
-		return 1;
+	FD_SET(pcap_fd, &readset);
+	max = pcap_fd;
+	if(arp_netlink >= 0) {
+		FD_SET(arp_netlink, &readset);
+		if(arp_netlink > max) {
+			max = arp_netlink;
+		}
+	}
+	to.tv_sec = (time_t)(usec/1000000);
+	to.tv_usec = (suseconds_t)(usec%1000000);
+	if((n = select(max+1, &readset, NULL, NULL, &to)) < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	} else if(n == 0) {
+		return 0;
+	}
+#ifdef __linux__
+	if(arp_netlink >= 0 && FD_ISSET(arp_netlink, &readset)) {
+		arp_netlink_read(arp_netlink);
 	}
 #endif
-	if(pcap_handle != NULL) {
-		if((pcap_dispatch(pcap_handle, -1, callback, NULL)) == -1) {
-			logprintf(LOG_ERR, "pcap_dispatch: %s", pcap_geterr(pcap_handle));
-			return -1;
+#endif
+	if(pcap_dispatch(arp_pcap, -1, arp_capture, NULL) == -1) {
+		logprintf(LOG_ERR, "pcap_dispatch: %s", pcap_geterr(arp_pcap));
+		return -1;
+	}
+	return 0;
+}
+
+static void arp_format(uint8_t *mac, char *out) {
+	sprintf(out, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void *arp_thread(void *param) {
+	struct arp_watch_t *tmp = NULL;
+	struct arp_entry_t *entry = NULL;
+	struct in_addr addr;
+	unsigned long long now_us = 0, timeout = 0;
+	time_t now = 0;
+	int nr = 0, i = 0, state = 0;
+
+	while(arp_loop == 1) {
+		now = time(NULL);
+
+		pthread_mutex_lock(&arp_lock);
+		nr = 0;
+		for(tmp=arp_watches;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct {
+			char mac[18];
+			char ip[INET_ADDRSTRLEN+1];
+			int state;
+			arp_callback_t *callback;
+		} changes[nr+1];
+		nr = 0;
+
+		arp_expire(now);
+
+		for(tmp=arp_watches;tmp!=NULL;tmp=tmp->next) {
+			entry = arp_find(tmp->mac);
+			if(tmp->probing == 0) {
+				if(now < tmp->due) {
+					continue;
+				}
+				/* Recently seen neighbours need no request at all */
+				if(entry == NULL || now-entry->seen >= tmp->interval) {
+					tmp->probing = 1;
+					tmp->swept = 0;
+					tmp->probed = now;
+					tmp->deadline = now+ARP_TIMEOUT;
+					if(entry != NULL) {
+						arp_send(entry->addr);
+					} else {
+						tmp->swept = 1;
+						tmp->deadline += (255*ARP_PACE)/1000000+1;
+						if(arp_sweep == 0) {
+							arp_sweep = 1;
+							arp_sweep_time = arp_time();
+						}
+					}
+					continue;
+				}
+			} else if(entry == NULL || entry->seen < tmp->probed) {
+				if(now < tmp->deadline) {
+					continue;
+				}
+				/* The device might have moved to another address */
+				if(tmp->swept == 0) {
+					tmp->swept = 1;
+					tmp->deadline = now+ARP_TIMEOUT+(255*ARP_PACE)/1000000+1;
+					if(arp_sweep == 0) {
+						arp_sweep = 1;
+						arp_sweep_time = arp_time();
+					}
+					continue;
+				}
+			}
+
+			tmp->probing = 0;
+			tmp->due = now+tmp->interval;
+			state = (entry != NULL && (entry->seen >= tmp->probed || now-entry->seen < tmp->interval)) ? ARP_CONNECTED : ARP_DISCONNECTED;
+			if(state == ARP_CONNECTED) {
+				inet_ntop(AF_INET, (void *)&(entry->addr), changes[nr].ip, INET_ADDRSTRLEN+1);
+			} else {
+				strcpy(changes[nr].ip, "0.0.0.0");
+			}
+			if(state != tmp->state || strcmp(changes[nr].ip, tmp->ip) != 0) {
+				if(state == ARP_CONNECTED && tmp->state == ARP_CONNECTED) {
+					logprintf(LOG_NOTICE, "ip address changed from %s to %s", tmp->ip, changes[nr].ip);
+				}
+				tmp->state = state;
+				strcpy(tmp->ip, changes[nr].ip);
+				arp_format(tmp->mac, changes[nr].mac);
+				changes[nr].state = state;
+				changes[nr].callback = tmp->callback;
+				nr++;
+			}
+		}
+
+		/* Pace the requests of a running sweep */
+		now_us = arp_time();
+		while(arp_sweep > 0 && now_us >= arp_sweep_time) {
+			addr.s_addr = (arp_srcip.s_addr & htonl(0xFFFFFF00)) | htonl((uint32_t)arp_sweep);
+			if(addr.s_addr != arp_srcip.s_addr) {
+				arp_send(addr);
+			}
+			arp_sweep_time += ARP_PACE;
+			if(++arp_sweep > 254) {
+				arp_sweep = 0;
+			}
+		}
+		timeout = (arp_sweep > 0) ? arp_sweep_time-now_us : 250000;
+		pthread_mutex_unlock(&arp_lock);
+
+		for(i=0;i<nr;i++) {
+			changes[i].callback(changes[i].mac, changes[i].ip, changes[i].state);
+		}
+
+		if(arp_wait(timeout) == -1) {
+			break;
 		}
-		return 0;
 	}
-	return -1;
+
+	return (void *)NULL;
 }
 
-int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
-	struct timeval now, diff, last_packet_time;
-	pcap_t *pcap_handle = NULL;
-	unsigned long int loop_timediff = 0, host_timediff = 0;
-	unsigned long int req_interval = 0, select_timeout = 0;
-	unsigned long int cum_err = 0, interval = 0;
-	char *if_cpy = NULL, error[PCAP_ERRBUF_SIZE], *e = error;
-	int found = -1;
-	int reset_cum_err = 0, first_timeout = 1;
-	int i = 0;
+static int arp_open(void) {
+	char ip[INET_ADDRSTRLEN+1], *p = ip, srcmac[ETH_ALEN], *a = srcmac;
+	char error[PCAP_ERRBUF_SIZE], *e = error, **devs = NULL, *if_cpy = NULL;
+	struct bpf_program bpf;
+	int nrdevs = 0, ret = -1;
+
+	if((nrdevs = inetdevs(&devs)) == 0) {
+		logprintf(LOG_ERR, "could not determine default network interface");
+		goto close;
+	}
+
+	memset(&ip, '\0', INET_ADDRSTRLEN+1);
+	if(dev2ip(devs[0], &p, AF_INET) != 0 || inet_pton(AF_INET, ip, &arp_srcip) <= 0) {
+		logprintf(LOG_ERR, "could not determine host ip address");
+		goto close;
+	}
 
-	if((if_cpy = MALLOC(strlen(if_name)+1)) == NULL) {
+	memset(&srcmac, '\0', ETH_ALEN);
+	if(dev2mac(devs[0], &a) != 0 || (srcmac[0] == 0 && srcmac[1] == 0 &&
+		srcmac[2] == 0 && srcmac[3] == 0 &&
+		srcmac[4] == 0 && srcmac[5] == 0)) {
+		logprintf(LOG_ERR, "could not obtain MAC address for interface %s", devs[0]);
+		goto close;
+	}
+	memcpy(arp_srcmac, srcmac, ETH_ALEN);
+
+	if((if_cpy = MALLOC(strlen(devs[0])+1)) == NULL) {
 		logprintf(LOG_ERR, "out of memory");
 		exit(EXIT_FAILURE);
 	}
-	strcpy(if_cpy, if_name);
+	strcpy(if_cpy, devs[0]);
 
 #ifdef _WIN32
 	int match = 0;
@@ -459,123 +641,123 @@ int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
 		pcap_freealldevs(alldevs);
 	}
 	if(match == 0) {
-		logprintf(LOG_ERR, "could not full interface name for %s", if_name);
+		logprintf(LOG_ERR, "could not full interface name for %s", devs[0]);
 		goto close;
 	}
 #endif
 
-	if((pcap_handle = pcap_open_live(if_cpy, 64, 0, 3, e)) == NULL) {
+	if((arp_pcap = pcap_open_live(if_cpy, 64, 0, 3, e)) == NULL) {
 		logprintf(LOG_ERR, "pcap_open_live: %s", e);
 		goto close;
 	}
 
-	if((pcap_setnonblock(pcap_handle, 1, e)) < 0) {
+	if((pcap_setnonblock(arp_pcap, 1, e)) < 0) {
 		logprintf(LOG_ERR, "pcap_setnonblock: %s", e);
 		goto close;
 	}
 
-	live_count = num_hosts;
-	cursor = helist;
-	last_packet_time.tv_sec=0;
-	last_packet_time.tv_usec=0;
-
-	interval = 10000;
-
-	reset_cum_err = 1;
-	req_interval = interval;
-  while(live_count > 0) {
-		gettimeofday(&now, NULL);
-    timeval_diff(&now, &last_packet_time, &diff);
-    loop_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-    if(loop_timediff >= (unsigned)req_interval) {
-			timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-			host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-			if(host_timediff >= (*cursor)->timeout) {
-				if(reset_cum_err > 0) {
-					cum_err = 0;
-					req_interval = interval;
-					reset_cum_err = 0;
-				} else {
-					cum_err += loop_timediff - interval;
-					if(req_interval >= cum_err) {
-						req_interval = req_interval - cum_err;
-					} else {
-						req_interval = 0;
-					}
-				}
-				select_timeout = req_interval;
-				if((*cursor)->num_sent >= 2) {
-					remove_host(cursor);
-					if(first_timeout > 0) {
-						timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-						host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-						while(host_timediff >= (*cursor)->timeout && live_count) {
-							if((*cursor)->live == 1) {
-								remove_host(cursor);
-							} else {
-								advance_cursor();
-							}
-							timeval_diff(&now, &((*cursor)->last_send_time), &diff);
-							host_timediff = (unsigned long int)(1000000*diff.tv_sec + diff.tv_usec);
-						}
-						first_timeout=0;
-					}
-					gettimeofday(&last_packet_time, NULL);
-				} else {
-					if((*cursor)->num_sent > 0) {
-						(*cursor)->timeout *= 1.5;
-					}
-					if(send_packet(pcap_handle, *cursor, &last_packet_time, srcmac) == -1) {
-						goto close;
-					}
-					advance_cursor();
-				}
-			} else {
-				select_timeout = (long unsigned int)((*cursor)->timeout - host_timediff);
-				reset_cum_err = 1;
-      }
-		} else {
-			select_timeout = req_interval - loop_timediff;
-		}
-		if(recvfrom_wto(select_timeout, pcap_handle) == -1) {
-			goto close;
+	/* Only wake up for arp traffic */
+	if(pcap_compile(arp_pcap, &bpf, "arp", 1, 0) == 0) {
+		if(pcap_setfilter(arp_pcap, &bpf) != 0) {
+			logprintf(LOG_NOTICE, "pcap_setfilter: %s", pcap_geterr(arp_pcap));
 		}
+		pcap_freecode(&bpf);
 	}
 
-	for(i=0;i<num_hosts;i++) {
-		if(helist[i]->found == 1) {
-			char fmac[ETH_ALEN];
-			memset(fmac, '\0', ETH_ALEN);
-			sprintf(fmac, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-													helist[i]->mac[0], helist[i]->mac[1],
-													helist[i]->mac[2], helist[i]->mac[3],
-													helist[i]->mac[4], helist[i]->mac[5]);
-			if(strcmp(fmac, dstmac) == 0) {
-				memset(*ip, '\0', INET_ADDRSTRLEN+1);
-				inet_ntop(AF_INET, (void *)&(helist[i]->addr), *ip, INET_ADDRSTRLEN+1);
-				found = 1;
-				break;
-			}
-		}
-	}
+#ifdef __linux__
+	arp_netlink = arp_netlink_open();
+#endif
+	ret = 0;
 
 close:
-	if(pcap_handle != NULL) {
-		pcap_close(pcap_handle);
+	if(ret != 0 && arp_pcap != NULL) {
+		pcap_close(arp_pcap);
+		arp_pcap = NULL;
 	}
 	if(if_cpy != NULL) {
 		FREE(if_cpy);
 	}
-  for(i=0;i<num_hosts;i++) {
-		FREE(helist[i]);
+	array_free(&devs, nrdevs);
+	return ret;
+}
+
+int arp_watch(char *mac, int interval, arp_callback_t *callback) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct arp_watch_t *watch = NULL;
+	unsigned int m[ETH_ALEN];
+	int i = 0;
+
+	if(sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6) {
+		logprintf(LOG_ERR, "%s is not a valid mac address", mac);
+		return -1;
 	}
-	FREE(helist);
-	helist = NULL;
-	num_hosts = 0;
 
-	if(found == 1) {
-		return 0;
-	} else {
+	pthread_mutex_lock(&arp_lock);
+	if(arp_pcap == NULL && arp_open() != 0) {
+		pthread_mutex_unlock(&arp_lock);
 		return -1;
 	}
+
+	if((watch = MALLOC(sizeof(struct arp_watch_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(watch, '\0', sizeof(struct arp_watch_t));
+	for(i=0;i<ETH_ALEN;i++) {
+		watch->mac[i] = (uint8_t)m[i];
+	}
+	strcpy(watch->ip, "0.0.0.0");
+	watch->interval = interval;
+	watch->state = ARP_DISCONNECTED;
+	watch->callback = callback;
+	watch->due = time(NULL)+interval;
+	watch->next = arp_watches;
+	arp_watches = watch;
+
+	if(arp_started == 0) {
+		arp_loop = 1;
+		threads_create(&arp_pth, NULL, arp_thread, NULL);
+		arp_started = 1;
+	}
+	pthread_mutex_unlock(&arp_lock);
+	return 0;
+}
+
+int arp_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct arp_watch_t *watch = NULL;
+	struct arp_entry_t *entry = NULL;
+
+	if(arp_started == 1) {
+		arp_loop = 0;
+		pthread_join(arp_pth, NULL);
+		arp_started = 0;
+	}
+
+	pthread_mutex_lock(&arp_lock);
+	while(arp_watches) {
+		watch = arp_watches;
+		arp_watches = arp_watches->next;
+		FREE(watch);
+	}
+	while(arp_table) {
+		entry = arp_table;
+		arp_table = arp_table->next;
+		FREE(entry);
+	}
+	if(arp_pcap != NULL) {
+		pcap_close(arp_pcap);
+		arp_pcap = NULL;
+	}
+	if(arp_netlink >= 0) {
+		close(arp_netlink);
+		arp_netlink = -1;
+	}
+	arp_sweep = 0;
+	pthread_mutex_unlock(&arp_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected arp library");
+	return 0;
 }
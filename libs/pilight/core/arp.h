@@ -25,5 +25,10 @@
  *
  */
 
-void arp_add_host(const char *host_name);
-int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip);
+#define ARP_DISCONNECTED	0
+#define ARP_CONNECTED			1
+
+typedef void (arp_callback_t)(char *mac, char *ip, int state);
+
+int arp_watch(char *mac, int interval, arp_callback_t *callback);
+int arp_gc(void);
@@ -0,0 +1,364 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+
+#include "pilight.h"
+#include "common.h"
+#include "log.h"
+#include "capture.h"
+
+/*
+ * A capture file starts with an eight byte header, the
+ * magic "PLC", a version byte and four reserved bytes,
+ * followed by one record per pulse train:
+ *
+ *   varint	number of pulses << 1 | delta flag
+ *   varint	microseconds since the previous record
+ *   varint	hardware type + 1
+ *   varint	each pulse, or the zigzag difference with the
+ *					same pulse of the previous train when the
+ *					delta flag is set
+ *
+ * Repeated trains therefore cost about a byte per pulse.
+ * A record without pulses carries the absolute time instead
+ * of a difference and starts a new recording session, so
+ * the recorder can keep appending to the same file.
+ */
+
+#define CAPTURE_MAGIC		"PLC\x01"
+#define CAPTURE_HEADER	8
+#define CAPTURE_RECORD	(MAXPULSESTREAMLENGTH*5+32)
+
+struct capture_t {
+	int mode;
+	FILE *fp;
+	unsigned char *bytes;
+	size_t size;
+	size_t pos;
+	int mapped;
+	unsigned long long last;
+	int prev[MAXPULSESTREAMLENGTH];
+	int prevlen;
+	unsigned int unflushed;
+};
+
+static size_t capture_put_varint(unsigned char *buf, uint64_t value) {
+	size_t n = 0;
+
+	while(value >= 0x80) {
+		buf[n++] = (unsigned char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	buf[n++] = (unsigned char)value;
+	return n;
+}
+
+static int capture_get_varint(struct capture_t *capture, uint64_t *value) {
+	unsigned int shift = 0;
+
+	*value = 0;
+	while(capture->pos < capture->size && shift < 64) {
+		unsigned char c = capture->bytes[capture->pos++];
+		*value |= (uint64_t)(c & 0x7F) << shift;
+		if((c & 0x80) == 0) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+unsigned long long capture_time(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
+
+int capture_is_file(const char *file) {
+	char magic[4];
+	FILE *fp = NULL;
+	int match = 0;
+
+	if((fp = fopen(file, "rb")) == NULL) {
+		return 0;
+	}
+	if(fread(magic, 1, 4, fp) == 4 && memcmp(magic, CAPTURE_MAGIC, 4) == 0) {
+		match = 1;
+	}
+	fclose(fp);
+	return match;
+}
+
+static int capture_sync(struct capture_t *capture, unsigned long long timestamp) {
+	unsigned char buf[32];
+	size_t n = 0;
+
+	n += capture_put_varint(&buf[n], 0);
+	n += capture_put_varint(&buf[n], timestamp);
+	n += capture_put_varint(&buf[n], 0);
+	if(fwrite(buf, 1, n, capture->fp) != n) {
+		return -1;
+	}
+	capture->last = timestamp;
+	capture->prevlen = 0;
+	return 0;
+}
+
+static struct capture_t *capture_open_write(const char *file) {
+	struct capture_t *capture = NULL;
+	FILE *fp = NULL;
+	char header[CAPTURE_HEADER];
+	long size = 0;
+
+	if((fp = fopen(file, "ab")) == NULL) {
+		logprintf(LOG_ERR, "cannot open capture file %s", file);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	if(size > 0 && capture_is_file(file) == 0) {
+		logprintf(LOG_ERR, "%s is not a pulse capture file", file);
+		fclose(fp);
+		return NULL;
+	}
+	if(size == 0) {
+		memset(header, 0, sizeof(header));
+		memcpy(header, CAPTURE_MAGIC, 4);
+		if(fwrite(header, 1, sizeof(header), fp) != sizeof(header)) {
+			logprintf(LOG_ERR, "cannot write capture file %s", file);
+			fclose(fp);
+			return NULL;
+		}
+	}
+
+	if((capture = MALLOC(sizeof(struct capture_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(capture, 0, sizeof(struct capture_t));
+	capture->mode = CAPTURE_WRITE;
+	capture->fp = fp;
+
+	if(capture_sync(capture, capture_time()) != 0) {
+		logprintf(LOG_ERR, "cannot write capture file %s", file);
+		capture_close(capture);
+		return NULL;
+	}
+	return capture;
+}
+
+static struct capture_t *capture_open_read(const char *file) {
+	struct capture_t *capture = NULL;
+	struct stat st;
+	int fd = 0;
+
+	if((fd = open(file, O_RDONLY)) < 0) {
+		logprintf(LOG_ERR, "cannot open capture file %s", file);
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < CAPTURE_HEADER) {
+		logprintf(LOG_ERR, "%s is not a pulse capture file", file);
+		close(fd);
+		return NULL;
+	}
+
+	if((capture = MALLOC(sizeof(struct capture_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(capture, 0, sizeof(struct capture_t));
+	capture->mode = CAPTURE_READ;
+	capture->size = (size_t)st.st_size;
+
+#ifndef _WIN32
+	capture->bytes = mmap(NULL, capture->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(capture->bytes == MAP_FAILED) {
+		capture->bytes = NULL;
+	} else {
+		capture->mapped = 1;
+	}
+#endif
+	/* Fall back to reading the whole file */
+	if(capture->bytes == NULL) {
+		if((capture->bytes = MALLOC(capture->size)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		if(read(fd, capture->bytes, capture->size) != (ssize_t)capture->size) {
+			logprintf(LOG_ERR, "cannot read capture file %s", file);
+			close(fd);
+			capture_close(capture);
+			return NULL;
+		}
+	}
+	close(fd);
+
+	if(memcmp(capture->bytes, CAPTURE_MAGIC, 4) != 0) {
+		logprintf(LOG_ERR, "%s is not a pulse capture file", file);
+		capture_close(capture);
+		return NULL;
+	}
+	capture->pos = CAPTURE_HEADER;
+	return capture;
+}
+
+struct capture_t *capture_open(const char *file, int mode) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(mode == CAPTURE_WRITE) {
+		return capture_open_write(file);
+	}
+	return capture_open_read(file);
+}
+
+int capture_write(struct capture_t *capture, unsigned long long timestamp, int hwtype, int *pulses, int length) {
+	unsigned char abs[CAPTURE_RECORD], delta[CAPTURE_RECORD];
+	unsigned char *buf = abs;
+	size_t alen = 0, dlen = 0, len = 0;
+	int64_t diff = 0;
+	int i = 0;
+
+	if(capture == NULL || capture->mode != CAPTURE_WRITE || length <= 0 || length > MAXPULSESTREAMLENGTH) {
+		return -1;
+	}
+
+	/* The clock went back, so start a new session */
+	if(timestamp < capture->last) {
+		if(capture_sync(capture, timestamp) != 0) {
+			return -1;
+		}
+	}
+
+	for(i=0;i<length;i++) {
+		alen += capture_put_varint(&abs[alen], (uint64_t)(pulses[i] < 0 ? 0 : pulses[i]));
+	}
+	len = alen;
+	if(length == capture->prevlen) {
+		for(i=0;i<length;i++) {
+			diff = (int64_t)pulses[i]-(int64_t)capture->prev[i];
+			dlen += capture_put_varint(&delta[dlen], ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63));
+		}
+		if(dlen < alen) {
+			buf = delta;
+			len = dlen;
+		}
+	}
+
+	unsigned char head[32];
+	size_t hlen = 0;
+	hlen += capture_put_varint(&head[hlen], ((uint64_t)length << 1) | (buf == delta));
+	hlen += capture_put_varint(&head[hlen], timestamp-capture->last);
+	hlen += capture_put_varint(&head[hlen], (uint64_t)(hwtype+1));
+
+	if(fwrite(head, 1, hlen, capture->fp) != hlen || fwrite(buf, 1, len, capture->fp) != len) {
+		return -1;
+	}
+
+	memcpy(capture->prev, pulses, sizeof(int)*(size_t)length);
+	capture->prevlen = length;
+	capture->last = timestamp;
+
+	if(++capture->unflushed >= CAPTURE_FLUSH) {
+		fflush(capture->fp);
+		capture->unflushed = 0;
+	}
+	return 0;
+}
+
+/* Returns 1 for each pulse train, 0 at the end and -1 on corrupt data */
+int capture_read(struct capture_t *capture, unsigned long long *timestamp, int *hwtype, int *pulses, int *length) {
+	uint64_t head = 0, time = 0, type = 0, value = 0;
+	int64_t diff = 0;
+	int i = 0, nr = 0;
+
+	if(capture == NULL || capture->mode != CAPTURE_READ) {
+		return -1;
+	}
+
+	while(capture->pos < capture->size) {
+		if(capture_get_varint(capture, &head) != 0 ||
+		   capture_get_varint(capture, &time) != 0 ||
+		   capture_get_varint(capture, &type) != 0) {
+			return -1;
+		}
+		nr = (int)(head >> 1);
+		if(nr == 0) {
+			capture->last = time;
+			capture->prevlen = 0;
+			continue;
+		}
+		if(nr > MAXPULSESTREAMLENGTH || ((head & 1) == 1 && nr != capture->prevlen)) {
+			return -1;
+		}
+		for(i=0;i<nr;i++) {
+			if(capture_get_varint(capture, &value) != 0) {
+				return -1;
+			}
+			if((head & 1) == 1) {
+				diff = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+				pulses[i] = (int)(capture->prev[i]+diff);
+			} else {
+				pulses[i] = (int)value;
+			}
+		}
+		memcpy(capture->prev, pulses, sizeof(int)*(size_t)nr);
+		capture->prevlen = nr;
+		capture->last += time;
+
+		*timestamp = capture->last;
+		*hwtype = (int)type-1;
+		*length = nr;
+		return 1;
+	}
+	return 0;
+}
+
+void capture_close(struct capture_t *capture) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(capture == NULL) {
+		return;
+	}
+	if(capture->fp != NULL) {
+		fflush(capture->fp);
+		fclose(capture->fp);
+	}
+	if(capture->bytes != NULL) {
+#ifndef _WIN32
+		if(capture->mapped == 1) {
+			munmap(capture->bytes, capture->size);
+		} else {
+			FREE(capture->bytes);
+		}
+#else
+		FREE(capture->bytes);
+#endif
+	}
+	FREE(capture);
+}
@@ -0,0 +1,37 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#define CAPTURE_READ		0
+#define CAPTURE_WRITE		1
+
+/* Flush the recorder after this many pulse trains */
+#define CAPTURE_FLUSH		64
+
+typedef struct capture_t capture_t;
+
+struct capture_t *capture_open(const char *file, int mode);
+int capture_write(struct capture_t *capture, unsigned long long timestamp, int hwtype, int *pulses, int length);
+int capture_read(struct capture_t *capture, unsigned long long *timestamp, int *hwtype, int *pulses, int *length);
+int capture_is_file(const char *file);
+unsigned long long capture_time(void);
+void capture_close(struct capture_t *capture);
+
+#endif
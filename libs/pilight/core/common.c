@@ -990,3 +990,16 @@ int stricmp(char const *a, char const *b) {
 				return d;
 	}
 }
+
+/* FNV-1a hash of a buffer */
+unsigned int fnv1a(const void *buf, size_t len) {
+	const unsigned char *p = buf;
+	unsigned int hash = 2166136261U;
+	size_t i = 0;
+
+	for(i=0;i<len;i++) {
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
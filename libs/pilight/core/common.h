@@ -73,5 +73,6 @@ pid_t findproc(char *name, char *args, int loosely);
 int vercmp(char *val, char *ref);
 int str_replace(char *search, char *replace, char **str);
 int strcicmp(char const *a, char const *b);
+unsigned int fnv1a(const void *buf, size_t len);
 
 #endif
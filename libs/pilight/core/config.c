@@ -25,7 +25,18 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <libgen.h>
+#ifdef _WIN32
+	#include <windows.h>
+	#include <io.h>
+#else
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+#include <sys/time.h>
 
+#include "../../polarssl/polarssl/sha1.h"
 #include "pilight.h"
 #include "common.h"
 #include "json.h"
@@ -84,10 +95,31 @@ static void sort_list(int r) {
 /* The location of the config file */
 static char *configfile = NULL;
 
+/* Write-behind state of the config writer */
+static pthread_mutex_t writer_lock;
+static pthread_cond_t writer_signal;
+static pthread_mutexattr_t writer_attr;
+static unsigned short writer_init = 0;
+static unsigned short writer_loop = 1;
+static unsigned short writer_dirty = 0;
+static int writer_delay = CONFIG_WRITE_DELAY;
+
+/* Digest of the content last written to disk */
+static unsigned char written_sha1[20];
+static unsigned short written = 0;
+
 int config_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct config_t *listeners;
+
+	if(writer_init == 1) {
+		pthread_mutex_lock(&writer_lock);
+		writer_loop = 0;
+		pthread_mutex_unlock(&writer_lock);
+		pthread_cond_signal(&writer_signal);
+	}
+
 	while(config) {
 		listeners = config;
 		listeners->gc();
@@ -153,38 +185,170 @@ JsonNode *config_print(int level, const char *media) {
 	return root;
 }
 
-int config_write(int level, const char *media) {
+/* Write the content to a temporary file next to the config
+   file and rename it over the original, so a crash halfway
+   never leaves a truncated config behind */
+static int config_write_atomic(char *content) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct JsonNode *root = json_mkobject();
-	FILE *fp;
+	struct stat st;
+	char *tmpfile = NULL;
+	size_t len = strlen(content), pos = 0;
+	ssize_t n = 0;
+	int fd = 0, mode = S_IRUSR | S_IWUSR;
 
-	sort_list(0);
-	struct config_t *listeners = config;
-	while(listeners) {
-		if(listeners->sync) {
-			struct JsonNode *child = listeners->sync(level, media);
-			if(child != NULL) {
-				json_append_member(root, listeners->name, child);
+	if((tmpfile = MALLOC(strlen(configfile)+5)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmpfile, "%s.tmp", configfile);
+
+	if(stat(configfile, &st) == 0) {
+		mode = st.st_mode & 0777;
+	}
+
+	if((fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, mode)) == -1) {
+		logprintf(LOG_ERR, "cannot write config file: %s", tmpfile);
+		FREE(tmpfile);
+		return EXIT_FAILURE;
+	}
+	while(pos < len) {
+		if((n = write(fd, &content[pos], len-pos)) <= 0) {
+			if(n == -1 && errno == EINTR) {
+				continue;
 			}
+			logprintf(LOG_ERR, "cannot write config file: %s", tmpfile);
+			close(fd);
+			unlink(tmpfile);
+			FREE(tmpfile);
+			return EXIT_FAILURE;
 		}
-		listeners = listeners->next;
+		pos += (size_t)n;
 	}
+#ifdef _WIN32
+	_commit(fd);
+#else
+	fsync(fd);
+#endif
+	close(fd);
 
-	/* Overwrite config file with proper format */
-	if((fp = fopen(configfile, "w+")) == NULL) {
-		logprintf(LOG_ERR, "cannot write config file: %s", configfile);
+#ifdef _WIN32
+	if(MoveFileEx(tmpfile, configfile, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == 0) {
+#else
+	if(rename(tmpfile, configfile) == -1) {
+#endif
+		logprintf(LOG_ERR, "cannot replace config file: %s", configfile);
+		unlink(tmpfile);
+		FREE(tmpfile);
 		return EXIT_FAILURE;
 	}
-	fseek(fp, 0L, SEEK_SET);
+	FREE(tmpfile);
+
+#ifndef _WIN32
+	/* Make the rename itself durable */
+	char *dir = MALLOC(strlen(configfile)+1);
+	if(dir == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(dir, configfile);
+	if((fd = open(dirname(dir), O_RDONLY)) != -1) {
+		fsync(fd);
+		close(fd);
+	}
+	FREE(dir);
+#endif
+
+	return EXIT_SUCCESS;
+}
+
+int config_write(int level, const char *media) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned char sha1sum[20];
 	char *content = NULL;
+	int ret = EXIT_SUCCESS;
+
+	if(configfile == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if(writer_init == 1) {
+		pthread_mutex_lock(&writer_lock);
+	}
+
+	struct JsonNode *root = config_print(level, media);
 	if((content = json_stringify(root, "\t")) != NULL) {
-		fwrite(content, sizeof(char), strlen(content), fp);
+		sha1((unsigned char *)content, strlen(content), sha1sum);
+		/* Nothing changed since the last write */
+		if(written == 1 && memcmp(sha1sum, written_sha1, sizeof(sha1sum)) == 0) {
+			logprintf(LOG_DEBUG, "config file unchanged, skipping write");
+			writer_dirty = 0;
+		} else if((ret = config_write_atomic(content)) == EXIT_SUCCESS) {
+			memcpy(written_sha1, sha1sum, sizeof(sha1sum));
+			written = 1;
+			writer_dirty = 0;
+		}
+		/* On failure the config stays dirty and the writer retries */
 		json_free(content);
-		json_delete(root);
+	} else {
+		ret = EXIT_FAILURE;
 	}
-	fclose(fp);
-	return EXIT_SUCCESS;
+	json_delete(root);
+
+	if(writer_init == 1) {
+		pthread_mutex_unlock(&writer_lock);
+	}
+	return ret;
+}
+
+/* Mark the config as changed. The config writer
+   thread will persist it once the write delay
+   has passed without forcing a write per change */
+void config_schedule_write(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(writer_init == 0 || pilight.runmode != STANDALONE) {
+		return;
+	}
+
+	pthread_mutex_lock(&writer_lock);
+	writer_dirty = 1;
+	pthread_mutex_unlock(&writer_lock);
+	pthread_cond_signal(&writer_signal);
+}
+
+void *config_writer(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct timeval tp;
+	struct timespec ts;
+
+	if(writer_init == 0) {
+		return (void *)NULL;
+	}
+
+	settings_find_number("config-write-delay", &writer_delay);
+
+	pthread_mutex_lock(&writer_lock);
+	while(writer_loop) {
+		if(writer_dirty == 1) {
+			/* Coalesce all changes within the write delay */
+			gettimeofday(&tp, NULL);
+			ts.tv_sec = tp.tv_sec + writer_delay;
+			ts.tv_nsec = tp.tv_usec * 1000;
+			while(writer_loop && pthread_cond_timedwait(&writer_signal, &writer_lock, &ts) != ETIMEDOUT);
+
+			if(writer_loop == 1 && writer_dirty == 1) {
+				config_write(1, "all");
+			}
+		} else {
+			pthread_cond_wait(&writer_signal, &writer_lock);
+		}
+	}
+	pthread_mutex_unlock(&writer_lock);
+
+	return (void *)NULL;
 }
 
 int config_read(void) {
@@ -281,6 +445,15 @@ char *config_get_file(void) {
 void config_init() {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	if(writer_init == 0) {
+		pthread_mutexattr_init(&writer_attr);
+		pthread_mutexattr_settype(&writer_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&writer_lock, &writer_attr);
+		pthread_cond_init(&writer_signal, NULL);
+		writer_init = 1;
+	}
+	writer_loop = 1;
+
 	hardware_init();
 	settings_init();
 	devices_init();
@@ -36,6 +36,8 @@ typedef struct config_t {
 } config_t;
 
 int config_write(int level, const char *media);
+void config_schedule_write(void);
+void *config_writer(void *param);
 int config_read(void);
 int config_parse(struct JsonNode *root);
 struct JsonNode *config_print(int level, const char *media);
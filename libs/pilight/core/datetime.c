@@ -18,6 +18,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #define __USE_XOPEN
 #include <sys/time.h>
 #include <math.h>
@@ -31,6 +32,7 @@
 #include <ctype.h>
 #include <pthread.h>
 #ifndef _WIN32
+	#include <sys/mman.h>
 	#ifdef __mips__
 		#define __USE_UNIX98
 	#endif
@@ -41,7 +43,6 @@
 #include "log.h"
 #include "mem.h"
 
-#define NRCOUNTRIES 	408
 #define PRECISION 		1
 
 #ifndef min
@@ -51,13 +52,70 @@
 	#define max(a,b) (((a)>(b))?(a):(b))
 #endif
 
-static int ***tzcoords;
-static unsigned int tznrpolys[NRCOUNTRIES];
-static char tznames[NRCOUNTRIES][30];
-static int tzdatafilled = 0;
-static pthread_mutex_t tzlock;
-static pthread_mutexattr_t tzattr;
-static int tz_lock_initialized = 0;
+/*
+ * The json polygons are compiled once into a binary index next
+ * to the json file, which every later run memory maps:
+ *
+ *   header
+ *   zones				name, first vertex, number of vertices, start
+ *								point of the crossing test and bounding box
+ *   vertices			longitude and latitude times 10^PRECISION
+ *   cells				offset of each grid cell in the candidate list
+ *   candidates		zones within the search margin of each cell
+ *
+ * A lookup therefore only walks the few polygons that can match
+ * the grid cell of the coordinate. The index is never changed
+ * once loaded, so searching does not need to lock anything. It is
+ * published as a single pointer, which the garbage collector takes
+ * away before it waits for the running searches and frees it.
+ */
+
+#define TZ_MAGIC		"PTZ\x01"
+#define TZ_ORDER		0x01020304
+#define TZ_STEP			(int)pow(10, PRECISION)
+#define TZ_MARGIN		(4*TZ_STEP)
+#define TZ_CELL			(2*TZ_STEP)
+
+struct tzheader_t {
+	char magic[4];
+	uint32_t order;
+	uint32_t jsonsize;
+	uint32_t jsonmtime;
+	uint32_t nrzones;
+	uint32_t nrvertices;
+	int32_t gridx;
+	int32_t gridy;
+	uint32_t cols;
+	uint32_t rows;
+	uint32_t nrcandidates;
+	uint32_t size;
+};
+
+struct tzzone_t {
+	char name[48];
+	uint32_t first;
+	uint32_t nrvertices;
+	int32_t startx;
+	int32_t starty;
+	int32_t minx;
+	int32_t miny;
+	int32_t maxx;
+	int32_t maxy;
+};
+
+struct tzindex_t {
+	unsigned char *data;
+	size_t size;
+	int mapped;
+	struct tzheader_t *header;
+	struct tzzone_t *zones;
+	int32_t *vertices;
+	uint32_t *cells;
+	uint16_t *candidates;
+};
+
+static struct tzindex_t *tzindex = NULL;
+static pthread_mutex_t tzlock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
 	Extra checks for gracefull (early)
@@ -66,118 +124,402 @@ static int tz_lock_initialized = 0;
 static int fillingtzdata = 0;
 static int searchingtz = 0;
 
+static size_t tz_layout(struct tzindex_t *index, unsigned char *data, uint32_t nrzones, uint32_t nrvertices, uint32_t nrcells, uint32_t nrcandidates) {
+	size_t pos = sizeof(struct tzheader_t);
+
+	if(data != NULL) {
+		index->data = data;
+		index->header = (struct tzheader_t *)data;
+		index->zones = (struct tzzone_t *)&data[pos];
+	}
+	pos += sizeof(struct tzzone_t)*nrzones;
+	if(data != NULL) {
+		index->vertices = (int32_t *)&data[pos];
+	}
+	pos += sizeof(int32_t)*2*nrvertices;
+	if(data != NULL) {
+		index->cells = (uint32_t *)&data[pos];
+	}
+	pos += sizeof(uint32_t)*(nrcells+1);
+	if(data != NULL) {
+		index->candidates = (uint16_t *)&data[pos];
+	}
+	pos += sizeof(uint16_t)*nrcandidates;
+	return pos;
+}
+
+static int tz_validate(struct tzindex_t *index, unsigned char *data, size_t size, struct stat *json) {
+	struct tzheader_t *header = (struct tzheader_t *)data;
+	unsigned int i = 0;
+
+	if(size < sizeof(struct tzheader_t) ||
+	   memcmp(header->magic, TZ_MAGIC, 4) != 0 ||
+	   header->order != TZ_ORDER ||
+	   header->jsonsize != (uint32_t)json->st_size ||
+	   header->jsonmtime != (uint32_t)json->st_mtime ||
+	   header->size != size ||
+	   header->nrzones > 0xFFFF ||
+	   tz_layout(NULL, NULL, header->nrzones, header->nrvertices, header->cols*header->rows, header->nrcandidates) != size) {
+		return -1;
+	}
+	tz_layout(index, data, header->nrzones, header->nrvertices, header->cols*header->rows, header->nrcandidates);
+	for(i=0;i<header->nrzones;i++) {
+		if(index->zones[i].first+index->zones[i].nrvertices > header->nrvertices ||
+		   index->zones[i].name[sizeof(index->zones[i].name)-1] != '\0') {
+			return -1;
+		}
+	}
+	for(i=0;i<header->cols*header->rows;i++) {
+		if(index->cells[i] > index->cells[i+1]) {
+			return -1;
+		}
+	}
+	if(index->cells[header->cols*header->rows] != header->nrcandidates) {
+		return -1;
+	}
+	for(i=0;i<header->nrcandidates;i++) {
+		if(index->candidates[i] >= header->nrzones) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static unsigned char *tz_compile(struct tzindex_t *index, char *content, struct stat *json, size_t *size) {
+	JsonNode *root = NULL, *alist = NULL, *country = NULL, *coords = NULL, *lonlat = NULL;
+	unsigned char *data = NULL;
+	uint32_t nrzones = 0, nrvertices = 0, nrcandidates = 0, cols = 0, rows = 0;
+	int32_t minx = 0, miny = 0, maxx = 0, maxy = 0;
+	unsigned int i = 0, a = 0, v = 0, cx = 0, cy = 0;
+	int bounded = 0;
+
+	/* Validate JSON and turn into JSON object */
+	if(json_validate(content) == false) {
+		logprintf(LOG_ERR, "tzdata is not in a valid json format");
+		return NULL;
+	}
+	root = json_decode(content);
+
+	alist = json_first_child(root);
+	while(alist) {
+		country = json_first_child(alist);
+		while(country) {
+			nrzones++;
+			coords = json_first_child(country);
+			while(coords) {
+				nrvertices++;
+				coords = coords->next;
+			}
+			country = country->next;
+		}
+		alist = alist->next;
+	}
+	if(nrzones == 0 || nrzones > 0xFFFF) {
+		logprintf(LOG_ERR, "tzdata does not contain a valid number of timezones");
+		json_delete(root);
+		return NULL;
+	}
+
+	/* First fill the zones and vertices to know the grid size */
+	if((data = MALLOC(tz_layout(NULL, NULL, nrzones, nrvertices, 0, 0))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	tz_layout(index, data, nrzones, nrvertices, 0, 0);
+	memset(index->zones, 0, sizeof(struct tzzone_t)*nrzones);
+
+	alist = json_first_child(root);
+	while(alist) {
+		country = json_first_child(alist);
+		while(country) {
+			struct tzzone_t *zone = &index->zones[i++];
+			strncpy(zone->name, country->key, sizeof(zone->name)-1);
+			zone->first = v;
+			coords = json_first_child(country);
+			while(coords) {
+				int32_t *vertex = &index->vertices[2*v++];
+				vertex[0] = 0, vertex[1] = 0;
+				a = 0;
+				lonlat = json_first_child(coords);
+				while(lonlat && a < 2) {
+					vertex[a++] = (int32_t)lonlat->number_;
+					lonlat = lonlat->next;
+				}
+				if(zone->nrvertices == 0) {
+					zone->minx = zone->maxx = vertex[0];
+					zone->miny = zone->maxy = vertex[1];
+				}
+				zone->minx = min(zone->minx, vertex[0]);
+				zone->maxx = max(zone->maxx, vertex[0]);
+				zone->miny = min(zone->miny, vertex[1]);
+				zone->maxy = max(zone->maxy, vertex[1]);
+
+				/* The start point of the crossing test as it has always been chosen */
+				if(vertex[0] < zone->startx || zone->startx == 0) {
+					zone->startx = vertex[0];
+				}
+				if(vertex[1] < zone->starty && zone->starty == 0) {
+					zone->starty = vertex[1];
+				}
+				zone->nrvertices++;
+				coords = coords->next;
+			}
+			if(zone->nrvertices > 0) {
+				if(bounded == 0) {
+					minx = zone->minx, maxx = zone->maxx;
+					miny = zone->miny, maxy = zone->maxy;
+					bounded = 1;
+				}
+				minx = min(minx, zone->minx);
+				maxx = max(maxx, zone->maxx);
+				miny = min(miny, zone->miny);
+				maxy = max(maxy, zone->maxy);
+			}
+			country = country->next;
+		}
+		alist = alist->next;
+	}
+	json_delete(root);
+
+	/* Cells cover all vertices widened by the largest search margin */
+	minx -= TZ_MARGIN, miny -= TZ_MARGIN;
+	maxx += TZ_MARGIN, maxy += TZ_MARGIN;
+	cols = (uint32_t)((maxx-minx)/TZ_CELL+1);
+	rows = (uint32_t)((maxy-miny)/TZ_CELL+1);
+
+	uint32_t *counts = NULL;
+	if((counts = MALLOC(sizeof(uint32_t)*(cols*rows+1))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(counts, 0, sizeof(uint32_t)*(cols*rows+1));
+	for(i=0;i<nrzones;i++) {
+		if(index->zones[i].nrvertices == 0) {
+			continue;
+		}
+		for(cy=(index->zones[i].miny-TZ_MARGIN-miny)/TZ_CELL;cy<=(index->zones[i].maxy+TZ_MARGIN-miny)/TZ_CELL;cy++) {
+			for(cx=(index->zones[i].minx-TZ_MARGIN-minx)/TZ_CELL;cx<=(index->zones[i].maxx+TZ_MARGIN-minx)/TZ_CELL;cx++) {
+				counts[cy*cols+cx]++;
+				nrcandidates++;
+			}
+		}
+	}
+
+	*size = tz_layout(NULL, NULL, nrzones, nrvertices, cols*rows, nrcandidates);
+	if((data = REALLOC(data, *size)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	tz_layout(index, data, nrzones, nrvertices, cols*rows, nrcandidates);
+
+	/* Zones are appended in file order, so the first match still wins */
+	index->cells[0] = 0;
+	for(i=0;i<cols*rows;i++) {
+		index->cells[i+1] = index->cells[i]+counts[i];
+		counts[i] = index->cells[i];
+	}
+	for(i=0;i<nrzones;i++) {
+		if(index->zones[i].nrvertices == 0) {
+			continue;
+		}
+		for(cy=(index->zones[i].miny-TZ_MARGIN-miny)/TZ_CELL;cy<=(index->zones[i].maxy+TZ_MARGIN-miny)/TZ_CELL;cy++) {
+			for(cx=(index->zones[i].minx-TZ_MARGIN-minx)/TZ_CELL;cx<=(index->zones[i].maxx+TZ_MARGIN-minx)/TZ_CELL;cx++) {
+				index->candidates[counts[cy*cols+cx]++] = (uint16_t)i;
+			}
+		}
+	}
+	FREE(counts);
+
+	memset(index->header, 0, sizeof(struct tzheader_t));
+	memcpy(index->header->magic, TZ_MAGIC, 4);
+	index->header->order = TZ_ORDER;
+	index->header->jsonsize = (uint32_t)json->st_size;
+	index->header->jsonmtime = (uint32_t)json->st_mtime;
+	index->header->nrzones = nrzones;
+	index->header->nrvertices = nrvertices;
+	index->header->gridx = minx;
+	index->header->gridy = miny;
+	index->header->cols = cols;
+	index->header->rows = rows;
+	index->header->nrcandidates = nrcandidates;
+	index->header->size = (uint32_t)*size;
+
+	return data;
+}
+
+static void tz_save(char *file, unsigned char *data, size_t size) {
+	char tmp[strlen(file)+5];
+	FILE *fp = NULL;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	if((fp = fopen(tmp, "wb")) == NULL) {
+		logprintf(LOG_DEBUG, "cannot write tzdata index: %s", file);
+		return;
+	}
+	if(fwrite(data, 1, size, fp) != size) {
+		logprintf(LOG_DEBUG, "cannot write tzdata index: %s", file);
+		fclose(fp);
+		unlink(tmp);
+		return;
+	}
+	fclose(fp);
+	if(rename(tmp, file) != 0) {
+		logprintf(LOG_DEBUG, "cannot write tzdata index: %s", file);
+		unlink(tmp);
+	}
+}
+
+/* Make a loaded index visible to coord2tz */
+static void tz_publish(struct tzindex_t *layout, size_t size, int mapped) {
+	struct tzindex_t *index = NULL;
+
+	if((index = MALLOC(sizeof(struct tzindex_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(index, layout, sizeof(struct tzindex_t));
+	index->size = size;
+	index->mapped = mapped;
+	__atomic_store_n(&tzindex, index, __ATOMIC_RELEASE);
+}
+
+static int tz_map(char *file, struct stat *json) {
+	struct tzindex_t index;
+	struct stat st;
+	unsigned char *data = NULL;
+	int fd = 0;
+
+	if((fd = open(file, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct tzheader_t)) {
+		close(fd);
+		return -1;
+	}
+#ifndef _WIN32
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data != MAP_FAILED) {
+		if(tz_validate(&index, data, (size_t)st.st_size, json) != 0) {
+			munmap(data, (size_t)st.st_size);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		tz_publish(&index, (size_t)st.st_size, 1);
+		return 0;
+	}
+#endif
+	/* Fall back to reading the whole file */
+	if((data = MALLOC((size_t)st.st_size)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	if(read(fd, data, (size_t)st.st_size) != st.st_size ||
+	   tz_validate(&index, data, (size_t)st.st_size, json) != 0) {
+		FREE(data);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	tz_publish(&index, (size_t)st.st_size, 0);
+	return 0;
+}
+
 static int fillTZData(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(tz_lock_initialized == 0) {
-		pthread_mutexattr_init(&tzattr);
-		pthread_mutexattr_settype(&tzattr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&tzlock, &tzattr);
-		tz_lock_initialized = 1;
-	}
+	char tzdatafile[] = TZDATA_FILE;
+	char tzindexfile[sizeof(tzdatafile)+4];
+	struct tzindex_t index;
+	unsigned char *data = NULL;
+	char *content = NULL;
+	FILE *fp = NULL;
+	size_t bytes = 0, size = 0;
+	struct stat st;
 
-	if(tz_lock_initialized == 1) {
-		pthread_mutex_lock(&tzlock);
+	if(__atomic_load_n(&tzindex, __ATOMIC_ACQUIRE) != NULL) {
+		return EXIT_SUCCESS;
 	}
+
+	pthread_mutex_lock(&tzlock);
 /*
 	Extra checks for gracefull (early)
   stopping of pilight
 */
 	fillingtzdata = 1;
-	if(tzdatafilled == 1) {
+	if(__atomic_load_n(&tzindex, __ATOMIC_ACQUIRE) != NULL) {
 		fillingtzdata = 0;
-		if(tz_lock_initialized == 1) {
-			pthread_mutex_unlock(&tzlock);
-		}
+		pthread_mutex_unlock(&tzlock);
+		return EXIT_SUCCESS;
+	}
+
+	/* The index replaces the .json extension with .bin */
+	strcpy(tzindexfile, tzdatafile);
+	if((bytes = strlen(tzindexfile)) > 5 && strcmp(&tzindexfile[bytes-5], ".json") == 0) {
+		tzindexfile[bytes-5] = '\0';
+	}
+	strcat(tzindexfile, ".bin");
+
+	if(stat(tzdatafile, &st) != 0) {
+		logprintf(LOG_ERR, "cannot read tzdata file: %s", tzdatafile);
+		fillingtzdata = 0;
+		pthread_mutex_unlock(&tzlock);
+		return EXIT_FAILURE;
+	}
+
+	if(tz_map(tzindexfile, &st) == 0) {
+		logprintf(LOG_DEBUG, "loaded timezone index %s", tzindexfile);
+		fillingtzdata = 0;
+		pthread_mutex_unlock(&tzlock);
 		return EXIT_SUCCESS;
 	}
-	char *content = NULL;
-	JsonNode *root = NULL;
-	FILE *fp;
-	size_t bytes;
-	struct stat st;
 
-	char tzdatafile[] = TZDATA_FILE;
 	/* Read JSON tzdata file */
 	if((fp = fopen(tzdatafile, "rb")) == NULL) {
 		logprintf(LOG_ERR, "cannot read tzdata file: %s", tzdatafile);
+		fillingtzdata = 0;
+		pthread_mutex_unlock(&tzlock);
 		return EXIT_FAILURE;
 	}
 
 	fstat(fileno(fp), &st);
 	bytes = (size_t)st.st_size;
 
-	if(!(content = calloc(bytes+1, sizeof(char)))) {
+	if((content = MALLOC(bytes+1)) == NULL) {
 		logprintf(LOG_ERR, "out of memory");
-		fclose(fp);
-		fillingtzdata = 0;
-		return EXIT_FAILURE;
+		exit(EXIT_FAILURE);
 	}
 
-	if(fread(content, sizeof(char), bytes, fp) == -1) {
+	if(fread(content, sizeof(char), bytes, fp) != bytes) {
 		logprintf(LOG_ERR, "cannot read tzdata file: %s", tzdatafile);
+		FREE(content);
+		fclose(fp);
+		fillingtzdata = 0;
+		pthread_mutex_unlock(&tzlock);
+		return EXIT_FAILURE;
 	}
+	content[bytes] = '\0';
 	fclose(fp);
 
-	/* Validate JSON and turn into JSON object */
-	if(json_validate(content) == false) {
-		logprintf(LOG_ERR, "tzdata is not in a valid json format");
-		free(content);
+	logprintf(LOG_DEBUG, "loading timezone database...");
+	data = tz_compile(&index, content, &st, &size);
+	FREE(content);
+	if(data == NULL) {
 		fillingtzdata = 0;
+		pthread_mutex_unlock(&tzlock);
 		return EXIT_FAILURE;
 	}
+	tz_save(tzindexfile, data, size);
 
-	logprintf(LOG_DEBUG, "loading timezone database...");
-	root = json_decode(content);
-
-	JsonNode *alist = json_first_child(root);
-	unsigned int i = 0, x = 0, y = 0;
-	while(alist) {
-		JsonNode *country = json_first_child(alist);
-		while(country) {
-			strcpy(tznames[i], country->key);
-			if(!(tzcoords = realloc(tzcoords, sizeof(int **)*(i+1)))) {
-				logprintf(LOG_ERR, "out of memory");
-			}
-			tzcoords[i] = NULL;
-			JsonNode *coords = json_first_child(country);
-			x = 0;
-			while(coords) {
-				y = 0;
-				if(!(tzcoords[i] = realloc(tzcoords[i], sizeof(int *)*(x+1)))) {
-					logprintf(LOG_ERR, "out of memory");
-				}
-				tzcoords[i][x] = NULL;
-				if(!(tzcoords[i][x] = malloc(sizeof(int)*2))) {
-					logprintf(LOG_ERR, "out of memory");
-				}
-				JsonNode *lonlat = json_first_child(coords);
-				while(lonlat) {
-					tzcoords[i][x][y] = (int)lonlat->number_;
-					y++;
-					lonlat = lonlat->next;
-				}
-				x++;
-				coords = coords->next;
-			}
-			tznrpolys[i] = x;
-			i++;
-			country = country->next;
-		}
-		alist = alist->next;
-	}
-	json_delete(root);
-	free(content);
-	tzdatafilled = 1;
+	tz_publish(&index, size, 0);
 	fillingtzdata = 0;
-	if(tz_lock_initialized == 1) {
-		pthread_mutex_unlock(&tzlock);
-	}
+	pthread_mutex_unlock(&tzlock);
 	return EXIT_SUCCESS;
 }
 
 int datetime_gc(void) {
-	int i = 0, a = 0;
+	struct tzindex_t *index = NULL;
+
 /*
 	Extra checks for gracefull (early)
   stopping of pilight
@@ -185,20 +527,27 @@ int datetime_gc(void) {
 	while(fillingtzdata) {
 		usleep(10);
 	}
-	while(searchingtz) {
+	pthread_mutex_lock(&tzlock);
+	/* New searches no longer find the index, so only
+	   the ones already running have to be waited for */
+	index = __atomic_exchange_n(&tzindex, NULL, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&searchingtz, __ATOMIC_SEQ_CST) > 0) {
 		usleep(10);
 	}
-	if(tzdatafilled == 1) {
-		for(i=0;i<NRCOUNTRIES;i++) {
-			unsigned int n = tznrpolys[i];
-			for(a=0;a<n;a++) {
-				free(tzcoords[i][a]);
-			}
-			free(tzcoords[i]);
+	if(index != NULL) {
+#ifndef _WIN32
+		if(index->mapped == 1) {
+			munmap(index->data, index->size);
+		} else {
+			FREE(index->data);
 		}
-		free(tzcoords);
+#else
+		FREE(index->data);
+#endif
+		FREE(index);
 		logprintf(LOG_DEBUG, "garbage collected datetime library");
 	}
+	pthread_mutex_unlock(&tzlock);
 	return EXIT_SUCCESS;
 }
 
@@ -213,68 +562,73 @@ char *coord2tz(double longitude, double latitude) {
 	Extra checks for gracefull (early)
   stopping of pilight
 */
-	if(tz_lock_initialized == 1) {
-		pthread_mutex_lock(&tzlock);
+	__sync_add_and_fetch(&searchingtz, 1);
+	struct tzindex_t *index = __atomic_load_n(&tzindex, __ATOMIC_ACQUIRE);
+	if(index == NULL) {
+		__sync_sub_and_fetch(&searchingtz, 1);
+		return NULL;
 	}
-	searchingtz = 1;
-	int i = 0, a = 0, margin = 1, inside = 0;
+
+	unsigned int i = 0, a = 0, c = 0, cell = 0;
+	int margin = TZ_STEP, inside = 0;
 	char *tz = NULL;
 
-	margin *= (int)pow(10, PRECISION);
 	int y = (int)round(latitude*(int)pow(10, PRECISION));
 	int x = (int)round(longitude*(int)pow(10, PRECISION));
 
-	while(!inside && margin < (5*(int)pow(10, PRECISION))) {
-		for(i=0;i<NRCOUNTRIES;i++) {
-			unsigned int n = tznrpolys[i];
-			if(n > 0) {
-				int p1x = 0;
-				int p1y = 0;
-				for(a=0;a<n;a++) {
-					if(tzcoords[i][a][0] < p1x || ((int)p1x == 0)) {
-						p1x = tzcoords[i][a][0];
-					}
-					if(tzcoords[i][a][1] < p1y && ((int)p1y == 0)) {
-						p1y = tzcoords[i][a][1];
-					}
-				}
-				for(a=0;a<n+1;a++) {
-					int p2x = tzcoords[i][a % (int)n][0];
-					int p2y = tzcoords[i][a % (int)n][1];
-					if((round(p2x)-margin < round(x) && round(p2x)+margin > round(x))
-					   &&(round(p2y)-margin < round(y) && round(p2y)+margin > round(y))) {
-						int xinters = 0;
-						if(y > min(p1y, p2y)) {
-							if(y <= max(p1y, p2y)) {
-								if(x <= max(p1x, p2x)) {
-									if(p1y != p2y) {
-										xinters = (y-p1y)*(p2x-p1x)/(p2y-p1y)+p1x;
-									}
-									if(p1x == p2x || x <= xinters) {
-										tz = tznames[i];
-										inside = 1;
-										break;
-									}
+	if(x < index->header->gridx || y < index->header->gridy ||
+	   (uint32_t)((x-index->header->gridx)/TZ_CELL) >= index->header->cols ||
+	   (uint32_t)((y-index->header->gridy)/TZ_CELL) >= index->header->rows) {
+		__sync_sub_and_fetch(&searchingtz, 1);
+		return NULL;
+	}
+	cell = ((y-index->header->gridy)/TZ_CELL)*index->header->cols+(x-index->header->gridx)/TZ_CELL;
+
+	while(!inside && margin <= TZ_MARGIN) {
+		for(c=index->cells[cell];c<index->cells[cell+1];c++) {
+			struct tzzone_t *zone = &index->zones[index->candidates[c]];
+			int32_t *vertices = &index->vertices[2*zone->first];
+			unsigned int n = zone->nrvertices;
+
+			if(x <= zone->minx-margin || x >= zone->maxx+margin ||
+			   y <= zone->miny-margin || y >= zone->maxy+margin) {
+				continue;
+			}
+
+			int p1x = zone->startx;
+			int p1y = zone->starty;
+			for(a=0;a<n+1;a++) {
+				i = a % n;
+				int p2x = vertices[2*i];
+				int p2y = vertices[2*i+1];
+				if((p2x-margin < x && p2x+margin > x)
+				   &&(p2y-margin < y && p2y+margin > y)) {
+					int xinters = 0;
+					if(y > min(p1y, p2y)) {
+						if(y <= max(p1y, p2y)) {
+							if(x <= max(p1x, p2x)) {
+								if(p1y != p2y) {
+									xinters = (y-p1y)*(p2x-p1x)/(p2y-p1y)+p1x;
+								}
+								if(p1x == p2x || x <= xinters) {
+									tz = zone->name;
+									inside = 1;
+									break;
 								}
 							}
 						}
-						p1x = p2x;
-						p1y = p2y;
 					}
+					p1x = p2x;
+					p1y = p2y;
 				}
-				if(inside == 1) {
-					break;
-				}
+			}
+			if(inside == 1) {
+				break;
 			}
 		}
-		margin /= (int)pow(10, PRECISION);
-		margin++;
-		margin *= (int)pow(10, PRECISION);
-	}
-	searchingtz = 0;
-	if(tz_lock_initialized == 1) {
-		pthread_mutex_unlock(&tzlock);
+		margin += TZ_STEP;
 	}
+	__sync_sub_and_fetch(&searchingtz, 1);
 	return tz;
 }
 
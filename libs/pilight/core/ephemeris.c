@@ -0,0 +1,372 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+#ifndef __USE_XOPEN
+	#define __USE_XOPEN
+#endif
+#include <time.h>
+#include <math.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "threads.h"
+#include "datetime.h"
+#include "ntp.h"
+#include "log.h"
+#include "mem.h"
+#include "ephemeris.h"
+
+/*
+ * Sunrise and sunset service
+ *
+ * One thread keeps the sunrise and sunset of every location
+ * for the current local day. They are only calculated again
+ * when the day or the daylight saving time changes. Instead of
+ * checking the clock every second, the thread sleeps until the
+ * next sunrise, sunset, midnight or hourly daylight saving
+ * time check of any location.
+ *
+ * The wait ends at an absolute wall clock time, so a clock set
+ * forward still wakes the thread at the right moment. Every
+ * wakeup compares the wall clock with the monotonic clock and
+ * the ntp correction, and calculates all locations again when
+ * the time did not just advance. A clock set backwards is thereby
+ * noticed at the next hourly check at the latest.
+ */
+
+#define PI 3.1415926
+#define PIX 57.29578049044297 // 180 / PI
+#define ZENITH 90.83333333333333
+
+/* Longest sleep, the hourly daylight saving time check */
+#define EPHEMERIS_WAKE	3601
+
+typedef struct ephemeris_location_t {
+	struct ephemeris_t ephemeris;
+	char tz[64];
+	int offset;
+	int dst;
+	int day;
+	time_t due;
+	ephemeris_callback_t *callback;
+	void *userdata;
+	struct ephemeris_location_t *next;
+} ephemeris_location_t;
+
+static pthread_mutex_t ephemeris_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ephemeris_signal = PTHREAD_COND_INITIALIZER;
+static struct ephemeris_location_t *ephemeris_locations = NULL;
+static pthread_t ephemeris_pth;
+static int ephemeris_started = 0;
+static int ephemeris_changed = 0;
+static int ephemeris_loop = 1;
+
+static double ephemeris_calculate(int year, int month, int day, double lon, double lat, int rising, int tz) {
+	int N = (int)((floor(275 * month / 9)) - ((floor((month + 9) / 12)) *
+			((1 + floor((year - 4 * floor(year / 4) + 2) / 3)))) + (int)day - 30);
+
+	double lngHour = lon / 15.0;
+	double T = 0;
+
+	if(rising) {
+		T = N + ((6 - lngHour) / 24);
+	} else {
+		T = N + ((18 - lngHour) / 24);
+	}
+
+	double M = (0.9856 * T) - 3.289;
+	double M1 = M * PI / 180;
+	double L = fmod((M + (1.916 * sin(M1)) + (0.020 * sin(2 * M1)) + 282.634), 360.0);
+	double L1 = L * PI / 180;
+	double L2 = lat * PI / 180;
+	double SD = 0.39782 * sin(L1);
+	double CH = (cos(ZENITH * PI / 180)-(SD * sin(L2))) / (cos((PIX * asin((SD))) * PI / 180) * cos(L2));
+
+	if(CH > 1) {
+		return -1;
+	} else if(CH < -1) {
+		return -1;
+	}
+
+	double RA = fmod((PIX * atan((0.91764 * tan(L1)))), 360);
+	double MQ = (RA + (((floor(L / 90)) * 90) - ((floor(RA / 90)) * 90))) / 15;
+	double A;
+	double B;
+	if(rising == 0) {
+		A = 0.06571;
+		B = 6.595;
+	} else {
+		A = 0.06571;
+		B = 6.618;
+	}
+
+	double t = ((rising ? 360 - PIX * acos(CH) : PIX * acos(CH)) / 15) + MQ - (A * T) - B;
+	double UT = fmod((t - lngHour) + 24.0, 24.0);
+	double min = (round(60*fmod(UT, 1))/100);
+
+	if(min >= 0.60) {
+		min -= 0.60;
+	}
+
+	double hour = UT-min;
+
+	return ((round(hour)+min)+tz)*100;
+}
+
+/* Seconds from now until a hhmm local time later today */
+static int ephemeris_until(int hhmm, int secs, int until) {
+	int at = (hhmm/100)*3600+(hhmm%100)*60;
+
+	if(hhmm >= 0 && at < 86400 && at > secs && at-secs < until) {
+		return at-secs;
+	}
+	return until;
+}
+
+static time_t ephemeris_update(struct ephemeris_location_t *location, time_t now, int *changed) {
+	struct ephemeris_t *ephemeris = &location->ephemeris;
+	struct tm tm;
+	int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+	int hournow = 0, secs = 0, until = 0, dst = 0, dstchange = 0, rise = 0;
+
+	*changed = 0;
+	dst = isdst(now, location->tz);
+	if(location->day != 0 && dst != location->dst) {
+		dstchange = 1;
+	}
+	location->dst = dst;
+
+	/* Get UTC time */
+#ifdef _WIN32
+	struct tm *tm1;
+	if((tm1 = gmtime(&now)) == NULL) {
+		return now+EPHEMERIS_WAKE;
+	}
+	memcpy(&tm, tm1, sizeof(struct tm));
+#else
+	if(gmtime_r(&now, &tm) == NULL) {
+		return now+EPHEMERIS_WAKE;
+	}
+#endif
+	year = tm.tm_year+1900;
+	month = tm.tm_mon+1;
+	day = tm.tm_mday;
+	/* Add our hour difference and daylight saving time to the UTC time */
+	hour = tm.tm_hour+location->offset+dst;
+	minute = tm.tm_min;
+	second = tm.tm_sec;
+
+	datefix(&year, &month, &day, &hour, &minute, &second);
+
+	if(location->day != year*10000+month*100+day || dstchange == 1) {
+		if(location->day != year*10000+month*100+day) {
+			*changed |= EPHEMERIS_TIMES;
+		}
+		if(location->day == 0) {
+			*changed |= EPHEMERIS_SUN;
+		}
+		location->day = year*10000+month*100+day;
+
+		ephemeris->sunrise = (int)ephemeris_calculate(year, month, day, ephemeris->longitude, ephemeris->latitude, 1, location->offset);
+		ephemeris->sunset = (int)ephemeris_calculate(year, month, day, ephemeris->longitude, ephemeris->latitude, 0, location->offset);
+		if(dst == 1) {
+			ephemeris->sunrise += 100;
+			ephemeris->sunset += 100;
+			if(ephemeris->sunrise > 2400) {
+				ephemeris->sunrise -= 2400;
+			}
+			if(ephemeris->sunset > 2400) {
+				ephemeris->sunset -= 2400;
+			}
+		}
+	}
+
+	hournow = (hour*100)+minute;
+	rise = (hournow >= ephemeris->sunrise && hournow < ephemeris->sunset);
+	if(rise != ephemeris->rise || dstchange == 1) {
+		*changed |= EPHEMERIS_SUN;
+	}
+	ephemeris->rise = rise;
+
+	/*
+	 * Wake up at the next sunrise, sunset or midnight, and just
+	 * after each hour to notice daylight saving time changes.
+	 */
+	secs = hour*3600+minute*60+second;
+	until = 86400-secs;
+	if((hour+1)*3600+1-secs < until) {
+		until = (hour+1)*3600+1-secs;
+	}
+	until = ephemeris_until(ephemeris->sunrise, secs, until);
+	until = ephemeris_until(ephemeris->sunset, secs, until);
+
+	return now+until;
+}
+
+static double ephemeris_seconds(struct timespec *ts) {
+	return (double)ts->tv_sec+(double)ts->tv_nsec/1000000000.0;
+}
+
+static void *ephemeris_thread(void *param) {
+	struct ephemeris_location_t *tmp = NULL;
+	struct timespec real, mono, prevreal, prevmono, ts;
+	time_t now = 0, wake = 0;
+	int nr = 0, i = 0, changed = 0, jump = 0, ntpdiff = 0, prevntpdiff = 0;
+	double drift = 0.0;
+
+	clock_gettime(CLOCK_REALTIME, &prevreal);
+	clock_gettime(CLOCK_MONOTONIC, &prevmono);
+	prevntpdiff = getntpdiff();
+
+	while(ephemeris_loop == 1) {
+		clock_gettime(CLOCK_REALTIME, &real);
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		drift = (ephemeris_seconds(&real)-ephemeris_seconds(&prevreal))-(ephemeris_seconds(&mono)-ephemeris_seconds(&prevmono));
+		if((ntpdiff = getntpdiff()) != prevntpdiff || drift > 1.0 || drift < -1.0) {
+			logprintf(LOG_DEBUG, "clock changed by %.3f seconds", drift-(double)(ntpdiff-prevntpdiff));
+			jump = 1;
+		} else {
+			jump = 0;
+		}
+		prevreal = real;
+		prevmono = mono;
+		prevntpdiff = ntpdiff;
+
+		now = real.tv_sec-ntpdiff;
+		wake = now+EPHEMERIS_WAKE;
+
+		pthread_mutex_lock(&ephemeris_lock);
+		ephemeris_changed = 0;
+		nr = 0;
+		for(tmp=ephemeris_locations;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct ephemeris_location_t *due[nr+1];
+		nr = 0;
+		for(tmp=ephemeris_locations;tmp!=NULL;tmp=tmp->next) {
+			if(now >= tmp->due || jump == 1) {
+				due[nr++] = tmp;
+			} else if(tmp->due < wake) {
+				wake = tmp->due;
+			}
+		}
+		pthread_mutex_unlock(&ephemeris_lock);
+
+		/*
+		 * Locations are only freed after this thread stopped
+		 * and only this thread changes them after they were added.
+		 */
+		for(i=0;i<nr&&ephemeris_loop==1;i++) {
+			due[i]->due = ephemeris_update(due[i], now, &changed);
+			if(due[i]->due < wake) {
+				wake = due[i]->due;
+			}
+			if(changed > 0) {
+				due[i]->callback(&due[i]->ephemeris, changed, due[i]->userdata);
+			}
+		}
+
+		pthread_mutex_lock(&ephemeris_lock);
+		if(ephemeris_loop == 1 && ephemeris_changed == 0) {
+			ts.tv_sec = real.tv_sec+(wake-now);
+			ts.tv_nsec = 0;
+			while(ephemeris_loop == 1 && ephemeris_changed == 0 &&
+			      pthread_cond_timedwait(&ephemeris_signal, &ephemeris_lock, &ts) != ETIMEDOUT);
+		}
+		pthread_mutex_unlock(&ephemeris_lock);
+	}
+
+	return (void *)NULL;
+}
+
+int ephemeris_add(double longitude, double latitude, ephemeris_callback_t *callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct ephemeris_location_t *location = NULL;
+	char UTC[] = "UTC", *tz = NULL;
+
+	if((location = MALLOC(sizeof(struct ephemeris_location_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(location, '\0', sizeof(struct ephemeris_location_t));
+	location->ephemeris.longitude = longitude;
+	location->ephemeris.latitude = latitude;
+	location->callback = callback;
+	location->userdata = userdata;
+
+	if((tz = coord2tz(longitude, latitude)) == NULL) {
+		logprintf(LOG_DEBUG, "could not determine timezone");
+		tz = UTC;
+	} else {
+		logprintf(LOG_DEBUG, "%.6f:%.6f seems to be in timezone: %s", longitude, latitude, tz);
+	}
+	snprintf(location->tz, sizeof(location->tz), "%s", tz);
+
+	/* Check how many hours we differ from UTC? */
+	location->offset = tzoffset(UTC, location->tz);
+	/* Report the sun state of a new location right away */
+	location->due = time(NULL)-getntpdiff()+1;
+
+	pthread_mutex_lock(&ephemeris_lock);
+	location->next = ephemeris_locations;
+	ephemeris_locations = location;
+	ephemeris_changed = 1;
+
+	if(ephemeris_started == 0) {
+		ephemeris_loop = 1;
+		threads_create(&ephemeris_pth, NULL, ephemeris_thread, NULL);
+		ephemeris_started = 1;
+	}
+	pthread_cond_signal(&ephemeris_signal);
+	pthread_mutex_unlock(&ephemeris_lock);
+	return 0;
+}
+
+int ephemeris_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct ephemeris_location_t *tmp = NULL;
+
+	if(ephemeris_started == 1) {
+		pthread_mutex_lock(&ephemeris_lock);
+		ephemeris_loop = 0;
+		pthread_cond_signal(&ephemeris_signal);
+		pthread_mutex_unlock(&ephemeris_lock);
+		pthread_join(ephemeris_pth, NULL);
+		ephemeris_started = 0;
+	}
+
+	pthread_mutex_lock(&ephemeris_lock);
+	while(ephemeris_locations) {
+		tmp = ephemeris_locations;
+		ephemeris_locations = ephemeris_locations->next;
+		FREE(tmp);
+	}
+	pthread_mutex_unlock(&ephemeris_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected ephemeris library");
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EPHEMERIS_H_
+#define _EPHEMERIS_H_
+
+/* What changed since the previous report */
+#define EPHEMERIS_SUN		1
+#define EPHEMERIS_TIMES	2
+
+typedef struct ephemeris_t {
+	double longitude;
+	double latitude;
+	/* Local time as hhmm */
+	int sunrise;
+	int sunset;
+	/* The sun is up */
+	int rise;
+} ephemeris_t;
+
+typedef void (ephemeris_callback_t)(struct ephemeris_t *ephemeris, int changed, void *userdata);
+
+int ephemeris_add(double longitude, double latitude, ephemeris_callback_t *callback, void *userdata);
+int ephemeris_gc(void);
+
+#endif
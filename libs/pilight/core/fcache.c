@@ -21,7 +21,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	#include <sys/inotify.h>
+#endif
 
 #include "fcache.h"
 #include "common.h"
@@ -29,63 +37,314 @@
 #include "log.h"
 #include "gc.h"
 
-int fcache_gc(void) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/*
+ * Files are kept in a hash table. Small files are read into
+ * memory, larger files are memory mapped. A mapped file that is
+ * truncated in place raises SIGBUS when it is read and one that
+ * is rewritten in place no longer matches its etag, so files
+ * should be replaced by renaming a new file over them, as the
+ * installer does. A file that has a name.gz next to it that is at least
+ * as new, also keeps that precompressed variant. The directories
+ * of all cached files are watched through inotify, and a changed
+ * file is dropped from the cache the next time the cache is used.
+ * Nodes are reference counted, so a file that is still being sent
+ * is only unmapped after it was released.
+ */
+
+#define FCACHE_BUCKETS	128
+/* Files of at least this size are memory mapped */
+#define FCACHE_MAPSIZE	(512*1024)
+
+static struct fcache_t *fcache[FCACHE_BUCKETS];
+static pthread_mutex_t fcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+typedef struct fcache_watch_t {
+	int wd;
+	char *path;
+	struct fcache_watch_t *next;
+} fcache_watch_t;
+
+static struct fcache_watch_t *fcache_watches = NULL;
+static int fcache_inotify = -1;
+#endif
+
+static unsigned int fcache_hash(char *str) {
+	unsigned int hash = 5381;
+
+	while(*str) {
+		hash = ((hash << 5)+hash)+(unsigned char)*str++;
+	}
+	return hash % FCACHE_BUCKETS;
+}
 
-	struct fcache_t *tmp = fcache;
-	while(fcache) {
-		tmp = fcache;
-		FREE(tmp->name);
-		FREE(tmp->bytes);
-		fcache = fcache->next;
-		FREE(tmp);
+static void fcache_unload(struct fcache_file_t *file) {
+	if(file->bytes == NULL) {
+		return;
 	}
-	if(fcache != NULL) {
-		FREE(fcache);
+#ifndef _WIN32
+	if(file->mapped == 1) {
+		munmap(file->bytes, (size_t)file->size);
+	} else {
+		FREE(file->bytes);
 	}
+#else
+	FREE(file->bytes);
+#endif
+	file->bytes = NULL;
+}
 
-	logprintf(LOG_DEBUG, "garbage collected fcache library");
-	return 1;
+static void fcache_free(struct fcache_t *node) {
+	fcache_unload(&node->plain);
+	fcache_unload(&node->gzip);
+	FREE(node->name);
+	FREE(node);
 }
 
-void fcache_remove_node(struct fcache_t **cache, char *name) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/* Unlink a node from the table and free it once it is no longer used */
+static void fcache_drop(struct fcache_t **ptr) {
+	struct fcache_t *node = *ptr;
 
-	struct fcache_t *currP, *prevP;
+	*ptr = node->next;
+	logprintf(LOG_DEBUG, "removed %s from cache", node->name);
+	if(node->refs == 0) {
+		fcache_free(node);
+	} else {
+		node->stale = 1;
+	}
+}
 
-	prevP = NULL;
+static void fcache_remove(char *filename) {
+	struct fcache_t **ptr = NULL;
 
-	for(currP = *cache; currP != NULL; prevP = currP, currP = currP->next) {
+	for(ptr=&fcache[fcache_hash(filename)];*ptr!=NULL;ptr=&(*ptr)->next) {
+		if(strcmp((*ptr)->name, filename) == 0) {
+			fcache_drop(ptr);
+			break;
+		}
+	}
+}
 
-		if(strcmp(currP->name, name) == 0) {
-			if(prevP == NULL) {
-				*cache = currP->next;
-			} else {
-				prevP->next = currP->next;
-			}
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+static void fcache_remove_all(void) {
+	int i = 0;
 
-			FREE(currP->name);
-			FREE(currP->bytes);
-			FREE(currP);
+	for(i=0;i<FCACHE_BUCKETS;i++) {
+		while(fcache[i] != NULL) {
+			fcache_drop(&fcache[i]);
+		}
+	}
+}
+
+static void fcache_watch(char *filename) {
+	struct fcache_watch_t *watch = NULL;
+	char *slash = NULL;
+	int wd = 0;
+
+	if(fcache_inotify == -1) {
+		if((fcache_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+			logprintf(LOG_NOTICE, "cannot watch cached files for changes: %s", strerror(errno));
+			fcache_inotify = -2;
+		}
+	}
+	if(fcache_inotify < 0 || (slash = strrchr(filename, '/')) == NULL) {
+		return;
+	}
 
+	char path[(slash-filename)+2];
+	memcpy(path, filename, (size_t)(slash-filename));
+	path[slash-filename] = '\0';
+	if(slash == filename) {
+		strcpy(path, "/");
+	}
+
+	for(watch=fcache_watches;watch!=NULL;watch=watch->next) {
+		if(strcmp(watch->path, path) == 0) {
+			return;
+		}
+	}
+	if((wd = inotify_add_watch(fcache_inotify, path, IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)) < 0) {
+		logprintf(LOG_NOTICE, "cannot watch %s for changes: %s", path, strerror(errno));
+		return;
+	}
+	if((watch = MALLOC(sizeof(struct fcache_watch_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	if((watch->path = MALLOC(strlen(path)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(watch->path, path);
+	watch->wd = wd;
+	watch->next = fcache_watches;
+	fcache_watches = watch;
+}
+
+/* Forget a watch that was removed or whose directory was moved */
+static void fcache_unwatch(int wd, int remove) {
+	struct fcache_watch_t **ptr = NULL, *watch = NULL;
+
+	for(ptr=&fcache_watches;*ptr!=NULL;ptr=&(*ptr)->next) {
+		if((*ptr)->wd == wd) {
+			watch = *ptr;
+			*ptr = watch->next;
+			if(remove == 1) {
+				inotify_rm_watch(fcache_inotify, wd);
+			}
+			FREE(watch->path);
+			FREE(watch);
 			break;
 		}
 	}
 }
 
+/* Drop all files that changed since the cache was last used */
+static void fcache_changes(void) {
+	struct fcache_watch_t *watch = NULL;
+	struct inotify_event *event = NULL;
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len = 0, i = 0;
+	size_t n = 0;
+
+	if(fcache_inotify < 0) {
+		return;
+	}
+	while((len = read(fcache_inotify, buffer, sizeof(buffer))) > 0) {
+		for(i=0;i<len;i+=(ssize_t)(sizeof(struct inotify_event)+event->len)) {
+			event = (struct inotify_event *)&buffer[i];
+			if((event->mask & IN_Q_OVERFLOW) > 0) {
+				fcache_remove_all();
+				continue;
+			}
+			/*
+			 * The directory itself is gone or moved, so its files are
+			 * dropped and the next fcache_add of such a file watches
+			 * the directory at its path again.
+			 */
+			if((event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) > 0) {
+				fcache_unwatch(event->wd, ((event->mask & IN_MOVE_SELF) > 0) ? 1 : 0);
+				fcache_remove_all();
+				continue;
+			}
+			if(event->len == 0) {
+				continue;
+			}
+			for(watch=fcache_watches;watch!=NULL;watch=watch->next) {
+				if(watch->wd == event->wd) {
+					break;
+				}
+			}
+			if(watch == NULL) {
+				continue;
+			}
+
+			char name[strlen(watch->path)+strlen(event->name)+2];
+			snprintf(name, sizeof(name), "%s%s%s", watch->path, (strcmp(watch->path, "/") == 0) ? "" : "/", event->name);
+			/* A changed name.gz invalidates name */
+			if((n = strlen(name)) > 3 && strcmp(&name[n-3], ".gz") == 0) {
+				name[n-3] = '\0';
+			}
+			fcache_remove(name);
+		}
+	}
+}
+#endif
+
+int fcache_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct fcache_t *tmp = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&fcache_lock);
+	for(i=0;i<FCACHE_BUCKETS;i++) {
+		while(fcache[i]) {
+			tmp = fcache[i];
+			fcache[i] = fcache[i]->next;
+			fcache_free(tmp);
+		}
+	}
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	struct fcache_watch_t *watch = NULL;
+	while(fcache_watches) {
+		watch = fcache_watches;
+		fcache_watches = fcache_watches->next;
+		FREE(watch->path);
+		FREE(watch);
+	}
+	if(fcache_inotify > -1) {
+		close(fcache_inotify);
+	}
+	fcache_inotify = -1;
+#endif
+	pthread_mutex_unlock(&fcache_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected fcache library");
+	return 1;
+}
+
 int fcache_rm(char *filename) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	fcache_remove_node(&fcache, filename);
-	logprintf(LOG_DEBUG, "removed %s from cache", filename);
+	pthread_mutex_lock(&fcache_lock);
+	fcache_remove(filename);
+	pthread_mutex_unlock(&fcache_lock);
 	return 1;
 }
 
+static int fcache_load(char *filename, struct fcache_file_t *file, struct stat *st) {
+	unsigned long long hash = 14695981039346656037ULL;
+	int fd = 0, i = 0;
+
+	if((fd = open(filename, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if(fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) {
+		close(fd);
+		return -1;
+	}
+	file->size = (int)st->st_size;
+	file->mapped = 0;
+	file->bytes = NULL;
+
+#ifndef _WIN32
+	if(file->size >= FCACHE_MAPSIZE) {
+		file->bytes = mmap(NULL, (size_t)file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(file->bytes == MAP_FAILED) {
+			file->bytes = NULL;
+		} else {
+			file->mapped = 1;
+		}
+	}
+#endif
+	/* Read the whole file when it is not mapped */
+	if(file->bytes == NULL) {
+		if((file->bytes = MALLOC((size_t)file->size+1)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		if(read(fd, file->bytes, (size_t)file->size) != (ssize_t)file->size) {
+			FREE(file->bytes);
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	for(i=0;i<file->size;i++) {
+		hash = (hash ^ file->bytes[i])*1099511628211ULL;
+	}
+	snprintf(file->etag, sizeof(file->etag), "\"%016llx\"", hash);
+	return 0;
+}
+
 int fcache_add(char *filename) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	size_t filesize = 0;
-	FILE *fp = NULL;
+	struct fcache_t *node = NULL;
+	struct stat st, gzst;
+	unsigned int hash = 0;
 
 	logprintf(LOG_NOTICE, "caching %s", filename);
 
@@ -99,65 +358,74 @@ int fcache_add(char *filename) {
 	}
 #endif
 
-	if((fp = fopen(filename, "rb")) == NULL) {
+	if((node = MALLOC(sizeof(struct fcache_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(node, '\0', sizeof(struct fcache_t));
+
+	pthread_mutex_lock(&fcache_lock);
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	/* Watch before reading, so no change can be missed */
+	fcache_watch(filename);
+	fcache_changes();
+#endif
+	if(fcache_load(filename, &node->plain, &st) != 0) {
+		pthread_mutex_unlock(&fcache_lock);
 		logprintf(LOG_NOTICE, "failed to open %s", filename);
+		FREE(node);
 		return -1;
-	} else {
-		struct fcache_t *node = MALLOC(sizeof(struct fcache_t));
-		if(node == NULL) {
-			logprintf(LOG_ERR, "out of memory");
-			exit(EXIT_FAILURE);
-		}
-		fseek(fp, 0, SEEK_END);
-		filesize = (size_t)ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		if((node->bytes = MALLOC(filesize + 1)) == NULL) {
-			logprintf(LOG_ERR, "out of memory");
-			exit(EXIT_FAILURE);
-		}
-		memset(node->bytes, '\0', filesize + 1);
-		if(fread(node->bytes, 1, filesize, fp) != filesize) {
-			logprintf(LOG_NOTICE, "error reading %s", filename);
-			FREE(node->bytes);
-			FREE(node);
-			return -1;
-		}
-		node->size = (int)filesize;
-		if((node->name = MALLOC(strlen(filename)+1)) == NULL) {
-			logprintf(LOG_ERR, "out of memory");
-			exit(EXIT_FAILURE);
+	}
+	node->mtime = st.st_mtime;
+
+	char gzname[strlen(filename)+4];
+	snprintf(gzname, sizeof(gzname), "%s.gz", filename);
+	if(fcache_load(gzname, &node->gzip, &gzst) == 0) {
+		/* An older or larger variant is not worth sending */
+		if(gzst.st_mtime < st.st_mtime || node->gzip.size >= node->plain.size) {
+			fcache_unload(&node->gzip);
 		}
-		strcpy(node->name, filename);
-		node->next = fcache;
-		fcache = node;
-		return 0;
 	}
-	return -1;
+
+	if((node->name = MALLOC(strlen(filename)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(node->name, filename);
+
+	fcache_remove(filename);
+	hash = fcache_hash(filename);
+	node->next = fcache[hash];
+	fcache[hash] = node;
+	pthread_mutex_unlock(&fcache_lock);
+	return 0;
 }
 
-short fcache_get_size(char *filename, int *out) {
+struct fcache_t *fcache_get(char *filename) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct fcache_t *ftmp = fcache;
-	while(ftmp) {
-		if(strcmp(ftmp->name, filename) == 0) {
-			*out = ftmp->size;
-			return 0;
+	struct fcache_t *node = NULL;
+
+	pthread_mutex_lock(&fcache_lock);
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	fcache_changes();
+#endif
+	for(node=fcache[fcache_hash(filename)];node!=NULL;node=node->next) {
+		if(strcmp(node->name, filename) == 0) {
+			node->refs++;
+			break;
 		}
-		ftmp = ftmp->next;
 	}
-	return -1;
+	pthread_mutex_unlock(&fcache_lock);
+	return node;
 }
 
-unsigned char *fcache_get_bytes(char *filename) {
+void fcache_release(struct fcache_t *node) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct fcache_t *ftmp = fcache;
-	while(ftmp) {
-		if(strcmp(ftmp->name, filename) == 0) {
-			return ftmp->bytes;
-		}
-		ftmp = ftmp->next;
+	pthread_mutex_lock(&fcache_lock);
+	if(--node->refs == 0 && node->stale == 1) {
+		fcache_free(node);
 	}
-	return NULL;
+	pthread_mutex_unlock(&fcache_lock);
 }
@@ -20,19 +20,31 @@ with Splash. If not, see <http://www.gnu.org/licenses/>
 #ifndef _FCACHE_H_
 #define _FCACHE_H_
 
-typedef struct fcache_t {
-	char *name;
+#include <time.h>
+
+typedef struct fcache_file_t {
 	int size;
 	unsigned char *bytes;
+	int mapped;
+	/* Strong entity tag including the quotes */
+	char etag[24];
+} fcache_file_t;
+
+typedef struct fcache_t {
+	char *name;
+	time_t mtime;
+	/* The file itself and an optional precompressed name.gz */
+	struct fcache_file_t plain;
+	struct fcache_file_t gzip;
+	int refs;
+	int stale;
 	struct fcache_t *next;
 } fcaches_t;
 
-struct fcache_t *fcache;
-
 int fcache_gc(void);
 int fcache_add(char *filename);
 int fcache_rm(char *filename);
-short fcache_get_size(char *filename, int *out);
-unsigned char *fcache_get_bytes(char *filename);
+struct fcache_t *fcache_get(char *filename);
+void fcache_release(struct fcache_t *node);
 
 #endif
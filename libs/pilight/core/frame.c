@@ -0,0 +1,293 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "log.h"
+#include "json.h"
+#include "frame.h"
+
+/*
+ * A compact binary form of json messages, used to forward the
+ * received codes of a node to its master. Every value starts with
+ * a type byte. Strings, arrays and objects carry their length or
+ * number of children as a varint, object members are preceded by
+ * their key. Numbers are stored as the zigzag varint of their value
+ * scaled by their decimals, so a protocol id or unit mostly takes
+ * a couple of bytes. Other numbers are stored as the big-endian
+ * bits of their IEEE-754 double. Messages are simply concatenated, so a single
+ * frame can hold a whole batch of them.
+ */
+
+#define FRAME_NULL			0
+#define FRAME_FALSE			1
+#define FRAME_TRUE			2
+#define FRAME_STRING		3
+#define FRAME_INTEGER		4
+#define FRAME_DOUBLE		5
+#define FRAME_ARRAY			6
+#define FRAME_OBJECT		7
+
+#define FRAME_DEPTH			32
+
+static void frame_reserve(struct frame_t *frame, size_t len) {
+	if(frame->len+len > frame->size) {
+		size_t size = (frame->size == 0) ? 1024 : frame->size;
+		while(size < frame->len+len) {
+			size *= 2;
+		}
+		if((frame->buffer = REALLOC(frame->buffer, size)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		frame->size = size;
+	}
+}
+
+static void frame_put_byte(struct frame_t *frame, unsigned char c) {
+	frame_reserve(frame, 1);
+	frame->buffer[frame->len++] = c;
+}
+
+static void frame_put_varint(struct frame_t *frame, uint64_t value) {
+	frame_reserve(frame, 10);
+	while(value >= 0x80) {
+		frame->buffer[frame->len++] = (unsigned char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	frame->buffer[frame->len++] = (unsigned char)value;
+}
+
+static void frame_put_double(struct frame_t *frame, double number) {
+	uint64_t bits = 0;
+	int i = 0;
+
+	memcpy(&bits, &number, sizeof(bits));
+	frame_reserve(frame, 8);
+	for(i=7;i>=0;i--) {
+		frame->buffer[frame->len++] = (unsigned char)((bits >> (i*8)) & 0xFF);
+	}
+}
+
+static void frame_put_string(struct frame_t *frame, const char *str) {
+	size_t len = strlen(str);
+
+	frame_put_varint(frame, len);
+	frame_reserve(frame, len);
+	memcpy(&frame->buffer[frame->len], str, len);
+	frame->len += len;
+}
+
+static void frame_put_number(struct frame_t *frame, double number, int decimals) {
+	double scaled = number;
+	int64_t value = 0;
+	int i = 0;
+
+	if(decimals < 0 || decimals > 15) {
+		decimals = 0;
+	}
+	for(i=0;i<decimals;i++) {
+		scaled *= 10;
+	}
+	if(isfinite(scaled) && fabs(scaled) < 9007199254740992.0 && scaled == round(scaled)) {
+		value = (int64_t)scaled;
+		frame_put_byte(frame, FRAME_INTEGER);
+		frame_put_varint(frame, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+	} else {
+		frame_put_byte(frame, FRAME_DOUBLE);
+		frame_put_double(frame, number);
+	}
+	frame_put_byte(frame, (unsigned char)decimals);
+}
+
+static void frame_put_node(struct frame_t *frame, struct JsonNode *node) {
+	struct JsonNode *child = NULL;
+	unsigned int count = 0;
+
+	switch(node->tag) {
+		case JSON_BOOL:
+			frame_put_byte(frame, (node->bool_ == true) ? FRAME_TRUE : FRAME_FALSE);
+		break;
+		case JSON_STRING:
+			frame_put_byte(frame, FRAME_STRING);
+			frame_put_string(frame, node->string_);
+		break;
+		case JSON_NUMBER:
+			frame_put_number(frame, node->number_, node->decimals_);
+		break;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			frame_put_byte(frame, (node->tag == JSON_ARRAY) ? FRAME_ARRAY : FRAME_OBJECT);
+			json_foreach(child, node) {
+				count++;
+			}
+			frame_put_varint(frame, count);
+			json_foreach(child, node) {
+				if(node->tag == JSON_OBJECT) {
+					frame_put_string(frame, child->key);
+				}
+				frame_put_node(frame, child);
+			}
+		break;
+		default:
+			frame_put_byte(frame, FRAME_NULL);
+		break;
+	}
+}
+
+void frame_add(struct frame_t *frame, struct JsonNode *json) {
+	frame_put_node(frame, json);
+	frame->count++;
+}
+
+static int frame_get_varint(const unsigned char *buffer, size_t len, size_t *pos, uint64_t *value) {
+	unsigned int shift = 0;
+
+	*value = 0;
+	while(*pos < len && shift < 64) {
+		unsigned char c = buffer[(*pos)++];
+		*value |= (uint64_t)(c & 0x7F) << shift;
+		if((c & 0x80) == 0) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+static char *frame_get_string(const unsigned char *buffer, size_t len, size_t *pos) {
+	uint64_t size = 0;
+	char *str = NULL;
+
+	if(frame_get_varint(buffer, len, pos, &size) != 0 || size > len-*pos) {
+		return NULL;
+	}
+	if((str = MALLOC((size_t)size+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(str, &buffer[*pos], (size_t)size);
+	str[size] = '\0';
+	*pos += (size_t)size;
+	return str;
+}
+
+static struct JsonNode *frame_get_node(const unsigned char *buffer, size_t len, size_t *pos, int depth) {
+	struct JsonNode *node = NULL, *child = NULL;
+	uint64_t value = 0, count = 0, i = 0;
+	double number = 0;
+	char *str = NULL;
+	int decimals = 0;
+
+	if(*pos >= len || depth > FRAME_DEPTH) {
+		return NULL;
+	}
+
+	switch(buffer[(*pos)++]) {
+		case FRAME_NULL:
+			return json_mknull();
+		case FRAME_FALSE:
+			return json_mkbool(false);
+		case FRAME_TRUE:
+			return json_mkbool(true);
+		case FRAME_STRING:
+			if((str = frame_get_string(buffer, len, pos)) == NULL) {
+				return NULL;
+			}
+			node = json_mkstring(str);
+			FREE(str);
+			return node;
+		case FRAME_INTEGER:
+			if(frame_get_varint(buffer, len, pos, &value) != 0 || *pos >= len) {
+				return NULL;
+			}
+			decimals = buffer[(*pos)++];
+			number = (double)((int64_t)(value >> 1) ^ -(int64_t)(value & 1));
+			for(i=0;i<(uint64_t)decimals;i++) {
+				number /= 10;
+			}
+			return json_mknumber(number, decimals);
+		case FRAME_DOUBLE:
+			if(len-*pos < 9) {
+				return NULL;
+			}
+			value = 0;
+			for(i=0;i<8;i++) {
+				value = (value << 8) | buffer[(*pos)++];
+			}
+			memcpy(&number, &value, sizeof(number));
+			decimals = buffer[(*pos)++];
+			return json_mknumber(number, decimals);
+		case FRAME_ARRAY:
+		case FRAME_OBJECT:
+			node = (buffer[*pos-1] == FRAME_ARRAY) ? json_mkarray() : json_mkobject();
+			if(frame_get_varint(buffer, len, pos, &count) != 0) {
+				json_delete(node);
+				return NULL;
+			}
+			for(i=0;i<count;i++) {
+				str = NULL;
+				if(node->tag == JSON_OBJECT && (str = frame_get_string(buffer, len, pos)) == NULL) {
+					json_delete(node);
+					return NULL;
+				}
+				if((child = frame_get_node(buffer, len, pos, depth+1)) == NULL) {
+					if(str != NULL) {
+						FREE(str);
+					}
+					json_delete(node);
+					return NULL;
+				}
+				if(node->tag == JSON_OBJECT) {
+					json_append_member(node, str, child);
+					FREE(str);
+				} else {
+					json_append_element(node, child);
+				}
+			}
+			return node;
+		default:
+		break;
+	}
+	return NULL;
+}
+
+/* Decodes the message at pos, NULL at the end or on corrupt data */
+struct JsonNode *frame_next(const unsigned char *buffer, size_t len, size_t *pos) {
+	return frame_get_node(buffer, len, pos, 0);
+}
+
+void frame_clear(struct frame_t *frame) {
+	frame->len = 0;
+	frame->count = 0;
+}
+
+void frame_free(struct frame_t *frame) {
+	if(frame->buffer != NULL) {
+		FREE(frame->buffer);
+	}
+	frame->len = 0;
+	frame->size = 0;
+	frame->count = 0;
+}
@@ -0,0 +1,41 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stddef.h>
+
+#include "json.h"
+
+/* Largest frame we accept from a node */
+#define FRAME_MAX_SIZE	1048576
+
+typedef struct frame_t {
+	unsigned char *buffer;
+	size_t len;
+	size_t size;
+	unsigned int count;
+} frame_t;
+
+void frame_add(struct frame_t *frame, struct JsonNode *json);
+struct JsonNode *frame_next(const unsigned char *buffer, size_t len, size_t *pos);
+void frame_clear(struct frame_t *frame);
+void frame_free(struct frame_t *frame);
+
+#endif
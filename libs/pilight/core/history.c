@@ -0,0 +1,1051 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef _WIN32
+	#include <windows.h>
+	#include <io.h>
+#else
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "json.h"
+#include "log.h"
+#include "history.h"
+#include "../config/settings.h"
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+/*
+ * Every numeric device value gets its own series. A series holds
+ * three tiers of columnar blocks: the raw values, and per minute
+ * and per hour aggregates (minimum, maximum, sum and count). The
+ * last minute and hour are kept in open buckets until they are
+ * complete.
+ *
+ * Timestamps are stored as zigzag varints of the delta-of-delta.
+ * Values are XOR'ed with the previous value of the same column and
+ * stored as a header byte with the number of leading and trailing
+ * zero bytes, followed by the remaining bytes.
+ *
+ * Each tier keeps a fixed number of blocks, so the memory used by
+ * a series is bounded.
+ */
+
+#define HISTORY_SERIES_BUCKETS	64
+#define HISTORY_COLUMNS					4
+
+static const unsigned char history_magic[4] = { 'P', 'L', 'H', 1 };
+static const int history_columns[HISTORY_TIERS] = { 1, 4, 4 };
+static const unsigned int history_blocks[HISTORY_TIERS] = {
+	HISTORY_RAW_BLOCKS, HISTORY_MINUTE_BLOCKS, HISTORY_HOUR_BLOCKS
+};
+static const char *history_tiers[HISTORY_TIERS] = { "raw", "minute", "hour" };
+
+struct history_buffer_t {
+	unsigned char *bytes;
+	size_t len;
+	size_t size;
+};
+
+struct history_column_t {
+	struct history_buffer_t data;
+	uint64_t prev;
+};
+
+struct history_block_t {
+	int64_t first;
+	int64_t last;
+	int64_t delta;
+	unsigned int count;
+	struct history_buffer_t ts;
+	struct history_column_t columns[HISTORY_COLUMNS];
+	struct history_block_t *next;
+};
+
+struct history_tier_t {
+	struct history_block_t *blocks;
+	struct history_block_t *tail;
+	unsigned int nrblocks;
+	/* Older blocks were dropped */
+	int truncated;
+};
+
+struct history_bucket_t {
+	int64_t start;
+	double min;
+	double max;
+	double sum;
+	double count;
+};
+
+struct history_series_t {
+	char *device;
+	char *name;
+	unsigned int hash;
+	int decimals;
+	struct history_tier_t tiers[HISTORY_TIERS];
+	struct history_bucket_t minute;
+	struct history_bucket_t hour;
+	struct history_series_t *next;
+};
+
+static struct history_series_t *history_series[HISTORY_SERIES_BUCKETS];
+
+static pthread_mutex_t history_lock;
+/* Serializes the file writes, which happen outside the history lock */
+static pthread_mutex_t history_save_lock;
+static pthread_cond_t history_signal;
+static pthread_mutexattr_t history_attr;
+static unsigned short history_loop = 0;
+static unsigned short history_init_done = 0;
+
+static char *history_file = NULL;
+
+static void history_put(struct history_buffer_t *buf, const void *data, size_t len) {
+	if(buf->len+len > buf->size) {
+		if(buf->size == 0) {
+			buf->size = 32;
+		}
+		while(buf->len+len > buf->size) {
+			buf->size *= 2;
+		}
+		if((buf->bytes = REALLOC(buf->bytes, buf->size)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(&buf->bytes[buf->len], data, len);
+	buf->len += len;
+}
+
+/* Release the unused part of a buffer once a block is full */
+static void history_shrink(struct history_buffer_t *buf) {
+	if(buf->len > 0 && buf->len < buf->size) {
+		if((buf->bytes = REALLOC(buf->bytes, buf->len)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		buf->size = buf->len;
+	}
+}
+
+static void history_put_varint(struct history_buffer_t *buf, uint64_t value) {
+	unsigned char bytes[10];
+	size_t n = 0;
+
+	while(value >= 0x80) {
+		bytes[n++] = (unsigned char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	bytes[n++] = (unsigned char)value;
+	history_put(buf, bytes, n);
+}
+
+static int history_get_varint(struct history_buffer_t *buf, size_t *pos, uint64_t *value) {
+	unsigned int shift = 0;
+
+	*value = 0;
+	while(*pos < buf->len && shift < 64) {
+		unsigned char c = buf->bytes[(*pos)++];
+		*value |= (uint64_t)(c & 0x7F) << shift;
+		if((c & 0x80) == 0) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+static void history_put_value(struct history_column_t *column, double value) {
+	unsigned char bytes[9];
+	uint64_t bits = 0, x = 0;
+	int lead = 0, trail = 0, n = 0, i = 0;
+
+	memcpy(&bits, &value, sizeof(bits));
+	x = bits ^ column->prev;
+	column->prev = bits;
+
+	while(lead < 8 && ((x >> (56-8*lead)) & 0xFF) == 0) {
+		lead++;
+	}
+	if(lead == 8) {
+		bytes[0] = 0x80;
+		history_put(&column->data, bytes, 1);
+		return;
+	}
+	while(((x >> (8*trail)) & 0xFF) == 0) {
+		trail++;
+	}
+	n = 8-lead-trail;
+	bytes[0] = (unsigned char)((lead << 4) | trail);
+	for(i=0;i<n;i++) {
+		bytes[i+1] = (unsigned char)((x >> (8*(7-lead-i))) & 0xFF);
+	}
+	history_put(&column->data, bytes, (size_t)n+1);
+}
+
+static int history_get_value(struct history_column_t *column, size_t *pos, uint64_t *prev, double *value) {
+	uint64_t x = 0;
+	int lead = 0, trail = 0, n = 0, i = 0;
+
+	if(*pos >= column->data.len) {
+		return -1;
+	}
+	lead = column->data.bytes[*pos] >> 4;
+	trail = column->data.bytes[*pos] & 0x0F;
+	(*pos)++;
+	if(lead < 8) {
+		n = 8-lead-trail;
+		if(n <= 0 || *pos+(size_t)n > column->data.len) {
+			return -1;
+		}
+		for(i=0;i<n;i++) {
+			x = (x << 8) | column->data.bytes[(*pos)++];
+		}
+		x <<= 8*trail;
+	}
+	*prev ^= x;
+	memcpy(value, prev, sizeof(*value));
+	return 0;
+}
+
+static unsigned int history_hash(const char *device, const char *name) {
+	return fnv1a(device, strlen(device)) ^ (fnv1a(name, strlen(name)) * 16777619U);
+}
+
+static struct history_series_t *history_find(const char *device, const char *name) {
+	struct history_series_t *series = NULL;
+	unsigned int hash = history_hash(device, name);
+
+	series = history_series[hash % HISTORY_SERIES_BUCKETS];
+	while(series) {
+		if(series->hash == hash && strcmp(series->device, device) == 0 && strcmp(series->name, name) == 0) {
+			return series;
+		}
+		series = series->next;
+	}
+	return NULL;
+}
+
+static struct history_series_t *history_create(const char *device, const char *name) {
+	struct history_series_t *series = NULL;
+
+	if((series = MALLOC(sizeof(struct history_series_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(series, 0, sizeof(struct history_series_t));
+	if((series->device = MALLOC(strlen(device)+1)) == NULL ||
+	   (series->name = MALLOC(strlen(name)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(series->device, device);
+	strcpy(series->name, name);
+	series->hash = history_hash(device, name);
+	series->next = history_series[series->hash % HISTORY_SERIES_BUCKETS];
+	history_series[series->hash % HISTORY_SERIES_BUCKETS] = series;
+	return series;
+}
+
+static void history_free_block(struct history_block_t *block) {
+	int i = 0;
+
+	if(block->ts.bytes != NULL) {
+		FREE(block->ts.bytes);
+	}
+	for(i=0;i<HISTORY_COLUMNS;i++) {
+		if(block->columns[i].data.bytes != NULL) {
+			FREE(block->columns[i].data.bytes);
+		}
+	}
+	FREE(block);
+}
+
+static struct history_block_t *history_new_block(struct history_tier_t *tier, int type) {
+	struct history_block_t *block = NULL, *tmp = NULL;
+	int i = 0;
+
+	if((block = MALLOC(sizeof(struct history_block_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(block, 0, sizeof(struct history_block_t));
+	if(tier->tail != NULL) {
+		history_shrink(&tier->tail->ts);
+		for(i=0;i<HISTORY_COLUMNS;i++) {
+			history_shrink(&tier->tail->columns[i].data);
+		}
+		tier->tail->next = block;
+	} else {
+		tier->blocks = block;
+	}
+	tier->tail = block;
+	tier->nrblocks++;
+
+	/* Drop the oldest block when the tier is full */
+	if(tier->nrblocks > history_blocks[type]) {
+		tmp = tier->blocks;
+		tier->blocks = tmp->next;
+		history_free_block(tmp);
+		tier->nrblocks--;
+		tier->truncated = 1;
+	}
+	return block;
+}
+
+static void history_append(struct history_series_t *series, int type, int64_t ts, double *values) {
+	struct history_tier_t *tier = &series->tiers[type];
+	struct history_block_t *block = tier->tail;
+	int64_t delta = 0, dod = 0;
+	int i = 0;
+
+	/* Points are only ever appended in order */
+	if(block != NULL && ts < block->last) {
+		return;
+	}
+	if(block == NULL || block->count >= HISTORY_BLOCK_POINTS) {
+		block = history_new_block(tier, type);
+	}
+	if(block->count == 0) {
+		block->first = ts;
+	} else {
+		delta = ts - block->last;
+		dod = delta - block->delta;
+		history_put_varint(&block->ts, ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63));
+		block->delta = delta;
+	}
+	block->last = ts;
+	for(i=0;i<history_columns[type];i++) {
+		history_put_value(&block->columns[i], values[i]);
+	}
+	block->count++;
+}
+
+static void history_fold(struct history_bucket_t *bucket, int64_t start, double min, double max, double sum, double count) {
+	if(bucket->count == 0) {
+		bucket->start = start;
+		bucket->min = min;
+		bucket->max = max;
+		bucket->sum = sum;
+		bucket->count = count;
+	} else {
+		if(min < bucket->min) {
+			bucket->min = min;
+		}
+		if(max > bucket->max) {
+			bucket->max = max;
+		}
+		bucket->sum += sum;
+		bucket->count += count;
+	}
+}
+
+static void history_flush(struct history_series_t *series, int type, struct history_bucket_t *bucket) {
+	double values[4] = { bucket->min, bucket->max, bucket->sum, bucket->count };
+
+	history_append(series, type, bucket->start, values);
+	bucket->count = 0;
+}
+
+/* Close the current minute and fold it into the current hour */
+static void history_flush_minute(struct history_series_t *series) {
+	struct history_bucket_t *minute = &series->minute;
+	int64_t start = minute->start - (minute->start % 3600);
+
+	if(series->hour.count > 0 && series->hour.start != start) {
+		history_flush(series, HISTORY_HOUR, &series->hour);
+	}
+	history_fold(&series->hour, start, minute->min, minute->max, minute->sum, minute->count);
+	history_flush(series, HISTORY_MINUTE, minute);
+}
+
+void history_add(char *device, char *name, double value, int decimals, time_t timestamp) {
+	struct history_series_t *series = NULL;
+	int64_t ts = (int64_t)timestamp, start = ts - (ts % 60);
+
+	if(history_init_done == 0 || history_file == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&history_lock);
+	if((series = history_find(device, name)) == NULL) {
+		series = history_create(device, name);
+	}
+	series->decimals = decimals;
+
+	history_append(series, HISTORY_RAW, ts, &value);
+
+	if(series->minute.count > 0 && start < series->minute.start) {
+		pthread_mutex_unlock(&history_lock);
+		return;
+	}
+	if(series->minute.count > 0 && series->minute.start != start) {
+		history_flush_minute(series);
+	}
+	history_fold(&series->minute, start, value, value, value, 1);
+	pthread_mutex_unlock(&history_lock);
+}
+
+static void history_emit(struct history_bucket_t *bucket, time_t from, time_t to, history_callback_t callback, void *userdata) {
+	double values[4];
+
+	if(bucket->count > 0 && bucket->start >= from && bucket->start <= to) {
+		values[0] = bucket->min;
+		values[1] = bucket->max;
+		values[2] = bucket->sum / bucket->count;
+		values[3] = bucket->count;
+		callback((time_t)bucket->start, values, 4, userdata);
+	}
+}
+
+static int history_walk(struct history_series_t *series, time_t from, time_t to, int type, history_callback_t callback, void *userdata) {
+	struct history_block_t *block = NULL;
+	struct history_bucket_t bucket;
+	uint64_t prev[HISTORY_COLUMNS], u = 0;
+	size_t tspos = 0, pos[HISTORY_COLUMNS];
+	double values[HISTORY_COLUMNS];
+	int64_t ts = 0, delta = 0;
+	unsigned int x = 0;
+	int i = 0, ncols = 0;
+
+	/* Use the finest tier that still covers the requested period */
+	if(type == HISTORY_AUTO) {
+		for(type=HISTORY_RAW;type<HISTORY_HOUR;type++) {
+			if(series->tiers[type].truncated == 0 ||
+			   (series->tiers[type].blocks != NULL && series->tiers[type].blocks->first <= from)) {
+				break;
+			}
+		}
+	}
+	ncols = history_columns[type];
+
+	block = series->tiers[type].blocks;
+	while(block) {
+		if(block->count == 0 || block->last < from || block->first > to) {
+			block = block->next;
+			continue;
+		}
+		memset(prev, 0, sizeof(prev));
+		memset(pos, 0, sizeof(pos));
+		tspos = 0;
+		ts = block->first;
+		delta = 0;
+		for(x=0;x<block->count;x++) {
+			if(x > 0) {
+				if(history_get_varint(&block->ts, &tspos, &u) != 0) {
+					break;
+				}
+				delta += (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+				ts += delta;
+			}
+			for(i=0;i<ncols;i++) {
+				if(history_get_value(&block->columns[i], &pos[i], &prev[i], &values[i]) != 0) {
+					break;
+				}
+			}
+			if(i < ncols || ts > to) {
+				break;
+			}
+			if(ts >= from) {
+				if(ncols > 1) {
+					values[2] = (values[3] > 0) ? values[2] / values[3] : 0;
+				}
+				callback((time_t)ts, values, ncols, userdata);
+			}
+		}
+		block = block->next;
+	}
+
+	/* Include the buckets that are still open */
+	if(type == HISTORY_MINUTE) {
+		history_emit(&series->minute, from, to, callback, userdata);
+	} else if(type == HISTORY_HOUR) {
+		memcpy(&bucket, &series->hour, sizeof(struct history_bucket_t));
+		if(series->minute.count > 0) {
+			ts = series->minute.start - (series->minute.start % 3600);
+			if(bucket.count > 0 && bucket.start != ts) {
+				history_emit(&bucket, from, to, callback, userdata);
+				bucket.count = 0;
+			}
+			history_fold(&bucket, ts, series->minute.min, series->minute.max, series->minute.sum, series->minute.count);
+		}
+		history_emit(&bucket, from, to, callback, userdata);
+	}
+	return type;
+}
+
+int history_query(char *device, char *name, time_t from, time_t to, int tier, history_callback_t callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct history_series_t *series = NULL;
+	int ret = -1;
+
+	if(history_init_done == 0) {
+		return -1;
+	}
+	pthread_mutex_lock(&history_lock);
+	if((series = history_find(device, name)) != NULL) {
+		ret = history_walk(series, from, to, tier, callback, userdata);
+	}
+	pthread_mutex_unlock(&history_lock);
+	return ret;
+}
+
+static void history_collect(time_t timestamp, double *values, int nrvalues, void *userdata) {
+	struct history_bucket_t *bucket = userdata;
+
+	if(nrvalues == 1) {
+		history_fold(bucket, 0, values[0], values[0], values[0], 1);
+	} else {
+		history_fold(bucket, 0, values[0], values[1], values[2]*values[3], values[3]);
+	}
+}
+
+int history_aggregate(char *device, char *name, time_t from, time_t to, int type, double *out, int *decimals) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct history_series_t *series = NULL;
+	struct history_bucket_t bucket;
+
+	if(history_init_done == 0) {
+		return -1;
+	}
+	memset(&bucket, 0, sizeof(struct history_bucket_t));
+
+	pthread_mutex_lock(&history_lock);
+	if((series = history_find(device, name)) == NULL ||
+	   history_walk(series, from, to, HISTORY_AUTO, &history_collect, &bucket) == -1) {
+		pthread_mutex_unlock(&history_lock);
+		return -1;
+	}
+	*decimals = series->decimals;
+	pthread_mutex_unlock(&history_lock);
+
+	if(bucket.count == 0) {
+		return -1;
+	}
+	switch(type) {
+		case HISTORY_MIN:
+			*out = bucket.min;
+		break;
+		case HISTORY_MAX:
+			*out = bucket.max;
+		break;
+		case HISTORY_SUM:
+			*out = bucket.sum;
+		break;
+		case HISTORY_COUNT:
+			*out = bucket.count;
+			*decimals = 0;
+		break;
+		case HISTORY_AVG:
+		default:
+			*out = bucket.sum / bucket.count;
+		break;
+	}
+	return 0;
+}
+
+int history_tier(const char *name) {
+	int i = 0;
+
+	for(i=0;i<HISTORY_TIERS;i++) {
+		if(strcmp(history_tiers[i], name) == 0) {
+			return i;
+		}
+	}
+	return HISTORY_AUTO;
+}
+
+struct history_print_t {
+	struct JsonNode *jdata;
+	int decimals;
+};
+
+static void history_print_point(time_t timestamp, double *values, int nrvalues, void *userdata) {
+	struct history_print_t *print = userdata;
+	struct JsonNode *jpoint = json_mkarray();
+
+	json_append_element(jpoint, json_mknumber((double)timestamp, 0));
+	if(nrvalues == 1) {
+		json_append_element(jpoint, json_mknumber(values[0], print->decimals));
+	} else {
+		json_append_element(jpoint, json_mknumber(values[0], print->decimals));
+		json_append_element(jpoint, json_mknumber(values[1], print->decimals));
+		json_append_element(jpoint, json_mknumber(values[2], print->decimals+1));
+		json_append_element(jpoint, json_mknumber(values[3], 0));
+	}
+	json_append_element(print->jdata, jpoint);
+}
+
+JsonNode *history_print(char *device, char *name, time_t from, time_t to, int tier) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct history_series_t *series = NULL;
+	struct history_print_t print;
+	struct JsonNode *jroot = NULL;
+
+	if(history_init_done == 0) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&history_lock);
+	if((series = history_find(device, name)) == NULL) {
+		pthread_mutex_unlock(&history_lock);
+		return NULL;
+	}
+	print.jdata = json_mkarray();
+	print.decimals = series->decimals;
+	tier = history_walk(series, from, to, tier, &history_print_point, &print);
+	pthread_mutex_unlock(&history_lock);
+
+	jroot = json_mkobject();
+	json_append_member(jroot, "message", json_mkstring("history"));
+	json_append_member(jroot, "device", json_mkstring(device));
+	json_append_member(jroot, "value", json_mkstring(name));
+	json_append_member(jroot, "tier", json_mkstring(history_tiers[tier]));
+	json_append_member(jroot, "data", print.jdata);
+	return jroot;
+}
+
+static void history_put_string(struct history_buffer_t *buf, const char *str) {
+	uint16_t len = (uint16_t)strlen(str);
+
+	history_put(buf, &len, sizeof(len));
+	history_put(buf, str, len);
+}
+
+static void history_put_bucket(struct history_buffer_t *buf, struct history_bucket_t *bucket) {
+	history_put(buf, &bucket->start, sizeof(bucket->start));
+	history_put(buf, &bucket->min, sizeof(bucket->min));
+	history_put(buf, &bucket->max, sizeof(bucket->max));
+	history_put(buf, &bucket->sum, sizeof(bucket->sum));
+	history_put(buf, &bucket->count, sizeof(bucket->count));
+}
+
+static void history_put_bytes(struct history_buffer_t *buf, struct history_buffer_t *data) {
+	uint32_t len = (uint32_t)data->len;
+
+	history_put(buf, &len, sizeof(len));
+	if(len > 0) {
+		history_put(buf, data->bytes, len);
+	}
+}
+
+/*
+ * The history file is the magic, followed by every series with its
+ * open buckets and the blocks of all tiers as stored in memory, and
+ * a checksum over everything after the magic.
+ */
+static void history_serialize(struct history_buffer_t *buf) {
+	struct history_series_t *series = NULL;
+	struct history_block_t *block = NULL;
+	uint32_t checksum = 0, nr = 0;
+	int32_t decimals = 0, truncated = 0;
+	int i = 0, x = 0, y = 0;
+
+	history_put(buf, history_magic, sizeof(history_magic));
+	for(i=0;i<HISTORY_SERIES_BUCKETS;i++) {
+		for(series=history_series[i];series;series=series->next) {
+			history_put_string(buf, series->device);
+			history_put_string(buf, series->name);
+			decimals = series->decimals;
+			history_put(buf, &decimals, sizeof(decimals));
+			history_put_bucket(buf, &series->minute);
+			history_put_bucket(buf, &series->hour);
+			for(x=0;x<HISTORY_TIERS;x++) {
+				truncated = series->tiers[x].truncated;
+				nr = series->tiers[x].nrblocks;
+				history_put(buf, &truncated, sizeof(truncated));
+				history_put(buf, &nr, sizeof(nr));
+				for(block=series->tiers[x].blocks;block;block=block->next) {
+					history_put(buf, &block->first, sizeof(block->first));
+					history_put(buf, &block->last, sizeof(block->last));
+					history_put(buf, &block->delta, sizeof(block->delta));
+					nr = block->count;
+					history_put(buf, &nr, sizeof(nr));
+					history_put_bytes(buf, &block->ts);
+					for(y=0;y<history_columns[x];y++) {
+						history_put(buf, &block->columns[y].prev, sizeof(block->columns[y].prev));
+						history_put_bytes(buf, &block->columns[y].data);
+					}
+				}
+			}
+		}
+	}
+	checksum = fnv1a(&buf->bytes[sizeof(history_magic)], buf->len-sizeof(history_magic));
+	history_put(buf, &checksum, sizeof(checksum));
+}
+
+static int history_get(unsigned char *content, size_t bytes, size_t *pos, void *out, size_t len) {
+	if(*pos+len > bytes) {
+		return -1;
+	}
+	memcpy(out, &content[*pos], len);
+	*pos += len;
+	return 0;
+}
+
+static int history_get_string(unsigned char *content, size_t bytes, size_t *pos, char **out) {
+	uint16_t len = 0;
+
+	if(history_get(content, bytes, pos, &len, sizeof(len)) != 0 || *pos+len > bytes) {
+		return -1;
+	}
+	if((*out = MALLOC((size_t)len+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(*out, &content[*pos], len);
+	(*out)[len] = '\0';
+	*pos += len;
+	return 0;
+}
+
+static int history_get_bucket(unsigned char *content, size_t bytes, size_t *pos, struct history_bucket_t *bucket) {
+	if(history_get(content, bytes, pos, &bucket->start, sizeof(bucket->start)) != 0 ||
+	   history_get(content, bytes, pos, &bucket->min, sizeof(bucket->min)) != 0 ||
+	   history_get(content, bytes, pos, &bucket->max, sizeof(bucket->max)) != 0 ||
+	   history_get(content, bytes, pos, &bucket->sum, sizeof(bucket->sum)) != 0 ||
+	   history_get(content, bytes, pos, &bucket->count, sizeof(bucket->count)) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static int history_get_bytes(unsigned char *content, size_t bytes, size_t *pos, struct history_buffer_t *data) {
+	uint32_t len = 0;
+
+	if(history_get(content, bytes, pos, &len, sizeof(len)) != 0 || *pos+len > bytes) {
+		return -1;
+	}
+	if(len > 0) {
+		history_put(data, &content[*pos], len);
+		*pos += len;
+	}
+	return 0;
+}
+
+static int history_deserialize(unsigned char *content, size_t bytes) {
+	struct history_series_t *series = NULL;
+	struct history_block_t *block = NULL;
+	struct history_tier_t *tier = NULL;
+	char *device = NULL, *name = NULL;
+	size_t pos = sizeof(history_magic);
+	uint32_t nr = 0, count = 0, n = 0;
+	int32_t decimals = 0, truncated = 0;
+	int x = 0, y = 0;
+
+	while(pos < bytes) {
+		if(history_get_string(content, bytes, &pos, &device) != 0) {
+			return -1;
+		}
+		if(history_get_string(content, bytes, &pos, &name) != 0) {
+			FREE(device);
+			return -1;
+		}
+		if((series = history_find(device, name)) == NULL) {
+			series = history_create(device, name);
+		}
+		FREE(device);
+		FREE(name);
+
+		if(history_get(content, bytes, &pos, &decimals, sizeof(decimals)) != 0 ||
+		   history_get_bucket(content, bytes, &pos, &series->minute) != 0 ||
+		   history_get_bucket(content, bytes, &pos, &series->hour) != 0) {
+			return -1;
+		}
+		series->decimals = decimals;
+		for(x=0;x<HISTORY_TIERS;x++) {
+			tier = &series->tiers[x];
+			if(history_get(content, bytes, &pos, &truncated, sizeof(truncated)) != 0 ||
+			   history_get(content, bytes, &pos, &nr, sizeof(nr)) != 0) {
+				return -1;
+			}
+			for(n=0;n<nr;n++) {
+				block = history_new_block(tier, x);
+				if(history_get(content, bytes, &pos, &block->first, sizeof(block->first)) != 0 ||
+				   history_get(content, bytes, &pos, &block->last, sizeof(block->last)) != 0 ||
+				   history_get(content, bytes, &pos, &block->delta, sizeof(block->delta)) != 0 ||
+				   history_get(content, bytes, &pos, &count, sizeof(count)) != 0 ||
+				   history_get_bytes(content, bytes, &pos, &block->ts) != 0) {
+					return -1;
+				}
+				block->count = count;
+				for(y=0;y<history_columns[x];y++) {
+					if(history_get(content, bytes, &pos, &block->columns[y].prev, sizeof(block->columns[y].prev)) != 0 ||
+					   history_get_bytes(content, bytes, &pos, &block->columns[y].data) != 0) {
+						return -1;
+					}
+				}
+			}
+			tier->truncated |= truncated;
+		}
+	}
+	return 0;
+}
+
+static int history_load(void) {
+	unsigned char *content = NULL;
+	struct stat st;
+	size_t bytes = 0, pos = 0;
+	ssize_t n = 0;
+	uint32_t checksum = 0;
+	int fd = 0, ret = 0;
+
+	if((fd = open(history_file, O_RDONLY | O_BINARY)) == -1) {
+		return 0;
+	}
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	bytes = (size_t)st.st_size;
+	if((content = MALLOC(bytes+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	while(pos < bytes) {
+		if((n = read(fd, &content[pos], bytes-pos)) <= 0) {
+			if(n == -1 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		pos += (size_t)n;
+	}
+	close(fd);
+	bytes = pos;
+
+	if(bytes < sizeof(history_magic)+sizeof(checksum) ||
+	   memcmp(content, history_magic, sizeof(history_magic)) != 0) {
+		ret = -1;
+	} else {
+		memcpy(&checksum, &content[bytes-sizeof(checksum)], sizeof(checksum));
+		bytes -= sizeof(checksum);
+		if(checksum != fnv1a(&content[sizeof(history_magic)], bytes-sizeof(history_magic)) ||
+		   history_deserialize(content, bytes) != 0) {
+			ret = -1;
+		}
+	}
+	FREE(content);
+
+	if(ret != 0) {
+		logprintf(LOG_NOTICE, "history file %s is invalid, starting a new one", history_file);
+	}
+	return ret;
+}
+
+int history_save(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct history_buffer_t buf;
+	char *tmpfile = NULL, *file = NULL;
+	size_t pos = 0;
+	ssize_t n = 0;
+	int fd = 0, ret = 0;
+
+	if(history_init_done == 0 || history_file == NULL) {
+		return -1;
+	}
+
+	memset(&buf, 0, sizeof(struct history_buffer_t));
+
+	pthread_mutex_lock(&history_save_lock);
+
+	/* Only take a snapshot under the history lock, so new values
+	   can be added while the snapshot is written and synced */
+	pthread_mutex_lock(&history_lock);
+	if((file = MALLOC(strlen(history_file)+1)) == NULL ||
+	   (tmpfile = MALLOC(strlen(history_file)+5)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(file, history_file);
+	sprintf(tmpfile, "%s.tmp", history_file);
+	history_serialize(&buf);
+	pthread_mutex_unlock(&history_lock);
+
+	if((fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRUSR | S_IWUSR)) == -1) {
+		logprintf(LOG_ERR, "cannot write history file: %s", tmpfile);
+		ret = -1;
+	} else {
+		while(pos < buf.len) {
+			if((n = write(fd, &buf.bytes[pos], buf.len-pos)) <= 0) {
+				if(n == -1 && errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+			pos += (size_t)n;
+		}
+#ifdef _WIN32
+		_commit(fd);
+#else
+		fsync(fd);
+#endif
+		close(fd);
+#ifdef _WIN32
+		if(pos < buf.len || MoveFileEx(tmpfile, file, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == 0) {
+#else
+		if(pos < buf.len || rename(tmpfile, file) == -1) {
+#endif
+			logprintf(LOG_ERR, "cannot write history file: %s", file);
+			unlink(tmpfile);
+			ret = -1;
+		}
+	}
+	pthread_mutex_unlock(&history_save_lock);
+
+	if(buf.bytes != NULL) {
+		FREE(buf.bytes);
+	}
+	FREE(tmpfile);
+	FREE(file);
+	return ret;
+}
+
+void *history_writer(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct timeval tp;
+	struct timespec ts;
+
+	if(history_init_done == 0 || history_file == NULL) {
+		return (void *)NULL;
+	}
+
+	pthread_mutex_lock(&history_lock);
+	while(history_loop) {
+		gettimeofday(&tp, NULL);
+		ts.tv_sec = tp.tv_sec + HISTORY_SAVE_INTERVAL;
+		ts.tv_nsec = tp.tv_usec * 1000;
+		while(history_loop && pthread_cond_timedwait(&history_signal, &history_lock, &ts) != ETIMEDOUT);
+
+		if(history_loop == 1) {
+			pthread_mutex_unlock(&history_lock);
+			history_save();
+			pthread_mutex_lock(&history_lock);
+		}
+	}
+	pthread_mutex_unlock(&history_lock);
+
+	return (void *)NULL;
+}
+
+int history_init(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	char *file = NULL;
+
+	if(history_init_done == 0) {
+		pthread_mutexattr_init(&history_attr);
+		pthread_mutexattr_settype(&history_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&history_lock, &history_attr);
+		pthread_mutex_init(&history_save_lock, NULL);
+		pthread_cond_init(&history_signal, NULL);
+		memset(history_series, 0, sizeof(history_series));
+		history_init_done = 1;
+	}
+
+	if(settings_find_string("history-file", &file) != 0) {
+		file = HISTORY_FILE;
+	}
+	/* An empty path disables the history */
+	if(strlen(file) == 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&history_lock);
+	if((history_file = REALLOC(history_file, strlen(file)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(history_file, file);
+	history_loop = 1;
+	history_load();
+	pthread_mutex_unlock(&history_lock);
+
+	return 0;
+}
+
+int history_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct history_series_t *series = NULL, *next = NULL;
+	struct history_block_t *block = NULL;
+	int i = 0, x = 0, save = 0;
+
+	if(history_init_done == 1) {
+		pthread_mutex_lock(&history_lock);
+		if(history_loop == 1) {
+			history_loop = 0;
+			pthread_cond_signal(&history_signal);
+			save = 1;
+		}
+		pthread_mutex_unlock(&history_lock);
+
+		if(save == 1) {
+			history_save();
+		}
+
+		pthread_mutex_lock(&history_lock);
+		for(i=0;i<HISTORY_SERIES_BUCKETS;i++) {
+			series = history_series[i];
+			while(series) {
+				next = series->next;
+				for(x=0;x<HISTORY_TIERS;x++) {
+					while(series->tiers[x].blocks) {
+						block = series->tiers[x].blocks;
+						series->tiers[x].blocks = block->next;
+						history_free_block(block);
+					}
+				}
+				FREE(series->device);
+				FREE(series->name);
+				FREE(series);
+				series = next;
+			}
+			history_series[i] = NULL;
+		}
+		if(history_file != NULL) {
+			FREE(history_file);
+		}
+		pthread_mutex_unlock(&history_lock);
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected history library");
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <time.h>
+
+#include "json.h"
+
+/* Downsampling tiers */
+#define HISTORY_AUTO						-1
+#define HISTORY_RAW							0
+#define HISTORY_MINUTE					1
+#define HISTORY_HOUR						2
+#define HISTORY_TIERS						3
+
+/* Points per compressed block and the number of blocks kept per tier */
+#define HISTORY_BLOCK_POINTS		128
+#define HISTORY_RAW_BLOCKS			64
+#define HISTORY_MINUTE_BLOCKS		96
+#define HISTORY_HOUR_BLOCKS			96
+
+/* Seconds between two writes of the history file */
+#define HISTORY_SAVE_INTERVAL		300
+
+/* Aggregate functions */
+#define HISTORY_AVG							0
+#define HISTORY_MIN							1
+#define HISTORY_MAX							2
+#define HISTORY_SUM							3
+#define HISTORY_COUNT						4
+
+/*
+ * Raw points are passed as a single value, downsampled
+ * points as minimum, maximum, average and count.
+ */
+typedef void (*history_callback_t)(time_t timestamp, double *values, int nrvalues, void *userdata);
+
+int history_init(void);
+void history_add(char *device, char *name, double value, int decimals, time_t timestamp);
+int history_query(char *device, char *name, time_t from, time_t to, int tier, history_callback_t callback, void *userdata);
+int history_aggregate(char *device, char *name, time_t from, time_t to, int type, double *out, int *decimals);
+JsonNode *history_print(char *device, char *name, time_t from, time_t to, int tier);
+int history_tier(const char *name);
+int history_save(void);
+void *history_writer(void *param);
+int history_gc(void);
+
+#endif
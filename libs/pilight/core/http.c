@@ -25,7 +25,9 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/types.h>
 #ifdef _WIN32
 	#define WIN32_LEAN_AND_MEAN
@@ -43,10 +45,14 @@
 
 
 #include "pilight.h"
+#include "common.h"
 #include "socket.h"
+#include "threads.h"
 #include "log.h"
 #include "network.h"
+#include "http.h"
 #include "../../polarssl/polarssl/ssl.h"
+#include "../../polarssl/polarssl/net.h"
 #include "../../polarssl/polarssl/entropy.h"
 #include "../../polarssl/polarssl/ctr_drbg.h"
 
@@ -54,361 +60,746 @@
 #define HTTP_POST			1
 #define HTTP_GET			0
 
-char *http_process_request(char *url, int method, char **type, int *code, int *size, const char *contype, char *post) {
-	struct sockaddr_in serv_addr;
-	int sockfd = 0, bytes = 0;
-	int has_code = 0, has_type = 0;
-	int pos = 0;
-	size_t bufsize = BUFFER_SIZE;
-	char ip[INET_ADDRSTRLEN+1], *content = NULL, *host = NULL, *auth = NULL, *auth64 = NULL;
-	char *page = NULL, *tok = NULL;
-	char recvBuff[BUFFER_SIZE+1], *header = MALLOC(bufsize);
-	unsigned short port = 0, sslfree = 0, entropyfree = 0;
-	size_t len = 0, tlen = 0, plen = 0;
-
-	entropy_context entropy;
-	ctr_drbg_context ctr_drbg;
+/* Idle keep-alive connections are closed after this many seconds */
+#define HTTP_IDLE			30
+/* Idle connections kept per host */
+#define HTTP_POOL			2
+/* Seconds a resolved host name is reused */
+#define HTTP_DNS_TTL	300
+/* Read and write timeout in seconds */
+#define HTTP_TIMEOUT	10
+/* Largest response we are willing to buffer */
+#define HTTP_MAX_SIZE	1048576
+/* Callers pass a content type buffer of at least this size */
+#define HTTP_TYPE_SIZE	64
+
+#define HTTP_BODY_NONE		0
+#define HTTP_BODY_LENGTH	1
+#define HTTP_BODY_CHUNKED	2
+#define HTTP_BODY_CLOSE		3
+
+typedef struct http_conn_t {
+	char *host;
+	unsigned short port;
+	int tls;
+	int fd;
+	int handshake;
 	ssl_context ssl;
+	time_t used;
+	struct http_conn_t *next;
+} http_conn_t;
+
+typedef struct http_dns_t {
+	char *host;
+	char ip[INET_ADDRSTRLEN+1];
+	time_t expire;
+	struct http_dns_t *next;
+} http_dns_t;
+
+typedef struct http_session_t {
+	char *host;
+	unsigned short port;
+	ssl_session session;
+	struct http_session_t *next;
+} http_session_t;
+
+typedef struct http_request_t {
+	int method;
+	char *url;
+	char *contype;
+	char *post;
+	http_callback_t callback;
+	void *userdata;
+	struct http_request_t *next;
+} http_request_t;
+
+typedef struct http_buffer_t {
+	char *data;
+	size_t len;
+	size_t size;
+} http_buffer_t;
+
+static pthread_mutex_t http_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t http_rng_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t http_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_queue_signal = PTHREAD_COND_INITIALIZER;
+
+static struct http_conn_t *http_pool = NULL;
+static struct http_dns_t *http_dns = NULL;
+static struct http_session_t *http_sessions = NULL;
+static struct http_request_t *http_queue = NULL;
+
+static entropy_context http_entropy;
+static ctr_drbg_context http_ctr_drbg;
+static int http_rng_ready = 0;
+
+static pthread_t http_pth;
+static int http_worker_started = 0;
+static int http_loop = 1;
+
+static void http_buffer_append(struct http_buffer_t *buf, const char *data, size_t len) {
+	if(buf->len+len+1 > buf->size) {
+		while(buf->len+len+1 > buf->size) {
+			buf->size += BUFFER_SIZE;
+		}
+		if((buf->data = REALLOC(buf->data, buf->size)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
 
-	*size = 0;
+static void http_buffer_printf(struct http_buffer_t *buf, const char *fmt, ...) {
+	va_list ap;
+	int n = 0;
 
-	memset(header, '\0', bufsize);
-	memset(recvBuff, '\0', BUFFER_SIZE+1);
-	memset(&serv_addr, '\0', sizeof(struct sockaddr_in));
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	char line[n+1];
+	va_start(ap, fmt);
+	vsnprintf(line, (size_t)n+1, fmt, ap);
+	va_end(ap);
+
+	http_buffer_append(buf, line, (size_t)n);
+}
+
+static char *http_strndup(const char *str, size_t len) {
+	char *out = NULL;
+	if((out = MALLOC(len+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(out, str, len);
+	out[len] = '\0';
+	return out;
+}
+
+/* Split an url in the host, port, page and credentials part */
+static int http_parse_url(char *url, char **host, unsigned short *port, int *tls, char **page, char **auth) {
+	char *p = NULL, *end = NULL, *at = NULL, *colon = NULL;
 
-	/* Check which port we need to use based on the http(s) protocol */
 	if(strncmp(url, "http://", 7) == 0) {
-		port = 80;
-		plen = 8;
+		*port = 80;
+		*tls = 0;
+		p = &url[7];
 	} else if(strncmp(url, "https://", 8) == 0) {
-		port = 443;
-		plen = 9;
+		*port = 443;
+		*tls = 1;
+		p = &url[8];
 	} else {
-		logprintf(LOG_ERR, "an url should start with either http:// or https://", url);
-		*code = -1;
-		goto exit;
+		return -1;
 	}
 
-	/* Split the url into a host and page part */
-	len = strlen(url);
-	if((tok = strstr(&url[plen], "/"))) {
-		tlen = (size_t)(tok-url)-plen+1;
-		host = MALLOC(tlen+1);
-		strncpy(host, &url[plen-1], tlen);
-		host[tlen] = '\0';
-		page = MALLOC(len-tlen);
-		strcpy(page, &url[tlen+(plen-1)]);
+	if((end = strstr(p, "/")) == NULL) {
+		end = &p[strlen(p)];
+	}
+	for(at=end;at>p && *(at-1) != '@';at--);
+	if(at > p) {
+		*auth = http_strndup(p, (size_t)(at-p-1));
+		p = at;
+	}
+	for(colon=p;colon<end && *colon != ':';colon++);
+	if(colon < end) {
+		*port = (unsigned short)atoi(colon+1);
+	}
+	if(colon == p || *port == 0) {
+		return -1;
+	}
+	*host = http_strndup(p, (size_t)(colon-p));
+	if(*end == '\0') {
+		*page = http_strndup("/", 1);
 	} else {
-		tlen = strlen(url)-(plen-1);
-		host = MALLOC(tlen+1);
-		strncpy(host, &url[(plen-1)], tlen);
-		host[tlen] = '\0';
-		page = MALLOC(2);
-		strcpy(page, "/");
-	}
-	if((tok = strstr(host, "@"))) {
-		size_t pglen = strlen(page);
-		if(strcmp(page, "/") == 0) {
-			pglen -= 1;
-		}
-		tlen = (size_t)(tok-host);
-		auth = MALLOC(tlen+1);
-		strncpy(auth, &host[0], tlen);
-		auth[tlen] = '\0';
-		strncpy(&host[0], &url[plen+tlen], len-(plen+tlen+pglen));
-		host[len-(plen+tlen+pglen)] = '\0';
-		auth64 = base64encode(auth, strlen(auth));
+		*page = http_strndup(end, strlen(end));
+	}
+	return 0;
+}
+
+static int http_resolve(char *host, char *ip) {
+	struct http_dns_t *tmp = NULL;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_dns;tmp!=NULL;tmp=tmp->next) {
+		if(strcmp(tmp->host, host) == 0 && tmp->expire > now) {
+			strcpy(ip, tmp->ip);
+			pthread_mutex_unlock(&http_lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&http_lock);
+
+	if(host2ip(host, ip) == -1) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_dns;tmp!=NULL;tmp=tmp->next) {
+		if(strcmp(tmp->host, host) == 0) {
+			break;
+		}
+	}
+	if(tmp == NULL) {
+		if((tmp = MALLOC(sizeof(struct http_dns_t))) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		tmp->host = http_strndup(host, strlen(host));
+		tmp->next = http_dns;
+		http_dns = tmp;
+	}
+	snprintf(tmp->ip, sizeof(tmp->ip), "%s", ip);
+	tmp->expire = now+HTTP_DNS_TTL;
+	pthread_mutex_unlock(&http_lock);
+	return 0;
+}
+
+/* The random generator is shared by all tls connections */
+static int http_random(void *param, unsigned char *output, size_t len) {
+	int ret = 0;
+	pthread_mutex_lock(&http_rng_lock);
+	ret = ctr_drbg_random(param, output, len);
+	pthread_mutex_unlock(&http_rng_lock);
+	return ret;
+}
+
+static int http_rng_init(void) {
+	int ret = 0;
+
+	pthread_mutex_lock(&http_rng_lock);
+	if(http_rng_ready == 0) {
+		entropy_init(&http_entropy);
+		if(ctr_drbg_init(&http_ctr_drbg, entropy_func, &http_entropy, (const unsigned char *)USERAGENT, 6) != 0) {
+			logprintf(LOG_ERR, "ctr_drbg_init failed");
+			entropy_free(&http_entropy);
+			ret = -1;
+		} else {
+			http_rng_ready = 1;
+		}
+	}
+	pthread_mutex_unlock(&http_rng_lock);
+	return ret;
+}
+
+static void http_session_load(struct http_conn_t *conn) {
+	struct http_session_t *tmp = NULL;
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_sessions;tmp!=NULL;tmp=tmp->next) {
+		if(tmp->port == conn->port && strcmp(tmp->host, conn->host) == 0) {
+			ssl_set_session(&conn->ssl, &tmp->session);
+			break;
+		}
 	}
+	pthread_mutex_unlock(&http_lock);
+}
+
+static void http_session_store(struct http_conn_t *conn) {
+	struct http_session_t *tmp = NULL;
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_sessions;tmp!=NULL;tmp=tmp->next) {
+		if(tmp->port == conn->port && strcmp(tmp->host, conn->host) == 0) {
+			break;
+		}
+	}
+	if(tmp == NULL) {
+		if((tmp = MALLOC(sizeof(struct http_session_t))) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		tmp->host = http_strndup(conn->host, strlen(conn->host));
+		tmp->port = conn->port;
+		ssl_session_init(&tmp->session);
+		tmp->next = http_sessions;
+		http_sessions = tmp;
+	} else {
+		ssl_session_free(&tmp->session);
+	}
+	if(ssl_get_session(&conn->ssl, &tmp->session) != 0) {
+		ssl_session_init(&tmp->session);
+	}
+	pthread_mutex_unlock(&http_lock);
+}
+
+static void http_close(struct http_conn_t *conn) {
+	if(conn->tls == 1) {
+		if(conn->handshake == 1) {
+			ssl_close_notify(&conn->ssl);
+		}
+		ssl_free(&conn->ssl);
+	}
+	if(conn->fd > 0) {
+		close(conn->fd);
+	}
+	FREE(conn->host);
+	FREE(conn);
+}
+
+static struct http_conn_t *http_connect(char *host, unsigned short port, int tls, char *url) {
+	struct sockaddr_in serv_addr;
+	struct http_conn_t *conn = NULL;
+	char ip[INET_ADDRSTRLEN+1];
+	int ret = 0;
 
 #ifdef _WIN32
 	WSADATA wsa;
 
 	if(WSAStartup(0x202, &wsa) != 0) {
 		logprintf(LOG_ERR, "could not initialize new socket");
-		*code = -1;
-		goto exit;
+		return NULL;
 	}
 #endif
 
-	if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
-		logprintf(LOG_ERR, "could not http create socket");
-		*code = -1;
-		goto exit;
-	}
-  setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, 0, 0);
-
-	char *w = ip;
-	if(host2ip(host, w) == -1) {
-		*code = -1;
-		goto exit;
+	if(http_resolve(host, ip) == -1) {
+		return NULL;
 	}
 
+	memset(&serv_addr, '\0', sizeof(struct sockaddr_in));
 	serv_addr.sin_family = AF_INET;
 	if(inet_pton(AF_INET, ip, (void *)(&(serv_addr.sin_addr.s_addr))) <= 0) {
 		logprintf(LOG_ERR, "%s is not a valid ip address", ip);
-		*code = -1;
-		goto exit;
+		return NULL;
 	}
 	serv_addr.sin_port = htons(port);
 
+	if((conn = MALLOC(sizeof(struct http_conn_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(conn, '\0', sizeof(struct http_conn_t));
+	conn->host = http_strndup(host, strlen(host));
+	conn->port = port;
+
+	if((conn->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		logprintf(LOG_ERR, "could not http create socket");
+		conn->fd = 0;
+		http_close(conn);
+		return NULL;
+	}
+
 	/* Proper socket timeout testing */
-	switch(socket_timeout_connect(sockfd, (struct sockaddr *)&serv_addr, 3)) {
+	switch(socket_timeout_connect(conn->fd, (struct sockaddr *)&serv_addr, 3)) {
 		case -1:
 			logprintf(LOG_ERR, "could not connect to http socket (%s)", url);
-			*code = -1;
-			goto exit;
+			http_close(conn);
+			return NULL;
 		case -2:
 			logprintf(LOG_ERR, "http socket connection timeout (%s)", url);
-			*code = -1;
-			goto exit;
+			http_close(conn);
+			return NULL;
 		case -3:
-			logprintf(LOG_ERR, "error in http socket connection", url);
-			*code = -1;
-			goto exit;
+			logprintf(LOG_ERR, "error in http socket connection (%s)", url);
+			http_close(conn);
+			return NULL;
 		default:
 		break;
 	}
 
-	if(method == HTTP_POST) {
-		len = (size_t)snprintf(&header[0], bufsize, "POST %s HTTP/1.0\r\n", page);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+#ifdef _WIN32
+	DWORD tv = HTTP_TIMEOUT*1000;
+#else
+	struct timeval tv;
+	tv.tv_sec = HTTP_TIMEOUT;
+	tv.tv_usec = 0;
+#endif
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
+	setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(tv));
+
+	if(tls == 1) {
+		if(http_rng_init() != 0) {
+			http_close(conn);
+			return NULL;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "Host: %s\r\n", host);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+		if(ssl_init(&conn->ssl) != 0) {
+			logprintf(LOG_ERR, "ssl_init failed");
+			http_close(conn);
+			return NULL;
 		}
-		if(auth64 != NULL) {
-			len += (size_t)snprintf(&header[len], bufsize - len, "Authorization: Basic %s\r\n", auth64);
-			if(len >= bufsize) {
-				bufsize += BUFFER_SIZE;
-				if((header = REALLOC(header, bufsize)) == NULL) {
-					logprintf(LOG_ERR, "out of memory");
-					exit(EXIT_FAILURE);
-				}
+		conn->tls = 1;
+
+		ssl_set_endpoint(&conn->ssl, SSL_IS_CLIENT);
+		ssl_set_rng(&conn->ssl, http_random, &http_ctr_drbg);
+		ssl_set_bio(&conn->ssl, net_recv, &conn->fd, net_send, &conn->fd);
+		ssl_set_hostname(&conn->ssl, host);
+		/* Try to resume the previous session with this host */
+		http_session_load(conn);
+
+		while((ret = ssl_handshake(&conn->ssl)) != 0) {
+			if(ret != POLARSSL_ERR_NET_WANT_READ && ret != POLARSSL_ERR_NET_WANT_WRITE) {
+				logprintf(LOG_ERR, "ssl_handshake failed");
+				http_close(conn);
+				return NULL;
 			}
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "User-Agent: %s\r\n", USERAGENT);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
+		conn->handshake = 1;
+		http_session_store(conn);
+	}
+	return conn;
+}
+
+static int http_alive(struct http_conn_t *conn) {
+	struct timeval tv;
+	fd_set fdset;
+
+	/* An idle connection should have nothing to read, otherwise
+	   the server closed it or sent something we did not ask for */
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	FD_ZERO(&fdset);
+	FD_SET(conn->fd, &fdset);
+	if(select(conn->fd+1, &fdset, NULL, NULL, &tv) != 0) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Close idle connections that timed out */
+static void http_pool_reap(void) {
+	struct http_conn_t *tmp = NULL, *prev = NULL, *next = NULL;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&http_lock);
+	tmp = http_pool;
+	while(tmp) {
+		next = tmp->next;
+		if(now-tmp->used >= HTTP_IDLE || http_alive(tmp) == 0) {
+			if(prev == NULL) {
+				http_pool = next;
+			} else {
+				prev->next = next;
 			}
+			http_close(tmp);
+		} else {
+			prev = tmp;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "Content-Type: %s\r\n", contype);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
+		tmp = next;
+	}
+	pthread_mutex_unlock(&http_lock);
+}
+
+static struct http_conn_t *http_pool_take(char *host, unsigned short port, int tls) {
+	struct http_conn_t *tmp = NULL, *prev = NULL;
+
+	http_pool_reap();
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_pool;tmp!=NULL;prev=tmp,tmp=tmp->next) {
+		if(tmp->port == port && tmp->tls == tls && strcmp(tmp->host, host) == 0) {
+			if(prev == NULL) {
+				http_pool = tmp->next;
+			} else {
+				prev->next = tmp->next;
 			}
+			tmp->next = NULL;
+			break;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "Content-Length: %d\r\n\r\n", (int)strlen(post));
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+	}
+	pthread_mutex_unlock(&http_lock);
+	return tmp;
+}
+
+static void http_pool_put(struct http_conn_t *conn) {
+	struct http_conn_t *tmp = NULL;
+	int nr = 0;
+
+	pthread_mutex_lock(&http_lock);
+	for(tmp=http_pool;tmp!=NULL;tmp=tmp->next) {
+		if(tmp->port == conn->port && tmp->tls == conn->tls && strcmp(tmp->host, conn->host) == 0) {
+			nr++;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "%s", post);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
+	}
+	if(nr >= HTTP_POOL || http_loop == 0) {
+		http_close(conn);
+	} else {
+		conn->used = time(NULL);
+		conn->next = http_pool;
+		http_pool = conn;
+	}
+	pthread_mutex_unlock(&http_lock);
+}
+
+static int http_write(struct http_conn_t *conn, char *data, size_t len) {
+	size_t pos = 0;
+	int ret = 0;
+
+	while(pos < len) {
+		if(conn->tls == 1) {
+			ret = ssl_write(&conn->ssl, (const unsigned char *)&data[pos], len-pos);
+			if(ret == POLARSSL_ERR_NET_WANT_READ || ret == POLARSSL_ERR_NET_WANT_WRITE) {
+				continue;
 			}
+		} else {
+			ret = (int)send(conn->fd, &data[pos], len-pos, MSG_NOSIGNAL);
 		}
-	} else if(method == HTTP_GET) {
-		len = (size_t)snprintf(&header[0], bufsize, "GET %s HTTP/1.0\r\n", page);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+		if(ret <= 0) {
+			return -1;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "Host: %s\r\n", host);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+		pos += (size_t)ret;
+	}
+	return 0;
+}
+
+/* Returns the number of bytes read, 0 when the connection was closed */
+static int http_read(struct http_conn_t *conn, char *buffer, size_t len) {
+	int ret = 0;
+
+	if(conn->tls == 1) {
+		do {
+			ret = ssl_read(&conn->ssl, (unsigned char *)buffer, len);
+		} while(ret == POLARSSL_ERR_NET_WANT_READ || ret == POLARSSL_ERR_NET_WANT_WRITE);
+		if(ret == POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY) {
+			return 0;
 		}
-		if(auth64 != NULL) {
-			len += (size_t)snprintf(&header[len], bufsize - len, "Authorization: Basic %s\r\n", auth64);
-			if(len >= bufsize) {
-				bufsize += BUFFER_SIZE;
-				if((header = REALLOC(header, bufsize)) == NULL) {
-					logprintf(LOG_ERR, "out of memory");
-					exit(EXIT_FAILURE);
-				}
-			}
+	} else {
+		ret = (int)recv(conn->fd, buffer, len, 0);
+	}
+	if(ret < 0) {
+		return -1;
+	}
+	return ret;
+}
+
+/* Returns 1 after the last chunk, 0 when more data is needed */
+static int http_dechunk(struct http_buffer_t *raw, size_t *pos, struct http_buffer_t *body) {
+	char *p = NULL, *eol = NULL, *end = NULL;
+	unsigned long nr = 0;
+	size_t left = 0, need = 0;
+
+	while(1) {
+		p = &raw->data[*pos];
+		left = raw->len-*pos;
+		if((eol = strstr(p, "\r\n")) == NULL) {
+			return 0;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "User-Agent: %s\r\n", USERAGENT);
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+		nr = strtoul(p, &end, 16);
+		if(end == p) {
+			return -1;
 		}
-		len += (size_t)snprintf(&header[len], bufsize - len, "Connection: close\r\n\r\n");
-		if(len >= bufsize) {
-			bufsize += BUFFER_SIZE;
-			if((header = REALLOC(header, bufsize)) == NULL) {
-				logprintf(LOG_ERR, "out of memory");
-				exit(EXIT_FAILURE);
-			}
+		if(nr == 0) {
+			/* Skip the optional trailer */
+			return (strstr(eol, "\r\n\r\n") != NULL);
+		}
+		need = (size_t)(eol-p)+2+nr+2;
+		if(nr > HTTP_MAX_SIZE) {
+			return -1;
+		}
+		if(left < need) {
+			return 0;
 		}
+		http_buffer_append(body, eol+2, nr);
+		*pos += need;
 	}
+	return 0;
+}
 
-	if(port == 443) {
-		memset(&ssl, '\0', sizeof(ssl_context));
-		entropy_init(&entropy);
-		entropyfree = 1;
-		if((ctr_drbg_init(&ctr_drbg, entropy_func, &entropy, (const unsigned char *)USERAGENT, 6)) != 0) {
-			logprintf(LOG_ERR, "ctr_drbg_init failed");
-			*code = -1;
+/*
+ * Returns 0 on success, -1 on errors and -2 when the connection
+ * was closed before anything was received.
+ */
+static int http_response(struct http_conn_t *conn, int *code, char *type, struct http_buffer_t *body, int *keepalive) {
+	struct http_buffer_t raw;
+	char recvBuff[BUFFER_SIZE], *hdr = NULL, *line = NULL, *next = NULL, *val = NULL;
+	size_t hdrlen = 0, clen = 0, pos = 0;
+	int bytes = 0, minor = 0, mode = HTTP_BODY_CLOSE, done = 0, ret = -1;
+
+	memset(&raw, 0, sizeof(struct http_buffer_t));
+
+	while(done == 0) {
+		if((bytes = http_read(conn, recvBuff, sizeof(recvBuff))) <= 0) {
+			if(bytes == 0 && hdrlen > 0 && mode == HTTP_BODY_CLOSE) {
+				break;
+			}
+			if(raw.len == 0) {
+				ret = -2;
+			}
 			goto exit;
 		}
-
-		if((ssl_init(&ssl)) != 0) {
-			logprintf(LOG_ERR, "ssl_init failed");
-			*code = -1;
+		http_buffer_append(&raw, recvBuff, (size_t)bytes);
+		if(raw.len > HTTP_MAX_SIZE) {
+			logprintf(LOG_ERR, "http response too large");
 			goto exit;
 		}
-		sslfree = 1;
 
-		ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
-		ssl_set_rng(&ssl, ctr_drbg_random, &ctr_drbg);
-		ssl_set_bio(&ssl, net_recv, &sockfd, net_send, &sockfd);
+		if(hdrlen == 0) {
+			if((hdr = strstr(raw.data, "\r\n\r\n")) == NULL) {
+				continue;
+			}
+			hdrlen = (size_t)(hdr-raw.data)+4;
+			*hdr = '\0';
 
-		int ret = 0;
-		while((ret = ssl_handshake(&ssl)) != 0) {
-			if(ret != POLARSSL_ERR_NET_WANT_READ && ret != POLARSSL_ERR_NET_WANT_WRITE) {
-				logprintf(LOG_ERR, "ssl_handshake failed");
-				*code = -1;
+			if(sscanf(raw.data, "HTTP/1.%d %d", &minor, code) != 2) {
+				logprintf(LOG_ERR, "invalid http response");
 				goto exit;
 			}
-		}
+			*keepalive = (minor >= 1);
 
-		while((ret = ssl_write(&ssl, (const unsigned char *)header, len)) <= 0) {
-			if(ret != POLARSSL_ERR_NET_WANT_READ && ret != POLARSSL_ERR_NET_WANT_WRITE) {
-				if(ret == -76) {
-					logprintf(LOG_ERR, "ssl_write timed out");
-				} else {
-					logprintf(LOG_ERR, "ssl_write failed");
+			line = raw.data;
+			while(line != NULL) {
+				if((next = strstr(line, "\r\n")) != NULL) {
+					*next = '\0';
+					next += 2;
+				}
+				if((val = strstr(line, ":")) != NULL) {
+					val++;
+					while(*val == ' ' || *val == '\t') {
+						val++;
+					}
+					if(strncasecmp(line, "Content-Type:", 13) == 0) {
+						size_t i = 0;
+						while(i < HTTP_TYPE_SIZE-1 && (isalnum((unsigned char)val[i]) || strchr("/+-.", val[i]) != NULL) && val[i] != '\0') {
+							type[i] = val[i];
+							i++;
+						}
+						type[i] = '\0';
+					} else if(strncasecmp(line, "Content-Length:", 15) == 0 && mode != HTTP_BODY_CHUNKED) {
+						clen = (size_t)strtoul(val, NULL, 10);
+						mode = HTTP_BODY_LENGTH;
+					} else if(strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strncasecmp(val, "chunked", 7) == 0) {
+						mode = HTTP_BODY_CHUNKED;
+					} else if(strncasecmp(line, "Connection:", 11) == 0) {
+						if(strncasecmp(val, "close", 5) == 0) {
+							*keepalive = 0;
+						} else if(strncasecmp(val, "keep-alive", 10) == 0) {
+							*keepalive = 1;
+						}
+					}
 				}
-				*code = -1;
+				line = next;
+			}
+			if((*code >= 100 && *code < 200) || *code == 204 || *code == 304) {
+				mode = HTTP_BODY_NONE;
+			}
+			if(mode == HTTP_BODY_CLOSE) {
+				*keepalive = 0;
+			}
+			if(mode == HTTP_BODY_LENGTH && clen > HTTP_MAX_SIZE) {
+				logprintf(LOG_ERR, "http response too large");
 				goto exit;
 			}
+			pos = hdrlen;
 		}
-	} else {
-		if((bytes = send(sockfd, header, len, 0)) <= 0) {
-			logprintf(LOG_ERR, "sending header to http server failed");
-			*code = -1;
-			goto exit;
+
+		switch(mode) {
+			case HTTP_BODY_NONE:
+				done = 1;
+			break;
+			case HTTP_BODY_LENGTH:
+				done = (raw.len-hdrlen >= clen);
+			break;
+			case HTTP_BODY_CHUNKED:
+				if((done = http_dechunk(&raw, &pos, body)) == -1) {
+					logprintf(LOG_ERR, "invalid chunked http response");
+					goto exit;
+				}
+			break;
+			default:
+			break;
 		}
 	}
 
-	char *nl = NULL;
-	char *tp = *type;
-	memset(recvBuff, '\0', sizeof(recvBuff));
+	if(mode == HTTP_BODY_LENGTH) {
+		http_buffer_append(body, &raw.data[hdrlen], clen);
+	} else if(mode == HTTP_BODY_CLOSE) {
+		http_buffer_append(body, &raw.data[hdrlen], raw.len-hdrlen);
+	}
+	ret = 0;
 
-	while(1) {
-		if(port == 443) {
-			bytes = ssl_read(&ssl, (unsigned char *)recvBuff, BUFFER_SIZE);
-			if(bytes == POLARSSL_ERR_NET_WANT_READ || bytes == POLARSSL_ERR_NET_WANT_WRITE) {
-				continue;
-			}
-			if(bytes == POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY) {
-				break;
-			}
-		} else {
-			bytes = recv(sockfd, recvBuff, BUFFER_SIZE, 0);
-		}
+exit:
+	if(raw.data != NULL) {
+		FREE(raw.data);
+	}
+	return ret;
+}
 
-		if(bytes <= 0) {
-			if(*size == 0) {
-				logprintf(LOG_ERR, "http(s) read failed (%s)", url);
-			}
+static char *http_process_request(char *url, int method, char **type, int *code, int *size, const char *contype, char *post) {
+	struct http_conn_t *conn = NULL;
+	struct http_buffer_t request, body;
+	char *host = NULL, *page = NULL, *auth = NULL, *auth64 = NULL;
+	unsigned short port = 0;
+	int tls = 0, reused = 0, keepalive = 0, attempt = 0, ret = 0;
+
+	memset(&request, 0, sizeof(struct http_buffer_t));
+	memset(&body, 0, sizeof(struct http_buffer_t));
+
+	*size = 0;
+	*code = -1;
+	(*type)[0] = '\0';
+
+	if(http_parse_url(url, &host, &port, &tls, &page, &auth) == -1) {
+		logprintf(LOG_ERR, "an url should start with either http:// or https:// (%s)", url);
+		goto exit;
+	}
+
+	http_buffer_printf(&request, "%s %s HTTP/1.1\r\n", (method == HTTP_POST) ? "POST" : "GET", page);
+	if((tls == 0 && port == 80) || (tls == 1 && port == 443)) {
+		http_buffer_printf(&request, "Host: %s\r\n", host);
+	} else {
+		http_buffer_printf(&request, "Host: %s:%d\r\n", host, port);
+	}
+	if(auth != NULL) {
+		auth64 = base64encode(auth, strlen(auth));
+		http_buffer_printf(&request, "Authorization: Basic %s\r\n", auth64);
+	}
+	http_buffer_printf(&request, "User-Agent: %s\r\n", USERAGENT);
+	if(method == HTTP_POST) {
+		http_buffer_printf(&request, "Content-Type: %s\r\n", contype);
+		http_buffer_printf(&request, "Content-Length: %d\r\n\r\n", (int)strlen(post));
+		http_buffer_append(&request, post, strlen(post));
+	} else {
+		http_buffer_printf(&request, "\r\n");
+	}
+
+	/* A pooled connection may have been closed by the server
+	   in the meantime, so retry once on a fresh connection */
+	for(attempt=0;attempt<2;attempt++) {
+		reused = 0;
+		if((conn = http_pool_take(host, port, tls)) != NULL) {
+			reused = 1;
+		} else if((conn = http_connect(host, port, tls, url)) == NULL) {
 			break;
 		}
 
-		if((content = REALLOC(content, (size_t)(*size+bytes+1))) == NULL) {
-			logprintf(LOG_ERR, "out of memory");
-			exit(0);
-		}
-
-		memset(&content[*size], '\0', (size_t)(bytes+1));
-		strncpy(&content[*size], recvBuff, (size_t)(bytes));
-		*size += bytes;
-
-		char **array = NULL;
-		char *p = recvBuff;
-		/* Let's first normalize the HEADER terminator */
-		str_replace("\r\n", "\n\r", &p);
-		unsigned int n = explode(recvBuff, "\n\r", &array), q = 0;
-		int z = 0;
-		for(q=0;q<n;q++) {
-			if(has_code == 0 && sscanf(array[q], "HTTP/1.%d%*[ ]%d%*s%*[ \n\r]", &z, code)) {
-				has_code = 1;
-			}
-			// ;%*[ A-Za-z0-9\\/=+- \n\r]
-			if(has_type == 0 && sscanf(array[q], "Content-%*[tT]ype:%*[ ]%[A-Za-z\\/+-]", tp)) {
-				has_type = 1;
-			}
+		if(http_write(conn, request.data, request.len) != 0) {
+			ret = -2;
+		} else {
+			ret = http_response(conn, code, *type, &body, &keepalive);
 		}
-		array_free(&array, n);
-		memset(recvBuff, '\0', sizeof(recvBuff));
-	}
-	if(content != NULL) {
-		/* Remove the header */
-		if((nl = strstr(content, "\r\n\r\n"))) {
-			pos = (nl-content)+4;
-			memmove(&content[0], &content[pos], (size_t)(*size-pos));
-			*size-=pos;
+
+		if(ret == 0) {
+			if(keepalive == 1) {
+				http_pool_put(conn);
+			} else {
+				http_close(conn);
+			}
+			break;
 		}
-		/* Remove the footer */
-		if((nl = strstr(content, "0\r\n\r\n"))) {
-			*size -= 5;
+		http_close(conn);
+		*code = -1;
+		if(ret == -2 && reused == 1) {
+			continue;
 		}
+		logprintf(LOG_ERR, "http(s) read failed (%s)", url);
+		break;
 	}
 
 exit:
-	if(port == 443) {
-		if(sslfree == 1) {
-			ssl_free(&ssl);
-		}
-		if(entropyfree == 1) {
-			entropy_free(&entropy);
-		}
+	if(request.data != NULL) FREE(request.data);
+	if(auth64 != NULL) FREE(auth64);
+	if(auth != NULL) FREE(auth);
+	if(page != NULL) FREE(page);
+	if(host != NULL) FREE(host);
+
+	if(body.len > 0) {
+		*size = (int)body.len;
+		return body.data;
 	}
-	if(header) FREE(header);
-	if(auth) FREE(auth);
-	if(auth64) FREE(auth64);
-	if(page) FREE(page);
-	if(host) FREE(host);
-	if(sockfd > 0) {
-		close(sockfd);
-	}
-
-	if(*size > 0) {
-		content[*size] = '\0';
-		return content;
-	} else {
-		return NULL;
+	if(body.data != NULL) {
+		FREE(body.data);
 	}
 	return NULL;
 }
@@ -420,3 +811,171 @@ char *http_get_content(char *url, char **type, int *code, int *size) {
 char *http_post_content(char *url, char **type, int *code, int *size, const char *contype, char *post) {
 	return http_process_request(url, HTTP_POST, type, code, size, contype, post);
 }
+
+static void http_request_free(struct http_request_t *request) {
+	FREE(request->url);
+	if(request->contype != NULL) {
+		FREE(request->contype);
+	}
+	if(request->post != NULL) {
+		FREE(request->post);
+	}
+	FREE(request);
+}
+
+static void *http_worker(void *param) {
+	struct http_request_t *request = NULL;
+	struct timespec ts;
+	char typebuf[HTTP_TYPE_SIZE], *tp = typebuf, *data = NULL;
+	int code = 0, size = 0;
+
+	pthread_mutex_lock(&http_queue_lock);
+	while(http_loop == 1) {
+		if(http_queue == NULL) {
+			/* Wake up now and then to close idle connections */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += HTTP_IDLE;
+			if(pthread_cond_timedwait(&http_queue_signal, &http_queue_lock, &ts) == ETIMEDOUT) {
+				pthread_mutex_unlock(&http_queue_lock);
+				http_pool_reap();
+				pthread_mutex_lock(&http_queue_lock);
+			}
+			continue;
+		}
+		request = http_queue;
+		http_queue = http_queue->next;
+		pthread_mutex_unlock(&http_queue_lock);
+
+		data = http_process_request(request->url, request->method, &tp, &code, &size, request->contype, request->post);
+		if(request->callback != NULL) {
+			request->callback(code, data, size, typebuf, request->userdata);
+		}
+		if(data != NULL) {
+			FREE(data);
+		}
+		http_request_free(request);
+
+		pthread_mutex_lock(&http_queue_lock);
+	}
+	pthread_mutex_unlock(&http_queue_lock);
+
+	return (void *)NULL;
+}
+
+static int http_enqueue(int method, char *url, const char *contype, char *post, http_callback_t callback, void *userdata) {
+	struct http_request_t *request = NULL, *tmp = NULL;
+
+	if(strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) {
+		logprintf(LOG_ERR, "an url should start with either http:// or https:// (%s)", url);
+		return -1;
+	}
+
+	if((request = MALLOC(sizeof(struct http_request_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(request, 0, sizeof(struct http_request_t));
+	request->method = method;
+	request->url = http_strndup(url, strlen(url));
+	if(contype != NULL) {
+		request->contype = http_strndup(contype, strlen(contype));
+	}
+	if(post != NULL) {
+		request->post = http_strndup(post, strlen(post));
+	}
+	request->callback = callback;
+	request->userdata = userdata;
+
+	pthread_mutex_lock(&http_queue_lock);
+	if(http_loop == 0) {
+		pthread_mutex_unlock(&http_queue_lock);
+		http_request_free(request);
+		return -1;
+	}
+	if(http_queue == NULL) {
+		http_queue = request;
+	} else {
+		for(tmp=http_queue;tmp->next!=NULL;tmp=tmp->next);
+		tmp->next = request;
+	}
+	if(http_worker_started == 0) {
+		threads_create(&http_pth, NULL, http_worker, NULL);
+		http_worker_started = 1;
+	}
+	pthread_cond_signal(&http_queue_signal);
+	pthread_mutex_unlock(&http_queue_lock);
+	return 0;
+}
+
+int http_get(char *url, http_callback_t callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	return http_enqueue(HTTP_GET, url, NULL, NULL, callback, userdata);
+}
+
+int http_post(char *url, const char *contype, char *post, http_callback_t callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	return http_enqueue(HTTP_POST, url, contype, post, callback, userdata);
+}
+
+int http_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct http_request_t *request = NULL;
+	struct http_conn_t *conn = NULL;
+	struct http_dns_t *dns = NULL;
+	struct http_session_t *session = NULL;
+
+	pthread_mutex_lock(&http_queue_lock);
+	http_loop = 0;
+	pthread_cond_signal(&http_queue_signal);
+	pthread_mutex_unlock(&http_queue_lock);
+
+	if(http_worker_started == 1) {
+		pthread_join(http_pth, NULL);
+		http_worker_started = 0;
+	}
+
+	/* Let the owners of requests that never ran clean up */
+	while(http_queue) {
+		request = http_queue;
+		http_queue = http_queue->next;
+		if(request->callback != NULL) {
+			request->callback(-1, NULL, 0, NULL, request->userdata);
+		}
+		http_request_free(request);
+	}
+
+	pthread_mutex_lock(&http_lock);
+	while(http_pool) {
+		conn = http_pool;
+		http_pool = http_pool->next;
+		http_close(conn);
+	}
+	while(http_dns) {
+		dns = http_dns;
+		http_dns = http_dns->next;
+		FREE(dns->host);
+		FREE(dns);
+	}
+	while(http_sessions) {
+		session = http_sessions;
+		http_sessions = http_sessions->next;
+		ssl_session_free(&session->session);
+		FREE(session->host);
+		FREE(session);
+	}
+	pthread_mutex_unlock(&http_lock);
+
+	pthread_mutex_lock(&http_rng_lock);
+	if(http_rng_ready == 1) {
+		ctr_drbg_free(&http_ctr_drbg);
+		entropy_free(&http_entropy);
+		http_rng_ready = 0;
+	}
+	pthread_mutex_unlock(&http_rng_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected http library");
+	return 0;
+}
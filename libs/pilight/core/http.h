@@ -19,7 +19,17 @@
 #ifndef _HTTP_H_
 #define _HTTP_H_
 
+/*
+ * Called from the http worker thread once a request finished. The
+ * content is freed afterwards. When pilight stops before the request
+ * ran, the code is -1 and the content and type are NULL.
+ */
+typedef void (*http_callback_t)(int code, char *content, int size, char *type, void *userdata);
+
 char *http_get_content(char *url, char **type, int *code, int *size);
 char *http_post_content(char *url, char **type, int *code, int *size, const char *contype, char *post);
+int http_get(char *url, http_callback_t callback, void *userdata);
+int http_post(char *url, const char *contype, char *post, http_callback_t callback, void *userdata);
+int http_gc(void);
 
 #endif
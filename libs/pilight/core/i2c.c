@@ -0,0 +1,443 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "threads.h"
+#include "log.h"
+#include "mem.h"
+#include "i2c.h"
+
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+#include "../../wiringx/wiringX.h"
+
+/*
+ * I2C bus scheduler
+ *
+ * All I2C sensors share one thread that owns the bus. Whenever
+ * devices are ready at the same time, their messages go out as
+ * one I2C_RDWR transfer. A device waiting for a conversion does
+ * not block the bus, so the conversions of all sensors overlap.
+ */
+
+/* Most adapters accept up to 42 messages in one transfer */
+#define I2C_BATCH	42
+
+typedef struct i2c_device_t {
+	struct i2c_job_t job;
+	int interval;
+	int busy;
+	unsigned long long due;
+	unsigned long long ready;
+	i2c_step_t *step;
+	struct i2c_device_t *next;
+} i2c_device_t;
+
+static int i2c_bus_open(int address);
+static int i2c_bus_transfer(int fd, struct i2c_msg *msgs, int nr);
+static void i2c_bus_close(int fd);
+
+static struct i2c_backend_t i2c_bus = {
+	i2c_bus_open,
+	i2c_bus_transfer,
+	i2c_bus_close
+};
+
+static pthread_mutex_t i2c_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct i2c_device_t *i2c_devices = NULL;
+static struct i2c_backend_t *i2c_backend = &i2c_bus;
+static pthread_t i2c_pth;
+static int i2c_started = 0;
+static int i2c_loop = 1;
+static int i2c_fd = -1;
+
+static int i2c_bus_open(int address) {
+	wiringXSetup();
+	return wiringXI2CSetup(address);
+}
+
+static int i2c_bus_transfer(int fd, struct i2c_msg *msgs, int nr) {
+	struct i2c_rdwr_ioctl_data data;
+
+	data.msgs = msgs;
+	data.nmsgs = nr;
+	return (ioctl(fd, I2C_RDWR, &data) < 0) ? -1 : 0;
+}
+
+static void i2c_bus_close(int fd) {
+	close(fd);
+}
+
+static unsigned long long i2c_time(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
+
+int i2c_write(struct i2c_job_t *job, int reg, int value) {
+	struct i2c_msg *msg = NULL;
+
+	if(job->nrmsgs >= I2C_MSGS || job->used+2 > I2C_BUFFER) {
+		return -1;
+	}
+	msg = &job->msgs[job->nrmsgs++];
+	msg->addr = (__u16)job->address;
+	msg->flags = 0;
+	msg->len = 2;
+	msg->buf = (char *)&job->buffer[job->used];
+	job->buffer[job->used++] = (unsigned char)reg;
+	job->buffer[job->used++] = (unsigned char)value;
+	return 0;
+}
+
+/* Selects the register and reads len bytes from it */
+int i2c_read(struct i2c_job_t *job, int reg, int len) {
+	struct i2c_msg *msg = NULL;
+
+	if(job->nrmsgs+2 > I2C_MSGS || job->used+1+len > I2C_BUFFER) {
+		return -1;
+	}
+	msg = &job->msgs[job->nrmsgs++];
+	msg->addr = (__u16)job->address;
+	msg->flags = 0;
+	msg->len = 1;
+	msg->buf = (char *)&job->buffer[job->used];
+	job->buffer[job->used++] = (unsigned char)reg;
+
+	msg = &job->msgs[job->nrmsgs++];
+	msg->addr = (__u16)job->address;
+	msg->flags = I2C_M_RD;
+	msg->len = (short)len;
+	msg->buf = (char *)&job->buffer[job->used];
+	memset(&job->buffer[job->used], '\0', (size_t)len);
+	job->used += len;
+	return 0;
+}
+
+static int i2c_transfer(struct i2c_msg *msgs, int nr) {
+	if(i2c_fd < 0) {
+		return -1;
+	}
+	return i2c_backend->transfer(i2c_fd, msgs, nr);
+}
+
+/*
+ * Register selects followed by a read can safely be sent again,
+ * register writes can't. A failed transfer does not tell which
+ * of its messages already reached a device.
+ */
+static int i2c_idempotent(struct i2c_job_t *job) {
+	int i = 0;
+
+	for(i=0;i<job->nrmsgs;i++) {
+		if((job->msgs[i].flags & I2C_M_RD) == I2C_M_RD) {
+			continue;
+		}
+		if(job->msgs[i].len != 1 || i+1 >= job->nrmsgs ||
+		   (job->msgs[i+1].flags & I2C_M_RD) != I2C_M_RD) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Runs the next step of a device, returns 0 when its poll is done */
+static int i2c_next(struct i2c_device_t *dev, unsigned long long now) {
+	struct i2c_job_t *job = &dev->job;
+	int i = 0, delay = 0;
+
+	/* Hand the data that was read over to the device */
+	job->nrresult = 0;
+	for(i=0;i<job->nrmsgs;i++) {
+		if((job->msgs[i].flags & I2C_M_RD) == I2C_M_RD) {
+			memcpy(&job->result[job->nrresult], job->msgs[i].buf, (size_t)job->msgs[i].len);
+			job->nrresult += job->msgs[i].len;
+		}
+	}
+	job->nrmsgs = 0;
+	job->used = 0;
+
+	delay = dev->step(job);
+	job->step++;
+	job->error = 0;
+	if(delay < 0) {
+		dev->busy = 0;
+		dev->due = now+(unsigned long long)dev->interval*1000000;
+		return 0;
+	}
+	dev->ready = now+(unsigned long long)delay;
+	return 1;
+}
+
+static void *i2c_thread(void *param) {
+	struct i2c_device_t *tmp = NULL;
+	unsigned long long now = 0, wake = 0;
+	int nr = 0, n = 0, i = 0, x = 0, nrmsgs = 0;
+
+	while(i2c_loop == 1) {
+		now = i2c_time();
+
+		pthread_mutex_lock(&i2c_lock);
+		nr = 0;
+		for(tmp=i2c_devices;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct i2c_device_t *devices[nr+1];
+		nr = 0;
+		for(tmp=i2c_devices;tmp!=NULL;tmp=tmp->next) {
+			devices[nr++] = tmp;
+		}
+		pthread_mutex_unlock(&i2c_lock);
+
+		/*
+		 * Devices are only freed after this thread stopped,
+		 * so they can be used without holding the lock.
+		 */
+		for(i=0;i<nr;i++) {
+			if(devices[i]->busy == 0 && now >= devices[i]->due) {
+				if(i2c_fd < 0) {
+					i2c_fd = i2c_backend->open(devices[i]->job.address);
+				}
+				devices[i]->busy = 1;
+				devices[i]->job.step = 0;
+				devices[i]->job.error = 0;
+				devices[i]->job.nrmsgs = 0;
+				i2c_next(devices[i], now);
+			}
+		}
+
+		/* Send everything that is ready in as few transfers as possible */
+		struct i2c_msg msgs[I2C_BATCH];
+		struct i2c_device_t *batch[I2C_BATCH];
+		n = 0, nrmsgs = 0;
+		for(i=0;i<=nr;i++) {
+			if(i < nr && (devices[i]->busy == 0 || devices[i]->ready > now)) {
+				continue;
+			}
+			/* Writes go out on their own, so a failed batch only holds reads */
+			if(i < nr && i2c_idempotent(&devices[i]->job) == 0) {
+				devices[i]->job.error = (i2c_transfer(devices[i]->job.msgs, devices[i]->job.nrmsgs) != 0);
+				i2c_next(devices[i], i2c_time());
+				continue;
+			}
+			if(n > 0 && (i == nr || nrmsgs+devices[i]->job.nrmsgs > I2C_BATCH)) {
+				if(nrmsgs > 0 && i2c_transfer(msgs, nrmsgs) != 0) {
+					/* Find out which device failed */
+					for(x=0;x<n;x++) {
+						if(batch[x]->job.nrmsgs > 0) {
+							batch[x]->job.error = (i2c_transfer(batch[x]->job.msgs, batch[x]->job.nrmsgs) != 0);
+						}
+					}
+				}
+				now = i2c_time();
+				for(x=0;x<n;x++) {
+					i2c_next(batch[x], now);
+				}
+				n = 0, nrmsgs = 0;
+			}
+			if(i == nr) {
+				break;
+			}
+			memcpy(&msgs[nrmsgs], devices[i]->job.msgs, sizeof(struct i2c_msg)*(size_t)devices[i]->job.nrmsgs);
+			nrmsgs += devices[i]->job.nrmsgs;
+			batch[n++] = devices[i];
+		}
+
+		now = i2c_time();
+		wake = now+1000000;
+		for(i=0;i<nr;i++) {
+			if(devices[i]->busy == 1 && devices[i]->ready < wake) {
+				wake = devices[i]->ready;
+			}
+			if(devices[i]->busy == 0 && devices[i]->due < wake) {
+				wake = devices[i]->due;
+			}
+		}
+		if(wake > now && i2c_loop == 1) {
+			usleep((useconds_t)(wake-now));
+		}
+	}
+
+	return (void *)NULL;
+}
+
+int i2c_add(int address, int interval, i2c_step_t *step, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct i2c_device_t *dev = NULL;
+
+	if((dev = MALLOC(sizeof(struct i2c_device_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(dev, '\0', sizeof(struct i2c_device_t));
+	dev->job.address = address;
+	dev->job.userdata = userdata;
+	dev->interval = (interval < 1) ? 1 : interval;
+	dev->step = step;
+	dev->due = i2c_time()+(unsigned long long)dev->interval*1000000;
+
+	pthread_mutex_lock(&i2c_lock);
+	dev->next = i2c_devices;
+	i2c_devices = dev;
+
+	if(i2c_started == 0) {
+		i2c_loop = 1;
+		threads_create(&i2c_pth, NULL, i2c_thread, NULL);
+		i2c_started = 1;
+	}
+	pthread_mutex_unlock(&i2c_lock);
+	return 0;
+}
+
+void i2c_set_backend(struct i2c_backend_t *backend) {
+	pthread_mutex_lock(&i2c_lock);
+	i2c_backend = (backend == NULL) ? &i2c_bus : backend;
+	pthread_mutex_unlock(&i2c_lock);
+}
+
+int i2c_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct i2c_device_t *tmp = NULL;
+
+	if(i2c_started == 1) {
+		i2c_loop = 0;
+		pthread_join(i2c_pth, NULL);
+		i2c_started = 0;
+	}
+
+	pthread_mutex_lock(&i2c_lock);
+	while(i2c_devices) {
+		tmp = i2c_devices;
+		i2c_devices = i2c_devices->next;
+		FREE(tmp);
+	}
+	if(i2c_fd > -1) {
+		i2c_backend->close(i2c_fd);
+		i2c_fd = -1;
+	}
+	pthread_mutex_unlock(&i2c_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected i2c library");
+	return 0;
+}
+
+/*
+ * Mock bus
+ *
+ * Every address has 256 registers. A write selects a register
+ * and stores the bytes after it, a read returns the registers
+ * from the selected one onwards. Unknown addresses do not ack.
+ */
+
+typedef struct i2c_mock_t {
+	int address;
+	int reg;
+	unsigned char regs[256];
+	struct i2c_mock_t *next;
+} i2c_mock_t;
+
+static struct i2c_mock_t *i2c_mocks = NULL;
+
+static struct i2c_mock_t *i2c_mock_get(int address) {
+	struct i2c_mock_t *tmp = NULL;
+
+	for(tmp=i2c_mocks;tmp!=NULL;tmp=tmp->next) {
+		if(tmp->address == address) {
+			break;
+		}
+	}
+	return tmp;
+}
+
+static int i2c_mock_open(int address) {
+	return 0;
+}
+
+static int i2c_mock_transfer(int fd, struct i2c_msg *msgs, int nr) {
+	struct i2c_mock_t *mock = NULL;
+	int i = 0, x = 0;
+
+	for(i=0;i<nr;i++) {
+		if((mock = i2c_mock_get(msgs[i].addr)) == NULL) {
+			return -1;
+		}
+		if((msgs[i].flags & I2C_M_RD) == I2C_M_RD) {
+			for(x=0;x<msgs[i].len;x++) {
+				msgs[i].buf[x] = (char)mock->regs[(mock->reg+x) & 0xFF];
+			}
+		} else if(msgs[i].len > 0) {
+			mock->reg = (unsigned char)msgs[i].buf[0];
+			for(x=1;x<msgs[i].len;x++) {
+				mock->regs[(mock->reg+x-1) & 0xFF] = (unsigned char)msgs[i].buf[x];
+			}
+		}
+	}
+	return 0;
+}
+
+static void i2c_mock_close(int fd) {
+	struct i2c_mock_t *tmp = NULL;
+
+	while(i2c_mocks) {
+		tmp = i2c_mocks;
+		i2c_mocks = i2c_mocks->next;
+		FREE(tmp);
+	}
+}
+
+static struct i2c_backend_t i2c_mock_bus = {
+	i2c_mock_open,
+	i2c_mock_transfer,
+	i2c_mock_close
+};
+
+struct i2c_backend_t *i2c_mock(void) {
+	return &i2c_mock_bus;
+}
+
+void i2c_mock_set(int address, int reg, unsigned char *data, int len) {
+	struct i2c_mock_t *mock = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&i2c_lock);
+	if((mock = i2c_mock_get(address)) == NULL) {
+		if((mock = MALLOC(sizeof(struct i2c_mock_t))) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		memset(mock, '\0', sizeof(struct i2c_mock_t));
+		mock->address = address;
+		mock->next = i2c_mocks;
+		i2c_mocks = mock;
+	}
+	for(i=0;i<len;i++) {
+		mock->regs[(reg+i) & 0xFF] = data[i];
+	}
+	pthread_mutex_unlock(&i2c_lock);
+}
+#endif
@@ -0,0 +1,67 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _I2C_H_
+#define _I2C_H_
+
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+#include "i2c-dev.h"
+
+#define I2C_MSGS		8
+#define I2C_BUFFER	64
+
+/*
+ * A device is polled in steps. Each step queues the register
+ * writes and reads that should go out next and returns how many
+ * microseconds the bus should wait before sending them, or -1
+ * when the poll is done. The data read by the previous step is
+ * in result, error is set when its transfer failed.
+ */
+typedef struct i2c_job_t {
+	int address;
+	int step;
+	int error;
+	unsigned char result[I2C_BUFFER];
+	int nrresult;
+
+	struct i2c_msg msgs[I2C_MSGS];
+	int nrmsgs;
+	unsigned char buffer[I2C_BUFFER];
+	int used;
+
+	void *userdata;
+} i2c_job_t;
+
+typedef int (i2c_step_t)(struct i2c_job_t *job);
+
+typedef struct i2c_backend_t {
+	int (*open)(int address);
+	int (*transfer)(int fd, struct i2c_msg *msgs, int nr);
+	void (*close)(int fd);
+} i2c_backend_t;
+
+int i2c_add(int address, int interval, i2c_step_t *step, void *userdata);
+int i2c_write(struct i2c_job_t *job, int reg, int value);
+int i2c_read(struct i2c_job_t *job, int reg, int len);
+void i2c_set_backend(struct i2c_backend_t *backend);
+struct i2c_backend_t *i2c_mock(void);
+void i2c_mock_set(int address, int reg, unsigned char *data, int len);
+int i2c_gc(void);
+#endif
+
+#endif
@@ -24,6 +24,12 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
+#ifdef __linux__
+	#include <poll.h>
+	#include <errno.h>
+	#include <sys/ioctl.h>
+	#include <linux/gpio.h>
+#endif
 
 #include "irq.h"
 #include "gc.h"
@@ -60,3 +66,124 @@ int irq_read(int gpio) {
 	return -1;
 #endif
 }
+
+#if defined(__linux__) && defined(GPIO_GET_LINEEVENT_IOCTL)
+/*
+ * Edges read from the GPIO character device. The kernel timestamps
+ * every edge when it happens and queues them, so a single read()
+ * returns a whole batch and the durations don't suffer from the
+ * scheduling delays of a poll() per edge.
+ */
+struct irq_chip_t {
+	int fd;
+	int line;
+	int pos;
+	int nr;
+	int first;
+	unsigned long long last;
+	struct gpioevent_data events[IRQ_CHIP_BATCH];
+};
+
+struct irq_chip_t *irq_chip_open(const char *chip, int line) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct gpioevent_request req;
+	struct irq_chip_t *irq = NULL;
+	int fd = 0;
+
+	if((fd = open(chip, O_RDONLY)) < 0) {
+		logprintf(LOG_ERR, "cannot open gpio chip %s", chip);
+		return NULL;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = (unsigned int)line;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strncpy(req.consumer_label, "pilight", sizeof(req.consumer_label)-1);
+
+	if(ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+		logprintf(LOG_ERR, "unable to request events for line %d of %s", line, chip);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	if((irq = MALLOC(sizeof(struct irq_chip_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(irq, 0, sizeof(struct irq_chip_t));
+	irq->fd = req.fd;
+	irq->line = line;
+	irq->first = 1;
+
+	return irq;
+}
+
+/* Returns the time between the last two edges, 0 on a timeout
+   and -1 when the line can no longer be read */
+int irq_chip_read(struct irq_chip_t *irq) {
+	struct pollfd pfd;
+	unsigned long long duration = 0;
+	ssize_t n = 0;
+	int x = 0;
+
+	if(irq == NULL) {
+		return -1;
+	}
+
+	if(irq->pos >= irq->nr) {
+		pfd.fd = irq->fd;
+		pfd.events = POLLIN | POLLPRI;
+		pfd.revents = 0;
+		if((x = poll(&pfd, 1, 1000)) <= 0) {
+			return (x == 0 || errno == EINTR) ? 0 : -1;
+		}
+		if((n = read(irq->fd, irq->events, sizeof(irq->events))) <= 0) {
+			return (n < 0 && (errno == EINTR || errno == EAGAIN)) ? 0 : -1;
+		}
+		irq->nr = (int)((size_t)n/sizeof(struct gpioevent_data));
+		irq->pos = 0;
+	}
+
+	duration = irq->events[irq->pos].timestamp/1000;
+	irq->pos++;
+
+	if(irq->first == 1) {
+		irq->first = 0;
+		irq->last = duration;
+		return 0;
+	}
+	if(duration < irq->last) {
+		x = 0;
+	} else if(duration-irq->last > 0x7FFFFFFF) {
+		x = 0x7FFFFFFF;
+	} else {
+		x = (int)(duration-irq->last);
+	}
+	irq->last = duration;
+	return x;
+}
+
+void irq_chip_close(struct irq_chip_t *irq) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(irq != NULL) {
+		close(irq->fd);
+		FREE(irq);
+	}
+}
+#else
+struct irq_chip_t *irq_chip_open(const char *chip, int line) {
+	logprintf(LOG_ERR, "gpio character devices are not supported on this platform");
+	return NULL;
+}
+
+int irq_chip_read(struct irq_chip_t *irq) {
+	return -1;
+}
+
+void irq_chip_close(struct irq_chip_t *irq) {
+}
+#endif
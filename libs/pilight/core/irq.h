@@ -19,7 +19,15 @@
 #ifndef _IRQ_H_
 #define _IRQ_H_
 
+/* Number of edges fetched from a gpio chip at once */
+#define IRQ_CHIP_BATCH	64
+
+typedef struct irq_chip_t irq_chip_t;
+
 int irq_read(int gpio);
+struct irq_chip_t *irq_chip_open(const char *chip, int line);
+int irq_chip_read(struct irq_chip_t *irq);
+void irq_chip_close(struct irq_chip_t *irq);
 void irq_interrupt(void);
 
 #endif
@@ -0,0 +1,421 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+	#include <windows.h>
+	#include <io.h>
+#else
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "json.h"
+#include "log.h"
+#include "journal.h"
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+/*
+ * The journal is an append-only file of device value changes.
+ * It starts with a 4 byte magic, followed by records of:
+ *
+ * uint16 length of the body
+ * body:
+ *   int64  timestamp
+ *   uint8  type (JSON_NUMBER or JSON_STRING)
+ *   uint8  decimals
+ *   uint8  length of the device id
+ *   uint8  length of the setting name
+ *   device id, setting name
+ *   double value or uint16 length + string value
+ * uint32 checksum of the body
+ *
+ * All fields are stored in host byte order, the journal
+ * is never shared between machines.
+ */
+
+static const unsigned char journal_magic[4] = { 'P', 'L', 'J', 1 };
+
+static pthread_mutex_t journal_lock;
+static pthread_mutexattr_t journal_attr;
+static unsigned short journal_init = 0;
+
+static char *journal_file = NULL;
+static int journal_fd = -1;
+static int compact_fd = -1;
+static unsigned short compacting = 0;
+static unsigned int journal_records = 0;
+static void (*journal_snapshot)(void) = NULL;
+
+static int journal_write(int fd, unsigned char *buf, size_t len) {
+	size_t pos = 0;
+	ssize_t n = 0;
+
+	while(pos < len) {
+		if((n = write(fd, &buf[pos], len-pos)) <= 0) {
+			if(n == -1 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		pos += (size_t)n;
+	}
+	return 0;
+}
+
+static void journal_sync(int fd) {
+#ifdef _WIN32
+	_commit(fd);
+#else
+	fsync(fd);
+#endif
+}
+
+int journal_open(char *file) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct stat st;
+
+	if(journal_init == 0) {
+		pthread_mutexattr_init(&journal_attr);
+		pthread_mutexattr_settype(&journal_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&journal_lock, &journal_attr);
+		journal_init = 1;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	if(journal_fd != -1) {
+		close(journal_fd);
+	}
+	if((journal_file = REALLOC(journal_file, strlen(file)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(journal_file, file);
+
+	if((journal_fd = open(journal_file, O_RDWR | O_CREAT | O_APPEND | O_BINARY, S_IRUSR | S_IWUSR)) == -1) {
+		logprintf(LOG_NOTICE, "cannot open state journal: %s", journal_file);
+		pthread_mutex_unlock(&journal_lock);
+		return -1;
+	}
+	if(fstat(journal_fd, &st) == 0 && st.st_size == 0) {
+		journal_write(journal_fd, (unsigned char *)journal_magic, sizeof(journal_magic));
+	}
+	journal_records = 0;
+	pthread_mutex_unlock(&journal_lock);
+
+	return 0;
+}
+
+int journal_replay(journal_callback_t callback) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct stat st;
+	unsigned char *content = NULL;
+	char device[256], name[256], *string = NULL;
+	size_t bytes = 0, pos = 0, len = 0, x = 0, end = 0;
+	uint16_t blen = 0, slen = 0;
+	uint32_t checksum = 0;
+	int64_t ts = 0;
+	double number = 0.0;
+	int type = 0, decimals = 0, nr = 0;
+
+	if(journal_init == 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	if(journal_fd == -1 || fstat(journal_fd, &st) != 0) {
+		pthread_mutex_unlock(&journal_lock);
+		return -1;
+	}
+	bytes = (size_t)st.st_size;
+
+	if((content = MALLOC(bytes+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	lseek(journal_fd, 0, SEEK_SET);
+	while(pos < bytes) {
+		ssize_t n = read(journal_fd, &content[pos], bytes-pos);
+		if(n <= 0) {
+			if(n == -1 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		pos += (size_t)n;
+	}
+	bytes = pos;
+
+	if(bytes < sizeof(journal_magic) || memcmp(content, journal_magic, sizeof(journal_magic)) != 0) {
+		logprintf(LOG_NOTICE, "state journal %s is invalid, starting a new one", journal_file);
+		if(ftruncate(journal_fd, 0) == 0) {
+			journal_write(journal_fd, (unsigned char *)journal_magic, sizeof(journal_magic));
+		}
+		FREE(content);
+		pthread_mutex_unlock(&journal_lock);
+		return 0;
+	}
+
+	pos = sizeof(journal_magic);
+	while(pos+sizeof(blen) <= bytes) {
+		memcpy(&blen, &content[pos], sizeof(blen));
+		len = sizeof(blen)+blen+sizeof(checksum);
+		if(pos+len > bytes || blen < sizeof(ts)+4) {
+			break;
+		}
+		memcpy(&checksum, &content[pos+sizeof(blen)+blen], sizeof(checksum));
+		if(checksum != (uint32_t)fnv1a(&content[pos+sizeof(blen)], blen)) {
+			break;
+		}
+
+		x = pos+sizeof(blen);
+		end = x+blen;
+		memcpy(&ts, &content[x], sizeof(ts));
+		x += sizeof(ts);
+		type = content[x++];
+		decimals = content[x++];
+		size_t dlen = content[x++];
+		size_t nlen = content[x++];
+		if(x+dlen+nlen > end) {
+			break;
+		}
+		memcpy(device, &content[x], dlen);
+		device[dlen] = '\0';
+		x += dlen;
+		memcpy(name, &content[x], nlen);
+		name[nlen] = '\0';
+		x += nlen;
+
+		string = NULL;
+		number = 0.0;
+		/* A value running past its record ends the replay */
+		if(type == JSON_NUMBER) {
+			if(x+sizeof(number) > end) {
+				break;
+			}
+			memcpy(&number, &content[x], sizeof(number));
+		} else if(type == JSON_STRING) {
+			if(x+sizeof(slen) > end) {
+				break;
+			}
+			memcpy(&slen, &content[x], sizeof(slen));
+			x += sizeof(slen);
+			if(slen > end-x) {
+				break;
+			}
+			if((string = MALLOC((size_t)slen+1)) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(string, &content[x], slen);
+			string[slen] = '\0';
+		}
+
+		callback(device, name, type, number, decimals, string, (time_t)ts);
+		if(string != NULL) {
+			FREE(string);
+		}
+		nr++;
+		pos += len;
+	}
+
+	/* Drop a partially written record at the tail */
+	if(pos < bytes) {
+		logprintf(LOG_NOTICE, "state journal %s has a damaged tail, truncating", journal_file);
+		if(ftruncate(journal_fd, (off_t)pos) != 0) {
+			logprintf(LOG_ERR, "cannot truncate state journal: %s", journal_file);
+		}
+	}
+	FREE(content);
+	pthread_mutex_unlock(&journal_lock);
+
+	logprintf(LOG_DEBUG, "replayed %d state journal records", nr);
+	return nr;
+}
+
+int journal_append(char *device, char *name, int type, double number, int decimals, char *string, time_t timestamp) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned char buf[JOURNAL_MAX_RECORD];
+	size_t dlen = strlen(device), nlen = strlen(name), slen = 0, x = sizeof(uint16_t);
+	int64_t ts = (int64_t)timestamp;
+	uint16_t blen = 0;
+	uint32_t checksum = 0;
+	int fd = -1, ret = 0;
+
+	if(journal_init == 0) {
+		return -1;
+	}
+	if(type == JSON_STRING) {
+		slen = strlen(string);
+	}
+	if(dlen > 255 || nlen > 255 ||
+	   sizeof(blen)+sizeof(ts)+4+dlen+nlen+sizeof(uint16_t)+slen+sizeof(double)+sizeof(checksum) > JOURNAL_MAX_RECORD) {
+		logprintf(LOG_DEBUG, "state of %s %s too large for the journal", device, name);
+		return -1;
+	}
+
+	memcpy(&buf[x], &ts, sizeof(ts));
+	x += sizeof(ts);
+	buf[x++] = (unsigned char)type;
+	buf[x++] = (unsigned char)decimals;
+	buf[x++] = (unsigned char)dlen;
+	buf[x++] = (unsigned char)nlen;
+	memcpy(&buf[x], device, dlen);
+	x += dlen;
+	memcpy(&buf[x], name, nlen);
+	x += nlen;
+	if(type == JSON_NUMBER) {
+		memcpy(&buf[x], &number, sizeof(number));
+		x += sizeof(number);
+	} else {
+		uint16_t len = (uint16_t)slen;
+		memcpy(&buf[x], &len, sizeof(len));
+		x += sizeof(len);
+		memcpy(&buf[x], string, slen);
+		x += slen;
+	}
+	blen = (uint16_t)(x-sizeof(blen));
+	memcpy(buf, &blen, sizeof(blen));
+	checksum = (uint32_t)fnv1a(&buf[sizeof(blen)], blen);
+	memcpy(&buf[x], &checksum, sizeof(checksum));
+	x += sizeof(checksum);
+
+	pthread_mutex_lock(&journal_lock);
+	fd = (compacting == 1) ? compact_fd : journal_fd;
+	if(fd == -1) {
+		pthread_mutex_unlock(&journal_lock);
+		return -1;
+	}
+	if(journal_write(fd, buf, x) != 0) {
+		logprintf(LOG_ERR, "cannot write state journal: %s", journal_file);
+		ret = -1;
+	} else if(compacting == 0) {
+		journal_records++;
+		if(journal_records >= JOURNAL_COMPACT_RECORDS && journal_snapshot != NULL) {
+			journal_compact(journal_snapshot);
+		}
+	}
+	pthread_mutex_unlock(&journal_lock);
+
+	return ret;
+}
+
+/* Rewrite the journal with only the current state
+   as recorded by the snapshot function */
+int journal_compact(void (*snapshot)(void)) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	char *tmpfile = NULL;
+	int ret = 0;
+
+	if(journal_init == 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+	if(journal_fd == -1 || compacting == 1) {
+		pthread_mutex_unlock(&journal_lock);
+		return -1;
+	}
+
+	if((tmpfile = MALLOC(strlen(journal_file)+5)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmpfile, "%s.tmp", journal_file);
+
+	if((compact_fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRUSR | S_IWUSR)) == -1) {
+		logprintf(LOG_ERR, "cannot write state journal: %s", tmpfile);
+		FREE(tmpfile);
+		pthread_mutex_unlock(&journal_lock);
+		return -1;
+	}
+	journal_write(compact_fd, (unsigned char *)journal_magic, sizeof(journal_magic));
+
+	compacting = 1;
+	snapshot();
+	compacting = 0;
+
+	journal_sync(compact_fd);
+	close(compact_fd);
+	compact_fd = -1;
+
+	close(journal_fd);
+#ifdef _WIN32
+	if(MoveFileEx(tmpfile, journal_file, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == 0) {
+#else
+	if(rename(tmpfile, journal_file) == -1) {
+#endif
+		logprintf(LOG_ERR, "cannot replace state journal: %s", journal_file);
+		unlink(tmpfile);
+		ret = -1;
+	}
+	FREE(tmpfile);
+
+	if((journal_fd = open(journal_file, O_RDWR | O_APPEND | O_BINARY)) == -1) {
+		logprintf(LOG_ERR, "cannot open state journal: %s", journal_file);
+		ret = -1;
+	}
+	journal_records = 0;
+	pthread_mutex_unlock(&journal_lock);
+
+	logprintf(LOG_DEBUG, "compacted state journal %s", journal_file);
+	return ret;
+}
+
+void journal_set_snapshot(void (*snapshot)(void)) {
+	journal_snapshot = snapshot;
+}
+
+int journal_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(journal_init == 1) {
+		pthread_mutex_lock(&journal_lock);
+		if(journal_fd != -1) {
+			journal_sync(journal_fd);
+			close(journal_fd);
+			journal_fd = -1;
+		}
+		if(journal_file != NULL) {
+			FREE(journal_file);
+		}
+		journal_snapshot = NULL;
+		pthread_mutex_unlock(&journal_lock);
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected journal library");
+	return 0;
+}
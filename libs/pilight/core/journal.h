@@ -0,0 +1,37 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <time.h>
+
+/* Compact the journal after this many appended records */
+#define JOURNAL_COMPACT_RECORDS	4096
+#define JOURNAL_MAX_RECORD			1024
+
+typedef void (*journal_callback_t)(char *device, char *name, int type, double number, int decimals, char *string, time_t timestamp);
+
+int journal_open(char *file);
+int journal_replay(journal_callback_t callback);
+int journal_append(char *device, char *name, int type, double number, int decimals, char *string, time_t timestamp);
+int journal_compact(void (*snapshot)(void));
+void journal_set_snapshot(void (*snapshot)(void));
+int journal_gc(void);
+
+#endif
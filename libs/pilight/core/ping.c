@@ -90,9 +90,13 @@
 #include <string.h>
 #include <signal.h>
 
+#include <pthread.h>
+
 #include "common.h"
+#include "threads.h"
 #include "log.h"
 #include "mem.h"
+#include "ping.h"
 
 #ifdef _WIN32
 	typedef unsigned char u_int8_t;
@@ -189,16 +193,55 @@
 	};
 #endif
 
+#ifndef ICMP_MINLEN
+	#define ICMP_MINLEN	8
+#endif
+
+/* Probe payload, just enough to look like a regular ping */
+#define PING_DATALEN	8
+/* A probe without reply after this many microseconds is lost */
+#define PING_TIMEOUT	1000000
+/* Lost probes are retried this many times before a host is down */
+#define PING_RETRIES	2
+/* Loss is calculated over this many probes */
+#define PING_WINDOW		32
+
+typedef struct ping_target_t {
+	char ip[INET_ADDRSTRLEN+1];
+	struct in_addr addr;
+	int interval;
+	int state;
+	int lost;
+	unsigned short seq;
+	unsigned long long sent;
+	unsigned long long due;
+	unsigned int window;
+	unsigned int nrwindow;
+	double rtt;
+	ping_callback_t *callback;
+	struct ping_target_t *next;
+} ping_target_t;
+
+static pthread_mutex_t ping_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ping_target_t *ping_targets = NULL;
+static pthread_t ping_pth;
+static int ping_started = 0;
+static int ping_loop = 1;
+static int ping_fd = -1;
+static int ping_raw = 0;
+static unsigned short ping_ident = 0;
+static unsigned short ping_seq = 0;
+
 /*
  * in_cksum --
  *	Checksum routine for Internet Protocol family headers (C Version)
  *      From FreeBSD's ping.c
  */
-static int in_cksum(int *addr, int len) {
+static int in_cksum(unsigned short *addr, int len) {
 	register int nleft = len;
-	register int *w = addr;
+	register unsigned short *w = addr;
 	register int sum = 0;
-	int answer = 0;
+	unsigned short answer = 0;
 
 	/*
 	* Our algorithm is simple, using a 32 bit accumulator (sum), we add
@@ -219,112 +262,353 @@ static int in_cksum(int *addr, int len) {
 	/* add back carry outs from top 16 bits to low 16 bits */
 	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
 	sum += (sum >> 16);			/* add carry */
-	answer = ~sum;				/* truncate to 16 bits */
+	answer = (unsigned short)~sum;				/* truncate to 16 bits */
 	return answer;
 }
 
-static int initpacket(char *buf) {
-	struct ip *ip = (struct ip *)buf;
-	struct icmp *icmp = (struct icmp *)(ip + 1);
-	int icmplen = 20;
-	struct in_addr fromaddr;
-	fromaddr.s_addr = 0;
-
-	ip->ip_src = fromaddr;
-	ip->ip_v = 4;
-	ip->ip_hl = sizeof *ip >> 2;
-	ip->ip_tos = 0;
-	ip->ip_id = htons(4321);
-	ip->ip_ttl = 255;
-	ip->ip_p = 1;
-	ip->ip_sum = 0;
-
-	icmp->icmp_seq = 1;
-	icmp->icmp_cksum = 0;
-	icmp->icmp_type = ICMP_ECHO;
-	icmp->icmp_code = 0;
-
-	gettimeofday((struct timeval *)(icmp+8), NULL);
-	memset(icmp+12, '\0',	8);
-	ip->ip_len = sizeof(struct ip) + icmplen;
-	return icmplen;
+static unsigned long long ping_time(void) {
+#ifdef _WIN32
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000+(unsigned long long)(ts.tv_nsec/1000);
+#endif
 }
 
-int ping(char *addr) {
-	char buf[1500], buf1[INET_ADDRSTRLEN+1];
-	struct ip *ip = (struct ip *)buf;
-	struct icmp *icmp = (struct icmp *)(ip + 1);
-	struct sockaddr_in dst;
-	int icmplen = 0;
-	int sockfd = 0, on = 1;
-	long int fromlen = 0;
+/*
+ * Prefer an unprivileged icmp datagram socket where the kernel
+ * allows it. The kernel then fills in the identifier and only
+ * hands us our own replies.
+ */
+static int ping_socket(int *raw) {
+	int fd = -1;
 
 #ifdef _WIN32
 	WSADATA wsa;
 
 	if(WSAStartup(0x202, &wsa) != 0) {
 		logprintf(LOG_ERR, "could not initialize new socket");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 #endif
 
-	if((sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
+#ifdef __linux__
+	if((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)) >= 0) {
+		*raw = 0;
+		return fd;
+	}
+#endif
+	if((fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
 		logperror(LOG_DEBUG, "socket");
 		return -1;
 	}
+	*raw = 1;
+	return fd;
+}
+
+static int ping_send(int fd, struct in_addr addr, unsigned short id, unsigned short seq) {
+	unsigned char buf[ICMP_MINLEN+PING_DATALEN];
+	struct icmp *icmp = (struct icmp *)buf;
+	struct sockaddr_in dst;
 
-	if(setsockopt(sockfd, IPPROTO_IP, IP_HDRINCL, (const char *)&on, sizeof(on)) < 0) {
-		logperror(LOG_DEBUG, "IP_HDRINCL");
-		close(sockfd);
+	memset(buf, '\0', sizeof(buf));
+	icmp->icmp_type = ICMP_ECHO;
+	icmp->icmp_code = 0;
+	icmp->icmp_id = htons(id);
+	icmp->icmp_seq = htons(seq);
+	icmp->icmp_cksum = 0;
+	icmp->icmp_cksum = (unsigned short)in_cksum((unsigned short *)buf, sizeof(buf));
+
+	memset(&dst, '\0', sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_addr = addr;
+	dst.sin_port = htons(0);
+
+	if(sendto(fd, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&dst, sizeof(dst)) < 0) {
 		return -1;
 	}
+	return 0;
+}
 
-#ifndef _WIN32
-	struct timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
+/* Returns 0 for an echo reply to one of our probes */
+static int ping_recv(int fd, int raw, unsigned short id, struct in_addr *from, unsigned short *seq) {
+	unsigned char buf[1500];
+	struct sockaddr_in src;
+	struct icmp *icmp = NULL;
+	socklen_t srclen = sizeof(src);
+	int len = 0, hl = 0;
 
-	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval)) < 0) {
-#else
-	int timeout = 1000;
-	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(struct timeval)) < 0) {
-#endif
-		logperror(LOG_DEBUG, "SO_RCVTIMEO");
-		close(sockfd);
+	memset(&src, '\0', sizeof(src));
+	if((len = (int)recvfrom(fd, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&src, &srclen)) <= 0) {
 		return -1;
 	}
+	/* Raw sockets also deliver the ip header */
+	if(raw == 1) {
+		if(len < 20) {
+			return -1;
+		}
+		hl = (buf[0] & 0x0F) << 2;
+	}
+	if(len < hl+ICMP_MINLEN) {
+		return -1;
+	}
+	icmp = (struct icmp *)&buf[hl];
+	if(icmp->icmp_type != ICMP_ECHOREPLY) {
+		return -1;
+	}
+	if(raw == 1 && ntohs(icmp->icmp_id) != id) {
+		return -1;
+	}
+	*from = src.sin_addr;
+	*seq = ntohs(icmp->icmp_seq);
+	return 0;
+}
 
-	memset(buf, '\0', 1500);
-	icmplen = initpacket(buf);
-	dst.sin_family = AF_INET;
+static int ping_wait(int fd, unsigned long long usec) {
+	struct timeval tv;
+	fd_set fdset;
 
-	ip->ip_dst.s_addr = inet_addr(addr);
-	dst.sin_addr.s_addr = inet_addr(addr);
-	dst.sin_port = htons(0);
-	icmp->icmp_cksum = 0;
-	icmp->icmp_cksum = in_cksum((int *)icmp, icmplen);
-	if(sendto(sockfd, buf, ip->ip_len, 0, (struct sockaddr *)&dst, sizeof(dst)) < 0) {
+	tv.tv_sec = (long)(usec/1000000);
+	tv.tv_usec = (long)(usec%1000000);
+	FD_ZERO(&fdset);
+	FD_SET(fd, &fdset);
+	return select(fd+1, &fdset, NULL, NULL, &tv);
+}
+
+int ping(char *addr) {
+	struct in_addr dst, from;
+	unsigned long long start = 0, now = 0;
+	unsigned short seq = 0;
+	int fd = 0, raw = 0;
+
+	if(inet_pton(AF_INET, addr, &dst) <= 0) {
+		return -1;
+	}
+	if((fd = ping_socket(&raw)) < 0) {
+		return -1;
+	}
+	if(ping_send(fd, dst, (unsigned short)getpid(), 1) != 0) {
 		logperror(LOG_DEBUG, "sendto");
-		close(sockfd);
+		close(fd);
 		return -1;
 	}
 
-	memset(buf, '\0', sizeof(buf));
-	if((recvfrom(sockfd, buf, sizeof(buf), 0, NULL, (socklen_t *)&fromlen)) < 0) {
-		logperror(LOG_DEBUG, "recvfrom");
-		close(sockfd);
-		return -1;
+	start = ping_time();
+	while((now = ping_time()) < start+PING_TIMEOUT) {
+		if(ping_wait(fd, start+PING_TIMEOUT-now) <= 0) {
+			break;
+		}
+		if(ping_recv(fd, raw, (unsigned short)getpid(), &from, &seq) == 0 &&
+		   from.s_addr == dst.s_addr && seq == 1) {
+			close(fd);
+			return 0;
+		}
+	}
+	close(fd);
+	return -1;
+}
+
+static void ping_account(struct ping_target_t *target, int lost) {
+	target->window = (target->window << 1) | (unsigned int)lost;
+	if(target->nrwindow < PING_WINDOW) {
+		target->nrwindow++;
+	}
+}
+
+static void *ping_thread(void *param) {
+	struct ping_target_t *tmp = NULL;
+	struct in_addr from;
+	unsigned long long now = 0, wake = 0;
+	unsigned short seq = 0;
+	int nr = 0, i = 0;
+
+	while(ping_loop == 1) {
+		now = ping_time();
+		wake = now+PING_TIMEOUT;
+
+		pthread_mutex_lock(&ping_lock);
+		nr = 0;
+		for(tmp=ping_targets;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct {
+			char ip[INET_ADDRSTRLEN+1];
+			int state;
+			ping_callback_t *callback;
+		} changes[nr+1];
+		nr = 0;
+
+		for(tmp=ping_targets;tmp!=NULL;tmp=tmp->next) {
+			if(tmp->sent > 0 && now >= tmp->sent+PING_TIMEOUT) {
+				tmp->sent = 0;
+				ping_account(tmp, 1);
+				if(++tmp->lost <= PING_RETRIES) {
+					tmp->due = now;
+				} else if(tmp->state != PING_DISCONNECTED) {
+					tmp->state = PING_DISCONNECTED;
+					strcpy(changes[nr].ip, tmp->ip);
+					changes[nr].state = tmp->state;
+					changes[nr].callback = tmp->callback;
+					nr++;
+				}
+			}
+			if(tmp->sent == 0 && now >= tmp->due) {
+				tmp->seq = ++ping_seq;
+				tmp->sent = now;
+				tmp->due = now+(unsigned long long)tmp->interval*1000000;
+				/* An unreachable network counts as a lost probe */
+				if(ping_send(ping_fd, tmp->addr, ping_ident, tmp->seq) != 0) {
+					logprintf(LOG_DEBUG, "could not ping %s", tmp->ip);
+				}
+			}
+			if(tmp->sent > 0 && tmp->sent+PING_TIMEOUT < wake) {
+				wake = tmp->sent+PING_TIMEOUT;
+			}
+			if(tmp->sent == 0 && tmp->due < wake) {
+				wake = tmp->due;
+			}
+		}
+		pthread_mutex_unlock(&ping_lock);
+
+		for(i=0;i<nr;i++) {
+			changes[i].callback(changes[i].ip, changes[i].state);
+		}
+
+		now = ping_time();
+		if(wake <= now || ping_wait(ping_fd, wake-now) <= 0) {
+			continue;
+		}
+		if(ping_recv(ping_fd, ping_raw, ping_ident, &from, &seq) != 0) {
+			continue;
+		}
+
+		now = ping_time();
+		ping_callback_t *callback = NULL;
+		char ip[INET_ADDRSTRLEN+1];
+
+		pthread_mutex_lock(&ping_lock);
+		for(tmp=ping_targets;tmp!=NULL;tmp=tmp->next) {
+			if(tmp->sent > 0 && tmp->seq == seq && tmp->addr.s_addr == from.s_addr) {
+				double rtt = (double)(now-tmp->sent)/1000;
+				/* Smoothed like the tcp round trip time */
+				if(tmp->rtt == 0.0) {
+					tmp->rtt = rtt;
+				} else {
+					tmp->rtt += (rtt-tmp->rtt)/8;
+				}
+				tmp->sent = 0;
+				tmp->lost = 0;
+				ping_account(tmp, 0);
+				if(tmp->state != PING_CONNECTED) {
+					tmp->state = PING_CONNECTED;
+					callback = tmp->callback;
+					strcpy(ip, tmp->ip);
+				}
+				break;
+			}
+		}
+		pthread_mutex_unlock(&ping_lock);
+
+		if(callback != NULL) {
+			callback(ip, PING_CONNECTED);
+		}
 	}
 
-	icmp = (struct icmp *)(buf + (ip->ip_hl << 2));
-	memset(&buf1, '\0', INET_ADDRSTRLEN+1);
-	inet_ntop(AF_INET, (void *)&(ip->ip_src), buf1, INET_ADDRSTRLEN+1);
-	if(!((icmp->icmp_type == ICMP_ECHOREPLY || icmp->icmp_type == ICMP_ECHO) && strcmp(buf1, addr) == 0)) {
-		logprintf(LOG_DEBUG, "unexpected status reply: %d code: %d at: %s from: %s",icmp->icmp_type, icmp->icmp_code, buf1, addr);
-		close(sockfd);
+	return (void *)NULL;
+}
+
+int ping_add(char *ip, int interval, int state, ping_callback_t *callback) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct ping_target_t *target = NULL;
+	struct in_addr addr;
+
+	if(inet_pton(AF_INET, ip, &addr) <= 0) {
+		logprintf(LOG_ERR, "%s is not a valid ip address", ip);
 		return -1;
 	}
 
-	close(sockfd);
+	pthread_mutex_lock(&ping_lock);
+	if(ping_fd == -1) {
+		if((ping_fd = ping_socket(&ping_raw)) < 0) {
+			logprintf(LOG_ERR, "could not create icmp socket");
+			pthread_mutex_unlock(&ping_lock);
+			return -1;
+		}
+		ping_ident = (unsigned short)getpid();
+	}
+
+	if((target = MALLOC(sizeof(struct ping_target_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(target, '\0', sizeof(struct ping_target_t));
+	snprintf(target->ip, sizeof(target->ip), "%s", ip);
+	target->addr = addr;
+	target->interval = (interval < 1) ? 1 : interval;
+	target->state = state;
+	target->callback = callback;
+	/* The configured state holds until the first probe */
+	target->due = ping_time()+(unsigned long long)target->interval*1000000;
+	target->next = ping_targets;
+	ping_targets = target;
+
+	if(ping_started == 0) {
+		ping_loop = 1;
+		threads_create(&ping_pth, NULL, ping_thread, NULL);
+		ping_started = 1;
+	}
+	pthread_mutex_unlock(&ping_lock);
+	return 0;
+}
+
+int ping_stats(char *ip, double *rtt, double *loss) {
+	struct ping_target_t *tmp = NULL;
+	unsigned int i = 0, lost = 0;
+	int ret = -1;
+
+	pthread_mutex_lock(&ping_lock);
+	for(tmp=ping_targets;tmp!=NULL;tmp=tmp->next) {
+		if(strcmp(tmp->ip, ip) == 0) {
+			for(i=0;i<tmp->nrwindow;i++) {
+				lost += (tmp->window >> i) & 1;
+			}
+			*rtt = tmp->rtt;
+			*loss = (tmp->nrwindow == 0) ? 0.0 : (double)lost*100/tmp->nrwindow;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ping_lock);
+	return ret;
+}
+
+int ping_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct ping_target_t *tmp = NULL;
+
+	if(ping_started == 1) {
+		ping_loop = 0;
+		pthread_join(ping_pth, NULL);
+		ping_started = 0;
+	}
+
+	pthread_mutex_lock(&ping_lock);
+	while(ping_targets) {
+		tmp = ping_targets;
+		ping_targets = ping_targets->next;
+		FREE(tmp);
+	}
+	if(ping_fd != -1) {
+		close(ping_fd);
+		ping_fd = -1;
+	}
+	pthread_mutex_unlock(&ping_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected ping library");
 	return 0;
 }
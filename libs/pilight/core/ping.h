@@ -63,6 +63,14 @@
 #ifndef _LIBPROC_H_
 #define _LIBPROC_H_
 
+#define PING_DISCONNECTED	0
+#define PING_CONNECTED		1
+
+typedef void (ping_callback_t)(char *ip, int state);
+
 int ping(char *addr);
+int ping_add(char *ip, int interval, int state, ping_callback_t *callback);
+int ping_stats(char *ip, double *rtt, double *loss);
+int ping_gc(void);
 
 #endif
@@ -31,11 +31,21 @@
 #include <time.h>
 #ifdef _WIN32
 	#include <windows.h>
+#else
+	#include <poll.h>
+	#include <sys/socket.h>
+#endif
+#ifdef __linux__
+	#include <sys/syscall.h>
+	#include <linux/netlink.h>
+	#include <linux/connector.h>
+	#include <linux/cn_proc.h>
 #endif
 #include <pthread.h>
 #include <ctype.h>
 #include <dirent.h>
 
+#include "threads.h"
 #include "proc.h"
 #include "log.h"
 #include "mem.h"
@@ -239,3 +249,528 @@ double getRAMUsage(void) {
 	return 0.0;
 #endif
 }
+
+#ifndef _WIN32
+/*
+ * Process tracker
+ *
+ * One thread keeps a table of all running processes, indexed
+ * by pid and by program name, and reports watched programs
+ * that start or stop. On Linux the netlink process connector
+ * tells about every fork, exec and exit so the table is kept
+ * up to date without reading /proc. Without the connector the
+ * table is rebuilt by a single /proc scan for all watches
+ * together. A matched process is followed by a pidfd so its
+ * exit is noticed immediately either way.
+ */
+
+#define PROC_BUCKETS	256
+#define PROC_CMDLINE	1024
+/* Programs can rewrite their cmdline without any event */
+#define PROC_RESYNC		60
+
+typedef struct proc_entry_t {
+	pid_t pid;
+	char *cmd;
+	char *args;
+	struct proc_entry_t *nextpid;
+	struct proc_entry_t *nextcmd;
+} proc_entry_t;
+
+typedef struct proc_watch_t {
+	char *program;
+	char *arguments;
+	int interval;
+	pid_t pid;
+	int pidfd;
+	int reported;
+	unsigned long long due;
+	proc_callback_t *callback;
+	void *userdata;
+	struct proc_watch_t *next;
+} proc_watch_t;
+
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proc_entry_t *proc_bypid[PROC_BUCKETS];
+static struct proc_entry_t *proc_bycmd[PROC_BUCKETS];
+static struct proc_watch_t *proc_watches = NULL;
+static pthread_t proc_pth;
+static int proc_started = 0;
+static int proc_loop = 1;
+static int proc_nl = -1;
+
+static unsigned long long proc_time(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
+
+static unsigned int proc_hash(char *str) {
+	unsigned int hash = 5381;
+
+	while(*str != '\0') {
+		hash = ((hash << 5)+hash)+(unsigned char)*str++;
+	}
+	return hash % PROC_BUCKETS;
+}
+
+static struct proc_entry_t *proc_table_get(pid_t pid) {
+	struct proc_entry_t *tmp = proc_bypid[(unsigned int)pid % PROC_BUCKETS];
+
+	while(tmp != NULL && tmp->pid != pid) {
+		tmp = tmp->nextpid;
+	}
+	return tmp;
+}
+
+static void proc_table_add(pid_t pid, char *cmd, char *args) {
+	struct proc_entry_t *entry = NULL;
+	unsigned int hash = 0;
+
+	if((entry = MALLOC(sizeof(struct proc_entry_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(entry, '\0', sizeof(struct proc_entry_t));
+	entry->pid = pid;
+	if((entry->cmd = MALLOC(strlen(cmd)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(entry->cmd, cmd);
+	if(args != NULL) {
+		if((entry->args = MALLOC(strlen(args)+1)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(entry->args, args);
+	}
+
+	hash = (unsigned int)pid % PROC_BUCKETS;
+	entry->nextpid = proc_bypid[hash];
+	proc_bypid[hash] = entry;
+	hash = proc_hash(cmd);
+	entry->nextcmd = proc_bycmd[hash];
+	proc_bycmd[hash] = entry;
+}
+
+static void proc_table_del(pid_t pid) {
+	struct proc_entry_t **ptr = NULL, *entry = NULL;
+
+	for(ptr=&proc_bypid[(unsigned int)pid % PROC_BUCKETS];*ptr!=NULL;ptr=&(*ptr)->nextpid) {
+		if((*ptr)->pid == pid) {
+			entry = *ptr;
+			*ptr = entry->nextpid;
+			break;
+		}
+	}
+	if(entry == NULL) {
+		return;
+	}
+	for(ptr=&proc_bycmd[proc_hash(entry->cmd)];*ptr!=NULL;ptr=&(*ptr)->nextcmd) {
+		if(*ptr == entry) {
+			*ptr = entry->nextcmd;
+			break;
+		}
+	}
+	FREE(entry->cmd);
+	if(entry->args != NULL) {
+		FREE(entry->args);
+	}
+	FREE(entry);
+}
+
+static void proc_table_clear(void) {
+	struct proc_entry_t *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<PROC_BUCKETS;i++) {
+		while(proc_bypid[i] != NULL) {
+			tmp = proc_bypid[i];
+			proc_bypid[i] = tmp->nextpid;
+			FREE(tmp->cmd);
+			if(tmp->args != NULL) {
+				FREE(tmp->args);
+			}
+			FREE(tmp);
+		}
+		proc_bycmd[i] = NULL;
+	}
+}
+
+/*
+ * Split the cmdline the same way findproc does, the
+ * program itself and all arguments joined by spaces.
+ */
+static void proc_table_read(pid_t pid) {
+	char fname[64], cmdline[PROC_CMDLINE], *args = NULL;
+	int fd = 0, len = 0, i = 0;
+
+	proc_table_del(pid);
+
+	snprintf(fname, sizeof(fname), "/proc/%d/cmdline", (int)pid);
+	if((fd = open(fname, O_RDONLY, 0)) < 0) {
+		return;
+	}
+	memset(cmdline, '\0', sizeof(cmdline));
+	len = (int)read(fd, cmdline, sizeof(cmdline)-1);
+	close(fd);
+
+	/* Kernel threads have no cmdline */
+	if(len <= 0 || cmdline[0] == '\0') {
+		return;
+	}
+	for(i=0;i<len-1;i++) {
+		if(cmdline[i] == '\0') {
+			if(args == NULL) {
+				args = &cmdline[i+1];
+			} else {
+				cmdline[i] = ' ';
+			}
+		}
+	}
+	proc_table_add(pid, cmdline, args);
+}
+
+static void proc_table_fork(pid_t parent, pid_t child) {
+	struct proc_entry_t *entry = NULL;
+
+	if((entry = proc_table_get(parent)) != NULL) {
+		proc_table_del(child);
+		proc_table_add(child, entry->cmd, entry->args);
+	} else {
+		proc_table_read(child);
+	}
+}
+
+static void proc_scan(void) {
+	struct dirent *ent = NULL;
+	DIR *dir = NULL;
+
+	proc_table_clear();
+	if((dir = opendir("/proc")) == NULL) {
+		logprintf(LOG_ERR, "/proc filesystem not properly mounted");
+		return;
+	}
+	while((ent = readdir(dir)) != NULL) {
+		if(ent->d_name[0] >= '1' && ent->d_name[0] <= '9') {
+			proc_table_read((pid_t)atol(ent->d_name));
+		}
+	}
+	closedir(dir);
+}
+
+/* The lowest matching pid, unless the current one still matches */
+static pid_t proc_match(char *program, char *arguments, pid_t current) {
+	struct proc_entry_t *tmp = NULL;
+	pid_t pid = 0;
+
+	for(tmp=proc_bycmd[proc_hash(program)];tmp!=NULL;tmp=tmp->nextcmd) {
+		if(strcmp(tmp->cmd, program) != 0) {
+			continue;
+		}
+		if(arguments != NULL && (tmp->args == NULL || strcmp(tmp->args, arguments) != 0)) {
+			continue;
+		}
+		if(tmp->pid == current) {
+			return current;
+		}
+		if(pid == 0 || tmp->pid < pid) {
+			pid = tmp->pid;
+		}
+	}
+	return pid;
+}
+
+static int proc_pidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1;
+#endif
+}
+
+#ifdef __linux__
+static int proc_connect(void) {
+	struct sockaddr_nl addr;
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg)+sizeof(enum proc_cn_mcast_op))];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(nlh);
+	int fd = 0;
+
+	/* Only available to root in the initial network namespace */
+	if((fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR)) < 0) {
+		return -1;
+	}
+	memset(&addr, '\0', sizeof(struct sockaddr_nl));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_nl)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	memset(buf, '\0', sizeof(buf));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg)+sizeof(enum proc_cn_mcast_op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	msg->id.idx = CN_IDX_PROC;
+	msg->id.val = CN_VAL_PROC;
+	msg->len = sizeof(enum proc_cn_mcast_op);
+	memcpy(msg->data, &op, sizeof(enum proc_cn_mcast_op));
+	if(send(fd, buf, nlh->nlmsg_len, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Returns -1 when events were lost and the table needs a rescan */
+static int proc_receive(void) {
+	char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh = NULL;
+	struct cn_msg *msg = NULL;
+	struct proc_event *ev = NULL;
+	int len = 0;
+
+	while((len = (int)recv(proc_nl, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for(nlh=(struct nlmsghdr *)buf;NLMSG_OK(nlh, (unsigned int)len);nlh=NLMSG_NEXT(nlh, len)) {
+			if(nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN) {
+				return -1;
+			}
+			msg = (struct cn_msg *)NLMSG_DATA(nlh);
+			if(msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) {
+				continue;
+			}
+			ev = (struct proc_event *)msg->data;
+			switch(ev->what) {
+				case PROC_EVENT_FORK:
+					/* Threads share the cmdline of their process */
+					if(ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid) {
+						proc_table_fork(ev->event_data.fork.parent_tgid, ev->event_data.fork.child_tgid);
+					}
+				break;
+				case PROC_EVENT_EXEC:
+					proc_table_read(ev->event_data.exec.process_tgid);
+				break;
+				case PROC_EVENT_EXIT:
+					if(ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid) {
+						proc_table_del(ev->event_data.exit.process_tgid);
+					}
+				break;
+				default:
+				break;
+			}
+		}
+	}
+	if(len < 0 && errno == ENOBUFS) {
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+static void *proc_thread(void *param) {
+	struct proc_watch_t *tmp = NULL;
+	unsigned long long now = 0, rescan = 0;
+	int nr = 0, i = 0, n = 0, interval = 0;
+
+	while(proc_loop == 1) {
+		pthread_mutex_lock(&proc_lock);
+		nr = 0;
+		interval = PROC_RESYNC;
+		for(tmp=proc_watches;tmp!=NULL;tmp=tmp->next) {
+			if(tmp->interval < interval) {
+				interval = tmp->interval;
+			}
+			nr++;
+		}
+		struct pollfd fds[nr+1];
+		struct proc_watch_t *owners[nr+1];
+		n = 0;
+		if(proc_nl > -1) {
+			fds[n].fd = proc_nl;
+			fds[n].events = POLLIN;
+			fds[n].revents = 0;
+			owners[n++] = NULL;
+		}
+		for(tmp=proc_watches;tmp!=NULL;tmp=tmp->next) {
+			if(tmp->pidfd > -1) {
+				fds[n].fd = tmp->pidfd;
+				fds[n].events = POLLIN;
+				fds[n].revents = 0;
+				owners[n++] = tmp;
+			}
+		}
+		pthread_mutex_unlock(&proc_lock);
+
+		/* Wake up every second to see if we need to stop */
+		i = poll(fds, (nfds_t)n, 1000);
+
+		pthread_mutex_lock(&proc_lock);
+		now = proc_time();
+		for(n=n-1;i>0&&n>=0;n--) {
+			if(fds[n].revents == 0) {
+				continue;
+			}
+			if(owners[n] == NULL) {
+#ifdef __linux__
+				if(proc_receive() != 0) {
+					rescan = 0;
+				}
+#endif
+			} else {
+				/* A pidfd becomes readable when the process exits */
+				proc_table_del(owners[n]->pid);
+			}
+		}
+		if(now >= rescan) {
+			proc_scan();
+			rescan = now+(unsigned long long)(proc_nl > -1 ? PROC_RESYNC : interval)*1000000;
+		}
+
+		struct {
+			int pid;
+			proc_callback_t *callback;
+			void *userdata;
+		} changes[nr+1];
+		nr = 0;
+
+		for(tmp=proc_watches;tmp!=NULL;tmp=tmp->next) {
+			pid_t pid = proc_match(tmp->program, tmp->arguments, tmp->pid);
+			if(pid != tmp->pid) {
+				if(tmp->pidfd > -1) {
+					close(tmp->pidfd);
+					tmp->pidfd = -1;
+				}
+				if(pid > 0) {
+					tmp->pidfd = proc_pidfd(pid);
+				}
+				tmp->pid = pid;
+				tmp->reported = 0;
+			}
+			if(tmp->reported == 0 && now >= tmp->due) {
+				tmp->reported = 1;
+				changes[nr].pid = (int)pid;
+				changes[nr].callback = tmp->callback;
+				changes[nr].userdata = tmp->userdata;
+				nr++;
+			}
+		}
+		pthread_mutex_unlock(&proc_lock);
+
+		for(i=0;i<nr;i++) {
+			changes[i].callback(changes[i].userdata, changes[i].pid);
+		}
+	}
+
+	return (void *)NULL;
+}
+
+int proc_watch(char *program, char *arguments, int interval, proc_callback_t *callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct proc_watch_t *watch = NULL;
+
+	if(program == NULL) {
+		return -1;
+	}
+
+	if((watch = MALLOC(sizeof(struct proc_watch_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(watch, '\0', sizeof(struct proc_watch_t));
+	if((watch->program = MALLOC(strlen(program)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(watch->program, program);
+	if(arguments != NULL) {
+		if((watch->arguments = MALLOC(strlen(arguments)+1)) == NULL) {
+			logprintf(LOG_ERR, "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(watch->arguments, arguments);
+	}
+	watch->interval = (interval < 1) ? 1 : interval;
+	watch->pidfd = -1;
+	watch->callback = callback;
+	watch->userdata = userdata;
+	watch->due = proc_time()+(unsigned long long)watch->interval*1000000;
+
+	pthread_mutex_lock(&proc_lock);
+	watch->next = proc_watches;
+	proc_watches = watch;
+
+	if(proc_started == 0) {
+#ifdef __linux__
+		if((proc_nl = proc_connect()) > -1) {
+			logprintf(LOG_DEBUG, "tracking processes through the netlink process connector");
+		}
+#endif
+		proc_loop = 1;
+		threads_create(&proc_pth, NULL, proc_thread, NULL);
+		proc_started = 1;
+	}
+	pthread_mutex_unlock(&proc_lock);
+	return 0;
+}
+
+/* Looks a program up without waiting for the tracker */
+pid_t proc_find(char *program, char *arguments) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	pid_t pid = 0;
+
+	pthread_mutex_lock(&proc_lock);
+#ifdef __linux__
+	/* Catch up with a program that was just started or stopped */
+	if(proc_nl > -1 && proc_receive() != 0) {
+		proc_scan();
+	}
+#endif
+	if(proc_nl == -1) {
+		proc_scan();
+	}
+	pid = proc_match(program, arguments, 0);
+	pthread_mutex_unlock(&proc_lock);
+
+	return (pid > 0) ? pid : -1;
+}
+
+int proc_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct proc_watch_t *tmp = NULL;
+
+	if(proc_started == 1) {
+		proc_loop = 0;
+		pthread_join(proc_pth, NULL);
+		proc_started = 0;
+	}
+
+	pthread_mutex_lock(&proc_lock);
+	while(proc_watches) {
+		tmp = proc_watches;
+		proc_watches = proc_watches->next;
+		if(tmp->pidfd > -1) {
+			close(tmp->pidfd);
+		}
+		if(tmp->arguments != NULL) {
+			FREE(tmp->arguments);
+		}
+		FREE(tmp->program);
+		FREE(tmp);
+	}
+	if(proc_nl > -1) {
+		close(proc_nl);
+		proc_nl = -1;
+	}
+	proc_table_clear();
+	pthread_mutex_unlock(&proc_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected process tracker");
+	return 0;
+}
+#endif
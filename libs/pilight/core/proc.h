@@ -37,4 +37,15 @@ double getCPUUsage(void);
 double getRAMUsage(void);
 void getThreadCPUUsage(pthread_t pth, struct cpu_usage_t *cpu_usage);
 
+#ifndef _WIN32
+#include <sys/types.h>
+
+/* Called with the pid of the program, or 0 when it stopped */
+typedef void (proc_callback_t)(void *userdata, int pid);
+
+int proc_watch(char *program, char *arguments, int interval, proc_callback_t *callback, void *userdata);
+pid_t proc_find(char *program, char *arguments);
+int proc_gc(void);
+#endif
+
 #endif
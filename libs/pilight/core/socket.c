@@ -26,6 +26,7 @@
 #include <time.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #ifdef _WIN32
@@ -54,6 +55,7 @@
 #include "log.h"
 #include "gc.h"
 #include "socket.h"
+#include "frame.h"
 #include "../config/settings.h"
 
 static char recvBuff[BUFFER_SIZE];
@@ -64,6 +66,36 @@ static int socket_loopback = 0;
 static int socket_server = 0;
 static int socket_clients[MAX_CLIENTS];
 
+/*
+ * A node that negotiated it sends length prefixed frames to its
+ * master instead of text messages ending with EOSS. Each frame
+ * starts with a magic byte, the frame type and the payload length
+ * as four bytes in network order. Text the node writes is wrapped
+ * in a text frame, so all other messages keep working unchanged.
+ * The master keeps answering in plain text.
+ */
+#define SOCKET_FRAME_MAGIC		0xFA
+#define SOCKET_FRAME_HEADER		6
+
+typedef struct socket_frames_t {
+	int framed;
+	unsigned char *buffer;
+	size_t len;
+} socket_frames_t;
+
+static struct socket_frames_t socket_frames[MAX_CLIENTS];
+static int socket_framed_fd = 0;
+
+/* Frames are written whole under a lock of their socket */
+#define SOCKET_WRITE_LOCKS		16
+
+static pthread_mutex_t socket_write_lock[SOCKET_WRITE_LOCKS] = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+};
+
 int socket_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -89,6 +121,12 @@ int socket_gc(void) {
 		FREE(waitMessage);
 	}
 
+	for(x=0;x<MAX_CLIENTS;x++) {
+		if(socket_frames[x].buffer != NULL) {
+			FREE(socket_frames[x].buffer);
+		}
+	}
+
 	logprintf(LOG_DEBUG, "garbage collected socket library");
 	return EXIT_SUCCESS;
 }
@@ -329,9 +367,14 @@ void socket_close(int sockfd) {
 		for(i=0;i<MAX_CLIENTS;i++) {
 			if(socket_clients[i] == sockfd) {
 				socket_clients[i] = 0;
+				socket_frames[i].framed = 0;
+				socket_frames[i].len = 0;
 				break;
 			}
 		}
+		if(sockfd == socket_framed_fd) {
+			socket_framed_fd = 0;
+		}
 		shutdown(sockfd, 2);
 		close(sockfd);
 	}
@@ -371,6 +414,12 @@ int socket_write(int sockfd, const char *msg, ...) {
 
 		memcpy(&sendBuff[n-len], EOSS, (size_t)len);
 
+		if(sockfd == socket_framed_fd) {
+			bytes = socket_write_frame(sockfd, SOCKET_FRAME_TEXT, (unsigned char *)sendBuff, (size_t)(n-len));
+			FREE(sendBuff);
+			return (bytes == -1) ? -1 : n;
+		}
+
 		while(ptr < n) {
 			if((n-ptr) < BUFFER_SIZE) {
 				x = (n-ptr);
@@ -399,6 +448,167 @@ int socket_write(int sockfd, const char *msg, ...) {
 	return n;
 }
 
+static int socket_client_index(int sockfd) {
+	int i = 0;
+
+	for(i=0;i<MAX_CLIENTS;i++) {
+		if(socket_clients[i] == sockfd) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Switch a connection over to frames, either a client
+   of our server or our own connection to the master */
+void socket_set_framed(int sockfd) {
+	int i = 0;
+
+	if(sockfd <= 0) {
+		return;
+	}
+	if((i = socket_client_index(sockfd)) >= 0) {
+		socket_frames[i].framed = 1;
+		socket_frames[i].len = 0;
+	} else {
+		socket_framed_fd = sockfd;
+	}
+}
+
+int socket_is_framed(int sockfd) {
+	int i = 0;
+
+	if(sockfd <= 0) {
+		return 0;
+	}
+	if(sockfd == socket_framed_fd) {
+		return 1;
+	}
+	if((i = socket_client_index(sockfd)) >= 0) {
+		return socket_frames[i].framed;
+	}
+	return 0;
+}
+
+static void socket_frames_reset(int i) {
+	if(socket_frames[i].buffer != NULL) {
+		FREE(socket_frames[i].buffer);
+	}
+	socket_frames[i].framed = 0;
+	socket_frames[i].len = 0;
+}
+
+int socket_write_frame(int sockfd, int type, const unsigned char *data, size_t len) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	pthread_mutex_t *lock = NULL;
+	unsigned char *buffer = NULL;
+	size_t ptr = 0;
+	int bytes = 0;
+
+	if(sockfd <= 0) {
+		return -1;
+	}
+
+	if((buffer = MALLOC(SOCKET_FRAME_HEADER+len)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	buffer[0] = SOCKET_FRAME_MAGIC;
+	buffer[1] = (unsigned char)type;
+	buffer[2] = (unsigned char)((len >> 24) & 0xFF);
+	buffer[3] = (unsigned char)((len >> 16) & 0xFF);
+	buffer[4] = (unsigned char)((len >> 8) & 0xFF);
+	buffer[5] = (unsigned char)(len & 0xFF);
+	memcpy(&buffer[SOCKET_FRAME_HEADER], data, len);
+
+	/* Concurrent writers would otherwise interleave their frames */
+	lock = &socket_write_lock[sockfd % SOCKET_WRITE_LOCKS];
+	pthread_mutex_lock(lock);
+	while(ptr < SOCKET_FRAME_HEADER+len) {
+		bytes = (int)send(sockfd, &buffer[ptr], SOCKET_FRAME_HEADER+len-ptr, MSG_NOSIGNAL);
+		if(bytes == -1) {
+			if(errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			pthread_mutex_unlock(lock);
+			FREE(buffer);
+			logprintf(LOG_DEBUG, "socket frame write failed");
+			return -1;
+		}
+		ptr += (size_t)bytes;
+	}
+	pthread_mutex_unlock(lock);
+	FREE(buffer);
+
+	if(type == SOCKET_FRAME_TEXT && (len < 4 || strncmp((char *)data, "BEAT", 4) != 0)) {
+		logprintf(LOG_DEBUG, "socket write succeeded: %.*s", (int)len, data);
+	}
+	return (int)(SOCKET_FRAME_HEADER+len);
+}
+
+/*
+ * Read whatever a framed client sent and hand every complete
+ * frame to the callbacks. Incomplete frames are kept until the
+ * rest comes in.
+ */
+static int socket_read_frames(int i, struct socket_callback_t *socket_callback) {
+	struct socket_frames_t *frames = &socket_frames[i];
+	unsigned char *payload = NULL;
+	size_t size = 0, pos = 0;
+	int bytes = 0, type = 0;
+
+	if((bytes = (int)recv(socket_clients[i], recvBuff, BUFFER_SIZE, 0)) <= 0) {
+		return -1;
+	}
+	if((frames->buffer = REALLOC(frames->buffer, frames->len+(size_t)bytes+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(&frames->buffer[frames->len], recvBuff, (size_t)bytes);
+	frames->len += (size_t)bytes;
+
+	while(frames->len-pos >= SOCKET_FRAME_HEADER) {
+		if(frames->buffer[pos] != SOCKET_FRAME_MAGIC) {
+			logprintf(LOG_NOTICE, "invalid frame from client %d", i);
+			return -1;
+		}
+		type = frames->buffer[pos+1];
+		size = ((size_t)frames->buffer[pos+2] << 24) | ((size_t)frames->buffer[pos+3] << 16) |
+					 ((size_t)frames->buffer[pos+4] << 8) | (size_t)frames->buffer[pos+5];
+		if(size > FRAME_MAX_SIZE) {
+			logprintf(LOG_NOTICE, "frame from client %d too large", i);
+			return -1;
+		}
+		if(frames->len-pos < SOCKET_FRAME_HEADER+size) {
+			break;
+		}
+		payload = &frames->buffer[pos+SOCKET_FRAME_HEADER];
+		pos += SOCKET_FRAME_HEADER+size;
+
+		if(type == SOCKET_FRAME_TEXT) {
+			/* The payload is followed by the next frame or the spare byte */
+			unsigned char c = payload[size];
+			payload[size] = '\0';
+			if(size > 0 && socket_callback->client_data_callback) {
+				socket_callback->client_data_callback(i, (char *)payload);
+			}
+			payload[size] = c;
+		} else if(socket_callback->client_frame_callback) {
+			socket_callback->client_frame_callback(i, type, payload, size);
+		}
+		/* The callback may have dropped the client */
+		if(socket_frames[i].framed == 0) {
+			return 0;
+		}
+	}
+	if(pos > 0) {
+		memmove(frames->buffer, &frames->buffer[pos], frames->len-pos);
+		frames->len -= pos;
+	}
+	return 0;
+}
+
 void socket_rm_client(int i, struct socket_callback_t *socket_callback) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -418,6 +628,7 @@ void socket_rm_client(int i, struct socket_callback_t *socket_callback) {
 	shutdown(sd, 2);
 	close(sd);
 	socket_clients[i] = 0;
+	socket_frames_reset(i);
 }
 
 int socket_read(int sockfd, char **message, time_t timeout) {
@@ -614,7 +825,12 @@ void *socket_wait(void *param) {
 			sd = socket_clients[i];
 			if(FD_ISSET((unsigned long)socket_clients[i], &readfds)) {
 				FD_CLR((unsigned long)socket_clients[i], &readfds);
-				if(socket_read(sd, &waitMessage, 0) == 0) {
+				if(socket_frames[i].framed == 1) {
+					if(socket_read_frames(i, socket_callback) != 0) {
+						socket_rm_client(i, socket_callback);
+						i--;
+					}
+				} else if(socket_read(sd, &waitMessage, 0) == 0) {
 					if(socket_callback->client_data_callback) {
 						size_t l = strlen(waitMessage);
 						if(l > 0) {
@@ -20,13 +20,19 @@
 #define _SOCKETS_H_
 
 #include <time.h>
+#include <stddef.h>
 
 typedef struct socket_callback_t {
     void (*client_connected_callback)(int);
     void (*client_disconnected_callback)(int);
     void (*client_data_callback)(int, char*);
+    void (*client_frame_callback)(int, int, unsigned char*, size_t);
 } socket_callback_t;
 
+/* Frame types of framed connections */
+#define SOCKET_FRAME_TEXT		1
+#define SOCKET_FRAME_JSON		2
+
 /* Start the socket server */
 int socket_start(unsigned short port);
 int socket_connect(char *address, unsigned short port);
@@ -34,6 +40,9 @@ int socket_timeout_connect(int sockfd, struct sockaddr *serv_addr, int usec);
 void socket_close(int i);
 int socket_write(int sockfd, const char *msg, ...);
 int socket_read(int sockfd, char **out, time_t timeout);
+int socket_write_frame(int sockfd, int type, const unsigned char *data, size_t len);
+void socket_set_framed(int sockfd);
+int socket_is_framed(int sockfd);
 void *socket_wait(void *param);
 int socket_gc(void);
 unsigned int socket_get_port(void);
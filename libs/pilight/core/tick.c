@@ -0,0 +1,194 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "threads.h"
+#include "ntp.h"
+#include "log.h"
+#include "mem.h"
+#include "tick.h"
+
+/*
+ * Clock tick service
+ *
+ * One thread wakes up at each whole second of the wall clock
+ * and hands the same tick to every subscriber. The wait itself
+ * runs on the monotonic clock and is aligned again after every
+ * tick, so setting the wall clock never stalls the ticks. The
+ * difference between both clocks tells subscribers when the
+ * time did not just advance a second.
+ */
+
+typedef struct tick_subscriber_t {
+	tick_callback_t *callback;
+	void *userdata;
+	struct tick_subscriber_t *next;
+} tick_subscriber_t;
+
+static pthread_mutex_t tick_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tick_signal;
+static int tick_signal_init = 0;
+static struct tick_subscriber_t *tick_subscribers = NULL;
+static pthread_t tick_pth;
+static int tick_started = 0;
+static int tick_loop = 1;
+
+static double tick_seconds(struct timespec *ts) {
+	return (double)ts->tv_sec+(double)ts->tv_nsec/1000000000.0;
+}
+
+static void *tick_thread(void *param) {
+	struct tick_subscriber_t *tmp = NULL;
+	struct timespec real, mono, prevreal, prevmono, wake;
+	time_t now = 0, prev = 0, next = 0;
+	int nr = 0, i = 0, changed = 0, ntpdiff = 0, prevntpdiff = 0;
+	double drift = 0.0;
+
+	clock_gettime(CLOCK_REALTIME, &prevreal);
+	clock_gettime(CLOCK_MONOTONIC, &prevmono);
+	prevntpdiff = getntpdiff();
+
+	while(tick_loop == 1) {
+		/* Wait for the next whole second */
+		pthread_mutex_lock(&tick_lock);
+		clock_gettime(CLOCK_REALTIME, &real);
+		clock_gettime(CLOCK_MONOTONIC, &wake);
+		next = real.tv_sec+1;
+		wake.tv_nsec += 1000000000-real.tv_nsec;
+		if(wake.tv_nsec >= 1000000000) {
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000;
+		}
+		while(tick_loop == 1 && pthread_cond_timedwait(&tick_signal, &tick_lock, &wake) != ETIMEDOUT);
+		pthread_mutex_unlock(&tick_lock);
+		if(tick_loop == 0) {
+			break;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &real);
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		/* Woke up too early */
+		if(real.tv_sec < next && next-real.tv_sec < 2) {
+			continue;
+		}
+
+		changed = TICK_SECOND;
+		drift = (tick_seconds(&real)-tick_seconds(&prevreal))-(tick_seconds(&mono)-tick_seconds(&prevmono));
+		if((ntpdiff = getntpdiff()) != prevntpdiff || drift > 1.0 || drift < -1.0) {
+			logprintf(LOG_DEBUG, "clock changed by %.3f seconds", drift-(double)(ntpdiff-prevntpdiff));
+			changed |= TICK_JUMP;
+		}
+		prevreal = real;
+		prevmono = mono;
+		prevntpdiff = ntpdiff;
+
+		now = real.tv_sec-ntpdiff;
+		if(prev == 0 || now/60 != prev/60 || (changed & TICK_JUMP) == TICK_JUMP) {
+			changed |= TICK_MINUTE;
+		}
+		prev = now;
+
+		pthread_mutex_lock(&tick_lock);
+		nr = 0;
+		for(tmp=tick_subscribers;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct tick_subscriber_t *subscribers[nr+1];
+		nr = 0;
+		for(tmp=tick_subscribers;tmp!=NULL;tmp=tmp->next) {
+			subscribers[nr++] = tmp;
+		}
+		pthread_mutex_unlock(&tick_lock);
+
+		/* Subscribers are only freed after this thread stopped */
+		for(i=0;i<nr&&tick_loop==1;i++) {
+			subscribers[i]->callback(now, changed, subscribers[i]->userdata);
+		}
+	}
+
+	return (void *)NULL;
+}
+
+int tick_add(tick_callback_t *callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct tick_subscriber_t *subscriber = NULL;
+
+	if((subscriber = MALLOC(sizeof(struct tick_subscriber_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	subscriber->callback = callback;
+	subscriber->userdata = userdata;
+
+	pthread_mutex_lock(&tick_lock);
+	subscriber->next = tick_subscribers;
+	tick_subscribers = subscriber;
+
+	if(tick_signal_init == 0) {
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&tick_signal, &attr);
+		pthread_condattr_destroy(&attr);
+		tick_signal_init = 1;
+	}
+	if(tick_started == 0) {
+		tick_loop = 1;
+		threads_create(&tick_pth, NULL, tick_thread, NULL);
+		tick_started = 1;
+	}
+	pthread_mutex_unlock(&tick_lock);
+	return 0;
+}
+
+int tick_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct tick_subscriber_t *tmp = NULL;
+
+	if(tick_started == 1) {
+		pthread_mutex_lock(&tick_lock);
+		tick_loop = 0;
+		pthread_cond_signal(&tick_signal);
+		pthread_mutex_unlock(&tick_lock);
+		pthread_join(tick_pth, NULL);
+		tick_started = 0;
+	}
+
+	pthread_mutex_lock(&tick_lock);
+	while(tick_subscribers) {
+		tmp = tick_subscribers;
+		tick_subscribers = tick_subscribers->next;
+		FREE(tmp);
+	}
+	pthread_mutex_unlock(&tick_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected tick library");
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TICK_H_
+#define _TICK_H_
+
+#include <time.h>
+
+/* What changed since the previous tick */
+#define TICK_SECOND		1
+#define TICK_MINUTE		2
+/* The wall clock or the ntp correction was changed */
+#define TICK_JUMP			4
+
+/* The ntp corrected time in whole seconds */
+typedef void (tick_callback_t)(time_t now, int changed, void *userdata);
+
+int tick_add(tick_callback_t *callback, void *userdata);
+int tick_gc(void);
+
+#endif
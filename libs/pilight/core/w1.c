@@ -0,0 +1,362 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "pilight.h"
+#include "common.h"
+#include "threads.h"
+#include "log.h"
+#include "mem.h"
+#include "w1.h"
+
+#ifndef _WIN32
+/*
+ * 1-wire bus manager
+ *
+ * The w1_slave file of each sensor stays open and is read
+ * again from the start on every poll. Reading that file makes the kernel start a
+ * conversion of about 750ms for just that sensor, so when the
+ * bus master supports it, all sensors on a bus are converted
+ * at once through therm_bulk_read and then read in one pass.
+ */
+
+#define W1_DEVICES		"/sys/bus/w1/devices/"
+#define W1_MASTER			"w1_bus_master"
+/* Longest conversion at the highest resolution */
+#define W1_CONVERSION	1000000
+#define W1_STEP				50000
+#define W1_CONTENT		256
+
+typedef struct w1_bus_t {
+	char name[32];
+	int bulkfd;
+	int triggered;
+	struct w1_bus_t *next;
+} w1_bus_t;
+
+typedef struct w1_sensor_t {
+	char name[32];
+	char *id;
+	int fd;
+	int missing;
+	int interval;
+	unsigned long long due;
+	struct w1_bus_t *bus;
+	w1_callback_t *callback;
+	void *userdata;
+	struct w1_sensor_t *next;
+} w1_sensor_t;
+
+static pthread_mutex_t w1_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct w1_sensor_t *w1_sensors = NULL;
+static struct w1_bus_t *w1_buses = NULL;
+static char w1_path[1024] = W1_DEVICES;
+static pthread_t w1_pth;
+static int w1_started = 0;
+static int w1_loop = 1;
+
+static unsigned long long w1_time(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
+
+/*
+ * The w1_slave file always looks like:
+ *
+ * 72 01 4b 46 7f ff 0e 10 57 : crc=57 YES
+ * 72 01 4b 46 7f ff 0e 10 57 t=23125
+ *
+ * so the crc check and the temperature are at fixed offsets.
+ * Anything else falls back to searching for them.
+ */
+int w1_parse(char *content, int len, double *temperature) {
+	char *p = NULL, *end = NULL;
+	long value = 0;
+
+	if(len >= 70 && strncmp(&content[36], "YES\n", 4) == 0 && content[67] == 't' && content[68] == '=') {
+		p = &content[69];
+	} else {
+		if((p = strstr(content, "crc=")) == NULL || (end = strchr(p, '\n')) == NULL) {
+			return -1;
+		}
+		*end = '\0';
+		if(strstr(p, "YES") == NULL) {
+			return -1;
+		}
+		if((p = strstr(end+1, "t=")) == NULL) {
+			return -1;
+		}
+		p += 2;
+	}
+	value = strtol(p, &end, 10);
+	if(end == p) {
+		return -1;
+	}
+	*temperature = (double)value/1000;
+	return 0;
+}
+
+static struct w1_bus_t *w1_bus(char *name) {
+	struct w1_bus_t *bus = NULL;
+	char path[sizeof(w1_path)+64];
+
+	for(bus=w1_buses;bus!=NULL;bus=bus->next) {
+		if(strcmp(bus->name, name) == 0) {
+			return bus;
+		}
+	}
+
+	if((bus = MALLOC(sizeof(struct w1_bus_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(bus, '\0', sizeof(struct w1_bus_t));
+	snprintf(bus->name, sizeof(bus->name), "%s", name);
+	snprintf(path, sizeof(path), "%s%s/therm_bulk_read", w1_path, name);
+	/* Older kernels can only convert one sensor at a time */
+	if((bus->bulkfd = open(path, O_RDWR)) > -1) {
+		logprintf(LOG_DEBUG, "1-wire bus %s supports bulk conversion", name);
+	}
+	bus->next = w1_buses;
+	w1_buses = bus;
+	return bus;
+}
+
+static int w1_open(struct w1_sensor_t *sensor) {
+	struct dirent *file = NULL;
+	DIR *d = NULL;
+	char path[sizeof(w1_path)+512];
+
+	snprintf(path, sizeof(path), "%s%s/w1_slave", w1_path, sensor->name);
+	if((sensor->fd = open(path, O_RDONLY)) < 0) {
+		if(sensor->missing == 0) {
+			logprintf(LOG_ERR, "1-wire device %s%s/ does not exists", w1_path, sensor->name);
+			sensor->missing = 1;
+		}
+		return -1;
+	}
+	sensor->missing = 0;
+
+	/* Find the bus master the sensor is attached to */
+	sensor->bus = NULL;
+	if((d = opendir(w1_path)) != NULL) {
+		while((file = readdir(d)) != NULL) {
+			if(strncmp(file->d_name, W1_MASTER, strlen(W1_MASTER)) != 0) {
+				continue;
+			}
+			snprintf(path, sizeof(path), "%s%s/%s", w1_path, file->d_name, sensor->name);
+			if(access(path, F_OK) == 0) {
+				pthread_mutex_lock(&w1_lock);
+				sensor->bus = w1_bus(file->d_name);
+				pthread_mutex_unlock(&w1_lock);
+				break;
+			}
+		}
+		closedir(d);
+	}
+	return 0;
+}
+
+static void w1_convert(struct w1_sensor_t **due, int nr) {
+	struct w1_bus_t *bus = NULL;
+	unsigned long long start = 0;
+	char status[8];
+	int i = 0, busy = 0;
+
+	for(i=0;i<nr;i++) {
+		bus = due[i]->bus;
+		if(bus != NULL && bus->bulkfd > -1 && bus->triggered == 0) {
+			if(pwrite(bus->bulkfd, "trigger\n", 8, 0) == 8) {
+				bus->triggered = 1;
+				busy++;
+			}
+		}
+	}
+
+	/* All buses convert at the same time */
+	start = w1_time();
+	while(busy > 0 && w1_loop == 1 && w1_time()-start < W1_CONVERSION) {
+		usleep(W1_STEP);
+		busy = 0;
+		for(i=0;i<nr;i++) {
+			bus = due[i]->bus;
+			if(bus != NULL && bus->triggered == 1) {
+				memset(status, '\0', sizeof(status));
+				if(pread(bus->bulkfd, status, sizeof(status)-1, 0) > 0 && strncmp(status, "-1", 2) == 0) {
+					busy++;
+				}
+			}
+		}
+	}
+
+	for(i=0;i<nr;i++) {
+		if(due[i]->bus != NULL) {
+			due[i]->bus->triggered = 0;
+		}
+	}
+}
+
+static void *w1_thread(void *param) {
+	struct w1_sensor_t *tmp = NULL;
+	unsigned long long now = 0, wake = 0;
+	char content[W1_CONTENT];
+	int nr = 0, n = 0, i = 0, len = 0;
+
+	while(w1_loop == 1) {
+		now = w1_time();
+		wake = now+1000000;
+
+		pthread_mutex_lock(&w1_lock);
+		nr = 0;
+		for(tmp=w1_sensors;tmp!=NULL;tmp=tmp->next) {
+			nr++;
+		}
+		struct w1_sensor_t *due[nr+1];
+		nr = 0;
+		for(tmp=w1_sensors;tmp!=NULL;tmp=tmp->next) {
+			if(now >= tmp->due) {
+				tmp->due = now+(unsigned long long)tmp->interval*1000000;
+				due[nr++] = tmp;
+			}
+			if(tmp->due < wake) {
+				wake = tmp->due;
+			}
+		}
+		pthread_mutex_unlock(&w1_lock);
+
+		/*
+		 * Sensors are only freed after this thread stopped,
+		 * so the bus can be used without holding the lock.
+		 */
+		n = 0;
+		for(i=0;i<nr;i++) {
+			if(due[i]->fd > -1 || w1_open(due[i]) == 0) {
+				due[n++] = due[i];
+			}
+		}
+		nr = n;
+		w1_convert(due, nr);
+
+		for(i=0;i<nr&&w1_loop==1;i++) {
+			double temperature = 0.0;
+
+			memset(content, '\0', sizeof(content));
+			if((len = (int)pread(due[i]->fd, content, sizeof(content)-1, 0)) <= 0) {
+				/* The sensor was unplugged */
+				close(due[i]->fd);
+				due[i]->fd = -1;
+				continue;
+			}
+			if(w1_parse(content, len, &temperature) == 0) {
+				due[i]->callback(due[i]->id, temperature, due[i]->userdata);
+			} else {
+				logprintf(LOG_DEBUG, "1-wire device %s returned an invalid reading", due[i]->name);
+			}
+		}
+
+		now = w1_time();
+		if(wake > now && w1_loop == 1) {
+			usleep((useconds_t)((wake-now > 1000000) ? 1000000 : wake-now));
+		}
+	}
+
+	return (void *)NULL;
+}
+
+void w1_set_path(char *path) {
+	pthread_mutex_lock(&w1_lock);
+	snprintf(w1_path, sizeof(w1_path), "%s", path);
+	pthread_mutex_unlock(&w1_lock);
+}
+
+int w1_add(char *family, char *id, int interval, w1_callback_t *callback, void *userdata) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct w1_sensor_t *sensor = NULL;
+
+	if((sensor = MALLOC(sizeof(struct w1_sensor_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(sensor, '\0', sizeof(struct w1_sensor_t));
+	snprintf(sensor->name, sizeof(sensor->name), "%s-%s", family, id);
+	sensor->id = &sensor->name[strlen(family)+1];
+	sensor->fd = -1;
+	sensor->interval = (interval < 1) ? 1 : interval;
+	sensor->callback = callback;
+	sensor->userdata = userdata;
+	sensor->due = w1_time()+(unsigned long long)sensor->interval*1000000;
+
+	pthread_mutex_lock(&w1_lock);
+	sensor->next = w1_sensors;
+	w1_sensors = sensor;
+
+	if(w1_started == 0) {
+		w1_loop = 1;
+		threads_create(&w1_pth, NULL, w1_thread, NULL);
+		w1_started = 1;
+	}
+	pthread_mutex_unlock(&w1_lock);
+	return 0;
+}
+
+int w1_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct w1_sensor_t *tmp = NULL;
+	struct w1_bus_t *bus = NULL;
+
+	if(w1_started == 1) {
+		w1_loop = 0;
+		pthread_join(w1_pth, NULL);
+		w1_started = 0;
+	}
+
+	pthread_mutex_lock(&w1_lock);
+	while(w1_sensors) {
+		tmp = w1_sensors;
+		w1_sensors = w1_sensors->next;
+		if(tmp->fd > -1) {
+			close(tmp->fd);
+		}
+		FREE(tmp);
+	}
+	while(w1_buses) {
+		bus = w1_buses;
+		w1_buses = w1_buses->next;
+		if(bus->bulkfd > -1) {
+			close(bus->bulkfd);
+		}
+		FREE(bus);
+	}
+	pthread_mutex_unlock(&w1_lock);
+
+	logprintf(LOG_DEBUG, "garbage collected 1-wire library");
+	return 0;
+}
+#endif
@@ -0,0 +1,30 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _W1_H_
+#define _W1_H_
+
+/* Temperature in degrees celsius */
+typedef void (w1_callback_t)(char *id, double temperature, void *userdata);
+
+void w1_set_path(char *path);
+int w1_add(char *family, char *id, int interval, w1_callback_t *callback, void *userdata);
+int w1_parse(char *content, int len, double *temperature);
+int w1_gc(void);
+
+#endif
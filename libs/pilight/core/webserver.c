@@ -48,6 +48,7 @@
 #include "../config/settings.h"
 #include "ssdp.h"
 #include "fcache.h"
+#include "history.h"
 
 #ifdef WEBSERVER_SSL
 static int webserver_ssl_port = WEBSERVER_SSL_PORT;
@@ -145,11 +146,27 @@ int webserver_gc(void) {
 struct filehandler_t {
 	unsigned char *bytes;
 	FILE *fp;
+	/* Cache node the bytes belong to, released when done */
+	struct fcache_t *cached;
 	unsigned int ptr;
 	unsigned int length;
 	unsigned short free;
 };
 
+static void filehandler_free(struct filehandler_t *filehandler) {
+	if(filehandler->fp != NULL) {
+		fclose(filehandler->fp);
+		filehandler->fp = NULL;
+	}
+	if(filehandler->free) {
+		FREE(filehandler->bytes);
+	}
+	if(filehandler->cached != NULL) {
+		fcache_release(filehandler->cached);
+	}
+	FREE(filehandler);
+}
+
 void webserver_create_header(unsigned char **p, const char *message, char *mimetype, unsigned int len) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -190,6 +207,101 @@ static void webserver_create_404(const char *in, unsigned char **p) {
 		(const char *)in);
 }
 
+/*
+ * Serve a cached file, or tell the client its own copy is still valid.
+ * The reference to the node is either released here or handed to the
+ * filehandler that streams the rest of the file.
+ */
+static int webserver_send_cached(struct mg_connection *conn, struct fcache_t *node, char *mimetype) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct filehandler_t *filehandler = NULL;
+	struct fcache_file_t *file = &node->plain;
+	const char *header = NULL;
+	char buffer[512], modified[32];
+	char *p = buffer;
+	unsigned int chunk = WEBSERVER_CHUNK_SIZE;
+	int notmodified = 0;
+	struct tm tm;
+
+	memset(&tm, '\0', sizeof(struct tm));
+#ifdef _WIN32
+	struct tm *tm1;
+	if((tm1 = gmtime(&node->mtime)) != NULL) {
+		memcpy(&tm, tm1, sizeof(struct tm));
+	}
+#else
+	gmtime_r(&node->mtime, &tm);
+#endif
+	strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+	if(node->gzip.bytes != NULL && (header = mg_get_header(conn, "Accept-Encoding")) != NULL &&
+	   strstr(header, "gzip") != NULL) {
+		file = &node->gzip;
+	}
+
+	/* An If-None-Match takes precedence over an If-Modified-Since */
+	if((header = mg_get_header(conn, "If-None-Match")) != NULL) {
+		notmodified = (strstr(header, file->etag) != NULL || strcmp(header, "*") == 0);
+	} else if((header = mg_get_header(conn, "If-Modified-Since")) != NULL) {
+		notmodified = (strcmp(header, modified) == 0);
+	}
+
+	p += sprintf(p,
+		"HTTP/1.0 %s\r\n"
+		"Server: pilight\r\n"
+		"ETag: %s\r\n"
+		"Last-Modified: %s\r\n"
+		"Cache-Control: no-cache\r\n",
+		(notmodified == 1) ? "304 Not Modified" : "200 OK", file->etag, modified);
+	if(node->gzip.bytes != NULL) {
+		p += sprintf(p, "Vary: Accept-Encoding\r\n");
+	}
+	if(notmodified == 1) {
+		p += sprintf(p, "\r\n");
+		mg_write(conn, buffer, (int)(p-buffer));
+		fcache_release(node);
+		return MG_TRUE;
+	}
+	if(file == &node->gzip) {
+		p += sprintf(p, "Content-Encoding: gzip\r\n");
+	}
+	p += sprintf(p,
+		"Content-Type: %s\r\n"
+		"Content-Length: %d\r\n\r\n",
+		mimetype, file->size);
+	mg_write(conn, buffer, (int)(p-buffer));
+	if(strcmp(conn->request_method, "HEAD") == 0 || file->size == 0) {
+		fcache_release(node);
+		return MG_TRUE;
+	}
+
+	/* Stream the file from the cache instead of buffering all of it */
+	if((filehandler = MALLOC(sizeof(struct filehandler_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	filehandler->bytes = file->bytes;
+	filehandler->length = (unsigned int)file->size;
+	filehandler->ptr = 0;
+	filehandler->free = 0;
+	filehandler->fp = NULL;
+	filehandler->cached = node;
+
+	if(filehandler->length < chunk) {
+		chunk = filehandler->length;
+	}
+	mg_write(conn, filehandler->bytes, (int)chunk);
+	filehandler->ptr += chunk;
+
+	if(filehandler->ptr == filehandler->length) {
+		filehandler_free(filehandler);
+		return MG_TRUE;
+	}
+	conn->connection_param = filehandler;
+	return MG_MORE;
+}
+
 char *webserver_mimetype(const char *str) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -328,6 +440,7 @@ static int webserver_request_handler(struct mg_connection *conn) {
 	unsigned char *p;
 	static unsigned char buffer[4096];
 	struct filehandler_t *filehandler = (struct filehandler_t *)conn->connection_param;
+	struct fcache_t *cached = NULL;
 	unsigned int chunk = WEBSERVER_CHUNK_SIZE;
 	struct stat st;
 
@@ -340,20 +453,16 @@ static int webserver_request_handler(struct mg_connection *conn) {
 			if(filehandler->fp != NULL) {
 				chunk = (unsigned int)fread(buff, sizeof(char), WEBSERVER_CHUNK_SIZE-1, filehandler->fp);
 				mg_send_data(conn, buff, (int)chunk);
+			} else if(filehandler->cached != NULL) {
+				/* Cached files were sent with their own length header */
+				mg_write(conn, &filehandler->bytes[filehandler->ptr], (int)chunk);
 			} else {
 				mg_send_data(conn, &filehandler->bytes[filehandler->ptr], (int)chunk);
 			}
 			filehandler->ptr += chunk;
 
 			if(filehandler->ptr == filehandler->length || conn->wsbits != 0) {
-				if(filehandler->fp != NULL) {
-					fclose(filehandler->fp);
-					filehandler->fp = NULL;
-				}
-				if(filehandler->free) {
-					FREE(filehandler->bytes);
-				}
-				FREE(filehandler);
+				filehandler_free(filehandler);
 				conn->connection_param = NULL;
 				return MG_TRUE;
 			} else {
@@ -414,6 +523,37 @@ static int webserver_request_handler(struct mg_connection *conn) {
 				}
 				jsend = NULL;
 				return MG_TRUE;
+			} else if(strcmp(conn->uri, "/history") == 0) {
+				char device[255], name[255], tier[15], number[21];
+				time_t from = 0, to = time(NULL);
+				JsonNode *jsend = NULL;
+				strcpy(tier, "");
+				if(mg_get_var(conn, "device", device, sizeof(device)) > 0 &&
+				   mg_get_var(conn, "value", name, sizeof(name)) > 0) {
+					if(mg_get_var(conn, "to", number, sizeof(number)) > 0) {
+						to = (time_t)atol(number);
+					}
+					from = to - 3600;
+					if(mg_get_var(conn, "from", number, sizeof(number)) > 0) {
+						from = (time_t)atol(number);
+					}
+					mg_get_var(conn, "tier", tier, sizeof(tier));
+					jsend = history_print(device, name, from, to, history_tier(tier));
+				}
+				char *output = NULL;
+				unsigned char header[256], *hp = header;
+				if(jsend != NULL) {
+					output = json_stringify(jsend, NULL);
+					json_delete(jsend);
+				}
+				char *b = (output != NULL) ? output : "{\"message\":\"failed\"}";
+				webserver_create_header(&hp, "200 OK", "application/json", (unsigned int)strlen(b));
+				mg_write(conn, header, (int)(hp-header));
+				mg_write(conn, b, (int)strlen(b));
+				if(output != NULL) {
+					json_free(output);
+				}
+				return MG_TRUE;
 			} else if(strcmp(&conn->uri[(rstrstr(conn->uri, "/")-conn->uri)], "/") == 0) {
 				char indexes[255];
 				strcpy(indexes, mg_get_option(mgserver[0], "index_files"));
@@ -508,15 +648,14 @@ static int webserver_request_handler(struct mg_connection *conn) {
 			memset(buffer, '\0', 4096);
 			p = buffer;
 
-			if(access(request, F_OK) == 0) {
-				stat(request, &st);
-				if(webserver_cache == 1 && st.st_size <= MAX_CACHE_FILESIZE &&
-				  strcmp(mimetype, "application/x-httpd-php") != 0 &&
-				  fcache_get_size(request, &size) != 0 && fcache_add(request) != 0) {
-					FREE(mimetype);
-					goto filenotfound;
+			/* Cached files are served without touching the disk */
+			if(webserver_cache == 1 && strcmp(mimetype, "application/x-httpd-php") != 0) {
+				if((cached = fcache_get(request)) == NULL && stat(request, &st) == 0 &&
+				   S_ISREG(st.st_mode) && st.st_size <= MAX_CACHE_FILESIZE && fcache_add(request) == 0) {
+					cached = fcache_get(request);
 				}
-			} else {
+			}
+			if(cached == NULL && access(request, F_OK) != 0) {
 				FREE(mimetype);
 				goto filenotfound;
 			}
@@ -531,6 +670,9 @@ static int webserver_request_handler(struct mg_connection *conn) {
 					webserver_create_header(&p, "200 OK", mimetype, (unsigned int)strlen(line));
 					mg_write(conn, buffer, (int)(p-buffer));
 					mg_write(conn, line, (int)strlen(line));
+					if(cached != NULL) {
+						fcache_release(cached);
+					}
 					FREE(mimetype);
 					FREE(request);
 					return MG_TRUE;
@@ -629,6 +771,7 @@ static int webserver_request_handler(struct mg_connection *conn) {
 								filehandler->ptr = 0;
 								filehandler->free = 1;
 								filehandler->fp = NULL;
+								filehandler->cached = NULL;
 								conn->connection_param = filehandler;
 							}
 							FREE(output);
@@ -668,8 +811,8 @@ static int webserver_request_handler(struct mg_connection *conn) {
 					return MG_TRUE;
 				}
 			} else {
-				stat(request, &st);
-				if(!webserver_cache || st.st_size > MAX_CACHE_FILESIZE) {
+				if(cached == NULL) {
+					stat(request, &st);
 					FILE *fp = fopen(request, "rb");
 					fseek(fp, 0, SEEK_END);
 					size = (int)ftell(fp);
@@ -694,6 +837,7 @@ static int webserver_request_handler(struct mg_connection *conn) {
 							filehandler->ptr = 0;
 							filehandler->free = 0;
 							filehandler->fp = fp;
+							filehandler->cached = NULL;
 							conn->connection_param = filehandler;
 						}
 						char buff[WEBSERVER_CHUNK_SIZE];
@@ -725,44 +869,10 @@ static int webserver_request_handler(struct mg_connection *conn) {
 					FREE(request);
 					return MG_TRUE;
 				} else {
-					if(fcache_get_size(request, &size) == 0) {
-						if(strstr(mimetype, "text") != NULL) {
-							webserver_create_header(&p, "200 OK", mimetype, (unsigned int)size);
-							mg_write(conn, buffer, (int)(p-buffer));
-							mg_write(conn, fcache_get_bytes(request), size);
-							FREE(mimetype);
-							FREE(request);
-							return MG_TRUE;
-						} else {
-							if(filehandler == NULL) {
-								filehandler = MALLOC(sizeof(struct filehandler_t));
-								filehandler->bytes = fcache_get_bytes(request);
-								filehandler->length = (unsigned int)size;
-								filehandler->ptr = 0;
-								filehandler->free = 0;
-								filehandler->fp = NULL;
-								conn->connection_param = filehandler;
-							}
-							chunk = WEBSERVER_CHUNK_SIZE;
-							if(filehandler != NULL) {
-								if((filehandler->length-filehandler->ptr) < chunk) {
-									chunk = (filehandler->length-filehandler->ptr);
-								}
-								mg_send_data(conn, &filehandler->bytes[filehandler->ptr], (int)chunk);
-								filehandler->ptr += chunk;
-
-								FREE(mimetype);
-								FREE(request);
-								if(filehandler->ptr == filehandler->length || conn->wsbits != 0) {
-									FREE(filehandler);
-									conn->connection_param = NULL;
-									return MG_TRUE;
-								} else {
-									return MG_MORE;
-								}
-							}
-						}
-					}
+					int ret = webserver_send_cached(conn, cached, mimetype);
+					FREE(mimetype);
+					FREE(request);
+					return ret;
 				}
 				FREE(mimetype);
 				FREE(request);
@@ -993,12 +1103,16 @@ static int webserver_handler(struct mg_connection *conn, enum mg_event ev) {
 			}
 		} else if(ev == MG_AUTH) {
 			return webserver_auth_handler(conn);
-		} else {
+		} else if(ev != MG_CLOSE) {
 			return MG_FALSE;
 		}
-	} else {
-		return MG_FALSE;
 	}
+	/* A connection can be closed before its file was sent completely */
+	if(ev == MG_CLOSE && conn->connection_param != NULL) {
+		filehandler_free((struct filehandler_t *)conn->connection_param);
+		conn->connection_param = NULL;
+	}
+	return MG_FALSE;
 }
 
 int webserver_start(void) {
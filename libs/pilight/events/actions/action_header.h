@@ -0,0 +1,9 @@
+	#include "dim.h"
+	#include "label.h"
+	#include "pushbullet.h"
+	#include "pushover.h"
+	#include "sendmail.h"
+	#include "sipcall.h"
+	#include "switch.h"
+	#include "toggle.h"
+
@@ -0,0 +1,9 @@
+	actionDimInit();
+	actionLabelInit();
+	actionPushbulletInit();
+	actionPushoverInit();
+	actionSendmailInit();
+	actionSipcallInit();
+	actionSwitchInit();
+	actionToggleInit();
+
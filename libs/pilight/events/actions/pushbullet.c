@@ -112,10 +112,16 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
-	struct rules_actions_t *pth = (struct rules_actions_t *)param;
-	// struct rules_t *obj = pth->obj;
-	struct JsonNode *arguments = pth->arguments;
+static void callback(int code, char *data, int size, char *type, void *userdata) {
+	if(code == 200) {
+		logprintf(LOG_DEBUG, "pushbullet action succeeded with message: %s", data);
+	} else {
+		logprintf(LOG_ERR, "pushbullet action failed (%d) with message: %s", code, data);
+	}
+}
+
+static int run(struct rules_actions_t *obj) {
+	struct JsonNode *arguments = obj->arguments;
 	struct JsonNode *jtitle = NULL;
 	struct JsonNode *jbody = NULL;
 	struct JsonNode *jtype = NULL;
@@ -129,11 +135,7 @@ static void *thread(void *param) {
 	struct JsonNode *jval3 = NULL;
 	struct JsonNode *jval4 = NULL;
 
-	char url[1024], typebuf[70];
-	char *data = NULL, *tp = typebuf;
-	int ret = 0, size = 0;
-
-	action_pushbullet->nrthreads++;
+	char url[1024];
 
 	jtitle = json_find_member(arguments, "TITLE");
 	jbody = json_find_member(arguments, "BODY");
@@ -153,7 +155,6 @@ static void *thread(void *param) {
 			if(jval1 != NULL && jval2 != NULL && jval3 != NULL && jval4 != NULL &&
 			 jval1->tag == JSON_STRING && jval2->tag == JSON_STRING &&
 			 jval3->tag == JSON_STRING && jval4->tag == JSON_STRING) {
-				data = NULL;
 				snprintf(url, 1024, "https://%s@api.pushbullet.com/v2/pushes", jval3->string_);
 
 				struct JsonNode *code = json_mkobject();
@@ -164,30 +165,12 @@ static void *thread(void *param) {
 				char *content = json_stringify(code, "\t");
 				json_delete(code);
 
-				data = http_post_content(url, &tp, &ret, &size, "application/json", content);
+				/* The http worker sends the message in the background */
+				http_post(url, "application/json", content, callback, NULL);
 				json_free(content);
-				if(ret == 200) {
-					logprintf(LOG_DEBUG, "pushbullet action succeeded with message: %s", data);
-				} else {
-					logprintf(LOG_ERR, "pushbullet action failed (%d) with message: %s", ret, data);
-				}
-				if(data != NULL) {
-					FREE(data);
-				}
 			}
 		}
 	}
-
-
-	action_pushbullet->nrthreads--;
-
-	return (void *)NULL;
-}
-
-static int run(struct rules_actions_t *obj) {
-	pthread_t pth;
-	threads_create(&pth, NULL, thread, (void *)obj);
-	pthread_detach(pth);
 	return 0;
 }
 
@@ -209,7 +192,7 @@ void actionPushbulletInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "pushbullet";
-	module->version = "2.2";
+	module->version = "2.3";
 	module->reqversion = "5.0";
 	module->reqcommit = "87";
 }
@@ -53,6 +53,7 @@
 
 #include "operator.h"
 #include "function.h"
+#include "window.h"
 #include "action.h"
 
 #define NONE 0
@@ -99,11 +100,12 @@ int events_gc(void) {
 	event_operator_gc();
 	event_action_gc();
 	event_function_gc();
+	event_window_gc();
 	logprintf(LOG_DEBUG, "garbage collected events library");
 	return 1;
 }
 
-void event_cache_device(struct rules_t *obj, char *device) {
+static void event_cache_device_value(struct rules_t *obj, char *device, unsigned short whole) {
 	int exists = 0;
 	int o = 0;
 
@@ -111,6 +113,7 @@ void event_cache_device(struct rules_t *obj, char *device) {
 		for(o=0;o<obj->nrdevices;o++) {
 			if(strcmp(obj->devices[o], device) == 0) {
 				exists = 1;
+				obj->whole[o] |= whole;
 				break;
 			}
 		}
@@ -120,16 +123,81 @@ void event_cache_device(struct rules_t *obj, char *device) {
 				logprintf(LOG_ERR, "out of memory");
 				exit(EXIT_FAILURE);
 			}
+			if((obj->whole = REALLOC(obj->whole, sizeof(unsigned short)*(unsigned int)(obj->nrdevices+1))) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			if((obj->minutes = REALLOC(obj->minutes, sizeof(long)*(unsigned int)(obj->nrdevices+1))) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
 			if((obj->devices[obj->nrdevices] = MALLOC(strlen(device)+1)) == NULL) {
 				logprintf(LOG_ERR, "out of memory");
 				exit(EXIT_FAILURE);
 			}
 			strcpy(obj->devices[obj->nrdevices], device);
+			obj->whole[obj->nrdevices] = whole;
+			obj->minutes[obj->nrdevices] = -1;
 			obj->nrdevices++;
 		}
 	}
 }
 
+void event_cache_device(struct rules_t *obj, char *device) {
+	event_cache_device_value(obj, device, 1);
+}
+
+/* Minutes since the epoch of the local date and time of a datetime update */
+static long event_minute_stamp(struct JsonNode *jvalues) {
+	double year = 0.0, month = 0.0, day = 0.0, hour = 0.0, minute = 0.0;
+
+	if(json_find_number(jvalues, "year", &year) != 0 ||
+	   json_find_number(jvalues, "month", &month) != 0 ||
+	   json_find_number(jvalues, "day", &day) != 0 ||
+	   json_find_number(jvalues, "hour", &hour) != 0 ||
+	   json_find_number(jvalues, "minute", &minute) != 0) {
+		return -1;
+	}
+
+	long y = (long)year-((int)month <= 2);
+	long m = (long)month;
+	long era = (y >= 0 ? y : y-399)/400;
+	long yoe = y-era*400;
+	long doy = (153*(m+(m > 2 ? -3 : 9))+2)/5+(long)day-1;
+	long days = era*146097+yoe*365+yoe/4-yoe/100+doy-719468;
+
+	return (days*24+(long)hour)*60+(long)minute;
+}
+
+/*
+ * A rule that uses a datetime device only through values
+ * coarser than its seconds, only has to run once a minute
+ * for the updates of that device. The whole date and time
+ * is compared, so a clock that was set to another minute
+ * always runs the rule again.
+ */
+static int event_device_due(struct rules_t *obj, int i, struct devices_t *dev, struct JsonNode *jvalues) {
+	struct rules_values_t *tmp_values = obj->values;
+	long stamp = 0;
+
+	if(dev->protocols == NULL || dev->protocols->listener->devtype != DATETIME ||
+	   obj->whole[i] == 1 || (stamp = event_minute_stamp(jvalues)) == -1) {
+		return 1;
+	}
+	while(tmp_values) {
+		if(strcmp(tmp_values->device, obj->devices[i]) == 0 &&
+		   strcmp(tmp_values->name, "second") == 0) {
+			return 1;
+		}
+		tmp_values = tmp_values->next;
+	}
+	if(stamp == obj->minutes[i]) {
+		return 0;
+	}
+	obj->minutes[i] = stamp;
+	return 1;
+}
+
 static int event_store_val_ptr(struct rules_t *obj, char *device, char *name, struct devices_settings_t *settings) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -276,7 +344,7 @@ int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varco
 			if(devices_get(device, &dev) == 0) {
 				if(validate == 1) {
 					if(origin == RULE) {
-						event_cache_device(obj, device);
+						event_cache_device_value(obj, device, 0);
 					}
 					struct protocols_t *tmp = dev->protocols;
 					unsigned int match1 = 0, match2 = 0, match3 = 0;
@@ -1418,6 +1486,8 @@ int event_parse_rule(char *rule, struct rules_t *obj, int depth, unsigned short
 	int x = 0, nrhooks = 0, error = 0, i = 0;
 	int type_or = 0, type_and = 0;
 
+	obj->validate = validate;
+
 	/* Replace all dual+ spaces with a single space */
 	rule = uniq_space(rule);
 	while(x < rlen) {
@@ -1593,7 +1663,7 @@ void *events_loop(void *param) {
 	}
 
 	struct devices_t *dev = NULL;
-	struct JsonNode *jdevices = NULL, *jchilds = NULL;
+	struct JsonNode *jdevices = NULL, *jvalues = NULL, *jchilds = NULL;
 	struct rules_t *tmp_rules = NULL;
 	char *str = NULL;
 	unsigned short match = 0;
@@ -1609,6 +1679,7 @@ void *events_loop(void *param) {
 			running = 1;
 
 			jdevices = json_find_member(eventsqueue->jconfig, "devices");
+			jvalues = json_find_member(eventsqueue->jconfig, "values");
 			tmp_rules = rules_get();
 			while(tmp_rules) {
 				if(tmp_rules->active == 1) {
@@ -1630,7 +1701,7 @@ void *events_loop(void *param) {
 											 tmp_rules->nr == dev->prevrule &&
 											 dev->lastrule == dev->prevrule) {
 											logprintf(LOG_ERR, "skipped rule #%d because of an infinite loop triggered by device %s", tmp_rules->nr, jchilds->string_);
-										} else {
+										} else if(event_device_due(tmp_rules, i, dev, jvalues) == 1) {
 											match = 1;
 										}
 									} else {
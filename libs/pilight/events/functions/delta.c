@@ -0,0 +1,54 @@
+/*
+	Copyright (C) 2013 - 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../function.h"
+#include "../window.h"
+#include "../../core/log.h"
+#include "../../core/dso.h"
+#include "../../core/pilight.h"
+#include "delta.h"
+
+static int run(struct rules_t *obj, struct JsonNode *arguments, char **ret, enum origin_t origin) {
+	return event_window_function("DELTA", WINDOW_DELTA, obj, arguments, ret, origin);
+}
+
+#if !defined(MODULE) && !defined(_WIN32)
+__attribute__((weak))
+#endif
+void functionDeltaInit(void) {
+	event_function_register(&function_delta, "DELTA");
+
+	function_delta->run = &run;
+}
+
+#if defined(MODULE) && !defined(_WIN32)
+void compatibility(struct module_t *module) {
+	module->name = "DELTA";
+	module->version = "1.0";
+	module->reqversion = "6.0";
+	module->reqcommit = "94";
+}
+
+void init(void) {
+	functionDeltaInit();
+}
+#endif
@@ -0,0 +1,10 @@
+	#include "avg.h"
+	#include "date_add.h"
+	#include "date_format.h"
+	#include "delta.h"
+	#include "history.h"
+	#include "max.h"
+	#include "min.h"
+	#include "random.h"
+	#include "rate.h"
+
@@ -0,0 +1,10 @@
+	functionAvgInit();
+	functionDateAddInit();
+	functionDateFormatInit();
+	functionDeltaInit();
+	functionHistoryInit();
+	functionMaxInit();
+	functionMinInit();
+	functionRandomInit();
+	functionRateInit();
+
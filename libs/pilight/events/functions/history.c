@@ -0,0 +1,132 @@
+/*
+	Copyright (C) 2013 - 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../function.h"
+#include "../events.h"
+#include "../../config/devices.h"
+#include "../../core/options.h"
+#include "../../core/log.h"
+#include "../../core/dso.h"
+#include "../../core/pilight.h"
+#include "../../core/common.h"
+#include "../../core/history.h"
+#include "history.h"
+
+static struct types_t {
+	char name[10];
+	int id;
+} types[] = {
+	{ "AVG", HISTORY_AVG },
+	{ "MIN", HISTORY_MIN },
+	{ "MAX", HISTORY_MAX },
+	{ "SUM", HISTORY_SUM },
+	{ "COUNT", HISTORY_COUNT }
+};
+
+static int run(struct rules_t *obj, struct JsonNode *arguments, char **ret, enum origin_t origin) {
+	struct JsonNode *childs = json_first_child(arguments);
+	struct devices_t *dev = NULL;
+	struct devices_settings_t *opt = NULL;
+	char *p = *ret, *device = NULL, *name = NULL, *type = NULL;
+	int nrtypes = (sizeof(types)/sizeof(types[0])), i = 0, id = -1, decimals = 0, period = 0;
+	double out = 0.0;
+	time_t now = time(NULL);
+
+	if(childs == NULL || childs->next == NULL || childs->next->next == NULL ||
+	   childs->next->next->next == NULL || childs->next->next->next->next != NULL) {
+		logprintf(LOG_ERR, "HISTORY requires four parameters e.g. HISTORY(sensor, temperature, AVG, 3600)");
+		return -1;
+	}
+	device = childs->string_;
+	name = childs->next->string_;
+	type = childs->next->next->string_;
+
+	if(isNumeric(childs->next->next->next->string_) != 0 ||
+	   (period = atoi(childs->next->next->next->string_)) <= 0) {
+		logprintf(LOG_ERR, "HISTORY requires the period to be a positive number of seconds e.g. HISTORY(sensor, temperature, AVG, 3600)");
+		return -1;
+	}
+	for(i=0;i<nrtypes;i++) {
+		if(strcmp(types[i].name, type) == 0) {
+			id = types[i].id;
+			break;
+		}
+	}
+	if(id == -1) {
+		logprintf(LOG_ERR, "HISTORY does not accept \"%s\" as a function, use AVG, MIN, MAX, SUM or COUNT", type);
+		return -1;
+	}
+	if(devices_get(device, &dev) != 0) {
+		logprintf(LOG_ERR, "HISTORY device \"%s\" does not exist", device);
+		return -1;
+	}
+	if(origin == RULE) {
+		event_cache_device(obj, device);
+	}
+
+	if(history_aggregate(device, name, now-period, now, id, &out, &decimals) != 0) {
+		/* Without any history use the current value */
+		opt = dev->settings;
+		while(opt) {
+			if(strcmp(opt->name, name) == 0 && opt->values != NULL && opt->values->type == JSON_NUMBER) {
+				out = (id == HISTORY_COUNT) ? 0 : opt->values->number_;
+				decimals = (id == HISTORY_COUNT) ? 0 : opt->values->decimals;
+				break;
+			}
+			opt = opt->next;
+		}
+		if(opt == NULL) {
+			logprintf(LOG_ERR, "HISTORY device \"%s\" has no numeric value \"%s\"", device, name);
+			return -1;
+		}
+	}
+	if(id == HISTORY_AVG) {
+		decimals++;
+	}
+	sprintf(p, "%.*f", decimals, out);
+
+	return 0;
+}
+
+#if !defined(MODULE) && !defined(_WIN32)
+__attribute__((weak))
+#endif
+void functionHistoryInit(void) {
+	event_function_register(&function_history, "HISTORY");
+
+	function_history->run = &run;
+}
+
+#if defined(MODULE) && !defined(_WIN32)
+void compatibility(struct module_t *module) {
+	module->name = "HISTORY";
+	module->version = "1.0";
+	module->reqversion = "6.0";
+	module->reqcommit = "94";
+}
+
+void init(void) {
+	functionHistoryInit();
+}
+#endif
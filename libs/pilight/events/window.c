@@ -0,0 +1,526 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "../core/pilight.h"
+#include "../core/common.h"
+#include "../core/log.h"
+#include "../core/history.h"
+#include "../config/devices.h"
+#include "events.h"
+#include "window.h"
+
+/*
+ * A window keeps the values of a device setting over the last period
+ * seconds in a ring buffer of slots. Windows longer than the number
+ * of slots combine several seconds into one slot. The ring buffer is
+ * sized when a rule using the window is parsed.
+ *
+ * The sum and count are kept up to date on every update, the minimum
+ * and maximum are tracked with monotonic queues of slot indexes, so
+ * every update and lookup is O(1) amortized.
+ */
+
+struct event_window_slot_t {
+	time_t start;
+	time_t first_ts;
+	time_t last_ts;
+	double min;
+	double max;
+	double sum;
+	double first;
+	double last;
+	unsigned int count;
+};
+
+struct event_window_queue_t {
+	unsigned int *index;
+	unsigned int head;
+	unsigned int nr;
+};
+
+typedef struct event_window_t {
+	char *device;
+	char *name;
+	unsigned int hash;
+	int period;
+	int width;
+	int decimals;
+	unsigned short seeded;
+
+	struct event_window_slot_t *slots;
+	unsigned int size;
+	unsigned int head;
+	unsigned int nr;
+
+	double sum;
+	double count;
+	struct event_window_queue_t min;
+	struct event_window_queue_t max;
+
+	struct event_window_t *next;
+} event_window_t;
+
+static struct event_window_t *windows = NULL;
+
+static pthread_mutex_t window_lock;
+static pthread_mutexattr_t window_attr;
+static unsigned short window_init = 0;
+
+static void event_window_lock_init(void) {
+	if(window_init == 0) {
+		pthread_mutexattr_init(&window_attr);
+		pthread_mutexattr_settype(&window_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&window_lock, &window_attr);
+		window_init = 1;
+	}
+}
+
+static unsigned int event_window_hash(const char *device, const char *name) {
+	return fnv1a(device, strlen(device)) ^ (fnv1a(name, strlen(name)) * 16777619U);
+}
+
+/* Index of the n-th slot counted from the oldest one */
+static unsigned int event_window_slot(struct event_window_t *window, unsigned int n) {
+	return (window->head + n) % window->size;
+}
+
+static unsigned int event_window_queue_get(struct event_window_t *window, struct event_window_queue_t *queue, unsigned int n) {
+	return queue->index[(queue->head + n) % window->size];
+}
+
+static void event_window_queue_push(struct event_window_t *window, struct event_window_queue_t *queue, unsigned int index, int max) {
+	struct event_window_slot_t *slots = window->slots;
+	double value = (max == 1) ? slots[index].max : slots[index].min;
+	unsigned int back = 0;
+
+	/* The newest slot can be updated, requeue it at its new value */
+	if(queue->nr > 0 && event_window_queue_get(window, queue, queue->nr-1) == index) {
+		queue->nr--;
+	}
+	while(queue->nr > 0) {
+		back = event_window_queue_get(window, queue, queue->nr-1);
+		if((max == 1 && slots[back].max > value) || (max == 0 && slots[back].min < value)) {
+			break;
+		}
+		queue->nr--;
+	}
+	queue->index[(queue->head + queue->nr) % window->size] = index;
+	queue->nr++;
+}
+
+static void event_window_queue_pop(struct event_window_t *window, struct event_window_queue_t *queue, unsigned int index) {
+	if(queue->nr > 0 && event_window_queue_get(window, queue, 0) == index) {
+		queue->head = (queue->head + 1) % window->size;
+		queue->nr--;
+	}
+}
+
+static void event_window_drop(struct event_window_t *window) {
+	struct event_window_slot_t *slot = &window->slots[window->head];
+
+	window->sum -= slot->sum;
+	window->count -= slot->count;
+	event_window_queue_pop(window, &window->min, window->head);
+	event_window_queue_pop(window, &window->max, window->head);
+	window->head = (window->head + 1) % window->size;
+	window->nr--;
+	if(window->nr == 0) {
+		window->sum = 0;
+		window->count = 0;
+	}
+}
+
+/* Drop all slots that fell out of the window */
+static void event_window_expire(struct event_window_t *window, time_t now) {
+	while(window->nr > 0 && window->slots[window->head].start + window->width <= now - window->period) {
+		event_window_drop(window);
+	}
+}
+
+static void event_window_add(struct event_window_t *window, double value, int decimals, time_t timestamp) {
+	struct event_window_slot_t *slot = NULL;
+	time_t start = timestamp - (timestamp % window->width);
+	unsigned int index = 0;
+
+	window->decimals = decimals;
+	if(window->nr > 0) {
+		index = event_window_slot(window, window->nr-1);
+		slot = &window->slots[index];
+		if(start < slot->start) {
+			return;
+		}
+		if(start > slot->start) {
+			slot = NULL;
+		}
+	}
+	if(slot == NULL) {
+		event_window_expire(window, timestamp);
+		if(window->nr == window->size) {
+			event_window_drop(window);
+		}
+		index = event_window_slot(window, window->nr);
+		slot = &window->slots[index];
+		memset(slot, 0, sizeof(struct event_window_slot_t));
+		slot->start = start;
+		slot->first_ts = timestamp;
+		slot->first = value;
+		slot->min = value;
+		slot->max = value;
+		window->nr++;
+	}
+	if(value < slot->min) {
+		slot->min = value;
+	}
+	if(value > slot->max) {
+		slot->max = value;
+	}
+	slot->sum += value;
+	slot->count++;
+	slot->last = value;
+	slot->last_ts = timestamp;
+	window->sum += value;
+	window->count++;
+
+	event_window_queue_push(window, &window->min, index, 0);
+	event_window_queue_push(window, &window->max, index, 1);
+}
+
+static void event_window_seed(time_t timestamp, double *values, int nrvalues, void *userdata) {
+	struct event_window_t *window = userdata;
+
+	/* Only raw values are used, downsampled values would skew the window */
+	if(nrvalues == 1) {
+		event_window_add(window, values[0], window->decimals, timestamp);
+	}
+}
+
+/*
+ * Rules are validated before the device states are restored and
+ * the history is loaded, so a window is only filled with what the
+ * history knows up to now on its first update or evaluation. On an
+ * evaluation without history, it starts with the current value.
+ */
+static void event_window_prepare(struct event_window_t *window, time_t now, int current) {
+	struct devices_t *dev = NULL;
+	struct devices_settings_t *sett = NULL;
+
+	if(window->seeded == 1) {
+		return;
+	}
+	window->seeded = 1;
+
+	if(history_query(window->device, window->name, now-window->period, now, HISTORY_RAW, &event_window_seed, window) != -1 &&
+	   window->nr > 0) {
+		return;
+	}
+	if(current == 1 && devices_get(window->device, &dev) == 0) {
+		for(sett=dev->settings;sett;sett=sett->next) {
+			if(strcmp(sett->name, window->name) == 0 && sett->values != NULL && sett->values->type == JSON_NUMBER) {
+				event_window_add(window, sett->values->number_, sett->values->decimals, (dev->timestamp > 0) ? dev->timestamp : now);
+				break;
+			}
+		}
+	}
+}
+
+void event_window_update(char *device, char *name, double value, int decimals, time_t timestamp) {
+	struct event_window_t *window = NULL;
+	unsigned int hash = 0;
+
+	if(windows == NULL) {
+		return;
+	}
+	hash = event_window_hash(device, name);
+
+	pthread_mutex_lock(&window_lock);
+	for(window=windows;window;window=window->next) {
+		if(window->hash == hash && strcmp(window->device, device) == 0 && strcmp(window->name, name) == 0) {
+			/* The history already holds this update */
+			window->decimals = decimals;
+			event_window_prepare(window, timestamp-1, 0);
+			event_window_add(window, value, decimals, timestamp);
+		}
+	}
+	pthread_mutex_unlock(&window_lock);
+}
+
+struct event_window_t *event_window_get(char *device, char *name, int period) {
+	struct event_window_t *window = NULL;
+	struct devices_t *dev = NULL;
+	struct devices_settings_t *sett = NULL;
+	unsigned int hash = event_window_hash(device, name);
+
+	event_window_lock_init();
+
+	pthread_mutex_lock(&window_lock);
+	for(window=windows;window;window=window->next) {
+		if(window->hash == hash && window->period == period &&
+		   strcmp(window->device, device) == 0 && strcmp(window->name, name) == 0) {
+			pthread_mutex_unlock(&window_lock);
+			return window;
+		}
+	}
+
+	if((window = MALLOC(sizeof(struct event_window_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(window, 0, sizeof(struct event_window_t));
+	if((window->device = MALLOC(strlen(device)+1)) == NULL ||
+	   (window->name = MALLOC(strlen(name)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(window->device, device);
+	strcpy(window->name, name);
+	window->hash = hash;
+	window->period = period;
+	window->width = (period + EVENT_WINDOW_SLOTS - 1) / EVENT_WINDOW_SLOTS;
+	window->size = (unsigned int)(period / window->width) + 2;
+	if((window->slots = MALLOC(sizeof(struct event_window_slot_t)*window->size)) == NULL ||
+	   (window->min.index = MALLOC(sizeof(unsigned int)*window->size)) == NULL ||
+	   (window->max.index = MALLOC(sizeof(unsigned int)*window->size)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	if(devices_get(device, &dev) == 0) {
+		for(sett=dev->settings;sett;sett=sett->next) {
+			if(strcmp(sett->name, name) == 0 && sett->values != NULL && sett->values->type == JSON_NUMBER) {
+				window->decimals = sett->values->decimals;
+				break;
+			}
+		}
+	}
+
+	window->next = windows;
+	windows = window;
+	pthread_mutex_unlock(&window_lock);
+
+	return window;
+}
+
+/*
+ * Windows are created when a rule is validated and kept
+ * with the rule, so evaluating it only looks them up.
+ */
+static struct event_window_t *event_window_rule(struct rules_t *obj, char *device, char *name, int period) {
+	struct event_window_t *window = NULL;
+	unsigned int hash = event_window_hash(device, name);
+	int i = 0;
+
+	for(i=0;i<obj->nrwindows;i++) {
+		window = obj->windows[i];
+		if(window->hash == hash && window->period == period &&
+		   strcmp(window->device, device) == 0 && strcmp(window->name, name) == 0) {
+			return window;
+		}
+	}
+	if(obj->validate == 0) {
+		return NULL;
+	}
+
+	window = event_window_get(device, name, period);
+	if((obj->windows = REALLOC(obj->windows, sizeof(struct event_window_t *)*(size_t)(obj->nrwindows+1))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	obj->windows[obj->nrwindows++] = window;
+	return window;
+}
+
+int event_window_value(struct event_window_t *window, int type, time_t now, double *out, int *decimals) {
+	struct event_window_slot_t *first = NULL, *last = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&window_lock);
+	event_window_prepare(window, now, 1);
+	event_window_expire(window, now);
+	if(window->nr == 0) {
+		pthread_mutex_unlock(&window_lock);
+		return -1;
+	}
+	first = &window->slots[window->head];
+	last = &window->slots[event_window_slot(window, window->nr-1)];
+	*decimals = window->decimals;
+
+	switch(type) {
+		case WINDOW_MIN:
+			*out = window->slots[event_window_queue_get(window, &window->min, 0)].min;
+		break;
+		case WINDOW_MAX:
+			*out = window->slots[event_window_queue_get(window, &window->max, 0)].max;
+		break;
+		case WINDOW_DELTA:
+			*out = last->last - first->first;
+		break;
+		case WINDOW_RATE:
+			/* Change per second */
+			if(last->last_ts > first->first_ts) {
+				*out = (last->last - first->first) / (double)(last->last_ts - first->first_ts);
+			} else {
+				*out = 0;
+			}
+			*decimals += 3;
+		break;
+		case WINDOW_AVG:
+			*out = window->sum / window->count;
+			*decimals += 1;
+		break;
+		default:
+			ret = -1;
+		break;
+	}
+	pthread_mutex_unlock(&window_lock);
+
+	return ret;
+}
+
+/* Parse a period like 30, 30s, 10m, 2h or 1d into seconds */
+static int event_window_period(char *str) {
+	size_t len = strlen(str);
+	int factor = 1, period = 0;
+	char unit = 0;
+
+	if(len == 0) {
+		return -1;
+	}
+	if(isalpha((unsigned char)str[len-1])) {
+		unit = (char)tolower((unsigned char)str[len-1]);
+		str[len-1] = '\0';
+		switch(unit) {
+			case 's': factor = 1; break;
+			case 'm': factor = 60; break;
+			case 'h': factor = 3600; break;
+			case 'd': factor = 86400; break;
+			default: factor = -1; break;
+		}
+	}
+	if(factor > 0 && isNumeric(str) == 0) {
+		period = atoi(str)*factor;
+	}
+	if(unit != 0) {
+		str[len-1] = unit;
+	}
+	return (period > 0) ? period : -1;
+}
+
+/*
+ * Shared implementation of the window functions, called as
+ * FUNC(device.value, period) e.g. AVG(living.temperature, 10m)
+ */
+int event_window_function(const char *func, int type, struct rules_t *obj, struct JsonNode *arguments, char **out, enum origin_t origin) {
+	struct JsonNode *childs = json_first_child(arguments);
+	struct event_window_t *window = NULL;
+	struct devices_t *dev = NULL;
+	struct devices_settings_t *sett = NULL;
+	char *p = *out, *device = NULL, *name = NULL;
+	double value = 0.0;
+	int period = 0, decimals = 0;
+
+	if(childs == NULL || childs->next == NULL || childs->next->next != NULL ||
+	   childs->tag != JSON_STRING || childs->next->tag != JSON_STRING) {
+		logprintf(LOG_ERR, "%s requires two parameters e.g. %s(device.value, 10m)", func, func);
+		return -1;
+	}
+	if((name = strstr(childs->string_, ".")) == NULL) {
+		logprintf(LOG_ERR, "%s requires a device value e.g. %s(device.value, 10m)", func, func);
+		return -1;
+	}
+	if((device = MALLOC((size_t)(name-childs->string_)+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strncpy(device, childs->string_, (size_t)(name-childs->string_));
+	device[name-childs->string_] = '\0';
+	name++;
+
+	if((period = event_window_period(childs->next->string_)) == -1) {
+		logprintf(LOG_ERR, "%s requires a period in seconds, minutes, hours or days e.g. %s(device.value, 10m)", func, func);
+		FREE(device);
+		return -1;
+	}
+	if(devices_get(device, &dev) != 0) {
+		logprintf(LOG_ERR, "%s device \"%s\" does not exist", func, device);
+		FREE(device);
+		return -1;
+	}
+	if(origin == RULE) {
+		event_cache_device(obj, device);
+	}
+
+	if((window = event_window_rule(obj, device, name, period)) == NULL) {
+		logprintf(LOG_ERR, "%s window of \"%s\" was not prepared when the rule was validated", func, device);
+		FREE(device);
+		return -1;
+	}
+	/* While validating, the window is still empty and the current value is used */
+	if(obj->validate == 1) {
+		for(sett=dev->settings;sett;sett=sett->next) {
+			if(strcmp(sett->name, name) == 0 && sett->values != NULL && sett->values->type == JSON_NUMBER) {
+				value = sett->values->number_;
+				decimals = sett->values->decimals;
+				break;
+			}
+		}
+	}
+	if((obj->validate == 1 && sett == NULL) ||
+	   (obj->validate == 0 && event_window_value(window, type, time(NULL), &value, &decimals) != 0)) {
+		logprintf(LOG_ERR, "%s device \"%s\" has no numeric value \"%s\"", func, device, name);
+		FREE(device);
+		return -1;
+	}
+	sprintf(p, "%.*f", decimals, value);
+	FREE(device);
+
+	return 0;
+}
+
+int event_window_gc(void) {
+	struct event_window_t *tmp = NULL;
+
+	if(window_init == 1) {
+		pthread_mutex_lock(&window_lock);
+		while(windows) {
+			tmp = windows;
+			windows = windows->next;
+			FREE(tmp->device);
+			FREE(tmp->name);
+			FREE(tmp->slots);
+			FREE(tmp->min.index);
+			FREE(tmp->max.index);
+			FREE(tmp);
+		}
+		pthread_mutex_unlock(&window_lock);
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected event window library");
+	return 0;
+}
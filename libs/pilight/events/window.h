@@ -0,0 +1,45 @@
+/*
+	Copyright (C) 2013 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EVENT_WINDOW_H_
+#define _EVENT_WINDOW_H_
+
+#include <time.h>
+
+#include "../core/json.h"
+#include "../core/common.h"
+#include "../config/rules.h"
+
+/* Maximum number of slots in a window ring buffer */
+#define EVENT_WINDOW_SLOTS	3600
+
+#define WINDOW_AVG					0
+#define WINDOW_MIN					1
+#define WINDOW_MAX					2
+#define WINDOW_DELTA				3
+#define WINDOW_RATE					4
+
+struct event_window_t;
+
+int event_window_function(const char *func, int type, struct rules_t *obj, struct JsonNode *arguments, char **out, enum origin_t origin);
+struct event_window_t *event_window_get(char *device, char *name, int period);
+void event_window_update(char *device, char *name, double value, int decimals, time_t timestamp);
+int event_window_value(struct event_window_t *window, int type, time_t now, double *out, int *decimals);
+int event_window_gc(void);
+
+#endif
@@ -20,6 +20,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "../core/pilight.h"
 #include "../core/common.h"
@@ -33,8 +36,77 @@
 
 static int gpio_433_in = 0;
 static int gpio_433_out = 0;
+static char *gpio_433_chip = NULL;
+static struct irq_chip_t *gpio_433_irq = NULL;
+
+/*
+ * Pulses are sent against absolute deadlines on the monotonic
+ * clock, so a late wakeup doesn't shift all pulses after it. The
+ * thread sleeps until shortly before each deadline and spins for
+ * the rest. How early it wakes up is calibrated at init from the
+ * observed sleep overshoot.
+ */
+#define GPIO_433_SPIN_MIN		10000
+#define GPIO_433_SPIN_MAX		200000
+
+static unsigned long long gpio_433_spin = GPIO_433_SPIN_MAX;
+
+static unsigned long gpio_433_frames = 0;
+static unsigned long long gpio_433_edges = 0;
+static unsigned long long gpio_433_error = 0;
+static unsigned long long gpio_433_error_max = 0;
+static pthread_mutex_t gpio_433_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long gpio433Now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+(unsigned long long)ts.tv_nsec;
+}
+
+static void gpio433Sleep(unsigned long long deadline) {
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(deadline/1000000000ULL);
+	ts.tv_nsec = (long)(deadline%1000000000ULL);
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void gpio433Until(unsigned long long deadline) {
+	if(deadline > gpio433Now()+gpio_433_spin) {
+		gpio433Sleep(deadline-gpio_433_spin);
+	}
+	while(gpio433Now() < deadline);
+}
+
+static void gpio433Calibrate(void) {
+	unsigned long long deadline = 0, late = 0, max = 0;
+	int i = 0;
+
+	for(i=0;i<16;i++) {
+		deadline = gpio433Now()+100000;
+		gpio433Sleep(deadline);
+		if((late = gpio433Now()-deadline) > max) {
+			max = late;
+		}
+	}
+	gpio_433_spin = max+GPIO_433_SPIN_MIN;
+	if(gpio_433_spin > GPIO_433_SPIN_MAX) {
+		gpio_433_spin = GPIO_433_SPIN_MAX;
+	}
+	logprintf(LOG_DEBUG, "433gpio: sleep overshoot %llu us, spinning the last %llu us of each pulse", max/1000, gpio_433_spin/1000);
+}
 
 static unsigned short gpio433HwInit(void) {
+	/* Receive through the gpio character device */
+	if(gpio_433_chip != NULL && strlen(gpio_433_chip) > 0 && gpio_433_in >= 0) {
+		if(gpio_433_irq == NULL && (gpio_433_irq = irq_chip_open(gpio_433_chip, gpio_433_in)) == NULL) {
+			return EXIT_FAILURE;
+		}
+		if(gpio_433_out < 0) {
+			return EXIT_SUCCESS;
+		}
+	}
 	if(wiringXSetup() == -1) {
 		return EXIT_FAILURE;
 	}
@@ -44,8 +116,9 @@ static unsigned short gpio433HwInit(void) {
 			return EXIT_FAILURE;
 		}
 		pinMode(gpio_433_out, OUTPUT);
+		gpio433Calibrate();
 	}
-	if(gpio_433_in >= 0) {
+	if(gpio_433_in >= 0 && gpio_433_irq == NULL) {
 		if(wiringXValidGPIO(gpio_433_in) != 0) {
 			logprintf(LOG_ERR, "invalid receiver pin: %d", gpio_433_in);
 			return EXIT_FAILURE;
@@ -59,31 +132,89 @@ static unsigned short gpio433HwInit(void) {
 }
 
 static unsigned short gpio433HwDeinit(void) {
+	if(gpio_433_frames > 0 && gpio_433_edges > 0) {
+		logprintf(LOG_INFO, "433gpio: %lu frames sent, timing error avg %.1f us, max %.1f us",
+			gpio_433_frames, ((double)gpio_433_error/(double)gpio_433_edges)/1000.0, (double)gpio_433_error_max/1000.0);
+	}
+	if(gpio_433_irq != NULL) {
+		irq_chip_close(gpio_433_irq);
+		gpio_433_irq = NULL;
+	}
+	if(gpio_433_chip != NULL) {
+		FREE(gpio_433_chip);
+	}
 	return EXIT_SUCCESS;
 }
 
+/* Write a pin at its deadline and keep track of how late it was */
+static void gpio433Edge(int value, unsigned long long deadline, unsigned long long *error, unsigned long long *max) {
+	unsigned long long late = 0;
+
+	gpio433Until(deadline);
+	digitalWrite(gpio_433_out, value);
+	late = gpio433Now()-deadline;
+	*error += late;
+	if(late > *max) {
+		*max = late;
+	}
+}
+
 static int gpio433Send(int *code, int rawlen, int repeats) {
-	int r = 0, x = 0;
+	unsigned long long deadline = 0, error = 0, max = 0;
+	int r = 0, x = 0, edges = 0;
 	if(gpio_433_out >= 0) {
+		deadline = gpio433Now();
 		for(r=0;r<repeats;r++) {
 			for(x=0;x<rawlen;x+=2) {
-				digitalWrite(gpio_433_out, 1);
-				usleep((__useconds_t)code[x]);
-				digitalWrite(gpio_433_out, 0);
+				gpio433Edge(1, deadline, &error, &max);
+				deadline += (unsigned long long)code[x]*1000;
+				gpio433Edge(0, deadline, &error, &max);
 				if(x+1 < rawlen) {
-					usleep((__useconds_t)code[x+1]);
+					deadline += (unsigned long long)code[x+1]*1000;
 				}
+				edges += 2;
 			}
 		}
+		gpio433Until(deadline);
 		digitalWrite(gpio_433_out, 0);
+
+		pthread_mutex_lock(&gpio_433_lock);
+		gpio_433_frames++;
+		gpio_433_edges += (unsigned long long)edges;
+		gpio_433_error += error;
+		if(max > gpio_433_error_max) {
+			gpio_433_error_max = max;
+		}
+		pthread_mutex_unlock(&gpio_433_lock);
+		if(edges > 0) {
+			logprintf(LOG_DEBUG, "433gpio: sent %d pulses, timing error avg %.1f us, max %.1f us",
+				edges, ((double)error/(double)edges)/1000.0, (double)max/1000.0);
+		}
 	} else {
 		sleep(1);
 	}
 	return EXIT_SUCCESS;
 }
 
+/* Timing error of the sent pulses in microseconds */
+static void gpio433Stats(JsonNode *json) {
+	struct JsonNode *jstats = NULL;
+
+	pthread_mutex_lock(&gpio_433_lock);
+	if(gpio_433_edges > 0) {
+		jstats = json_mkobject();
+		json_append_member(jstats, "frames", json_mknumber((double)gpio_433_frames, 0));
+		json_append_member(jstats, "jitter-avg", json_mknumber(((double)gpio_433_error/(double)gpio_433_edges)/1000.0, 1));
+		json_append_member(jstats, "jitter-max", json_mknumber((double)gpio_433_error_max/1000.0, 1));
+		json_append_member(json, "433gpio", jstats);
+	}
+	pthread_mutex_unlock(&gpio_433_lock);
+}
+
 static int gpio433Receive(void) {
-	if(gpio_433_in >= 0) {
+	if(gpio_433_irq != NULL) {
+		return irq_chip_read(gpio_433_irq);
+	} else if(gpio_433_in >= 0) {
 		return irq_read(gpio_433_in);
 	} else {
 		sleep(1);
@@ -99,6 +230,20 @@ static unsigned short gpio433Settings(JsonNode *json) {
 			return EXIT_FAILURE;
 		}
 	}
+	if(strcmp(json->key, "chip") == 0) {
+		if(json->tag == JSON_STRING) {
+			if(gpio_433_chip != NULL) {
+				FREE(gpio_433_chip);
+			}
+			if((gpio_433_chip = MALLOC(strlen(json->string_)+1)) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(gpio_433_chip, json->string_);
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
 	if(strcmp(json->key, "sender") == 0) {
 		if(json->tag == JSON_NUMBER) {
 			gpio_433_out = (int)json->number_;
@@ -118,6 +263,9 @@ void gpio433Init(void) {
 
 	options_add(&gpio433->options, 'r', "receiver", OPTION_HAS_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9-]+$");
 	options_add(&gpio433->options, 's', "sender", OPTION_HAS_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9-]+$");
+	options_add(&gpio433->options, 'c', "chip", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_STRING, NULL, NULL);
+
+	options_set_string(&gpio433->options, 'c', "");
 
 	gpio433->hwtype=RF433;
 	gpio433->comtype=COMOOK;
@@ -126,12 +274,13 @@ void gpio433Init(void) {
 	gpio433->send=&gpio433Send;
 	gpio433->receiveOOK=&gpio433Receive;
 	gpio433->settings=&gpio433Settings;
+	gpio433->stats=&gpio433Stats;
 }
 
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "433gpio";
-	module->version = "1.2";
+	module->version = "1.3";
 	module->reqversion = "5.0";
 	module->reqcommit = "86";
 }
@@ -323,12 +323,167 @@ static int nano433Send(int *code, int rawlen, int repeats) {
 	}
 }
 
+/*
+ * The nano sends pulse trains as "c:<indexes>;p:<pulses>@", with
+ * a digit per pulse pair indexing the comma separated pulse list,
+ * and its firmware values as "v:<values>@". The serial port is read
+ * in chunks and the frames are decoded byte by byte as they come
+ * in, so a frame may be spread over several reads and a read may
+ * hold several frames.
+ */
+#define NANO_IDLE			0
+#define NANO_INDEXES	1
+#define NANO_PULSES		2
+#define NANO_VERSION	3
+
+static char nano_433_buffer[1024];
+static int nano_433_buflen = 0;
+static int nano_433_bufpos = 0;
+
+static struct {
+	int state;
+	int skip;
+	unsigned char indexes[MAXPULSESTREAMLENGTH/2];
+	int nrindexes;
+	int pulses[10];
+	int nrpulses;
+	int value;
+	int digits;
+	char version[64];
+	int verlen;
+} nano_433_frame;
+
+static void nano433Version(void) {
+	int values[4], c = 0;
+
+	nano_433_frame.version[nano_433_frame.verlen] = '\0';
+	c = sscanf(nano_433_frame.version, "%d,%d,%d,%d,%lf,%lf,%lf", &values[0], &values[1], &values[2], &values[3],
+						 &firmware.version, &firmware.lpf, &firmware.hpf);
+	if(c != 7) {
+		return;
+	}
+	if(!(minrawlen == values[0] && maxrawlen == values[1] &&
+	     mingaplen == values[2] && maxgaplen == values[3])) {
+		logprintf(LOG_ERR, "could not sync FW values");
+	}
+
+	if(firmware.version > 0 && firmware.lpf > 0 && firmware.hpf > 0) {
+		registry_set_number("pilight.firmware.version", firmware.version, 0);
+		registry_set_number("pilight.firmware.lpf", firmware.lpf, 0);
+		registry_set_number("pilight.firmware.hpf", firmware.hpf, 0);
+
+		struct JsonNode *jmessage = json_mkobject();
+		struct JsonNode *jcode = json_mkobject();
+		json_append_member(jcode, "version", json_mknumber(firmware.version, 0));
+		json_append_member(jcode, "lpf", json_mknumber(firmware.lpf, 0));
+		json_append_member(jcode, "hpf", json_mknumber(firmware.hpf, 0));
+		json_append_member(jmessage, "values", jcode);
+		json_append_member(jmessage, "origin", json_mkstring("core"));
+		json_append_member(jmessage, "type", json_mknumber(FIRMWARE, 0));
+		char pname[17];
+		strcpy(pname, "pilight-firmware");
+		if(pilight.broadcast != NULL) {
+			pilight.broadcast(pname, jmessage, FW);
+		}
+		json_delete(jmessage);
+		jmessage = NULL;
+	}
+}
+
+static int nano433PushPulse(void) {
+	if(nano_433_frame.digits == 0 || nano_433_frame.nrpulses >= 10) {
+		return -1;
+	}
+	nano_433_frame.pulses[nano_433_frame.nrpulses++] = nano_433_frame.value;
+	nano_433_frame.value = 0;
+	nano_433_frame.digits = 0;
+	return 0;
+}
+
+/* Returns 1 when a complete pulse train was decoded into r */
+static int nano433Parse(char c, struct rawcode_t *r) {
+	int i = 0;
+
+	if(c == 'c') {
+		nano_433_frame.state = NANO_INDEXES;
+		nano_433_frame.skip = 1;
+		nano_433_frame.nrindexes = 0;
+		return 0;
+	}
+	if(c == 'v') {
+		nano_433_frame.state = NANO_VERSION;
+		nano_433_frame.skip = 1;
+		nano_433_frame.verlen = 0;
+		return 0;
+	}
+	if(nano_433_frame.state == NANO_IDLE) {
+		return 0;
+	}
+	/* The colon following the frame type */
+	if(nano_433_frame.skip == 1) {
+		nano_433_frame.skip = 0;
+		return 0;
+	}
+
+	switch(nano_433_frame.state) {
+		case NANO_INDEXES:
+			if(c >= '0' && c <= '9' && nano_433_frame.nrindexes < MAXPULSESTREAMLENGTH/2) {
+				nano_433_frame.indexes[nano_433_frame.nrindexes++] = (unsigned char)(c-'0');
+			} else if(c == 'p') {
+				nano_433_frame.state = NANO_PULSES;
+				nano_433_frame.skip = 1;
+				nano_433_frame.nrpulses = 0;
+				nano_433_frame.value = 0;
+				nano_433_frame.digits = 0;
+			} else if(c != ';') {
+				nano_433_frame.state = NANO_IDLE;
+			}
+		break;
+		case NANO_PULSES:
+			if(c >= '0' && c <= '9' && nano_433_frame.digits < 9) {
+				nano_433_frame.value = nano_433_frame.value*10+(c-'0');
+				nano_433_frame.digits++;
+			} else if(c == ',') {
+				if(nano433PushPulse() != 0) {
+					nano_433_frame.state = NANO_IDLE;
+				}
+			} else if(c == '@') {
+				nano_433_frame.state = NANO_IDLE;
+				if(nano433PushPulse() != 0) {
+					return 0;
+				}
+				r->length = 0;
+				for(i=0;i<nano_433_frame.nrindexes;i++) {
+					if(nano_433_frame.indexes[i] >= nano_433_frame.nrpulses) {
+						r->length = 0;
+						return 0;
+					}
+					r->pulses[r->length++] = nano_433_frame.pulses[0];
+					r->pulses[r->length++] = nano_433_frame.pulses[nano_433_frame.indexes[i]];
+				}
+				return (r->length > 0);
+			} else {
+				nano_433_frame.state = NANO_IDLE;
+			}
+		break;
+		case NANO_VERSION:
+			if(c == '@') {
+				nano_433_frame.state = NANO_IDLE;
+				nano433Version();
+			} else if(nano_433_frame.verlen < (int)sizeof(nano_433_frame.version)-1) {
+				nano_433_frame.version[nano_433_frame.verlen++] = c;
+			} else {
+				nano_433_frame.state = NANO_IDLE;
+			}
+		break;
+		default:
+		break;
+	}
+	return 0;
+}
+
 static int nano433Receive(struct rawcode_t *r) {
-	char buffer[1024], c[1];
-	int start = 0, bytes = 0, startv = 0;
-	int s = 0, nrpulses = 0, y = 0;
-	int startp = 0, pulses[10];
-	size_t x = 0;
+	char c = 0;
 #ifdef _WIN32
 	DWORD n;
 #else
@@ -336,110 +491,53 @@ static int nano433Receive(struct rawcode_t *r) {
 #endif
 
 	r->length = 0;
-	memset(r->pulses, 0, MAXPULSESTREAMLENGTH);
 
 	running = 1;
 
 	while(loop) {
+		if(nano_433_bufpos >= nano_433_buflen) {
+			nano_433_bufpos = 0;
+			nano_433_buflen = 0;
 #ifdef _WIN32
-		if(WriteFile(serial_433_fd, "ping", 0, &n, NULL) == 0) {
-			logprintf(LOG_INFO, "lost connection to %s", com);
-			CloseHandle(serial_433_fd);
-			r->length = -1;
-			return -1;
-		}
-		ReadFile(serial_433_fd, c, 1, &n, NULL);
+			if(WriteFile(serial_433_fd, "ping", 0, &n, NULL) == 0) {
+				logprintf(LOG_INFO, "lost connection to %s", com);
+				CloseHandle(serial_433_fd);
+				r->length = -1;
+				return -1;
+			}
+			ReadFile(serial_433_fd, nano_433_buffer, sizeof(nano_433_buffer), &n, NULL);
 #else
-		n = read(serial_433_fd, c, 1);
+			n = read(serial_433_fd, nano_433_buffer, sizeof(nano_433_buffer));
+			if(n < 0 && errno != EINTR && errno != EAGAIN) {
+				logprintf(LOG_INFO, "lost connection to %s", com);
+				close(serial_433_fd);
+				nano_433_initialized = 0;
+				running = 0;
+				r->length = -1;
+				return -1;
+			}
 #endif
-		if(n > 0) {
-			if(c[0] == '\n') {
+			if(n <= 0) {
+				continue;
+			}
+			nano_433_buflen = (int)n;
+		}
+		while(nano_433_bufpos < nano_433_buflen) {
+			c = nano_433_buffer[nano_433_bufpos++];
+			if(c == '\n') {
+				/* The nano is ready for instructions */
 				sendSync = 1;
-				break;
-			} else {
-				if(c[0] == 'v') {
-					startv = 1;
-					start = 1;
-					bytes = 0;
-				}
-				if(c[0] == 'c') {
-					start = 1;
-					bytes = 0;
-				}
-				if(c[0] == 'p') {
-					startp = bytes+2;
-					buffer[bytes-1] = '\0';
-				}
-				if(c[0] == '@') {
-					buffer[bytes] = '\0';
-					if(startv == 1) {
-						start = 0;
-						startv = 0;
-						char **array = NULL;
-						int c = explode(&buffer[2], ",", &array);
-						if(c == 7) {
-							if(!(minrawlen == atoi(array[0]) && maxrawlen == atoi(array[1]) &&
-							     mingaplen == atoi(array[2]) && maxgaplen == atoi(array[3]))) {
-								logprintf(LOG_ERR, "could not sync FW values");
-							}
-							firmware.version = atof(array[4]);
-							firmware.lpf = atof(array[5]);
-							firmware.hpf = atof(array[6]);
-
-							if(firmware.version > 0 && firmware.lpf > 0 && firmware.hpf > 0) {
-								registry_set_number("pilight.firmware.version", firmware.version, 0);
-								registry_set_number("pilight.firmware.lpf", firmware.lpf, 0);
-								registry_set_number("pilight.firmware.hpf", firmware.hpf, 0);
-
-								struct JsonNode *jmessage = json_mkobject();
-								struct JsonNode *jcode = json_mkobject();
-								json_append_member(jcode, "version", json_mknumber(firmware.version, 0));
-								json_append_member(jcode, "lpf", json_mknumber(firmware.lpf, 0));
-								json_append_member(jcode, "hpf", json_mknumber(firmware.hpf, 0));
-								json_append_member(jmessage, "values", jcode);
-								json_append_member(jmessage, "origin", json_mkstring("core"));
-								json_append_member(jmessage, "type", json_mknumber(FIRMWARE, 0));
-								char pname[17];
-								strcpy(pname, "pilight-firmware");
-								if(pilight.broadcast != NULL) {
-									pilight.broadcast(pname, jmessage, FW);
-								}
-								json_delete(jmessage);
-								jmessage = NULL;
-							}
-						}
-						array_free(&array, c);
-					} else {
-						x = strlen(&buffer[startp]);
-						s = startp;
-						nrpulses = 0;
-						for(y = startp; y < startp + (int)x; y++) {
-							if(buffer[y] == ',') {
-								buffer[y] = '\0';
-								pulses[nrpulses++] = atoi(&buffer[s]);
-								s = y+1;
-							}
-						}
-						pulses[nrpulses++] = atoi(&buffer[s]);
-						x = strlen(&buffer[2]);
-						for(y = 2; y < 2 + x; y++) {
-							r->pulses[r->length++] = pulses[0];
-							r->pulses[r->length++] = pulses[buffer[y] - '0'];
-						}
-						bytes = 0;
-						return 0;
-					}
-				}
-				if(start == 1) {
-					buffer[bytes++] = c[0];
-				}
+				continue;
+			}
+			if(nano433Parse(c, r) == 1) {
+				return 0;
 			}
 		}
 	}
 
 	running = 0;
 
-  return -1;
+	return -1;
 }
 
 static unsigned short nano433Settings(JsonNode *json) {
@@ -452,6 +550,13 @@ static unsigned short nano433Settings(JsonNode *json) {
 					return EXIT_SUCCESS;
 				}
 			}
+#ifndef _WIN32
+			/* Pseudo terminals standing in for a nano */
+			if(strncmp(json->string_, "/dev/pts/", 9) == 0 && strlen(json->string_) < sizeof(com)) {
+				strcpy(com, json->string_);
+				return EXIT_SUCCESS;
+			}
+#endif
 		}
 		return EXIT_FAILURE;
 	}
@@ -478,7 +583,7 @@ void nano433Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "433nano";
-	module->version = "0.13";
+	module->version = "0.14";
 	module->reqversion = "6.0";
 	module->reqcommit = "40";
 }
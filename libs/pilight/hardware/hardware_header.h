@@ -0,0 +1,6 @@
+	#include "../hardware/433gpio.h"
+	#include "../hardware/433lirc.h"
+	#include "../hardware/433nano.h"
+	#include "../hardware/none.h"
+	#include "../hardware/virtual.h"
+
@@ -0,0 +1,6 @@
+	gpio433Init();
+	lirc433Init();
+	nano433Init();
+	noneInit();
+	virtualInit();
+
@@ -0,0 +1,555 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "../core/pilight.h"
+#include "../core/common.h"
+#include "../core/json.h"
+#include "../core/log.h"
+#include "../core/dso.h"
+#include "../core/capture.h"
+#include "../config/hardware.h"
+#include "virtual.h"
+
+/* Microseconds the receiver idles before returning an empty train */
+#define VIRTUAL_IDLE		100000
+/* Maximum number of looped back trains waiting to be received */
+#define VIRTUAL_QUEUE		64
+
+typedef struct virtual_train_t {
+	int *pulses;
+	int length;
+	/* Microseconds until the next train */
+	unsigned long long delay;
+} virtual_train_t;
+
+typedef struct virtual_queue_t {
+	int pulses[MAXPULSESTREAMLENGTH];
+	int length;
+	struct virtual_queue_t *next;
+} virtual_queue_t;
+
+static pthread_mutex_t lock;
+static pthread_mutexattr_t attr;
+static pthread_cond_t cond;
+static int initialized = 0;
+static int loop = 1;
+
+/* Settings */
+static int loopback = 1;
+static char *replay = NULL;
+static double speed = 1;
+static int repeat = 1;
+static double noise = 0;
+static int jitter = 0;
+static unsigned int seed = 1;
+
+static struct virtual_train_t *trains = NULL;
+static int nrtrains = 0;
+static int position = 0;
+static int passes = 0;
+static unsigned long long next_replay = 0;
+static unsigned long long next_noise = 0;
+
+static struct virtual_queue_t *queue = NULL;
+static struct virtual_queue_t *queue_tail = NULL;
+static int queue_length = 0;
+
+static unsigned int state = 1;
+
+static struct {
+	unsigned long replayed;
+	unsigned long looped;
+	unsigned long noise;
+	unsigned long dropped;
+	unsigned long long first;
+	unsigned long long last;
+} stats;
+
+static unsigned long long virtualTime(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+(unsigned long long)tv.tv_usec;
+}
+
+/* Deterministic xorshift generator so runs can be reproduced */
+static unsigned int virtualRandom(void) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static int virtualRange(int min, int max) {
+	return min+(int)(virtualRandom() % (unsigned int)(max-min+1));
+}
+
+static unsigned long long virtualAirtime(int *pulses, int length) {
+	unsigned long long airtime = 0;
+	int i = 0;
+	for(i=0;i<length;i++) {
+		airtime += (unsigned long long)pulses[i];
+	}
+	return airtime;
+}
+
+static void virtualJitter(struct rawcode_t *r) {
+	int i = 0, delta = 0;
+	if(jitter > 0) {
+		for(i=0;i<r->length;i++) {
+			delta = (r->pulses[i]*jitter)/100;
+			if(delta > 0) {
+				r->pulses[i] += virtualRange(-delta, delta);
+			}
+			if(r->pulses[i] < 1) {
+				r->pulses[i] = 1;
+			}
+		}
+	}
+}
+
+static void virtualNoise(struct rawcode_t *r) {
+	int i = 0;
+	r->length = virtualRange(4, 64)*2;
+	for(i=0;i<r->length-1;i++) {
+		r->pulses[i] = virtualRange(80, 4000);
+	}
+	r->pulses[r->length-1] = virtualRange(4000, 12000);
+}
+
+static void virtualCount(void) {
+	stats.last = virtualTime();
+	if(stats.first == 0) {
+		stats.first = stats.last;
+	}
+}
+
+static void virtualStats(void) {
+	unsigned long total = stats.replayed+stats.looped+stats.noise;
+	double duration = (double)(stats.last-stats.first)/1000000;
+
+	if(total > 0) {
+		logprintf(LOG_INFO, "virtual: %lu trains (%lu replayed, %lu looped back, %lu noise, %lu dropped) in %.3f seconds, %.1f trains/s",
+			total, stats.replayed, stats.looped, stats.noise, stats.dropped, duration, (duration > 0) ? (double)total/duration : 0);
+	}
+}
+
+static void virtualFree(void) {
+	int i = 0;
+	for(i=0;i<nrtrains;i++) {
+		FREE(trains[i].pulses);
+	}
+	if(trains != NULL) {
+		FREE(trains);
+	}
+	nrtrains = 0;
+
+	struct virtual_queue_t *tmp = NULL;
+	while(queue) {
+		tmp = queue;
+		queue = queue->next;
+		FREE(tmp);
+	}
+	queue_tail = NULL;
+	queue_length = 0;
+}
+
+static void virtualAdd(int *pulses, int length, unsigned long long delay) {
+	if((trains = REALLOC(trains, sizeof(struct virtual_train_t)*(size_t)(nrtrains+1))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	if((trains[nrtrains].pulses = MALLOC(sizeof(int)*(size_t)length)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(trains[nrtrains].pulses, pulses, sizeof(int)*(size_t)length);
+	trains[nrtrains].length = length;
+	trains[nrtrains].delay = delay;
+	nrtrains++;
+}
+
+/* Binary captures are replayed with their recorded timing */
+static int virtualLoadCapture(char *file) {
+	struct capture_t *capture = NULL;
+	unsigned long long timestamp = 0, previous = 0;
+	int pulses[MAXPULSESTREAMLENGTH], length = 0, hwtype = 0, ret = 0;
+
+	if((capture = capture_open(file, CAPTURE_READ)) == NULL) {
+		return -1;
+	}
+	while((ret = capture_read(capture, &timestamp, &hwtype, pulses, &length)) == 1) {
+		if(nrtrains > 0 && timestamp >= previous) {
+			trains[nrtrains-1].delay = timestamp-previous;
+		}
+		virtualAdd(pulses, length, virtualAirtime(pulses, length));
+		previous = timestamp;
+	}
+	if(ret == -1) {
+		logprintf(LOG_NOTICE, "virtual: pulse capture %s is corrupt after %d pulse trains", file, nrtrains);
+	}
+	capture_close(capture);
+
+	logprintf(LOG_DEBUG, "virtual: loaded %d pulse trains from %s", nrtrains, file);
+	return nrtrains;
+}
+
+/*
+ * A replay file holds one pulse train per line, pulses
+ * in microseconds separated by spaces or commas. Lines
+ * starting with a # are ignored. Binary pulse captures
+ * are recognized as well.
+ */
+static int virtualLoad(char *file) {
+	char line[8192], *p = NULL, *end = NULL;
+	int pulses[MAXPULSESTREAMLENGTH], length = 0, nr = 0, valid = 0;
+	long value = 0;
+	FILE *fp = NULL;
+
+	if(capture_is_file(file) == 1) {
+		return virtualLoadCapture(file);
+	}
+
+	if((fp = fopen(file, "r")) == NULL) {
+		logprintf(LOG_ERR, "virtual: cannot open replay file %s", file);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		nr++;
+		p = line;
+		while(*p == ' ' || *p == '\t') {
+			p++;
+		}
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+			continue;
+		}
+		length = 0;
+		valid = 1;
+		while(*p != '\0' && *p != '\n' && *p != '\r') {
+			if(*p == ' ' || *p == '\t' || *p == ',') {
+				p++;
+				continue;
+			}
+			value = strtol(p, &end, 10);
+			if(end == p || value <= 0 || length >= MAXPULSESTREAMLENGTH) {
+				valid = 0;
+				break;
+			}
+			pulses[length++] = (int)value;
+			p = end;
+		}
+		if(valid == 0 || length < 2) {
+			logprintf(LOG_NOTICE, "virtual: skipping invalid pulse train on line %d of %s", nr, file);
+			continue;
+		}
+
+		virtualAdd(pulses, length, virtualAirtime(pulses, length));
+	}
+	fclose(fp);
+
+	logprintf(LOG_DEBUG, "virtual: loaded %d pulse trains from %s", nrtrains, file);
+	return nrtrains;
+}
+
+static unsigned short int virtualHwInit(void) {
+	if(initialized == 0) {
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&lock, &attr);
+		pthread_cond_init(&cond, NULL);
+		initialized = 1;
+	}
+
+	pthread_mutex_lock(&lock);
+	virtualFree();
+	memset(&stats, 0, sizeof(stats));
+	state = (seed == 0) ? 1 : seed;
+	position = 0;
+	passes = 0;
+	loop = 1;
+
+	if(replay != NULL && strlen(replay) > 0) {
+		if(virtualLoad(replay) < 0) {
+			pthread_mutex_unlock(&lock);
+			return EXIT_FAILURE;
+		}
+	}
+	next_replay = virtualTime();
+	if(noise > 0) {
+		next_noise = next_replay+(unsigned long long)(1000000/noise);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return EXIT_SUCCESS;
+}
+
+static unsigned short virtualHwDeinit(void) {
+	if(initialized == 1) {
+		pthread_mutex_lock(&lock);
+		loop = 0;
+		virtualStats();
+		virtualFree();
+		pthread_mutex_unlock(&lock);
+		pthread_cond_broadcast(&cond);
+	}
+	if(replay != NULL) {
+		FREE(replay);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Sent codes are queued and handed to the receiver as is */
+static int virtualSend(int *code, int rawlen, int repeats) {
+	int i = 0;
+
+	if(rawlen <= 0 || rawlen > MAXPULSESTREAMLENGTH) {
+		return EXIT_FAILURE;
+	}
+
+	if(loopback == 1) {
+		pthread_mutex_lock(&lock);
+		for(i=0;i<repeats;i++) {
+			if(queue_length >= VIRTUAL_QUEUE) {
+				stats.dropped++;
+				continue;
+			}
+			struct virtual_queue_t *node = MALLOC(sizeof(struct virtual_queue_t));
+			if(node == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(node->pulses, code, sizeof(int)*(size_t)rawlen);
+			node->length = rawlen;
+			node->next = NULL;
+			if(queue_tail == NULL) {
+				queue = node;
+			} else {
+				queue_tail->next = node;
+			}
+			queue_tail = node;
+			queue_length++;
+		}
+		pthread_mutex_unlock(&lock);
+		pthread_cond_signal(&cond);
+	}
+
+	/* Take as long as a real transmitter would */
+	if(speed > 0) {
+		usleep((__useconds_t)((double)(virtualAirtime(code, rawlen)*(unsigned long long)repeats)/speed));
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int virtualNext(struct rawcode_t *r, unsigned long long now, unsigned long long *due) {
+	struct virtual_queue_t *tmp = NULL;
+
+	if(queue != NULL) {
+		tmp = queue;
+		memcpy(r->pulses, tmp->pulses, sizeof(int)*(size_t)tmp->length);
+		r->length = tmp->length;
+		queue = queue->next;
+		if(queue == NULL) {
+			queue_tail = NULL;
+		}
+		queue_length--;
+		FREE(tmp);
+		virtualJitter(r);
+		stats.looped++;
+		virtualCount();
+		return 1;
+	}
+
+	if(noise > 0) {
+		if(next_noise <= now) {
+			virtualNoise(r);
+			next_noise += (unsigned long long)(1000000/noise);
+			stats.noise++;
+			virtualCount();
+			return 1;
+		}
+		if(next_noise < *due) {
+			*due = next_noise;
+		}
+	}
+
+	if(nrtrains > 0 && (repeat == 0 || passes < repeat)) {
+		if(next_replay <= now) {
+			memcpy(r->pulses, trains[position].pulses, sizeof(int)*(size_t)trains[position].length);
+			r->length = trains[position].length;
+			/* Keep the schedule absolute so replay does not drift */
+			if(speed > 0) {
+				next_replay += (unsigned long long)((double)trains[position].delay/speed);
+			} else {
+				next_replay = now;
+			}
+			if(++position >= nrtrains) {
+				position = 0;
+				passes++;
+				if(repeat > 0 && passes >= repeat) {
+					logprintf(LOG_DEBUG, "virtual: finished replaying %s", replay);
+				}
+			}
+			virtualJitter(r);
+			stats.replayed++;
+			virtualCount();
+			return 1;
+		}
+		if(next_replay < *due) {
+			*due = next_replay;
+		}
+	}
+
+	return 0;
+}
+
+static int virtualReceive(struct rawcode_t *r) {
+	unsigned long long now = 0, due = 0;
+	struct timespec ts;
+
+	r->length = 0;
+
+	pthread_mutex_lock(&lock);
+	if(loop == 1) {
+		now = virtualTime();
+		due = now+VIRTUAL_IDLE;
+		if(virtualNext(r, now, &due) == 0) {
+			ts.tv_sec = (time_t)(due/1000000);
+			ts.tv_nsec = (long)((due%1000000)*1000);
+			pthread_cond_timedwait(&cond, &lock, &ts);
+			due = virtualTime()+VIRTUAL_IDLE;
+			if(loop == 1) {
+				virtualNext(r, virtualTime(), &due);
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static unsigned short virtualSettings(JsonNode *json) {
+	if(strcmp(json->key, "loopback") == 0) {
+		if(json->tag == JSON_NUMBER && (json->number_ == 0 || json->number_ == 1)) {
+			loopback = (int)json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "replay") == 0) {
+		if(json->tag == JSON_STRING) {
+			if((replay = REALLOC(replay, strlen(json->string_)+1)) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(replay, json->string_);
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "speed") == 0) {
+		if(json->tag == JSON_NUMBER && json->number_ >= 0) {
+			speed = json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "repeat") == 0) {
+		if(json->tag == JSON_NUMBER && json->number_ >= 0) {
+			repeat = (int)json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "noise") == 0) {
+		if(json->tag == JSON_NUMBER && json->number_ >= 0) {
+			noise = json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "jitter") == 0) {
+		if(json->tag == JSON_NUMBER && json->number_ >= 0 && json->number_ <= 100) {
+			jitter = (int)json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	if(strcmp(json->key, "seed") == 0) {
+		if(json->tag == JSON_NUMBER && json->number_ >= 0) {
+			seed = (unsigned int)json->number_;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+#if !defined(MODULE) && !defined(_WIN32)
+__attribute__((weak))
+#endif
+void virtualInit(void) {
+	hardware_register(&virtual);
+	hardware_set_id(virtual, "virtual");
+
+	options_add(&virtual->options, 'l', "loopback", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[01]$");
+	options_add(&virtual->options, 'f', "replay", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_STRING, NULL, NULL);
+	options_add(&virtual->options, 's', "speed", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9]+(\\.[0-9]+)?$");
+	options_add(&virtual->options, 'r', "repeat", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9]+$");
+	options_add(&virtual->options, 'n', "noise", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9]+(\\.[0-9]+)?$");
+	options_add(&virtual->options, 'j', "jitter", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9]+$");
+	options_add(&virtual->options, 'e', "seed", OPTION_OPT_VALUE, DEVICES_VALUE, JSON_NUMBER, NULL, "^[0-9]+$");
+
+	/* Optional settings are written back with their defaults */
+	options_set_number(&virtual->options, 'l', loopback);
+	options_set_string(&virtual->options, 'f', "");
+	options_set_number(&virtual->options, 's', speed);
+	options_set_number(&virtual->options, 'r', repeat);
+	options_set_number(&virtual->options, 'n', noise);
+	options_set_number(&virtual->options, 'j', jitter);
+	options_set_number(&virtual->options, 'e', seed);
+
+	virtual->hwtype=RF433;
+	virtual->comtype=COMPLSTRAIN;
+	virtual->init=&virtualHwInit;
+	virtual->deinit=&virtualHwDeinit;
+	virtual->send=&virtualSend;
+	virtual->receivePulseTrain=&virtualReceive;
+	virtual->settings=&virtualSettings;
+}
+
+#if defined(MODULE) && !defined(_WIN32)
+void compatibility(struct module_t *module) {
+	module->name = "virtual";
+	module->version = "1.0";
+	module->reqversion = "5.0";
+	module->reqcommit = NULL;
+}
+
+void init(void) {
+	virtualInit();
+}
+#endif
@@ -79,21 +79,14 @@ static void createMessage(int id, int unit, int state, int all, int dimlevel, in
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
-
-	for(x=0;x<arctech_dimmer->rawlen;x+=4) {
-		if(arctech_dimmer->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
-
-	int dimlevel = binToDecRev(binary, 32, 35);
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	/* Every fourth pulse is long for a 1, the dim level follows the unit */
+	uint32_t bits = protocol_pulsetrain_bits(arctech_dimmer->pulses, 3, 4, 32);
+
+	int dimlevel = (int)protocol_pulsetrain_bits(arctech_dimmer->pulses, 131, 4, 4);
+	int unit = (int)(bits & 0xF);
+	int state = (int)((bits >> 4) & 1);
+	int all = (int)((bits >> 5) & 1);
+	int id = (int)(bits >> 6);
 
 	createMessage(id, unit, state, all, dimlevel, 0);
 }
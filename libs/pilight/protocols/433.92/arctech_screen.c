@@ -73,20 +73,13 @@ static void createMessage(int id, int unit, int state, int all, int learn) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	/* Every fourth pulse is long for a 1 */
+	uint32_t bits = protocol_pulsetrain_bits(arctech_screen->pulses, 3, 4, 32);
 
-	for(x=0;x<arctech_screen->rawlen;x+=4) {
-		if(arctech_screen->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
-
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int unit = (int)(bits & 0xF);
+	int state = (int)((bits >> 4) & 1);
+	int all = (int)((bits >> 5) & 1);
+	int id = (int)(bits >> 6);
 
 	createMessage(id, unit, state, all, 0);
 }
@@ -0,0 +1,44 @@
+	#include "alecto_ws1700.h"
+	#include "alecto_wsd17.h"
+	#include "alecto_wx500.h"
+	#include "arctech_contact.h"
+	#include "arctech_dimmer.h"
+	#include "arctech_dusk.h"
+	#include "arctech_motion.h"
+	#include "arctech_screen.h"
+	#include "arctech_screen_old.h"
+	#include "arctech_switch.h"
+	#include "arctech_switch_old.h"
+	#include "auriol.h"
+	#include "beamish_switch.h"
+	#include "clarus.h"
+	#include "cleverwatts.h"
+	#include "conrad_rsl_contact.h"
+	#include "conrad_rsl_switch.h"
+	#include "ehome.h"
+	#include "elro_300_switch.h"
+	#include "elro_400_switch.h"
+	#include "elro_800_contact.h"
+	#include "elro_800_switch.h"
+	#include "ev1527.h"
+	#include "impuls.h"
+	#include "logilink_switch.h"
+	#include "mumbi.h"
+	#include "ninjablocks_weather.h"
+	#include "pollin.h"
+	#include "quigg_gt1000.h"
+	#include "quigg_gt7000.h"
+	#include "quigg_screen.h"
+	#include "rc101.h"
+	#include "rev_v1.h"
+	#include "rev_v2.h"
+	#include "rev_v3.h"
+	#include "rsl366.h"
+	#include "sc2262.h"
+	#include "selectremote.h"
+	#include "silvercrest.h"
+	#include "techlico_switch.h"
+	#include "teknihall.h"
+	#include "tfa.h"
+	#include "x10.h"
+
@@ -0,0 +1,44 @@
+	alectoWS1700Init();
+	alectoWSD17Init();
+	alectoWX500Init();
+	arctechContactInit();
+	arctechDimmerInit();
+	arctechDuskInit();
+	arctechMotionInit();
+	arctechScreenInit();
+	arctechScreenOldInit();
+	arctechSwitchInit();
+	arctechSwitchOldInit();
+	auriolInit();
+	beamishSwitchInit();
+	clarusSwitchInit();
+	cleverwattsInit();
+	conradRSLContactInit();
+	conradRSLSwitchInit();
+	ehomeInit();
+	elro300SwitchInit();
+	elro400SwitchInit();
+	elro800ContactInit();
+	elro800SwitchInit();
+	ev1527Init();
+	impulsInit();
+	logilinkSwitchInit();
+	mumbiInit();
+	ninjablocksWeatherInit();
+	pollinInit();
+	quiggGT1000Init();
+	quiggGT7000Init();
+	quiggScreenInit();
+	rc101Init();
+	rev1Init();
+	rev2Init();
+	rev3Init();
+	rsl366Init();
+	sc2262Init();
+	selectremoteInit();
+	silvercrestInit();
+	techlicoSwitchInit();
+	teknihallInit();
+	tfaInit();
+	x10Init();
+
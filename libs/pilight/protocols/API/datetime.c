@@ -57,39 +57,107 @@
 #include "../../core/json.h"
 #include "../../core/gc.h"
 #include "../../core/datetime.h"
+#include "../../core/tick.h"
 #include "datetime.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+typedef struct settings_t {
+	double longitude;
+	double latitude;
+	char tz[64];
+	int offset;
+	int dst;
+	struct settings_t *next;
+} settings_t;
+
+static struct settings_t *settings = NULL;
 static char *format = NULL;
 
-static pthread_mutex_t lock;
+static void callback(time_t t, int changed, void *userdata) {
+	struct settings_t *device = (struct settings_t *)userdata;
+	struct tm tm;
+
+	/* Check for daylight saving time each hour and when the clock was set */
+	if((changed & TICK_MINUTE) == TICK_MINUTE && ((t/60)%60 == 0 || (changed & TICK_JUMP) == TICK_JUMP)) {
+		device->dst = isdst(t, device->tz);
+	}
+
+	/* Get UTC time */
+#ifdef _WIN32
+	struct tm *tm1;
+	if((tm1 = gmtime(&t)) == NULL) {
+		return;
+	}
+	memcpy(&tm, tm1, sizeof(struct tm));
+#else
+	if(gmtime_r(&t, &tm) == NULL) {
+		return;
+	}
+#endif
+	int year = tm.tm_year+1900;
+	int month = tm.tm_mon+1;
+	int day = tm.tm_mday;
+	/* Add our hour difference to the UTC time */
+	tm.tm_hour += device->offset;
+	/* Add possible daylist savings time hour */
+	tm.tm_hour += device->dst;
+	int hour = tm.tm_hour;
+	int minute = tm.tm_min;
+	int second = tm.tm_sec;
+	int weekday = tm.tm_wday+1;
+
+	datefix(&year, &month, &day, &hour, &minute, &second);
+
+	datetime->message = json_mkobject();
+
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "longitude", json_mknumber(device->longitude, 6));
+	json_append_member(code, "latitude", json_mknumber(device->latitude, 6));
+	json_append_member(code, "year", json_mknumber(year, 0));
+	json_append_member(code, "month", json_mknumber(month, 0));
+	json_append_member(code, "day", json_mknumber(day, 0));
+	json_append_member(code, "weekday", json_mknumber(weekday, 0));
+	json_append_member(code, "hour", json_mknumber(hour, 0));
+	json_append_member(code, "minute", json_mknumber(minute, 0));
+	json_append_member(code, "second", json_mknumber(second, 0));
+	json_append_member(code, "dst", json_mknumber(device->dst, 0));
+
+	json_append_member(datetime->message, "message", code);
+	json_append_member(datetime->message, "origin", json_mkstring("receiver"));
+	json_append_member(datetime->message, "protocol", json_mkstring(datetime->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(datetime->id, datetime->message, PROTOCOL);
+	}
+
+	json_delete(datetime->message);
+	datetime->message = NULL;
+}
 
-static void *thread(void *param) {
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	char UTC[] = "UTC";
-	struct protocol_threads_t *thread = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)thread->param;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
-	struct tm tm;
+	struct settings_t *device = NULL;
 	char *tz = NULL;
-	time_t t;
-	int target_offset = 0, counter = 0, dst = 0, x = 0;
-	double longitude = 0.0, latitude = 0.0;
+	int nr = 1;
 
-	threads++;
+	if((device = MALLOC(sizeof(struct settings_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(device, '\0', sizeof(struct settings_t));
 
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			jchild1 = json_first_child(jchild);
 			while(jchild1) {
 				if(strcmp(jchild1->key, "longitude") == 0) {
-					longitude = jchild1->number_;
+					device->longitude = jchild1->number_;
 				}
 				if(strcmp(jchild1->key, "latitude") == 0) {
-					latitude = jchild1->number_;
+					device->latitude = jchild1->number_;
 				}
 				jchild1 = jchild1->next;
 			}
@@ -97,108 +165,43 @@ static void *thread(void *param) {
 		}
 	}
 
-	if((tz = coord2tz(longitude, latitude)) == NULL) {
-		logprintf(LOG_INFO, "datetime #%d, could not determine timezone", threads);
-		tz = UTC;
-	} else {
-		logprintf(LOG_INFO, "datetime #%d %.6f:%.6f seems to be in timezone: %s", threads, longitude, latitude, tz);
+	if(settings != NULL) {
+		struct settings_t *tmp = settings;
+		while(tmp) {
+			nr++;
+			tmp = tmp->next;
+		}
 	}
 
-	t = time(NULL);
-	t -= getntpdiff();
-	dst = isdst(t, tz);
-	if(isntpsynced() == 0) {
-		x = 1;
+	if((tz = coord2tz(device->longitude, device->latitude)) == NULL) {
+		logprintf(LOG_INFO, "datetime #%d, could not determine timezone", nr);
+		tz = UTC;
+	} else {
+		logprintf(LOG_INFO, "datetime #%d %.6f:%.6f seems to be in timezone: %s", nr, device->longitude, device->latitude, tz);
 	}
+	snprintf(device->tz, sizeof(device->tz), "%s", tz);
 
+	device->dst = isdst(time(NULL)-getntpdiff(), device->tz);
 	/* Check how many hours we differ from UTC? */
-	target_offset = tzoffset(UTC, tz);
-
-	while(loop) {
-		pthread_mutex_lock(&lock);
-		t = time(NULL);
-		t -= getntpdiff();
-
-		/* Get UTC time */
-#ifdef _WIN32
-		struct tm *tm1;
-		if((tm1 = gmtime(&t)) != NULL) {
-			memcpy(&tm, tm1, sizeof(struct tm));
-#else
-		if(gmtime_r(&t, &tm) != NULL) {
-#endif
-			int year = tm.tm_year+1900;
-			int month = tm.tm_mon+1;
-			int day = tm.tm_mday;
-			/* Add our hour difference to the UTC time */
-			tm.tm_hour += target_offset;
-			/* Add possible daylist savings time hour */
-			tm.tm_hour += dst;
-			int hour = tm.tm_hour;
-			int minute = tm.tm_min;
-			int second = tm.tm_sec;
-			int weekday = tm.tm_wday+1;
-
-			datefix(&year, &month, &day, &hour, &minute, &second);
-
-			if((minute == 0 && second == 0) || (isntpsynced() == 0 && x == 0)) {
-				x = 1;
-				dst = isdst(t, tz);
-			}
+	device->offset = tzoffset(UTC, device->tz);
 
-			datetime->message = json_mkobject();
-
-			JsonNode *code = json_mkobject();
-			json_append_member(code, "longitude", json_mknumber(longitude, 6));
-			json_append_member(code, "latitude", json_mknumber(latitude, 6));
-			json_append_member(code, "year", json_mknumber(year, 0));
-			json_append_member(code, "month", json_mknumber(month, 0));
-			json_append_member(code, "day", json_mknumber(day, 0));
-			json_append_member(code, "weekday", json_mknumber(weekday, 0));
-			json_append_member(code, "hour", json_mknumber(hour, 0));
-			json_append_member(code, "minute", json_mknumber(minute, 0));
-			json_append_member(code, "second", json_mknumber(second, 0));
-			json_append_member(code, "dst", json_mknumber(dst, 0));
-
-			json_append_member(datetime->message, "message", code);
-			json_append_member(datetime->message, "origin", json_mkstring("receiver"));
-			json_append_member(datetime->message, "protocol", json_mkstring(datetime->id));
-
-			if(pilight.broadcast != NULL) {
-				pilight.broadcast(datetime->id, datetime->message, PROTOCOL);
-			}
-
-			json_delete(datetime->message);
-			datetime->message = NULL;
-			counter++;
-		}
-		pthread_mutex_unlock(&lock);
-		sleep(1);
-	}
-	pthread_mutex_unlock(&lock);
-
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+	device->next = settings;
+	settings = device;
 
-	struct protocol_threads_t *node = protocol_thread_init(datetime, json);
-	return threads_register("datetime", &thread, (void *)node, 0);
+	/* All datetime devices share one clock tick */
+	tick_add(callback, (void *)device);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
+	struct settings_t *tmp = NULL;
 
-	protocol_thread_stop(datetime);
-	while(threads > 0) {
-		usleep(10);
+	tick_gc();
+	while(settings) {
+		tmp = settings;
+		settings = settings->next;
+		FREE(tmp);
 	}
-	protocol_thread_free(datetime);
 }
 
 static void gc(void) {
@@ -243,7 +246,7 @@ void datetimeInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "datetime";
-	module->version = "2.6";
+	module->version = "2.7";
 	module->reqversion = "6.0";
 	module->reqcommit = "115";
 }
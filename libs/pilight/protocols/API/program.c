@@ -44,12 +44,10 @@
 #include "../../core/binary.h"
 #include "../../core/json.h"
 #include "../../core/gc.h"
+#include "../../core/proc.h"
 #include "program.h"
 
 #ifndef _WIN32
-static unsigned short loop = 1;
-static unsigned short threads = 0;
-
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
@@ -64,32 +62,64 @@ typedef struct settings_t {
 	int laststate;
 	pthread_t pth;
 	int hasthread;
-	protocol_threads_t *thread;
 	struct settings_t *next;
 } settings_t;
 
 static struct settings_t *settings = NULL;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *pnode = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)pnode->param;
+static void callback(void *userdata, int pid) {
+	struct settings_t *lnode = (struct settings_t *)userdata;
+
+	pthread_mutex_lock(&lock);
+	if(lnode->wait == 0) {
+		struct JsonNode *message = json_mkobject();
+
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "name", json_mkstring(lnode->name));
+
+		if(pid > 0) {
+			lnode->currentstate = 1;
+			json_append_member(code, "state", json_mkstring("running"));
+			json_append_member(code, "pid", json_mknumber((int)pid, 0));
+		} else {
+			lnode->currentstate = 0;
+			json_append_member(code, "state", json_mkstring("stopped"));
+			json_append_member(code, "pid", json_mknumber(0, 0));
+		}
+		json_append_member(message, "message", code);
+		json_append_member(message, "origin", json_mkstring("receiver"));
+		json_append_member(message, "protocol", json_mkstring(program->id));
+
+		if(lnode->currentstate != lnode->laststate) {
+			lnode->laststate = lnode->currentstate;
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(program->id, message, PROTOCOL);
+			}
+		}
+		json_delete(message);
+		message = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
 	char *prog = NULL, *args = NULL, *stopcmd = NULL, *startcmd = NULL;
-
-	int interval = 1, nrloops = 0;
-	int pid = 0;
+	int interval = 1;
 	double itmp = 0;
 
-	threads++;
-
-	json_find_string(json, "program", &prog);
-	json_find_string(json, "arguments", &args);
-	json_find_string(json, "stop-command", &stopcmd);
-	json_find_string(json, "start-command", &startcmd);
+	json_find_string(jdevice, "program", &prog);
+	json_find_string(jdevice, "arguments", &args);
+	json_find_string(jdevice, "stop-command", &stopcmd);
+	json_find_string(jdevice, "start-command", &startcmd);
 
 	struct settings_t *lnode = MALLOC(sizeof(struct settings_t));
+	if(lnode == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
 	lnode->wait = 0;
 	lnode->hasthread = 0;
 	memset(&lnode->pth, '\0', sizeof(pthread_t));
@@ -135,7 +165,7 @@ static void *thread(void *param) {
 	}
 
 	lnode->name = NULL;
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			jchild1 = json_first_child(jchild);
@@ -153,63 +183,20 @@ static void *thread(void *param) {
 		}
 	}
 
-	lnode->thread = pnode;
 	lnode->laststate = -1;
 
+	pthread_mutex_lock(&lock);
 	lnode->next = settings;
 	settings = lnode;
+	pthread_mutex_unlock(&lock);
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
 		interval = (int)round(itmp);
 
-	while(loop) {
-		if(protocol_thread_wait(pnode, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(lnode->wait == 0) {
-				struct JsonNode *message = json_mkobject();
-
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "name", json_mkstring(lnode->name));
-
-				if((pid = (int)findproc(lnode->program, lnode->arguments, 0)) > 0) {
-					lnode->currentstate = 1;
-					json_append_member(code, "state", json_mkstring("running"));
-					json_append_member(code, "pid", json_mknumber((int)pid, 0));
-				} else {
-					lnode->currentstate = 0;
-					json_append_member(code, "state", json_mkstring("stopped"));
-					json_append_member(code, "pid", json_mknumber(0, 0));
-				}
-				json_append_member(message, "message", code);
-				json_append_member(message, "origin", json_mkstring("receiver"));
-				json_append_member(message, "protocol", json_mkstring(program->id));
-
-				if(lnode->currentstate != lnode->laststate) {
-					lnode->laststate = lnode->currentstate;
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(program->id, message, PROTOCOL);
-					}
-				}
-				json_delete(message);
-				message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
-		}
+	if(lnode->program != NULL) {
+		proc_watch(lnode->program, lnode->arguments, interval, callback, (void *)lnode);
 	}
-	pthread_mutex_unlock(&lock);
-
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
-
-	struct protocol_threads_t *node = protocol_thread_init(program, json);
-	return threads_register("program", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static void *execute(void *param) {
@@ -217,7 +204,7 @@ static void *execute(void *param) {
 	int pid = 0;
 	int result = 0;
 
-	if((pid = (int)findproc(p->program, p->arguments, 0)) > 0) {
+	if((pid = (int)proc_find(p->program, p->arguments)) > 0) {
 		result = system(p->stop);
 	} else {
 		result = system(p->start);
@@ -225,21 +212,22 @@ static void *execute(void *param) {
 
 	/* Check of the user wanted to stop pilight */
 	if(WIFSIGNALED(result)) {
-		int ppid = 0;
-		/* Find the pilight daemon pid */
-		if((ppid = (int)findproc(progname, NULL, 0)) > 0) {
-			/* Send a sigint to ourself */
-			kill(ppid, SIGINT);
-		}
+		/* Send a sigint to ourself */
+		kill(getpid(), SIGINT);
 	}
 
+	pthread_mutex_lock(&lock);
 	p->wait = 0;
 	memset(&p->pth, '\0', sizeof(pthread_t));
 	p->hasthread = 0;
 	p->laststate = -1;
+	pthread_mutex_unlock(&lock);
 
-	pthread_mutex_unlock(&p->thread->mutex);
-	pthread_cond_signal(&p->thread->cond);
+	/* Report the outcome right away */
+	if(p->program != NULL) {
+		pid = (int)proc_find(p->program, p->arguments);
+		callback((void *)p, (pid > 0) ? pid : 0);
+	}
 
 	return NULL;
 }
@@ -263,7 +251,7 @@ static int createCode(JsonNode *code) {
 							else if(json_find_number(code, "stopped", &itmp) == 0)
 								state = 0;
 
-							if((pid = (int)findproc(tmp->program, tmp->arguments, 0)) > 0 && state == 1) {
+							if((pid = (int)proc_find(tmp->program, tmp->arguments)) > 0 && state == 1) {
 								logprintf(LOG_ERR, "program \"%s\" already running", tmp->name);
 							} else if(pid == -1 && state == 0) {
 								logprintf(LOG_ERR, "program \"%s\" already stopped", tmp->name);
@@ -329,12 +317,7 @@ static int createCode(JsonNode *code) {
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(program);
-	while(threads > 0) {
-		usleep(10);
-	}
-	protocol_thread_free(program);
+	proc_gc();
 
 	struct settings_t *tmp;
 	while(settings) {
@@ -402,7 +385,7 @@ void programInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "program";
-	module->version = "1.6";
+	module->version = "1.7";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
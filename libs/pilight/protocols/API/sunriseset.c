@@ -35,92 +35,53 @@
 #include "../../core/threads.h"
 #include "../../core/pilight.h"
 #include "../../core/common.h"
-#include "../../core/ntp.h"
 #include "../../core/dso.h"
-#include "../../core/datetime.h" // Full path because we also have a datetime protocol
+#include "../../core/ephemeris.h"
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/json.h"
 #include "../../core/gc.h"
 #include "sunriseset.h"
 
-#define PI 3.1415926
-#define PIX 57.29578049044297 // 180 / PI
-#define ZENITH 90.83333333333333
+static void callback(struct ephemeris_t *ephemeris, int changed, void *userdata) {
+	sunriseset->message = json_mkobject();
+	JsonNode *code = json_mkobject();
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+	json_append_member(code, "longitude", json_mknumber(ephemeris->longitude, 6));
+	json_append_member(code, "latitude", json_mknumber(ephemeris->latitude, 6));
 
-static double calculate(int year, int month, int day, double lon, double lat, int rising, int tz) {
-	int N = (int)((floor(275 * month / 9)) - ((floor((month + 9) / 12)) *
-			((1 + floor((year - 4 * floor(year / 4) + 2) / 3)))) + (int)day - 30);
-
-	double lngHour = lon / 15.0;
-	double T = 0;
-
-	if(rising) {
-		T = N + ((6 - lngHour) / 24);
-	} else {
-		T = N + ((18 - lngHour) / 24);
-	}
-
-	double M = (0.9856 * T) - 3.289;
-	double M1 = M * PI / 180;
-	double L = fmod((M + (1.916 * sin(M1)) + (0.020 * sin(2 * M1)) + 282.634), 360.0);
-	double L1 = L * PI / 180;
-	double L2 = lat * PI / 180;
-	double SD = 0.39782 * sin(L1);
-	double CH = (cos(ZENITH * PI / 180)-(SD * sin(L2))) / (cos((PIX * asin((SD))) * PI / 180) * cos(L2));
-
-	if(CH > 1) {
-		return -1;
-	} else if(CH < -1) {
-		return -1;
+	/* Only communicate the sun state change when they actually occur,
+		 and only communicate the new times when the day changes */
+	if((changed & EPHEMERIS_SUN) == EPHEMERIS_SUN) {
+		if(ephemeris->rise == 1) {
+			json_append_member(code, "sun", json_mkstring("rise"));
+		} else {
+			json_append_member(code, "sun", json_mkstring("set"));
+		}
 	}
-
-	double RA = fmod((PIX * atan((0.91764 * tan(L1)))), 360);
-	double MQ = (RA + (((floor(L / 90)) * 90) - ((floor(RA / 90)) * 90))) / 15;
-	double A;
-	double B;
-	if(rising == 0) {
-		A = 0.06571;
-		B = 6.595;
-	} else {
-		A = 0.06571;
-		B = 6.618;
+	if((changed & EPHEMERIS_TIMES) == EPHEMERIS_TIMES) {
+		json_append_member(code, "sunrise", json_mknumber(((double)ephemeris->sunrise/100), 2));
+		json_append_member(code, "sunset", json_mknumber(((double)ephemeris->sunset/100), 2));
 	}
 
-	double t = ((rising ? 360 - PIX * acos(CH) : PIX * acos(CH)) / 15) + MQ - (A * T) - B;
-	double UT = fmod((t - lngHour) + 24.0, 24.0);
-	double min = (round(60*fmod(UT, 1))/100);
+	json_append_member(sunriseset->message, "message", code);
+	json_append_member(sunriseset->message, "origin", json_mkstring("receiver"));
+	json_append_member(sunriseset->message, "protocol", json_mkstring(sunriseset->id));
 
-	if(min >= 0.60) {
-		min -= 0.60;
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(sunriseset->id, sunriseset->message, PROTOCOL);
 	}
-
-	double hour = UT-min;
-
-	return ((round(hour)+min)+tz)*100;
+	json_delete(sunriseset->message);
+	sunriseset->message = NULL;
 }
 
-static void *thread(void *param) {
-	struct protocol_threads_t *thread = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)thread->param;
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
 	double longitude = 0, latitude = 0;
-	char UTC[] = "UTC", *tz = NULL;
-
-	time_t timenow = 0;
-	struct tm tm;
-	int nrloops = 0, risetime = 0, settime = 0, hournow = 0, newdst = 0;
-	int firstrun = 0, target_offset = 0, x = 0, dst = 0, dstchange = 0;
-	int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
-
-	threads++;
 
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			jchild1 = json_first_child(jchild);
@@ -137,135 +98,13 @@ static void *thread(void *param) {
 		}
 	}
 
-	if((tz = coord2tz(longitude, latitude)) == NULL) {
-		logprintf(LOG_DEBUG, "could not determine timezone");
-		tz = UTC;
-	} else {
-		logprintf(LOG_DEBUG, "%.6f:%.6f seems to be in timezone: %s", longitude, latitude, tz);
-	}
-
-	timenow = time(NULL);
-	timenow -= getntpdiff();
-	dst = isdst(timenow, tz);
-	if(isntpsynced() == 0) {
-		x = 1;
-	}
-
-	/* Check how many hours we differ from UTC? */
-	target_offset = tzoffset(UTC, tz);
-
-	while(loop) {
-		protocol_thread_wait(thread, 1, &nrloops);
-		timenow = time(NULL);
-		timenow -= getntpdiff();
-
-			/* Get UTC time */
-#ifdef _WIN32
-		struct tm *tm1;
-		if((tm1 = gmtime(&timenow)) != NULL) {
-			memcpy(&tm, tm1, sizeof(struct tm));
-#else
-		if(gmtime_r(&timenow, &tm) != NULL) {
-#endif
-			year = tm.tm_year+1900;
-			month = tm.tm_mon+1;
-			day = tm.tm_mday;
-			/* Add our hour difference to the UTC time */
-			tm.tm_hour += target_offset;
-			/* Add possible daylist savings time hour */
-			tm.tm_hour += dst;
-			hour = tm.tm_hour;
-			minute = tm.tm_min;
-			second = tm.tm_sec;
-
-			datefix(&year, &month, &day, &hour, &minute, &second);
-
-			if((minute == 0 && second == 1) || (isntpsynced() == 0 && x == 0)) {
-				x = 1;
-				if((newdst = isdst(timenow, tz)) != dst) {
-					dstchange = 1;
-				} else {
-					dstchange = 0;
-				}
-				dst = newdst;
-			}
-
-			hournow = (hour*100)+minute;
-			if(((hournow == 0 || hournow == risetime || hournow == settime) && second == 0)
-				 || (settime == 0 && risetime == 0) || dstchange == 1) {
-
-				if(settime == 0 && risetime == 0) {
-					firstrun = 1;
-				}
-
-				sunriseset->message = json_mkobject();
-				JsonNode *code = json_mkobject();
-				risetime = (int)calculate(year, month, day, longitude, latitude, 1, target_offset);
-				settime = (int)calculate(year, month, day, longitude, latitude, 0, target_offset);
-
-				if(dst == 1) {
-					risetime += 100;
-					settime += 100;
-					if(risetime > 2400) {
-						risetime -= 2400;
-					}
-					if(settime > 2400) {
-						settime -= 2400;
-					}
-				}
-
-				json_append_member(code, "longitude", json_mknumber(longitude, 6));
-				json_append_member(code, "latitude", json_mknumber(latitude, 6));
-
-				/* Only communicate the sun state change when they actually occur,
-					 and only communicate the new times when the day changes */
-				if(hournow != 0 || firstrun == 1) {
-					if(hournow >= risetime && hournow < settime) {
-						json_append_member(code, "sun", json_mkstring("rise"));
-					} else {
-						json_append_member(code, "sun", json_mkstring("set"));
-					}
-				}
-				if(hournow == 0 || firstrun == 1) {
-					json_append_member(code, "sunrise", json_mknumber(((double)risetime/100), 2));
-					json_append_member(code, "sunset", json_mknumber(((double)settime/100), 2));
-				}
-
-				json_append_member(sunriseset->message, "message", code);
-				json_append_member(sunriseset->message, "origin", json_mkstring("receiver"));
-				json_append_member(sunriseset->message, "protocol", json_mkstring(sunriseset->id));
-
-				if(pilight.broadcast != NULL) {
-					pilight.broadcast(sunriseset->id, sunriseset->message, PROTOCOL);
-				}
-				json_delete(sunriseset->message);
-				sunriseset->message = NULL;
-				firstrun = 0;
-			}
-		}
-	}
-
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
-
-	struct protocol_threads_t *node = protocol_thread_init(sunriseset, json);
-	return threads_register("sunriseset", &thread, (void *)node, 0);
+	/* All locations share one ephemeris thread */
+	ephemeris_add(longitude, latitude, callback, NULL);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(sunriseset);
-	while(threads > 0) {
-		usleep(10);
-	}
-	protocol_thread_free(sunriseset);
+	ephemeris_gc();
 }
 
 static int checkValues(JsonNode *code) {
@@ -312,7 +151,7 @@ void sunRiseSetInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "sunriseset";
-	module->version = "2.6";
+	module->version = "2.7";
 	module->reqversion = "6.0";
 	module->reqcommit = "115";
 }
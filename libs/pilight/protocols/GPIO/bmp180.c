@@ -42,346 +42,287 @@
 #include "../../core/binary.h"
 #include "../../core/gc.h"
 #include "../../core/json.h"
+#include "../../core/i2c.h"
 #include "../protocol.h"
 #include "bmp180.h"
 
 #if !defined(__FreeBSD__) && !defined(_WIN32)
 #include "../../../wiringx/wiringX.h"
 
+// steps of a single poll
+#define BMP180_START		0
+#define BMP180_CALIBRATE	1
+#define BMP180_TEMPERATURE	2
+#define BMP180_UT		3
+#define BMP180_PRESSURE	4
+#define BMP180_UP		5
+
 typedef struct settings_t {
-	char **id;
-	int nrid;
-	int *fd;
+	char *id;
+	int phase;
+	int calibrated;
+	unsigned char oversampling;
+	double temp_offset;
+	double pressure_offset;
+	int b5;
 	// calibration values (stored in each BMP180/085)
-	short *ac1;
-	short *ac2;
-	short *ac3;
-	unsigned short *ac4;
-	unsigned short *ac5;
-	unsigned short *ac6;
-	short *b1;
-	short *b2;
-	short *mb;
-	short *mc;
-	short *md;
+	short ac1;
+	short ac2;
+	short ac3;
+	unsigned short ac4;
+	unsigned short ac5;
+	unsigned short ac6;
+	short b1;
+	short b2;
+	short mb;
+	short mc;
+	short md;
+	struct settings_t *next;
 } settings_t;
 
-static unsigned short loop = 1;
-static int threads = 0;
+static struct settings_t *settings = NULL;
 
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
 // helper function with built-in result conversion
-static int readReg16(int fd, int reg) {
-	int res = wiringXI2CReadReg16(fd, reg);
-	// convert result to 16 bits and swap bytes
-	return ((res << 8) & 0xFF00) | ((res >> 8) & 0xFF);
+static int readReg16(unsigned char *data) {
+	// registers are stored msb first
+	return ((data[0] << 8) & 0xFF00) | (data[1] & 0xFF);
 }
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *) param;
-	struct JsonNode *json = (struct JsonNode *) node->param;
+static void calibrate(struct settings_t *bmp180data, unsigned char *data) {
+	// read 0xD0 to check chip id: must equal 0x55 for BMP085/180
+	if (data[0] != 0x55) {
+		logprintf(LOG_ERR, "wrong device detected");
+		exit(EXIT_FAILURE);
+	}
+
+	// read 0xD1 to check chip version: must equal 0x01 for BMP085 or 0x02 for BMP180
+	if (data[1] != 0x01 && data[1] != 0x02) {
+		logprintf(LOG_ERR, "wrong device detected");
+		exit(EXIT_FAILURE);
+	}
+
+	// calibration coefficients from register addresses 0xAA to 0xBF
+	data = &data[2];
+	bmp180data->ac1 = (short) readReg16(&data[0]);
+	bmp180data->ac2 = (short) readReg16(&data[2]);
+	bmp180data->ac3 = (short) readReg16(&data[4]);
+	bmp180data->ac4 = (unsigned short) readReg16(&data[6]);
+	bmp180data->ac5 = (unsigned short) readReg16(&data[8]);
+	bmp180data->ac6 = (unsigned short) readReg16(&data[10]);
+	bmp180data->b1 = (short) readReg16(&data[12]);
+	bmp180data->b2 = (short) readReg16(&data[14]);
+	bmp180data->mb = (short) readReg16(&data[16]);
+	bmp180data->mc = (short) readReg16(&data[18]);
+	bmp180data->md = (short) readReg16(&data[20]);
+
+	// check communication: no result must equal 0 or 0xFFFF (=65535)
+	if (bmp180data->ac1 == 0 || bmp180data->ac1 == 0xFFFF ||
+			bmp180data->ac2 == 0 || bmp180data->ac2 == 0xFFFF ||
+			bmp180data->ac3 == 0 || bmp180data->ac3 == 0xFFFF ||
+			bmp180data->ac4 == 0 || bmp180data->ac4 == 0xFFFF ||
+			bmp180data->ac5 == 0 || bmp180data->ac5 == 0xFFFF ||
+			bmp180data->ac6 == 0 || bmp180data->ac6 == 0xFFFF ||
+			bmp180data->b1 == 0 || bmp180data->b1 == 0xFFFF ||
+			bmp180data->b2 == 0 || bmp180data->b2 == 0xFFFF ||
+			bmp180data->mb == 0 || bmp180data->mb == 0xFFFF ||
+			bmp180data->mc == 0 || bmp180data->mc == 0xFFFF ||
+			bmp180data->md == 0 || bmp180data->md == 0xFFFF) {
+		logprintf(LOG_ERR, "data communication error");
+		exit(EXIT_FAILURE);
+	}
+	bmp180data->calibrated = 1;
+}
+
+static void broadcast(struct settings_t *bmp180data, int temp, int pressure) {
+	pthread_mutex_lock(&lock);
+	bmp180->message = json_mkobject();
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "id", json_mkstring(bmp180data->id));
+	json_append_member(code, "temperature", json_mknumber(((double) temp / 10) + bmp180data->temp_offset, 1)); // in deg C
+	json_append_member(code, "pressure", json_mknumber(((double) pressure / 100) + bmp180data->pressure_offset, 1)); // in hPa
+
+	json_append_member(bmp180->message, "message", code);
+	json_append_member(bmp180->message, "origin", json_mkstring("receiver"));
+	json_append_member(bmp180->message, "protocol", json_mkstring(bmp180->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(bmp180->id, bmp180->message, PROTOCOL);
+	}
+	json_delete(bmp180->message);
+	bmp180->message = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+// each step queues the next bus transaction, the bus scheduler
+// polls other sensors while this one is converting
+static int step(struct i2c_job_t *job) {
+	struct settings_t *bmp180data = (struct settings_t *) job->userdata;
+	unsigned char oversampling = bmp180data->oversampling;
+
+	if (job->step == 0) {
+		bmp180data->phase = BMP180_START;
+	} else if (job->error == 1) {
+		logprintf(LOG_DEBUG, "error connecting to bmp180");
+		logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
+		logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
+		return -1;
+	}
+
+	switch (bmp180data->phase) {
+		case BMP180_START:
+			if (bmp180data->calibrated == 0) {
+				// chip id, chip version and calibration coefficients
+				i2c_read(job, 0xD0, 2);
+				i2c_read(job, 0xAA, 22);
+				bmp180data->phase = BMP180_CALIBRATE;
+				return 0;
+			}
+			// fallthrough
+		case BMP180_CALIBRATE:
+			if (bmp180data->calibrated == 0) {
+				calibrate(bmp180data, job->result);
+			}
+			// write 0x2E into Register 0xF4 to request a temperature reading.
+			i2c_write(job, 0xF4, 0x2E);
+			bmp180data->phase = BMP180_TEMPERATURE;
+			return 0;
+		case BMP180_TEMPERATURE:
+			// read the two byte result from address 0xF6 after at least 4.5ms
+			i2c_read(job, 0xF6, 2);
+			bmp180data->phase = BMP180_UT;
+			return 5000;
+		case BMP180_UT: {
+			// uncompensated temperature value
+			unsigned short ut = (unsigned short) readReg16(job->result);
+
+			// calculate temperature (in units of 0.1 deg C) given uncompensated value
+			int x1, x2;
+			x1 = (((int) ut - (int) bmp180data->ac6)) * (int) bmp180data->ac5 >> 15;
+			x2 = ((int) bmp180data->mc << 11) / (x1 + bmp180data->md);
+			bmp180data->b5 = x1 + x2;
+
+			// write 0x34+(BMP085_OVERSAMPLING_SETTING<<6) into register 0xF4
+			// request a pressure reading with specified oversampling setting
+			i2c_write(job, 0xF4, 0x34 + (oversampling << 6));
+			bmp180data->phase = BMP180_PRESSURE;
+			return 0;
+		}
+		case BMP180_PRESSURE:
+			// read the three byte result (block data): 0xF6 = MSB, 0xF7 = LSB and 0xF8 = XLSB
+			// after the conversion, delay time dependent on oversampling setting
+			i2c_read(job, 0xF6, 3);
+			bmp180data->phase = BMP180_UP;
+			return (2 + (3 << oversampling)) * 1000;
+		case BMP180_UP: {
+			int b5 = bmp180data->b5;
+			int temp = ((b5 + 8) >> 4);
+
+			// uncompensated pressure value
+			unsigned int up = (((unsigned int) job->result[0] << 16) | ((unsigned int) job->result[1] << 8) | (unsigned int) job->result[2])
+					>> (8 - oversampling);
+
+			// calculate pressure (in Pa) given uncompensated value
+			int x1, x2, x3, b3, b6, pressure;
+			unsigned int b4, b7;
+
+			// calculate B6
+			b6 = b5 - 4000;
+
+			// calculate B3
+			x1 = (bmp180data->b2 * (b6 * b6) >> 12) >> 11;
+			x2 = (bmp180data->ac2 * b6) >> 11;
+			x3 = x1 + x2;
+			b3 = (((bmp180data->ac1 * 4 + x3) << oversampling) + 2) >> 2;
+
+			// calculate B4
+			x1 = (bmp180data->ac3 * b6) >> 13;
+			x2 = (bmp180data->b1 * ((b6 * b6) >> 12)) >> 16;
+			x3 = ((x1 + x2) + 2) >> 2;
+			b4 = (bmp180data->ac4 * (unsigned int) (x3 + 32768)) >> 15;
+
+			// calculate B7
+			b7 = ((up - (unsigned int) b3) * ((unsigned int) 50000 >> oversampling));
+
+			// calculate pressure in Pa
+			pressure = b7 < 0x80000000 ? (int) ((b7 << 1) / b4) : (int) ((b7 / b4) << 1);
+			x1 = (pressure >> 8) * (pressure >> 8);
+			x1 = (x1 * 3038) >> 16;
+			x2 = (-7357 * pressure) >> 16;
+			pressure += (x1 + x2 + 3791) >> 4;
+
+			broadcast(bmp180data, temp, pressure);
+			return -1;
+		}
+	}
+	return -1;
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	struct settings_t *bmp180data = MALLOC(sizeof(struct settings_t));
-	int y = 0, interval = 10, nrloops = 0;
+	struct settings_t *bmp180data = NULL;
+	int interval = 10;
 	char *stmp = NULL;
 	double itmp = -1, temp_offset = 0, pressure_offset = 0;
 	unsigned char oversampling = 1;
 
-	if (!bmp180data) {
-		logprintf(LOG_ERR, "out of memory");
-		exit(EXIT_FAILURE);
+	wiringXSetup();
+
+	if (json_find_number(jdevice, "poll-interval", &itmp) == 0)
+		interval = (int) round(itmp);
+	json_find_number(jdevice, "temperature-offset", &temp_offset);
+	json_find_number(jdevice, "pressure-offset", &pressure_offset);
+	if (json_find_number(jdevice, "oversampling", &itmp) == 0) {
+		oversampling = (unsigned char) itmp;
 	}
 
-	bmp180data->nrid = 0;
-	bmp180data->id = NULL;
-	bmp180data->fd = 0;
-	bmp180data->ac1 = 0;
-	bmp180data->ac2 = 0;
-	bmp180data->ac3 = 0;
-	bmp180data->ac4 = 0;
-	bmp180data->ac5 = 0;
-	bmp180data->ac6 = 0;
-	bmp180data->b1 = 0;
-	bmp180data->b2 = 0;
-	bmp180data->mb = 0;
-	bmp180data->mc = 0;
-	bmp180data->md = 0;
-
-	threads++;
-
-	if ((jid = json_find_member(json, "id"))) {
+	if ((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while (jchild) {
 			if (json_find_string(jchild, "id", &stmp) == 0) {
-				bmp180data->id = REALLOC(bmp180data->id, (sizeof(char *) * (size_t)(bmp180data->nrid + 1)));
-				if (!bmp180data->id) {
+				if ((bmp180data = MALLOC(sizeof(struct settings_t))) == NULL) {
 					logprintf(LOG_ERR, "out of memory");
 					exit(EXIT_FAILURE);
 				}
-				bmp180data->id[bmp180data->nrid] = MALLOC(strlen(stmp) + 1);
-				if (!bmp180data->id[bmp180data->nrid]) {
+				memset(bmp180data, '\0', sizeof(struct settings_t));
+				if ((bmp180data->id = MALLOC(strlen(stmp) + 1)) == NULL) {
 					logprintf(LOG_ERR, "out of memory");
 					exit(EXIT_FAILURE);
 				}
-				strcpy(bmp180data->id[bmp180data->nrid], stmp);
-				bmp180data->nrid++;
-			}
-			jchild = jchild->next;
-		}
-	}
-
-	if (json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int) round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
-	json_find_number(json, "pressure-offset", &pressure_offset);
-	if (json_find_number(json, "oversampling", &itmp) == 0) {
-		oversampling = (unsigned char) itmp;
-	}
-
-	// resize the memory blocks pointed to by the different pointers
-	size_t sz = (size_t) (bmp180data->nrid + 1);
-	unsigned long int sizeShort = sizeof(short) * sz;
-	unsigned long int sizeUShort = sizeof(unsigned short) * sz;
-	bmp180data->fd = REALLOC(bmp180data->fd, (sizeof(int) * sz));
-	bmp180data->ac1 = REALLOC(bmp180data->ac1, sizeShort);
-	bmp180data->ac2 = REALLOC(bmp180data->ac2, sizeShort);
-	bmp180data->ac3 = REALLOC(bmp180data->ac3, sizeShort);
-	bmp180data->ac4 = REALLOC(bmp180data->ac4, sizeUShort);
-	bmp180data->ac5 = REALLOC(bmp180data->ac5, sizeUShort);
-	bmp180data->ac6 = REALLOC(bmp180data->ac6, sizeUShort);
-	bmp180data->b1 = REALLOC(bmp180data->b1, sizeShort);
-	bmp180data->b2 = REALLOC(bmp180data->b2, sizeShort);
-	bmp180data->mb = REALLOC(bmp180data->mb, sizeShort);
-	bmp180data->mc = REALLOC(bmp180data->mc, sizeShort);
-	bmp180data->md = REALLOC(bmp180data->md, sizeShort);
-	if (!bmp180data->ac1 || !bmp180data->ac2 || !bmp180data->ac3 || !bmp180data->ac4 || !bmp180data->ac5
-			|| !bmp180data->ac6 || !bmp180data->b1 || !bmp180data->b2 || !bmp180data->mb || !bmp180data->mc
-			|| !bmp180data->md || !bmp180data->fd) {
-		logprintf(LOG_ERR, "out of memory");
-		exit(EXIT_FAILURE);
-	}
+				strcpy(bmp180data->id, stmp);
+				bmp180data->oversampling = oversampling;
+				bmp180data->temp_offset = temp_offset;
+				bmp180data->pressure_offset = pressure_offset;
 
-	for (y = 0; y < bmp180data->nrid; y++) {
-		// setup i2c
-		bmp180data->fd[y] = wiringXI2CSetup((int) strtol(bmp180data->id[y], NULL, 16));
-		if (bmp180data->fd[y] > 0) {
-			// read 0xD0 to check chip id: must equal 0x55 for BMP085/180
-			int id = wiringXI2CReadReg8(bmp180data->fd[y], 0xD0);
-			if (id != 0x55) {
-				logprintf(LOG_ERR, "wrong device detected");
-				exit(EXIT_FAILURE);
-			}
-
-			// read 0xD1 to check chip version: must equal 0x01 for BMP085 or 0x02 for BMP180
-			int version = wiringXI2CReadReg8(bmp180data->fd[y], 0xD1);
-			if (version != 0x01 && version != 0x02) {
-				logprintf(LOG_ERR, "wrong device detected");
-				exit(EXIT_FAILURE);
-			}
+				pthread_mutex_lock(&lock);
+				bmp180data->next = settings;
+				settings = bmp180data;
+				pthread_mutex_unlock(&lock);
 
-			// read calibration coefficients from register addresses
-			bmp180data->ac1[y] = (short) readReg16(bmp180data->fd[y], 0xAA);
-			bmp180data->ac2[y] = (short) readReg16(bmp180data->fd[y], 0xAC);
-			bmp180data->ac3[y] = (short) readReg16(bmp180data->fd[y], 0xAE);
-			bmp180data->ac4[y] = (unsigned short) readReg16(bmp180data->fd[y], 0xB0);
-			bmp180data->ac5[y] = (unsigned short) readReg16(bmp180data->fd[y], 0xB2);
-			bmp180data->ac6[y] = (unsigned short) readReg16(bmp180data->fd[y], 0xB4);
-			bmp180data->b1[y] = (short) readReg16(bmp180data->fd[y], 0xB6);
-			bmp180data->b2[y] = (short) readReg16(bmp180data->fd[y], 0xB8);
-			bmp180data->mb[y] = (short) readReg16(bmp180data->fd[y], 0xBA);
-			bmp180data->mc[y] = (short) readReg16(bmp180data->fd[y], 0xBC);
-			bmp180data->md[y] = (short) readReg16(bmp180data->fd[y], 0xBE);
-
-			// check communication: no result must equal 0 or 0xFFFF (=65535)
-			if (bmp180data->ac1[y] == 0 || bmp180data->ac1[y] == 0xFFFF ||
-					bmp180data->ac2[y] == 0 || bmp180data->ac2[y] == 0xFFFF ||
-					bmp180data->ac3[y] == 0 || bmp180data->ac3[y] == 0xFFFF ||
-					bmp180data->ac4[y] == 0 || bmp180data->ac4[y] == 0xFFFF ||
-					bmp180data->ac5[y] == 0 || bmp180data->ac5[y] == 0xFFFF ||
-					bmp180data->ac6[y] == 0 || bmp180data->ac6[y] == 0xFFFF ||
-					bmp180data->b1[y] == 0 || bmp180data->b1[y] == 0xFFFF ||
-					bmp180data->b2[y] == 0 || bmp180data->b2[y] == 0xFFFF ||
-					bmp180data->mb[y] == 0 || bmp180data->mb[y] == 0xFFFF ||
-					bmp180data->mc[y] == 0 || bmp180data->mc[y] == 0xFFFF ||
-					bmp180data->md[y] == 0 || bmp180data->md[y] == 0xFFFF) {
-				logprintf(LOG_ERR, "data communication error");
-				exit(EXIT_FAILURE);
-			}
-		}
-	}
-
-	while (loop) {
-		if (protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for (y = 0; y < bmp180data->nrid; y++) {
-				if (bmp180data->fd[y] > 0) {
-					// uncompensated temperature value
-					unsigned short ut = 0;
-
-					// write 0x2E into Register 0xF4 to request a temperature reading.
-					wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4, 0x2E);
-
-					// wait at least 4.5ms: we suspend execution for 5000 microseconds.
-					usleep(5000);
-
-					// read the two byte result from address 0xF6.
-					ut = (unsigned short) readReg16(bmp180data->fd[y], 0xF6);
-
-					// calculate temperature (in units of 0.1 deg C) given uncompensated value
-					int x1, x2;
-					x1 = (((int) ut - (int) bmp180data->ac6[y])) * (int) bmp180data->ac5[y] >> 15;
-					x2 = ((int) bmp180data->mc[y] << 11) / (x1 + bmp180data->md[y]);
-					int b5 = x1 + x2;
-					int temp = ((b5 + 8) >> 4);
-
-					// uncompensated pressure value
-					unsigned int up = 0;
-
-					// write 0x34+(BMP085_OVERSAMPLING_SETTING<<6) into register 0xF4
-					// request a pressure reading with specified oversampling setting
-					wiringXI2CWriteReg8(bmp180data->fd[y], 0xF4,
-							0x34 + (oversampling << 6));
-
-					// wait for conversion, delay time dependent on oversampling setting
-					unsigned int delay = (unsigned int) ((2 + (3 << oversampling)) * 1000);
-					usleep(delay);
-
-					// read the three byte result (block data): 0xF6 = MSB, 0xF7 = LSB and 0xF8 = XLSB
-					int msb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF6);
-					int lsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF7);
-					int xlsb = wiringXI2CReadReg8(bmp180data->fd[y], 0xF8);
-					up = (((unsigned int) msb << 16) | ((unsigned int) lsb << 8) | (unsigned int) xlsb)
-							>> (8 - oversampling);
-
-					// calculate pressure (in Pa) given uncompensated value
-					int x3, b3, b6, pressure;
-					unsigned int b4, b7;
-
-					// calculate B6
-					b6 = b5 - 4000;
-
-					// calculate B3
-					x1 = (bmp180data->b2[y] * (b6 * b6) >> 12) >> 11;
-					x2 = (bmp180data->ac2[y] * b6) >> 11;
-					x3 = x1 + x2;
-					b3 = (((bmp180data->ac1[y] * 4 + x3) << oversampling) + 2) >> 2;
-
-					// calculate B4
-					x1 = (bmp180data->ac3[y] * b6) >> 13;
-					x2 = (bmp180data->b1[y] * ((b6 * b6) >> 12)) >> 16;
-					x3 = ((x1 + x2) + 2) >> 2;
-					b4 = (bmp180data->ac4[y] * (unsigned int) (x3 + 32768)) >> 15;
-
-					// calculate B7
-					b7 = ((up - (unsigned int) b3) * ((unsigned int) 50000 >> oversampling));
-
-					// calculate pressure in Pa
-					pressure = b7 < 0x80000000 ? (int) ((b7 << 1) / b4) : (int) ((b7 / b4) << 1);
-					x1 = (pressure >> 8) * (pressure >> 8);
-					x1 = (x1 * 3038) >> 16;
-					x2 = (-7357 * pressure) >> 16;
-					pressure += (x1 + x2 + 3791) >> 4;
-
-					bmp180->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "id", json_mkstring(bmp180data->id[y]));
-					json_append_member(code, "temperature", json_mknumber(((double) temp / 10) + temp_offset, 1)); // in deg C
-					json_append_member(code, "pressure", json_mknumber(((double) pressure / 100) + pressure_offset, 1)); // in hPa
-
-					json_append_member(bmp180->message, "message", code);
-					json_append_member(bmp180->message, "origin", json_mkstring("receiver"));
-					json_append_member(bmp180->message, "protocol", json_mkstring(bmp180->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(bmp180->id, bmp180->message, PROTOCOL);
-					}
-					json_delete(bmp180->message);
-					bmp180->message = NULL;
-				} else {
-					logprintf(LOG_DEBUG, "error connecting to bmp180");
-					logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
-					logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
-					protocol_thread_wait(node, 1, &nrloops);
-				}
-			}
-			pthread_mutex_unlock(&lock);
-		}
-	}
-
-	if (bmp180data->id) {
-		for (y = 0; y < bmp180data->nrid; y++) {
-			FREE(bmp180data->id[y]);
-		}
-		FREE(bmp180data->id);
-	}
-	if (bmp180data->ac1) {
-		FREE(bmp180data->ac1);
-	}
-	if (bmp180data->ac2) {
-		FREE(bmp180data->ac2);
-	}
-	if (bmp180data->ac3) {
-		FREE(bmp180data->ac3);
-	}
-	if (bmp180data->ac4) {
-		FREE(bmp180data->ac4);
-	}
-	if (bmp180data->ac5) {
-		FREE(bmp180data->ac5);
-	}
-	if (bmp180data->ac6) {
-		FREE(bmp180data->ac6);
-	}
-	if (bmp180data->b1) {
-		FREE(bmp180data->b1);
-	}
-	if (bmp180data->b2) {
-		FREE(bmp180data->b2);
-	}
-	if (bmp180data->mb) {
-		FREE(bmp180data->mb);
-	}
-	if (bmp180data->mc) {
-		FREE(bmp180data->mc);
-	}
-	if (bmp180data->md) {
-		FREE(bmp180data->md);
-	}
-	if (bmp180data->fd) {
-		for (y = 0; y < bmp180data->nrid; y++) {
-			if (bmp180data->fd[y] > 0) {
-				close(bmp180data->fd[y]);
+				i2c_add((int) strtol(bmp180data->id, NULL, 16), interval, step, (void *) bmp180data);
 			}
+			jchild = jchild->next;
 		}
-		FREE(bmp180data->fd);
 	}
-	FREE(bmp180data);
-	threads--;
-
-	return (void *) NULL;
+	return NULL;
 }
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	wiringXSetup();
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+static void threadGC(void) {
+	struct settings_t *tmp = NULL;
 
-	struct protocol_threads_t *node = protocol_thread_init(bmp180, json);
-	return threads_register("bmp180", &thread, (void *) node, 0);
-}
+	i2c_gc();
 
-static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(bmp180);
-	while (threads > 0) {
-		usleep(10);
+	pthread_mutex_lock(&lock);
+	while (settings) {
+		tmp = settings;
+		settings = settings->next;
+		FREE(tmp->id);
+		FREE(tmp);
 	}
-	protocol_thread_free(bmp180);
+	pthread_mutex_unlock(&lock);
 }
 #endif
 
@@ -425,7 +366,7 @@ void bmp180Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "bmp180";
-	module->version = "2.0";
+	module->version = "2.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -43,192 +43,102 @@
 #include "../../core/binary.h"
 #include "../../core/json.h"
 #include "../../core/gc.h"
+#include "../../core/w1.h"
 #include "ds18s20.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
-static char source_path[21];
-
+#ifndef _WIN32
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
-	struct JsonNode *jid = NULL;
-	struct JsonNode *jchild = NULL;
-
-#ifndef _WIN32
-	struct dirent *file = NULL;
-	struct stat st;
-
-	DIR *d = NULL;
-	FILE *fp = NULL;
-	char crcVar[5];
-	int w1valid = 0;
-	double w1temp = 0.0;
-	size_t bytes = 0;
-#endif
-	char **id = NULL, *stmp = NULL, *content = NULL;
-	char *ds18s20_sensor = NULL;
-	int nrid = 0, interval = 10, nrloops = 0, y = 0;
-	double temp_offset = 0.0, itmp = 0.0;
-
-	threads++;
-
-	if((jid = json_find_member(json, "id"))) {
-		jchild = json_first_child(jid);
-		while(jchild) {
-			if(json_find_string(jchild, "id", &stmp) == 0) {
-				id = REALLOC(id, (sizeof(char *)*(size_t)(nrid+1)));
-				if(!id) {
-					logprintf(LOG_ERR, "out of memory");
-					exit(EXIT_FAILURE);
-				}
-				id[nrid] = MALLOC(strlen(stmp)+1);
-				if(!id[nrid]) {
-					logprintf(LOG_ERR, "out of memory");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(id[nrid], stmp);
-				nrid++;
-			}
-			jchild = jchild->next;
-		}
-	}
-
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
+typedef struct settings_t {
+	double temp_offset;
+	struct settings_t *next;
+} settings_t;
 
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-#ifndef _WIN32
-			pthread_mutex_lock(&lock);
-			for(y=0;y<nrid;y++) {
-				ds18s20_sensor = REALLOC(ds18s20_sensor, strlen(source_path)+strlen(id[y])+5);
-				if(!ds18s20_sensor) {
-					logprintf(LOG_ERR, "out of memory");
-					exit(EXIT_FAILURE);
-				}
-				sprintf(ds18s20_sensor, "%s10-%s/", source_path, id[y]);
-				if((d = opendir(ds18s20_sensor))) {
-					while((file = readdir(d)) != NULL) {
-						if(file->d_type == DT_REG) {
-							if(strcmp(file->d_name, "w1_slave") == 0) {
-								size_t w1slavelen = strlen(ds18s20_sensor)+10;
-								char ds18s20_w1slave[w1slavelen];
-								memset(ds18s20_w1slave, '\0', w1slavelen);
-								strncpy(ds18s20_w1slave, ds18s20_sensor, strlen(ds18s20_sensor));
-								strcat(ds18s20_w1slave, "w1_slave");
+static struct settings_t *settings = NULL;
 
-								if(!(fp = fopen(ds18s20_w1slave, "rb"))) {
-									logprintf(LOG_ERR, "cannot read w1 file: %s", ds18s20_w1slave);
-									break;
-								}
+static void callback(char *id, double temperature, void *userdata) {
+	struct settings_t *lnode = (struct settings_t *)userdata;
 
-								fstat(fileno(fp), &st);
-								bytes = (size_t)st.st_size;
+	pthread_mutex_lock(&lock);
+	ds18s20->message = json_mkobject();
 
-								if(!(content = REALLOC(content, bytes+1))) {
-									logprintf(LOG_ERR, "out of memory");
-									fclose(fp);
-									break;
-								}
-								memset(content, '\0', bytes+1);
+	JsonNode *code = json_mkobject();
 
-								if(fread(content, sizeof(char), bytes, fp) == -1) {
-									logprintf(LOG_ERR, "cannot read config file: %s", ds18s20_w1slave);
-									fclose(fp);
-									break;
-								}
-								fclose(fp);
-								w1valid = 0;
+	json_append_member(code, "id", json_mkstring(id));
+	json_append_member(code, "temperature", json_mknumber(temperature+lnode->temp_offset, 1));
 
-								char **array = NULL;
-								unsigned int n = explode(content, "\n", &array);
-								if(n > 0) {
-									sscanf(array[0], "%*x %*x %*x %*x %*x %*x %*x %*x %*x : crc=%*x %s", crcVar);
-									if(strncmp(crcVar, "YES", 3) == 0 && n > 1) {
-										w1valid = 1;
-										sscanf(array[1], "%*x %*x %*x %*x %*x %*x %*x %*x %*x t=%lf", &w1temp);
-										w1temp = (w1temp/1000)+temp_offset;
-									}
-								}
-								array_free(&array, n);
+	json_append_member(ds18s20->message, "message", code);
+	json_append_member(ds18s20->message, "origin", json_mkstring("receiver"));
+	json_append_member(ds18s20->message, "protocol", json_mkstring(ds18s20->id));
 
-								if(w1valid) {
-									ds18s20->message = json_mkobject();
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(ds18s20->id, ds18s20->message, PROTOCOL);
+	}
+	json_delete(ds18s20->message);
+	ds18s20->message = NULL;
+	pthread_mutex_unlock(&lock);
+}
 
-									JsonNode *code = json_mkobject();
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	struct JsonNode *jid = NULL;
+	struct JsonNode *jchild = NULL;
+	struct settings_t *lnode = NULL;
+	char *stmp = NULL;
+	int interval = 10;
+	double itmp = 0.0;
+
+	if((lnode = MALLOC(sizeof(struct settings_t))) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	lnode->temp_offset = 0.0;
 
-									json_append_member(code, "id", json_mkstring(id[y]));
-									json_append_member(code, "temperature", json_mknumber(w1temp, 1));
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
+	json_find_number(jdevice, "temperature-offset", &lnode->temp_offset);
 
-									json_append_member(ds18s20->message, "message", code);
-									json_append_member(ds18s20->message, "origin", json_mkstring("receiver"));
-									json_append_member(ds18s20->message, "protocol", json_mkstring(ds18s20->id));
+	pthread_mutex_lock(&lock);
+	lnode->next = settings;
+	settings = lnode;
+	pthread_mutex_unlock(&lock);
 
-									if(pilight.broadcast != NULL) {
-										pilight.broadcast(ds18s20->id, ds18s20->message, PROTOCOL);
-									}
-									json_delete(ds18s20->message);
-									ds18s20->message = NULL;
-								}
-							}
-						}
-					}
-					closedir(d);
-				} else {
-					logprintf(LOG_ERR, "1-wire device %s does not exists", ds18s20_sensor);
-				}
+	if((jid = json_find_member(jdevice, "id"))) {
+		jchild = json_first_child(jid);
+		while(jchild) {
+			if(json_find_string(jchild, "id", &stmp) == 0) {
+				w1_add("10", stmp, interval, callback, (void *)lnode);
 			}
-#endif
-			pthread_mutex_unlock(&lock);
+			jchild = jchild->next;
 		}
 	}
-	pthread_mutex_unlock(&lock);
-
-	if(ds18s20_sensor) {
-		FREE(ds18s20_sensor);
-	}
-	if(content) {
-		FREE(content);
-	}
-	for(y=0;y<nrid;y++) {
-		FREE(id[y]);
-	}
-	FREE(id);
-	threads--;
-	return (void *)NULL;
+	return NULL;
 }
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+static void threadGC(void) {
+	struct settings_t *tmp = NULL;
 
-	struct protocol_threads_t *node = protocol_thread_init(ds18s20, json);
-	return threads_register("ds18s20", &thread, (void *)node, 0);
-}
+	w1_gc();
 
-static void theadGC(void) {
-	loop = 0;
-	protocol_thread_stop(ds18s20);
-	while(threads > 0) {
-		usleep(10);
+	pthread_mutex_lock(&lock);
+	while(settings) {
+		tmp = settings;
+		settings = settings->next;
+		FREE(tmp);
 	}
-	protocol_thread_free(ds18s20);
+	pthread_mutex_unlock(&lock);
 }
+#endif
 
 #if !defined(MODULE) && !defined(_WIN32)
 __attribute__((weak))
 #endif
 void ds18s20Init(void) {
+#ifndef _WIN32
 	pthread_mutexattr_init(&attr);
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&lock, &attr);
+#endif
 
 	protocol_register(&ds18s20);
 	protocol_set_id(ds18s20, "ds18s20");
@@ -245,17 +155,16 @@ void ds18s20Init(void) {
 	options_add(&ds18s20->options, 0, "show-temperature", OPTION_HAS_VALUE, GUI_SETTING, JSON_NUMBER, (void *)1, "^[10]{1}$");
 	options_add(&ds18s20->options, 0, "poll-interval", OPTION_HAS_VALUE, DEVICES_SETTING, JSON_NUMBER, (void *)10, "[0-9]");
 
-	memset(source_path, '\0', 21);
-	strcpy(source_path, "/sys/bus/w1/devices/");
-
+#ifndef _WIN32
 	ds18s20->initDev=&initDev;
-	ds18s20->threadGC=&theadGC;
+	ds18s20->threadGC=&threadGC;
+#endif
 }
 
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "ds18s20";
-	module->version = "2.0";
+	module->version = "2.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -42,6 +42,7 @@
 #include "../../core/binary.h"
 #include "../../core/gc.h"
 #include "../../core/json.h"
+#include "../../core/i2c.h"
 #ifndef _WIN32
 	#include "../../../wiringx/wiringX.h"
 #endif
@@ -50,144 +51,110 @@
 
 #if !defined(__FreeBSD__) && !defined(_WIN32)
 typedef struct settings_t {
-	char **id;
-	int nrid;
-	int *fd;
+	char *id;
+	double temp_offset;
+	struct settings_t *next;
 } settings_t;
 
-static unsigned short loop = 1;
-static int threads = 0;
-
 static pthread_mutex_t lock;
 static pthread_mutexattr_t attr;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+static struct settings_t *settings = NULL;
+
+static int step(struct i2c_job_t *job) {
+	struct settings_t *lnode = (struct settings_t *)job->userdata;
+
+	if(job->step == 0) {
+		i2c_read(job, 0x00, 2);
+		return 0;
+	}
+
+	if(job->error == 1) {
+		logprintf(LOG_DEBUG, "error connecting to lm75");
+		logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
+		logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
+		return -1;
+	}
+
+	/* Same byte order as wiringXI2CReadReg16 */
+	int raw = job->result[0] | (job->result[1] << 8);
+	float temp = ((float)((raw&0x00ff)+((raw>>15)?0:0.5))*10);
+
+	pthread_mutex_lock(&lock);
+	lm75->message = json_mkobject();
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "id", json_mkstring(lnode->id));
+	json_append_member(code, "temperature", json_mknumber((temp+lnode->temp_offset)/10, 1));
+
+	json_append_member(lm75->message, "message", code);
+	json_append_member(lm75->message, "origin", json_mkstring("receiver"));
+	json_append_member(lm75->message, "protocol", json_mkstring(lm75->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(lm75->id, lm75->message, PROTOCOL);
+	}
+	json_delete(lm75->message);
+	lm75->message = NULL;
+	pthread_mutex_unlock(&lock);
+
+	return -1;
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	struct settings_t *lm75data = MALLOC(sizeof(struct settings_t));
-	int y = 0, interval = 10, nrloops = 0;
+	struct settings_t *lnode = NULL;
 	char *stmp = NULL;
+	int interval = 10;
 	double itmp = -1, temp_offset = 0.0;
 
-	if(!lm75data) {
-		logprintf(LOG_ERR, "out of memory");
-		exit(EXIT_FAILURE);
-	}
-
-	lm75data->nrid = 0;
-	lm75data->id = NULL;
-	lm75data->fd = 0;
+	wiringXSetup();
 
-	threads++;
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
+	json_find_number(jdevice, "temperature-offset", &temp_offset);
 
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			if(json_find_string(jchild, "id", &stmp) == 0) {
-				lm75data->id = REALLOC(lm75data->id, (sizeof(char *)*(size_t)(lm75data->nrid+1)));
-				if(!lm75data->id) {
+				if((lnode = MALLOC(sizeof(struct settings_t))) == NULL) {
 					logprintf(LOG_ERR, "out of memory");
 					exit(EXIT_FAILURE);
 				}
-				lm75data->id[lm75data->nrid] = MALLOC(strlen(stmp)+1);
-				if(!lm75data->id[lm75data->nrid]) {
+				if((lnode->id = MALLOC(strlen(stmp)+1)) == NULL) {
 					logprintf(LOG_ERR, "out of memory");
 					exit(EXIT_FAILURE);
 				}
-				strcpy(lm75data->id[lm75data->nrid], stmp);
-				lm75data->nrid++;
-			}
-			jchild = jchild->next;
-		}
-	}
-
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
-	json_find_number(json, "temperature-offset", &temp_offset);
+				strcpy(lnode->id, stmp);
+				lnode->temp_offset = temp_offset;
 
-	lm75data->fd = REALLOC(lm75data->fd, (sizeof(int)*(size_t)(lm75data->nrid+1)));
-	if(!lm75data->fd) {
-		logprintf(LOG_ERR, "out of memory");
-		exit(EXIT_FAILURE);
-	}
-	for(y=0;y<lm75data->nrid;y++) {
-		lm75data->fd[y] = wiringXI2CSetup((int)strtol(lm75data->id[y], NULL, 16));
-	}
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			for(y=0;y<lm75data->nrid;y++) {
-				if(lm75data->fd[y] > 0) {
-					int raw = wiringXI2CReadReg16(lm75data->fd[y], 0x00);
-					float temp = ((float)((raw&0x00ff)+((raw>>15)?0:0.5))*10);
-
-					lm75->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "id", json_mkstring(lm75data->id[y]));
-					json_append_member(code, "temperature", json_mknumber((temp+temp_offset)/10, 1));
-
-					json_append_member(lm75->message, "message", code);
-					json_append_member(lm75->message, "origin", json_mkstring("receiver"));
-					json_append_member(lm75->message, "protocol", json_mkstring(lm75->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(lm75->id, lm75->message, PROTOCOL);
-					}
-					json_delete(lm75->message);
-					lm75->message = NULL;
-				} else {
-					logprintf(LOG_DEBUG, "error connecting to lm75");
-					logprintf(LOG_DEBUG, "(probably i2c bus error from wiringXI2CSetup)");
-					logprintf(LOG_DEBUG, "(maybe wrong id? use i2cdetect to find out)");
-					protocol_thread_wait(node, 1, &nrloops);
-				}
-			}
-			pthread_mutex_unlock(&lock);
-		}
-	}
-	pthread_mutex_unlock(&lock);
+				pthread_mutex_lock(&lock);
+				lnode->next = settings;
+				settings = lnode;
+				pthread_mutex_unlock(&lock);
 
-	if(lm75data->id) {
-		for(y=0;y<lm75data->nrid;y++) {
-			FREE(lm75data->id[y]);
-		}
-		FREE(lm75data->id);
-	}
-	if(lm75data->fd) {
-		for(y=0;y<lm75data->nrid;y++) {
-			if(lm75data->fd[y] > 0) {
-				close(lm75data->fd[y]);
+				i2c_add((int)strtol(lnode->id, NULL, 16), interval, step, (void *)lnode);
 			}
+			jchild = jchild->next;
 		}
-		FREE(lm75data->fd);
 	}
-	FREE(lm75data);
-	threads--;
-
-	return (void *)NULL;
+	return NULL;
 }
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	wiringXSetup();
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+static void threadGC(void) {
+	struct settings_t *tmp = NULL;
 
-	struct protocol_threads_t *node = protocol_thread_init(lm75, json);
-	return threads_register("lm75", &thread, (void *)node, 0);
-}
+	i2c_gc();
 
-static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(lm75);
-	while(threads > 0) {
-		usleep(10);
+	pthread_mutex_lock(&lock);
+	while(settings) {
+		tmp = settings;
+		settings = settings->next;
+		FREE(tmp->id);
+		FREE(tmp);
 	}
-	protocol_thread_free(lm75);
+	pthread_mutex_unlock(&lock);
 }
 #endif
 
@@ -223,7 +190,7 @@ void lm75Init(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "lm75";
-	module->version = "2.0";
+	module->version = "2.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -0,0 +1,10 @@
+	bmp180Init();
+	dht11Init();
+	dht22Init();
+	ds18b20Init();
+	ds18s20Init();
+	gpioSwitchInit();
+	lm75Init();
+	lm76Init();
+	relayInit();
+
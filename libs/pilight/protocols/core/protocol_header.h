@@ -0,0 +1,4 @@
+	#include "pilight_firmware_v2.h"
+	#include "pilight_firmware_v3.h"
+	#include "raw.h"
+
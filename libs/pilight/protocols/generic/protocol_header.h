@@ -0,0 +1,7 @@
+	#include "generic_dimmer.h"
+	#include "generic_label.h"
+	#include "generic_screen.h"
+	#include "generic_switch.h"
+	#include "generic_weather.h"
+	#include "generic_webcam.h"
+
@@ -44,28 +44,42 @@
 #include "../../core/gc.h"
 #include "ping.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
+static void callback(char *ip, int state) {
+	double rtt = 0.0, loss = 0.0;
 
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
+	if(ping_stats(ip, &rtt, &loss) == 0) {
+		logprintf(LOG_DEBUG, "ping %s %s, rtt %.1fms, loss %.0f%%", ip, (state == PING_CONNECTED) ? "connected" : "disconnected", rtt, loss);
+	}
+
+	pping->message = json_mkobject();
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "ip", json_mkstring(ip));
+	if(state == PING_CONNECTED) {
+		json_append_member(code, "state", json_mkstring("connected"));
+	} else {
+		json_append_member(code, "state", json_mkstring("disconnected"));
+	}
 
-#define CONNECTED				1
-#define DISCONNECTED 		0
+	json_append_member(pping->message, "message", code);
+	json_append_member(pping->message, "origin", json_mkstring("receiver"));
+	json_append_member(pping->message, "protocol", json_mkstring(pping->id));
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(pping->id, pping->message, PROTOCOL);
+	}
+	json_delete(pping->message);
+	pping->message = NULL;
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 	char *ip = NULL;
 	char *pstate = NULL;
 	double itmp = 0.0;
-	int state = 0, nrloops = 0, interval = 1;
+	int state = PING_DISCONNECTED, interval = 1;
 
-	threads++;
-
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			if(json_find_string(jchild, "ip", &ip) == 0) {
@@ -75,89 +89,28 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
 		interval = (int)round(itmp);
 
-   if(json_find_string(json, "state", &pstate) == 0) {
-      if(strcmp(pstate,"connected") == 0) state = CONNECTED;
-      if(strcmp(pstate,"disconnected") == 0) state = DISCONNECTED;
-      }
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(ping(ip) == 0) {
-				if(state == DISCONNECTED) {
-					state = CONNECTED;
-					pping->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "ip", json_mkstring(ip));
-					json_append_member(code, "state", json_mkstring("connected"));
-
-					json_append_member(pping->message, "message", code);
-					json_append_member(pping->message, "origin", json_mkstring("receiver"));
-					json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(pping->id, pping->message, PROTOCOL);
-					}
-					json_delete(pping->message);
-					pping->message = NULL;
-				}
-			} else if(state == CONNECTED) {
-				state = DISCONNECTED;
-
-				pping->message = json_mkobject();
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "ip", json_mkstring(ip));
-				json_append_member(code, "state", json_mkstring("disconnected"));
-
-				json_append_member(pping->message, "message", code);
-				json_append_member(pping->message, "origin", json_mkstring("receiver"));
-				json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-				if(pilight.broadcast != NULL) {
-					pilight.broadcast(pping->id, pping->message, PROTOCOL);
-				}
-				json_delete(pping->message);
-				pping->message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
-		}
+	if(json_find_string(jdevice, "state", &pstate) == 0) {
+		if(strcmp(pstate, "connected") == 0) state = PING_CONNECTED;
+		if(strcmp(pstate, "disconnected") == 0) state = PING_DISCONNECTED;
 	}
-	pthread_mutex_unlock(&lock);
-
-	threads--;
-	return (void *)NULL;
-}
-
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
 
-	struct protocol_threads_t *node = protocol_thread_init(pping, json);
-	return threads_register("ping", &thread, (void *)node, 0);
+	if(ip != NULL) {
+		ping_add(ip, interval, state, callback);
+	}
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(pping);
-	while(threads > 0) {
-		usleep(10);
-	}
-	protocol_thread_free(pping);
+	ping_gc();
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
 __attribute__((weak))
 #endif
 void pingInit(void) {
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&lock, &attr);
-
 	protocol_register(&pping);
 	protocol_set_id(pping, "ping");
 	protocol_device_add(pping, "ping", "Ping network devices");
@@ -179,7 +132,7 @@ void pingInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "ping";
-	module->version = "2.0";
+	module->version = "2.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
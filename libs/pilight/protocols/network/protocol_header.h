@@ -0,0 +1,2 @@
+	#include "ping.h"
+
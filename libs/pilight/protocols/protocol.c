@@ -202,6 +202,119 @@ void protocol_init(void) {
 #endif
 }
 
+/*
+ * Cluster the pulse widths of a train so decoders can work
+ * with symbols instead of comparing each width against their
+ * own thresholds. A width joins the nearest symbol when it
+ * lies within half of that symbol's average width.
+ */
+void protocol_pulsetrain(struct pulsetrain_t *train, int *raw, int length) {
+	int sums[PULSE_SYMBOLS], counts[PULSE_SYMBOLS], order[PULSE_SYMBOLS], map[PULSE_SYMBOLS];
+	int i = 0, x = 0, best = 0, diff = 0, bestdiff = 0, avg = 0, tmp = 0;
+	int first = 0, second = 0, threshold = 0;
+
+	train->raw = raw;
+	train->length = length;
+	train->footer = 0;
+	train->plslen = 0;
+	train->nrsymbols = 0;
+	memset(train->packed, 0, sizeof(train->packed));
+
+	if(length <= 0 || length > MAXPULSESTREAMLENGTH) {
+		train->length = 0;
+		return;
+	}
+
+	train->footer = raw[length-1];
+	train->plslen = train->footer/PULSE_DIV;
+
+	for(i=0;i<length-1;i++) {
+		best = -1;
+		bestdiff = 0;
+		for(x=0;x<train->nrsymbols;x++) {
+			avg = sums[x]/counts[x];
+			diff = abs(raw[i]-avg);
+			if(best == -1 || diff < bestdiff) {
+				best = x;
+				bestdiff = diff;
+			}
+		}
+		if(best == -1 || (bestdiff*2 > sums[best]/counts[best] && train->nrsymbols < PULSE_SYMBOLS)) {
+			best = train->nrsymbols++;
+			sums[best] = 0;
+			counts[best] = 0;
+		}
+		sums[best] += raw[i];
+		counts[best]++;
+		train->symbols[i] = (unsigned char)best;
+	}
+
+	/* Number the symbols from the shortest to the longest width */
+	for(i=0;i<train->nrsymbols;i++) {
+		order[i] = i;
+	}
+	for(i=1;i<train->nrsymbols;i++) {
+		tmp = order[i];
+		for(x=i;x>0 && sums[order[x-1]]/counts[order[x-1]] > sums[tmp]/counts[tmp];x--) {
+			order[x] = order[x-1];
+		}
+		order[x] = tmp;
+	}
+	for(i=0;i<train->nrsymbols;i++) {
+		map[order[i]] = i;
+		train->widths[i] = sums[order[i]]/counts[order[i]];
+	}
+
+	/*
+	 * A pulse counts as long when it lies above the midpoint of
+	 * the two most common widths. Symbols with only a few pulses,
+	 * like glitches or a header, don't take part in the vote.
+	 */
+	first = -1;
+	second = -1;
+	for(i=0;i<train->nrsymbols;i++) {
+		if(counts[i] < PULSE_MINCOUNT) {
+			continue;
+		}
+		if(first == -1 || counts[i] > counts[first]) {
+			second = first;
+			first = i;
+		} else if(second == -1 || counts[i] > counts[second]) {
+			second = i;
+		}
+	}
+	if(first == -1) {
+		threshold = train->widths[0]*2;
+	} else if(second == -1) {
+		threshold = (sums[first]/counts[first])*2;
+	} else {
+		threshold = (sums[first]/counts[first]+sums[second]/counts[second])/2;
+	}
+
+	for(i=0;i<length-1;i++) {
+		train->symbols[i] = (unsigned char)map[train->symbols[i]];
+		if(train->widths[train->symbols[i]] > threshold) {
+			train->packed[i >> 5] |= (uint32_t)1 << (i & 31);
+		}
+	}
+	train->symbols[length-1] = PULSE_FOOTER;
+	train->packed[(length-1) >> 5] |= (uint32_t)1 << ((length-1) & 31);
+}
+
+/*
+ * Collect the packed bits of every step-th pulse starting at start,
+ * the first pulse ending up as the most significant bit.
+ */
+uint32_t protocol_pulsetrain_bits(struct pulsetrain_t *train, int start, int step, int count) {
+	uint32_t bits = 0;
+	int i = 0, x = start;
+
+	for(i=0;i<count && i<32 && x<train->length;i++, x+=step) {
+		bits = (bits << 1) | ((train->packed[x >> 5] >> (x & 31)) & 1);
+	}
+	return bits;
+}
+
 void protocol_register(protocol_t **proto) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -234,10 +347,9 @@ void protocol_register(protocol_t **proto) {
 	(*proto)->threads = NULL;
 
 	(*proto)->repeats = 0;
-	(*proto)->first = 0;
-	(*proto)->second = 0;
 
 	(*proto)->raw = NULL;
+	(*proto)->pulses = NULL;
 
 	struct protocols_t *pnode = MALLOC(sizeof(struct protocols_t));
 	if(pnode == NULL) {
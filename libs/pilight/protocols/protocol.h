@@ -27,6 +27,7 @@
 	#endif
 #endif
 #include <pthread.h>
+#include <stdint.h>
 
 #include "defines.h"
 #include "../core/options.h"
@@ -71,6 +72,30 @@ typedef struct protocol_threads_t {
 	struct protocol_threads_t *next;
 } protocol_threads_t;
 
+/* Maximum number of distinct pulse widths in a train */
+#define PULSE_SYMBOLS		8
+/* Minimum number of pulses of a width to classify against it */
+#define PULSE_MINCOUNT		4
+#define PULSE_FOOTER		0xFF
+
+/*
+ * A received pulse train analysed once for all decoders.
+ * Pulse widths are clustered into symbols ordered from the
+ * shortest to the longest width. The packed view has a bit
+ * set for every pulse that is longer than the midpoint of
+ * the two most common widths.
+ */
+typedef struct pulsetrain_t {
+	int *raw;
+	int length;
+	int footer;
+	int plslen;
+	int nrsymbols;
+	int widths[PULSE_SYMBOLS];
+	unsigned char symbols[MAXPULSESTREAMLENGTH];
+	uint32_t packed[MAXPULSESTREAMLENGTH/32];
+} pulsetrain_t;
+
 typedef struct protocol_t {
 	char *id;
 	int rawlen;
@@ -87,10 +112,9 @@ typedef struct protocol_t {
 	struct JsonNode *message;
 
 	int repeats;
-	unsigned long first;
-	unsigned long second;
 
 	int *raw;
+	struct pulsetrain_t *pulses;
 
 	hwtype_t hwtype;
 	devtype_t devtype;
@@ -125,6 +149,8 @@ void protocol_plslen_add(protocol_t *proto, int plslen);
 void protocol_register(protocol_t **proto);
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc);
 int protocol_device_exists(protocol_t *proto, const char *id);
+void protocol_pulsetrain(struct pulsetrain_t *train, int *raw, int length);
+uint32_t protocol_pulsetrain_bits(struct pulsetrain_t *train, int start, int step, int count);
 int protocol_gc(void);
 
 #endif
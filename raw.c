@@ -39,6 +39,7 @@
 #include "libs/pilight/core/irq.h"
 #include "libs/pilight/core/dso.h"
 #include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/capture.h"
 
 #include "libs/pilight/protocols/protocol.h"
 
@@ -53,11 +54,30 @@
 
 static unsigned short main_loop = 1;
 static unsigned short linefeed = 0;
+static struct capture_t *recorder = NULL;
+static pthread_mutex_t recorder_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void record(int *pulses, int length, int hwtype) {
+	pthread_mutex_lock(&recorder_lock);
+	if(recorder != NULL && capture_write(recorder, capture_time(), hwtype, pulses, length) != 0) {
+		logprintf(LOG_ERR, "failed to record pulse train, recording stopped");
+		capture_close(recorder);
+		recorder = NULL;
+	}
+	pthread_mutex_unlock(&recorder_lock);
+}
 
 int main_gc(void) {
 	log_shell_disable();
 	main_loop = 0;
 
+	pthread_mutex_lock(&recorder_lock);
+	if(recorder != NULL) {
+		capture_close(recorder);
+		recorder = NULL;
+	}
+	pthread_mutex_unlock(&recorder_lock);
+
 	datetime_gc();
 	ssdp_gc();
 #ifdef EVENTS
@@ -90,12 +110,23 @@ int main_gc(void) {
 }
 
 void *receiveOOK(void *param) {
+	struct rawcode_t r;
 	int duration = 0, iLoop = 0;
 
+	r.length = 0;
+
 	struct hardware_t *hw = (hardware_t *)param;
 	while(main_loop && hw->receiveOOK) {
 		duration = hw->receiveOOK();
 		iLoop++;
+		if(duration > 0 && recorder != NULL) {
+			/* Split the stream into trains at each footer */
+			r.pulses[r.length++] = duration;
+			if(duration > 5100 || r.length >= MAXPULSESTREAMLENGTH) {
+				record(r.pulses, r.length, hw->hwtype);
+				r.length = 0;
+			}
+		}
 		if(duration > 0) {
 			if(linefeed == 1) {
 				if(duration > 5100) {
@@ -123,6 +154,9 @@ void *receivePulseTrain(void *param) {
 			main_gc();
 			break;
 		} else if(r.length > 0) {
+			if(recorder != NULL) {
+				record(r.pulses, r.length, hw->hwtype);
+			}
 			for(i=0;i<r.length;i++) {
 				if(linefeed == 1) {
 					printf(" %d", r.pulses[i]);
@@ -172,6 +206,7 @@ int main(int argc, char **argv) {
 	options_add(&options, 'V', "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, 'C', "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, 'L', "linefeed", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'R', "record", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 
 	while (1) {
 		int c;
@@ -187,11 +222,17 @@ int main(int argc, char **argv) {
 				printf("\t -V --version\t\tdisplay version\n");
  				printf("\t -L --linefeed\t\tstructure raw printout\n");
  				printf("\t -C --config\t\tconfig file\n");
+ 				printf("\t -R --record=file\trecord pulse trains to a capture file\n");
 				goto close;
 			break;
 			case 'L':
 				linefeed = 1;
 			break;
+			case 'R':
+				if((recorder = capture_open(args, CAPTURE_WRITE)) == NULL) {
+					goto close;
+				}
+			break;
 			case 'V':
 				printf("%s v%s\n", progname, PILIGHT_VERSION);
 				goto close;
@@ -0,0 +1,343 @@
+/*
+	Copyright (C) 2014 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "libs/pilight/core/pilight.h"
+#include "libs/pilight/core/common.h"
+#include "libs/pilight/core/datetime.h"
+#include "libs/pilight/core/json.h"
+#include "libs/pilight/core/log.h"
+#include "libs/pilight/core/options.h"
+#include "libs/pilight/core/gc.h"
+
+#define PRECISION 		1
+
+#ifndef min
+	#define min(a,b) (((a)<(b))?(a):(b))
+#endif
+#ifndef max
+	#define max(a,b) (((a)>(b))?(a):(b))
+#endif
+
+/*
+ * Compares coord2tz against the linear search it replaced. The
+ * reference below walks every polygon of the json database for
+ * each coordinate, exactly like the old implementation did, so
+ * both the speed and the answers of the index can be checked.
+ */
+
+struct reference_t {
+	char name[48];
+	int *coords;
+	unsigned int nrpolys;
+};
+
+static struct reference_t *zones = NULL;
+static unsigned int nrzones = 0;
+
+static double timestamp(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec+((double)tv.tv_usec/1000000);
+}
+
+static int reference_load(char *file) {
+	JsonNode *root = NULL;
+	FILE *fp = NULL;
+	char *content = NULL;
+	struct stat st;
+
+	if((fp = fopen(file, "rb")) == NULL) {
+		logprintf(LOG_ERR, "cannot read tzdata file: %s", file);
+		return -1;
+	}
+	fstat(fileno(fp), &st);
+
+	if((content = MALLOC((size_t)st.st_size+1)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	if(fread(content, sizeof(char), (size_t)st.st_size, fp) != (size_t)st.st_size) {
+		logprintf(LOG_ERR, "cannot read tzdata file: %s", file);
+		fclose(fp);
+		FREE(content);
+		return -1;
+	}
+	content[st.st_size] = '\0';
+	fclose(fp);
+
+	if(json_validate(content) == false) {
+		logprintf(LOG_ERR, "tzdata is not in a valid json format");
+		FREE(content);
+		return -1;
+	}
+	root = json_decode(content);
+
+	JsonNode *alist = json_first_child(root);
+	while(alist) {
+		JsonNode *country = json_first_child(alist);
+		while(country) {
+			if((zones = REALLOC(zones, sizeof(struct reference_t)*(nrzones+1))) == NULL) {
+				logprintf(LOG_ERR, "out of memory");
+				exit(EXIT_FAILURE);
+			}
+			struct reference_t *zone = &zones[nrzones++];
+			memset(zone, 0, sizeof(struct reference_t));
+			strncpy(zone->name, country->key, sizeof(zone->name)-1);
+
+			JsonNode *coords = json_first_child(country);
+			while(coords) {
+				if((zone->coords = REALLOC(zone->coords, sizeof(int)*2*(zone->nrpolys+1))) == NULL) {
+					logprintf(LOG_ERR, "out of memory");
+					exit(EXIT_FAILURE);
+				}
+				int y = 0;
+				JsonNode *lonlat = json_first_child(coords);
+				while(lonlat && y < 2) {
+					zone->coords[2*zone->nrpolys+y] = (int)lonlat->number_;
+					lonlat = lonlat->next;
+					y++;
+				}
+				zone->nrpolys++;
+				coords = coords->next;
+			}
+			country = country->next;
+		}
+		alist = alist->next;
+	}
+	json_delete(root);
+	FREE(content);
+	return 0;
+}
+
+static void reference_gc(void) {
+	unsigned int i = 0;
+	for(i=0;i<nrzones;i++) {
+		FREE(zones[i].coords);
+	}
+	if(zones != NULL) {
+		FREE(zones);
+	}
+	nrzones = 0;
+}
+
+static char *reference_search(double longitude, double latitude) {
+	unsigned int i = 0, a = 0;
+	int margin = (int)pow(10, PRECISION), inside = 0;
+	char *tz = NULL;
+
+	int y = (int)round(latitude*(int)pow(10, PRECISION));
+	int x = (int)round(longitude*(int)pow(10, PRECISION));
+
+	while(!inside && margin < (5*(int)pow(10, PRECISION))) {
+		for(i=0;i<nrzones;i++) {
+			unsigned int n = zones[i].nrpolys;
+			int *coords = zones[i].coords;
+			if(n == 0) {
+				continue;
+			}
+			int p1x = 0;
+			int p1y = 0;
+			for(a=0;a<n;a++) {
+				if(coords[2*a] < p1x || p1x == 0) {
+					p1x = coords[2*a];
+				}
+				if(coords[2*a+1] < p1y && p1y == 0) {
+					p1y = coords[2*a+1];
+				}
+			}
+			for(a=0;a<n+1;a++) {
+				int p2x = coords[2*(a % n)];
+				int p2y = coords[2*(a % n)+1];
+				if((p2x-margin < x && p2x+margin > x)
+				   &&(p2y-margin < y && p2y+margin > y)) {
+					int xinters = 0;
+					if(y > min(p1y, p2y)) {
+						if(y <= max(p1y, p2y)) {
+							if(x <= max(p1x, p2x)) {
+								if(p1y != p2y) {
+									xinters = (y-p1y)*(p2x-p1x)/(p2y-p1y)+p1x;
+								}
+								if(p1x == p2x || x <= xinters) {
+									tz = zones[i].name;
+									inside = 1;
+									break;
+								}
+							}
+						}
+					}
+					p1x = p2x;
+					p1y = p2y;
+				}
+			}
+			if(inside == 1) {
+				break;
+			}
+		}
+		margin += (int)pow(10, PRECISION);
+	}
+	return tz;
+}
+
+int main_gc(void) {
+	log_shell_disable();
+
+	reference_gc();
+	datetime_gc();
+	options_gc();
+	log_gc();
+	gc_clear();
+
+	FREE(progname);
+	xfree();
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+	// memtrack();
+	atomicinit();
+	gc_attach(main_gc);
+
+	/* Catch all exit signals for gc */
+	gc_catch();
+
+	log_shell_enable();
+	log_file_disable();
+	log_level_set(LOG_NOTICE);
+
+	struct options_t *options = NULL;
+	char *args = NULL;
+	char *file = NULL;
+	int count = 10000, seed = 1, i = 0, mismatches = 0;
+
+	if((progname = MALLOC(15)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(progname, "pilight-tzbench");
+
+	options_add(&options, 'H', "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'V', "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'n', "count", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^[0-9]+$");
+	options_add(&options, 's', "seed", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^[0-9]+$");
+
+	while (1) {
+		int c;
+		c = options_parse(&options, argc, argv, 1, &args);
+		if(c == -1)
+			break;
+		if(c == -2)
+			c = 'H';
+		switch (c) {
+			case 'H':
+				printf("Usage: %s [options]\n", progname);
+				printf("\t -H --help\t\tdisplay usage summary\n");
+				printf("\t -V --version\t\tdisplay version\n");
+				printf("\t -n --count=count\tnumber of coordinates to look up\n");
+				printf("\t -s --seed=seed\t\tseed of the random coordinates\n");
+				goto close;
+			break;
+			case 'V':
+				printf("%s v%s\n", progname, PILIGHT_VERSION);
+				goto close;
+			break;
+			case 'n':
+				count = atoi(args);
+			break;
+			case 's':
+				seed = atoi(args);
+			break;
+			default:
+				printf("Usage: %s [options]\n", progname);
+				goto close;
+			break;
+		}
+	}
+	options_delete(options);
+
+	if(count <= 0) {
+		count = 1;
+	}
+
+	file = TZDATA_FILE;
+	double start = timestamp();
+	if(reference_load(file) != 0) {
+		goto close;
+	}
+	double loaded = timestamp();
+
+	/* The first lookup loads or builds the index */
+	coord2tz(0, 0);
+	double indexed = timestamp();
+
+	printf("%-24s %.3f ms\n", "json load", (loaded-start)*1000);
+	printf("%-24s %.3f ms\n", "index load", (indexed-loaded)*1000);
+
+	double *lons = NULL, *lats = NULL;
+	char **results = NULL;
+	if((lons = MALLOC(sizeof(double)*(size_t)count)) == NULL ||
+	   (lats = MALLOC(sizeof(double)*(size_t)count)) == NULL ||
+	   (results = MALLOC(sizeof(char *)*(size_t)count)) == NULL) {
+		logprintf(LOG_ERR, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	srand((unsigned int)seed);
+	for(i=0;i<count;i++) {
+		lons[i] = ((double)rand()/RAND_MAX)*360-180;
+		lats[i] = ((double)rand()/RAND_MAX)*180-90;
+	}
+
+	start = timestamp();
+	for(i=0;i<count;i++) {
+		results[i] = coord2tz(lons[i], lats[i]);
+	}
+	double index = timestamp()-start;
+
+	start = timestamp();
+	for(i=0;i<count;i++) {
+		char *tz = reference_search(lons[i], lats[i]);
+		if((tz == NULL) != (results[i] == NULL) ||
+		   (tz != NULL && strcmp(tz, results[i]) != 0)) {
+			if(mismatches++ < 10) {
+				printf("mismatch at %f,%f: %s != %s\n", lons[i], lats[i],
+					(results[i] == NULL) ? "(null)" : results[i], (tz == NULL) ? "(null)" : tz);
+			}
+		}
+	}
+	double linear = timestamp()-start;
+
+	printf("%-24s %.3f us\n", "indexed lookup", (index*1000000)/count);
+	printf("%-24s %.3f us\n", "linear lookup", (linear*1000000)/count);
+	printf("%-24s %d of %d\n", "mismatches", mismatches, count);
+
+	FREE(lons);
+	FREE(lats);
+	FREE(results);
+
+close:
+	main_gc();
+	return (mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}